@@ -21,10 +21,15 @@
  */
 
 #include <string.h>
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#endif
 
 #include "evd-error.h"
 #include "evd-utils.h"
 #include "evd-buffered-input-stream.h"
+#include "evd-throttled-input-stream.h"
 
 G_DEFINE_TYPE (EvdBufferedInputStream,
                evd_buffered_input_stream,
@@ -526,3 +531,114 @@ evd_buffered_input_stream_thaw (EvdBufferedInputStream *self,
                        do_read,
                        self);
 }
+
+/**
+ * evd_buffered_input_stream_splice:
+ * @fd: the write end of a pipe
+ *
+ * Moves up to @size bytes of input into the pipe referred by @fd. Data
+ * already in the buffer (e.g, unread) goes first, and the rest is spliced
+ * from the socket without being copied to user-space. Fails with
+ * %G_IO_ERROR_NOT_SUPPORTED when the base stream can't do it (e.g, TLS is
+ * active).
+ *
+ * Returns: The number of bytes moved, 0 on end-of-stream, or -1 on error.
+ **/
+gssize
+evd_buffered_input_stream_splice (EvdBufferedInputStream  *self,
+                                  gint                     fd,
+                                  gsize                    size,
+                                  GError                 **error)
+{
+#ifdef __linux__
+  GInputStream *base_stream;
+  gssize from_buf = 0;
+  gssize from_stream = 0;
+
+  g_return_val_if_fail (EVD_IS_BUFFERED_INPUT_STREAM (self), -1);
+
+  base_stream =
+    g_filter_input_stream_get_base_stream (G_FILTER_INPUT_STREAM (self));
+
+  if (! EVD_IS_THROTTLED_INPUT_STREAM (base_stream))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_SUPPORTED,
+                           "Base stream doesn't support splicing");
+      return -1;
+    }
+
+  if (self->priv->frozen)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_WOULD_BLOCK,
+                           "Resource temporarily unavailable");
+      return -1;
+    }
+
+  if (size == 0)
+    return 0;
+
+  if (! g_input_stream_set_pending (G_INPUT_STREAM (self), error))
+    return -1;
+
+  /* buffered data goes first */
+  if (self->priv->buffer->len > 0)
+    {
+      from_buf = write (fd,
+                        self->priv->buffer->str,
+                        MIN (self->priv->buffer->len, size));
+      if (from_buf < 0)
+        {
+          gint errsv = errno;
+
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errsv),
+                       "Error writing to pipe: %s",
+                       g_strerror (errsv));
+
+          g_input_stream_clear_pending (G_INPUT_STREAM (self));
+          return -1;
+        }
+
+      g_string_erase (self->priv->buffer, 0, from_buf);
+      size -= from_buf;
+    }
+
+  if (size > 0 && self->priv->buffer->len == 0)
+    {
+      GError *_error = NULL;
+
+      from_stream =
+        evd_throttled_input_stream_splice (EVD_THROTTLED_INPUT_STREAM (base_stream),
+                                           fd,
+                                           size,
+                                           &_error);
+      if (from_stream < 0)
+        {
+          if (from_buf > 0)
+            {
+              g_clear_error (&_error);
+              from_stream = 0;
+            }
+          else
+            {
+              g_propagate_error (error, _error);
+            }
+        }
+    }
+
+  g_input_stream_clear_pending (G_INPUT_STREAM (self));
+
+  return from_stream + from_buf;
+#else
+  g_set_error_literal (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_NOT_SUPPORTED,
+                       "splice() is not supported on this platform");
+  return -1;
+#endif
+}
@@ -94,6 +94,11 @@ void                    evd_buffered_input_stream_freeze            (EvdBuffered
 void                    evd_buffered_input_stream_thaw              (EvdBufferedInputStream *self,
                                                                      gint                    priority);
 
+gssize                  evd_buffered_input_stream_splice            (EvdBufferedInputStream  *self,
+                                                                     gint                     fd,
+                                                                     gsize                    size,
+                                                                     GError                 **error);
+
 G_END_DECLS
 
 #endif /* __EVD_BUFFERED_INPUT_STREAM_H__ */
@@ -25,6 +25,7 @@
 #include "evd-error.h"
 #include "evd-utils.h"
 #include "evd-buffered-output-stream.h"
+#include "evd-throttled-output-stream.h"
 
 G_DEFINE_TYPE (EvdBufferedOutputStream,
                evd_buffered_output_stream,
@@ -256,6 +257,66 @@ evd_buffered_output_stream_real_write (GOutputStream  *stream,
                                 error);
 }
 
+static gssize
+evd_buffered_output_stream_real_writev (EvdBufferedOutputStream  *self,
+                                        const GOutputVector      *vectors,
+                                        gint                      n_vectors,
+                                        GCancellable             *cancellable,
+                                        GError                  **error)
+{
+  GOutputStream *base_stream;
+  gssize total = 0;
+  gssize size;
+  GError *_error = NULL;
+  gint i;
+
+  base_stream =
+    g_filter_output_stream_get_base_stream (G_FILTER_OUTPUT_STREAM (self));
+
+  if (EVD_IS_THROTTLED_OUTPUT_STREAM (base_stream))
+    return evd_throttled_output_stream_writev (
+                                 EVD_THROTTLED_OUTPUT_STREAM (base_stream),
+                                 vectors,
+                                 n_vectors,
+                                 cancellable,
+                                 error);
+
+  /* base stream can't do vectored I/O (e.g, TLS), so write the vectors one
+     by one until one of them doesn't go through entirely, and let the
+     caller buffer the rest */
+  for (i = 0; i < n_vectors; i++)
+    {
+      if (vectors[i].size == 0)
+        continue;
+
+      size = g_output_stream_write (base_stream,
+                                    vectors[i].buffer,
+                                    vectors[i].size,
+                                    cancellable,
+                                    &_error);
+      if (size < 0)
+        {
+          /* report what was already written, the error will show up
+             again on the next write */
+          if (total > 0)
+            {
+              g_error_free (_error);
+              return total;
+            }
+
+          g_propagate_error (error, _error);
+          return -1;
+        }
+
+      total += size;
+
+      if (size < vectors[i].size)
+        break;
+    }
+
+  return total;
+}
+
 static gssize
 evd_buffered_output_stream_write (GOutputStream  *stream,
                                   const void     *buffer,
@@ -675,3 +736,184 @@ evd_buffered_output_stream_notify_write (EvdBufferedOutputStream *self)
       evd_buffered_output_stream_flush (G_OUTPUT_STREAM (self), NULL, NULL);
     }
 }
+
+/**
+ * evd_buffered_output_stream_writev:
+ * @vectors: (array length=n_vectors):
+ * @cancellable: (allow-none):
+ *
+ * Writes the contents of several buffers as if they were one. If the stream
+ * has nothing buffered and auto-flush is on, @vectors are handed down to
+ * the socket in a single scatter/gather operation, and only the part that
+ * could not be sent gets copied into the buffer.
+ *
+ * Returns: The number of bytes written or buffered, or -1 on error.
+ **/
+gssize
+evd_buffered_output_stream_writev (EvdBufferedOutputStream  *self,
+                                   const GOutputVector      *vectors,
+                                   gint                      n_vectors,
+                                   GCancellable             *cancellable,
+                                   GError                  **error)
+{
+  gssize actual_size = 0;
+  gsize skip;
+  GError *_error = NULL;
+  gint i;
+
+  g_return_val_if_fail (EVD_IS_BUFFERED_OUTPUT_STREAM (self), -1);
+  g_return_val_if_fail (vectors != NULL || n_vectors == 0, -1);
+
+  if (! g_output_stream_set_pending (G_OUTPUT_STREAM (self), error))
+    return -1;
+
+  if (self->priv->buffer->len == 0 && self->priv->auto_flush)
+    {
+      actual_size = evd_buffered_output_stream_real_writev (self,
+                                                            vectors,
+                                                            n_vectors,
+                                                            cancellable,
+                                                            &_error);
+      if (actual_size < 0)
+        {
+          if (! g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              g_output_stream_clear_pending (G_OUTPUT_STREAM (self));
+              g_propagate_error (error, _error);
+
+              return -1;
+            }
+
+          g_clear_error (&_error);
+          actual_size = 0;
+        }
+    }
+
+  /* buffer whatever was not written */
+  skip = actual_size;
+  for (i = 0; i < n_vectors; i++)
+    {
+      const gchar *buf = vectors[i].buffer;
+      gsize size = vectors[i].size;
+
+      if (skip >= size)
+        {
+          skip -= size;
+          continue;
+        }
+
+      buf += skip;
+      size -= skip;
+      skip = 0;
+
+      actual_size += evd_buffered_output_stream_fill (self, buf, size);
+    }
+
+  g_output_stream_clear_pending (G_OUTPUT_STREAM (self));
+
+  return actual_size;
+}
+
+static gssize
+evd_buffered_output_stream_send_fd (EvdBufferedOutputStream  *self,
+                                    gint                      fd,
+                                    goffset                  *offset,
+                                    gsize                     size,
+                                    GError                  **error)
+{
+  GOutputStream *base_stream;
+  gssize actual_size;
+
+  base_stream =
+    g_filter_output_stream_get_base_stream (G_FILTER_OUTPUT_STREAM (self));
+
+  if (! EVD_IS_THROTTLED_OUTPUT_STREAM (base_stream))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_SUPPORTED,
+                           "Base stream doesn't support sending files");
+      return -1;
+    }
+
+  if (! g_output_stream_set_pending (G_OUTPUT_STREAM (self), error))
+    return -1;
+
+  if (self->priv->buffer->len > 0)
+    evd_buffered_output_stream_flush (G_OUTPUT_STREAM (self), NULL, NULL);
+
+  if (self->priv->buffer->len > 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_WOULD_BLOCK,
+                   "Resource temporarily unavailable");
+      actual_size = -1;
+    }
+  else
+    {
+      if (offset != NULL)
+        actual_size =
+          evd_throttled_output_stream_sendfile (
+                                 EVD_THROTTLED_OUTPUT_STREAM (base_stream),
+                                 fd,
+                                 offset,
+                                 size,
+                                 error);
+      else
+        actual_size =
+          evd_throttled_output_stream_splice_from (
+                                 EVD_THROTTLED_OUTPUT_STREAM (base_stream),
+                                 fd,
+                                 size,
+                                 error);
+    }
+
+  g_output_stream_clear_pending (G_OUTPUT_STREAM (self));
+
+  return actual_size;
+}
+
+/**
+ * evd_buffered_output_stream_sendfile:
+ * @offset: (inout):
+ *
+ * Sends part of a file directly to the socket, bypassing the buffer. Data
+ * already buffered always goes first, so if it can't be flushed right away
+ * %G_IO_ERROR_WOULD_BLOCK is returned. Fails with %G_IO_ERROR_NOT_SUPPORTED
+ * when the base stream can't do it (e.g, TLS is active).
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_buffered_output_stream_sendfile (EvdBufferedOutputStream  *self,
+                                     gint                      fd,
+                                     goffset                  *offset,
+                                     gsize                     size,
+                                     GError                  **error)
+{
+  g_return_val_if_fail (EVD_IS_BUFFERED_OUTPUT_STREAM (self), -1);
+  g_return_val_if_fail (offset != NULL, -1);
+
+  return evd_buffered_output_stream_send_fd (self, fd, offset, size, error);
+}
+
+/**
+ * evd_buffered_output_stream_splice_from:
+ * @fd: the read end of a pipe
+ *
+ * Like evd_buffered_output_stream_sendfile(), but moves the contents of the
+ * pipe referred by @fd into the socket.
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_buffered_output_stream_splice_from (EvdBufferedOutputStream  *self,
+                                        gint                      fd,
+                                        gsize                     size,
+                                        GError                  **error)
+{
+  g_return_val_if_fail (EVD_IS_BUFFERED_OUTPUT_STREAM (self), -1);
+
+  return evd_buffered_output_stream_send_fd (self, fd, NULL, size, error);
+}
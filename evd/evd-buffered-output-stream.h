@@ -90,6 +90,21 @@ gboolean                evd_buffered_output_stream_get_auto_flush    (EvdBuffere
 
 void                    evd_buffered_output_stream_notify_write      (EvdBufferedOutputStream *self);
 
+gssize                  evd_buffered_output_stream_writev            (EvdBufferedOutputStream  *self,
+                                                                      const GOutputVector      *vectors,
+                                                                      gint                      n_vectors,
+                                                                      GCancellable             *cancellable,
+                                                                      GError                  **error);
+gssize                  evd_buffered_output_stream_sendfile          (EvdBufferedOutputStream  *self,
+                                                                      gint                      fd,
+                                                                      goffset                  *offset,
+                                                                      gsize                     size,
+                                                                      GError                  **error);
+gssize                  evd_buffered_output_stream_splice_from       (EvdBufferedOutputStream  *self,
+                                                                      gint                      fd,
+                                                                      gsize                     size,
+                                                                      GError                  **error);
+
 G_END_DECLS
 
 #endif /* __EVD_BUFFERED_OUTPUT_STREAM_H__ */
@@ -20,6 +20,8 @@
  * for more details.
  */
 
+#include <string.h>
+
 #include "evd-connection-pool.h"
 
 #include "evd-utils.h"
@@ -37,11 +39,33 @@ G_DEFINE_TYPE (EvdConnectionPool, evd_connection_pool, EVD_TYPE_IO_STREAM_GROUP)
 
 #define RETRY_TIMEOUT 500 /* in miliseconds */
 
+/* back-off of an ejected pool doubles from RETRY_TIMEOUT up to this */
+#define MAX_RETRY_TIMEOUT 30000 /* in miliseconds */
+
+#define DEFAULT_MAX_FAILURES          0 /* never eject */
+#define DEFAULT_HEALTH_CHECK_TIMEOUT  2000 /* in miliseconds */
+
+#define PROBE_BUFFER_SIZE 256
+
+#define DEFAULT_IDLE_TIMEOUT 60000 /* in miliseconds */
+
+#define DEFAULT_CONNECT_TIMEOUT 10000 /* in miliseconds */
+
+/* average time requests wait for a connection above which the pool keeps
+   one more connection warm */
+#define GROW_WAIT_THRESHOLD 2000 /* in microseconds */
+#define WAIT_EWMA_ALPHA     0.2
+
+#define TIMESTAMP_DATA_KEY "org.eventdance.lib.connection-pool.timestamp"
+#define CONNECT_TIMEOUT_DATA_KEY "org.eventdance.lib.connection-pool.connect-timeout"
+
 #define TOTAL_SOCKETS(pool) (self->priv->connecting_sockets + \
                              g_queue_get_length (pool->priv->conns))
 
 #define HAS_REQUESTS(pool)  (g_queue_get_length (pool->priv->requests) > 0)
 
+typedef struct _EvdConnectionPoolProbe EvdConnectionPoolProbe;
+
 /* private data */
 struct _EvdConnectionPoolPrivate
 {
@@ -50,6 +74,20 @@ struct _EvdConnectionPoolPrivate
   guint min_conns;
   guint max_conns;
 
+  /* number of connections kept warm, between min_conns and max_conns */
+  guint target_conns;
+
+  guint idle_timeout;
+  guint reap_src_id;
+
+  guint connect_timeout;
+
+  /* stats */
+  guint64 hits;
+  guint64 misses;
+  gdouble avg_wait;
+  guint64 connect_latency[EVD_CONNECTION_POOL_LATENCY_BUCKETS];
+
   GQueue *conns;
   GQueue *requests;
 
@@ -61,6 +99,28 @@ struct _EvdConnectionPoolPrivate
   EvdTlsCredentials *tls_cred;
 
   guint retry_src_id;
+
+  /* health */
+  gboolean healthy;
+  guint failures;
+  guint max_failures;
+  guint ejections;
+
+  guint health_check_interval;
+  guint health_check_timeout;
+  guint health_check_src_id;
+  gchar *health_check_payload;
+  gchar *health_check_expect;
+  EvdConnectionPoolProbe *probe;
+};
+
+struct _EvdConnectionPoolProbe
+{
+  EvdConnectionPool *pool;
+  EvdSocket *socket;
+  EvdConnection *conn;
+  guint timeout_src_id;
+  gchar buf[PROBE_BUFFER_SIZE];
 };
 
 /* properties */
@@ -68,7 +128,13 @@ enum
 {
   PROP_0,
   PROP_ADDRESS,
-  PROP_CONNECTION_TYPE
+  PROP_CONNECTION_TYPE,
+  PROP_HEALTHY,
+  PROP_MAX_FAILURES,
+  PROP_MIN_CONNS,
+  PROP_MAX_CONNS,
+  PROP_IDLE_TIMEOUT,
+  PROP_CONNECT_TIMEOUT
 };
 
 static void     evd_connection_pool_class_init            (EvdConnectionPoolClass *class);
@@ -95,7 +161,9 @@ static void     evd_connection_pool_unref_request         (GSimpleAsyncResult *r
 
 static void     evd_connection_pool_create_new_socket     (EvdConnectionPool *self);
 
-static gboolean evd_connection_pool_create_min_conns      (gpointer user_data);
+static void     evd_connection_pool_create_min_conns      (EvdConnectionPool *self);
+
+static void     evd_connection_pool_probe_start           (EvdConnectionPool *self);
 
 static void     free_connection_in_queue                  (gpointer user_data);
 
@@ -130,6 +198,64 @@ evd_connection_pool_class_init (EvdConnectionPoolClass *class)
                                                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
                                                        G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (obj_class, PROP_HEALTHY,
+                                   g_param_spec_boolean ("healthy",
+                                                         "Healthy",
+                                                         "Whether the target is in rotation or has been ejected after failing",
+                                                         TRUE,
+                                                         G_PARAM_READABLE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_MAX_FAILURES,
+                                   g_param_spec_uint ("max-failures",
+                                                      "Maximum failures",
+                                                      "Consecutive connection or health check failures before the target is ejected, 0 disables ejection",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_MAX_FAILURES,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_MIN_CONNS,
+                                   g_param_spec_uint ("min-conns",
+                                                      "Minimum connections",
+                                                      "Number of connections always kept open",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_MIN_CONNS,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_MAX_CONNS,
+                                   g_param_spec_uint ("max-conns",
+                                                      "Maximum connections",
+                                                      "Maximum number of idle and connecting connections the pool grows to under demand",
+                                                      1,
+                                                      G_MAXUINT,
+                                                      DEFAULT_MAX_CONNS,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_IDLE_TIMEOUT,
+                                   g_param_spec_uint ("idle-timeout",
+                                                      "Idle timeout",
+                                                      "Miliseconds an idle connection above the minimum is kept open, 0 for ever",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_IDLE_TIMEOUT,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_CONNECT_TIMEOUT,
+                                   g_param_spec_uint ("connect-timeout",
+                                                      "Connect timeout",
+                                                      "Miliseconds a new connection to the target may take before it counts as failed, 0 for no limit",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_CONNECT_TIMEOUT,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
   g_type_class_add_private (obj_class, sizeof (EvdConnectionPoolPrivate));
 }
 
@@ -143,6 +269,12 @@ evd_connection_pool_init (EvdConnectionPool *self)
 
   priv->min_conns = DEFAULT_MIN_CONNS;
   priv->max_conns = DEFAULT_MAX_CONNS;
+  priv->target_conns = DEFAULT_MIN_CONNS;
+
+  priv->idle_timeout = 0;
+  priv->reap_src_id = 0;
+
+  priv->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
 
   priv->conns = g_queue_new ();
   priv->requests = g_queue_new ();
@@ -153,6 +285,16 @@ evd_connection_pool_init (EvdConnectionPool *self)
   priv->tls_cred = NULL;
 
   priv->retry_src_id = 0;
+
+  priv->healthy = TRUE;
+  priv->failures = 0;
+  priv->max_failures = DEFAULT_MAX_FAILURES;
+  priv->ejections = 0;
+
+  priv->health_check_interval = 0;
+  priv->health_check_timeout = DEFAULT_HEALTH_CHECK_TIMEOUT;
+  priv->health_check_src_id = 0;
+  priv->probe = NULL;
 }
 
 static void
@@ -160,6 +302,8 @@ evd_connection_pool_constructed (GObject *obj)
 {
   EvdConnectionPool *self = EVD_CONNECTION_POOL (obj);
 
+  evd_connection_pool_set_idle_timeout (self, DEFAULT_IDLE_TIMEOUT);
+
   evd_connection_pool_create_min_conns (self);
 
   G_OBJECT_CLASS (evd_connection_pool_parent_class)->constructed (obj);
@@ -199,6 +343,21 @@ evd_connection_pool_finalize (GObject *obj)
       self->priv->retry_src_id = 0;
     }
 
+  if (self->priv->health_check_src_id != 0)
+    {
+      g_source_remove (self->priv->health_check_src_id);
+      self->priv->health_check_src_id = 0;
+    }
+
+  if (self->priv->reap_src_id != 0)
+    {
+      g_source_remove (self->priv->reap_src_id);
+      self->priv->reap_src_id = 0;
+    }
+
+  g_free (self->priv->health_check_payload);
+  g_free (self->priv->health_check_expect);
+
   G_OBJECT_CLASS (evd_connection_pool_parent_class)->finalize (obj);
 }
 
@@ -233,6 +392,36 @@ evd_connection_pool_set_property (GObject      *obj,
         break;
       }
 
+    case PROP_MAX_FAILURES:
+      self->priv->max_failures = g_value_get_uint (value);
+      break;
+
+    case PROP_MIN_CONNS:
+      self->priv->min_conns = g_value_get_uint (value);
+      self->priv->max_conns = MAX (self->priv->max_conns,
+                                   self->priv->min_conns);
+      self->priv->target_conns = CLAMP (self->priv->target_conns,
+                                        self->priv->min_conns,
+                                        self->priv->max_conns);
+
+      evd_connection_pool_create_min_conns (self);
+      break;
+
+    case PROP_MAX_CONNS:
+      self->priv->max_conns = MAX (g_value_get_uint (value),
+                                   self->priv->min_conns);
+      self->priv->target_conns = MIN (self->priv->target_conns,
+                                      self->priv->max_conns);
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      evd_connection_pool_set_idle_timeout (self, g_value_get_uint (value));
+      break;
+
+    case PROP_CONNECT_TIMEOUT:
+      self->priv->connect_timeout = g_value_get_uint (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -259,12 +448,57 @@ evd_connection_pool_get_property (GObject    *obj,
       g_value_set_gtype (value, self->priv->connection_type);
       break;
 
+    case PROP_HEALTHY:
+      g_value_set_boolean (value, self->priv->healthy);
+      break;
+
+    case PROP_MAX_FAILURES:
+      g_value_set_uint (value, self->priv->max_failures);
+      break;
+
+    case PROP_MIN_CONNS:
+      g_value_set_uint (value, self->priv->min_conns);
+      break;
+
+    case PROP_MAX_CONNS:
+      g_value_set_uint (value, self->priv->max_conns);
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      g_value_set_uint (value, self->priv->idle_timeout);
+      break;
+
+    case PROP_CONNECT_TIMEOUT:
+      g_value_set_uint (value, self->priv->connect_timeout);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
     }
 }
 
+static void
+set_timestamp (gpointer obj)
+{
+  gint64 *timestamp;
+
+  timestamp = g_new (gint64, 1);
+  *timestamp = g_get_monotonic_time ();
+
+  g_object_set_data_full (G_OBJECT (obj), TIMESTAMP_DATA_KEY, timestamp, g_free);
+}
+
+static gint64
+get_elapsed_time (gpointer obj)
+{
+  gint64 *timestamp;
+
+  timestamp = g_object_get_data (G_OBJECT (obj), TIMESTAMP_DATA_KEY);
+
+  return timestamp != NULL ? g_get_monotonic_time () - *timestamp : 0;
+}
+
 static void
 connection_on_close (EvdConnection *conn, gpointer user_data)
 {
@@ -303,6 +537,21 @@ evd_connection_pool_finish_request (EvdConnectionPool  *self,
   evd_io_stream_group_remove (EVD_IO_STREAM_GROUP (self), G_IO_STREAM (conn));
 }
 
+static void
+evd_connection_pool_add_wait_sample (EvdConnectionPool *self, gint64 wait)
+{
+  /* requests served right away count as zero, so that the average decays
+     once enough connections are warm */
+  self->priv->avg_wait += WAIT_EWMA_ALPHA * (wait - self->priv->avg_wait);
+
+  /* keep more connections warm while requests have to wait */
+  if (self->priv->avg_wait > GROW_WAIT_THRESHOLD &&
+      self->priv->target_conns < self->priv->max_conns)
+    {
+      self->priv->target_conns++;
+    }
+}
+
 static void
 connection_available (EvdConnectionPool *self, EvdConnection *conn)
 {
@@ -312,6 +561,8 @@ connection_available (EvdConnectionPool *self, EvdConnection *conn)
 
       res = G_SIMPLE_ASYNC_RESULT (g_queue_pop_head (self->priv->requests));
 
+      evd_connection_pool_add_wait_sample (self, get_elapsed_time (res));
+
       evd_connection_pool_finish_request (self, conn, res);
 
       evd_connection_pool_create_min_conns (self);
@@ -323,6 +574,7 @@ connection_available (EvdConnectionPool *self, EvdConnection *conn)
                         G_CALLBACK (connection_on_close),
                         self);
 
+      set_timestamp (conn);
       g_queue_push_tail (self->priv->conns, g_object_ref (conn));
     }
 }
@@ -422,21 +674,306 @@ evd_connection_pool_unref_request (GSimpleAsyncResult *result)
   g_object_unref (result);
 }
 
+static void
+evd_connection_pool_create_min_conns (EvdConnectionPool *self)
+{
+  /* while ejected, only the back-off timer tries to reach the target */
+  if (! self->priv->healthy)
+    return;
+
+  /* top up to the warm size, and open one connection per waiting request
+     (up to the maximum) so that bursts don't queue behind a single one */
+  while (TOTAL_SOCKETS (self) < self->priv->target_conns ||
+         (self->priv->connecting_sockets <
+          g_queue_get_length (self->priv->requests) &&
+          TOTAL_SOCKETS (self) < self->priv->max_conns))
+    {
+      evd_connection_pool_create_new_socket (self);
+    }
+}
+
+static gboolean
+evd_connection_pool_reap_idle (gpointer user_data)
+{
+  EvdConnectionPool *self = EVD_CONNECTION_POOL (user_data);
+  gint64 max_idle;
+  GList *expired = NULL;
+  GList *node;
+
+  max_idle = (gint64) self->priv->idle_timeout * 1000;
+
+  /* the least recently used connections are at the head */
+  node = self->priv->conns->head;
+  while (node != NULL &&
+         g_queue_get_length (self->priv->conns) - g_list_length (expired) >
+         self->priv->min_conns)
+    {
+      if (get_elapsed_time (node->data) < max_idle)
+        break;
+
+      expired = g_list_prepend (expired, g_object_ref (node->data));
+
+      node = node->next;
+    }
+
+  /* shrink back towards the minimum as demand goes away */
+  if (expired != NULL)
+    self->priv->target_conns = MAX (self->priv->min_conns,
+                                    self->priv->target_conns -
+                                    MIN (self->priv->target_conns,
+                                         g_list_length (expired)));
+
+  for (node = expired; node != NULL; node = node->next)
+    {
+      g_io_stream_close (G_IO_STREAM (node->data), NULL, NULL);
+      g_object_unref (node->data);
+    }
+  g_list_free (expired);
+
+  return TRUE;
+}
+
 static gboolean
-evd_connection_pool_create_min_conns (gpointer user_data)
+evd_connection_pool_on_retry (gpointer user_data)
 {
   EvdConnectionPool *self = EVD_CONNECTION_POOL (user_data);
 
   self->priv->retry_src_id = 0;
 
-  while (TOTAL_SOCKETS (self) < self->priv->min_conns)
+  if (self->priv->healthy)
     {
+      evd_connection_pool_create_min_conns (self);
+    }
+  else if (self->priv->health_check_payload != NULL)
+    {
+      /* with a custom health check, the target has to pass it to recover */
+      evd_connection_pool_probe_start (self);
+    }
+  else
+    {
+      /* a single connection attempt is the probe */
       evd_connection_pool_create_new_socket (self);
     }
 
   return FALSE;
 }
 
+static void
+evd_connection_pool_fail_requests (EvdConnectionPool *self)
+{
+  GSimpleAsyncResult *res;
+
+  while ( (res = g_queue_pop_head (self->priv->requests)) != NULL)
+    {
+      g_simple_async_result_set_error (res,
+                                       G_IO_ERROR,
+                                       G_IO_ERROR_HOST_UNREACHABLE,
+                                       "Target '%s' is not available",
+                                       self->priv->target);
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+    }
+}
+
+static void
+evd_connection_pool_on_success (EvdConnectionPool *self)
+{
+  self->priv->failures = 0;
+  self->priv->ejections = 0;
+
+  if (! self->priv->healthy)
+    {
+      self->priv->healthy = TRUE;
+      g_object_notify (G_OBJECT (self), "healthy");
+
+      evd_connection_pool_create_min_conns (self);
+    }
+}
+
+static void
+evd_connection_pool_on_failure (EvdConnectionPool *self)
+{
+  guint timeout = RETRY_TIMEOUT;
+
+  self->priv->failures++;
+
+  if (self->priv->healthy &&
+      self->priv->max_failures > 0 &&
+      self->priv->failures >= self->priv->max_failures)
+    {
+      /* eject, and let callers pick another target right away */
+      self->priv->healthy = FALSE;
+      g_object_notify (G_OBJECT (self), "healthy");
+
+      evd_connection_pool_fail_requests (self);
+    }
+
+  if (! self->priv->healthy)
+    {
+      timeout = RETRY_TIMEOUT << MIN (self->priv->ejections, 6);
+      timeout = MIN (timeout, MAX_RETRY_TIMEOUT);
+      self->priv->ejections++;
+    }
+
+  if (self->priv->retry_src_id == 0)
+    self->priv->retry_src_id =
+      evd_timeout_add (NULL,
+                       timeout,
+                       G_PRIORITY_LOW,
+                       evd_connection_pool_on_retry,
+                       self);
+}
+
+static void
+evd_connection_pool_probe_finish (EvdConnectionPoolProbe *probe,
+                                  gboolean                success)
+{
+  EvdConnectionPool *self = probe->pool;
+
+  if (probe->timeout_src_id != 0)
+    g_source_remove (probe->timeout_src_id);
+
+  if (probe->conn != NULL)
+    {
+      if (! g_io_stream_is_closed (G_IO_STREAM (probe->conn)))
+        g_io_stream_close (G_IO_STREAM (probe->conn), NULL, NULL);
+      g_object_unref (probe->conn);
+    }
+  g_object_unref (probe->socket);
+
+  self->priv->probe = NULL;
+  g_slice_free (EvdConnectionPoolProbe, probe);
+
+  if (success)
+    evd_connection_pool_on_success (self);
+  else
+    evd_connection_pool_on_failure (self);
+
+  g_object_unref (self);
+}
+
+static void
+evd_connection_pool_probe_on_read (GObject      *obj,
+                                   GAsyncResult *res,
+                                   gpointer      user_data)
+{
+  EvdConnectionPoolProbe *probe = user_data;
+  const gchar *expect;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, NULL);
+  expect = probe->pool->priv->health_check_expect;
+
+  evd_connection_pool_probe_finish (probe,
+                                    size > 0 &&
+                                    (expect == NULL ||
+                                     ((gsize) size >= strlen (expect) &&
+                                      strncmp (probe->buf, expect, strlen (expect)) == 0)));
+}
+
+static void
+evd_connection_pool_probe_on_connect (GObject      *obj,
+                                      GAsyncResult *res,
+                                      gpointer      user_data)
+{
+  EvdConnectionPoolProbe *probe = user_data;
+  EvdConnectionPoolPrivate *priv = probe->pool->priv;
+  GIOStream *io_stream;
+
+  io_stream = evd_socket_connect_finish (EVD_SOCKET (obj), res, NULL);
+  if (io_stream == NULL)
+    {
+      evd_connection_pool_probe_finish (probe, FALSE);
+      return;
+    }
+
+  probe->conn = EVD_CONNECTION (io_stream);
+
+  if (priv->health_check_payload == NULL)
+    {
+      evd_connection_pool_probe_finish (probe, TRUE);
+      return;
+    }
+
+  if (g_output_stream_write (g_io_stream_get_output_stream (io_stream),
+                             priv->health_check_payload,
+                             strlen (priv->health_check_payload),
+                             NULL,
+                             NULL) < 0)
+    {
+      evd_connection_pool_probe_finish (probe, FALSE);
+      return;
+    }
+
+  /* only the first chunk of the response is checked */
+  g_input_stream_read_async (g_io_stream_get_input_stream (io_stream),
+                             probe->buf,
+                             PROBE_BUFFER_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             evd_connection_pool_probe_on_read,
+                             probe);
+}
+
+static gboolean
+evd_connection_pool_probe_on_timeout (gpointer user_data)
+{
+  EvdConnectionPoolProbe *probe = user_data;
+
+  probe->timeout_src_id = 0;
+
+  /* closing completes the pending operation with an error */
+  if (probe->conn != NULL)
+    g_io_stream_close (G_IO_STREAM (probe->conn), NULL, NULL);
+  else
+    evd_socket_close (probe->socket, NULL);
+
+  return FALSE;
+}
+
+static void
+evd_connection_pool_probe_start (EvdConnectionPool *self)
+{
+  EvdConnectionPoolProbe *probe;
+
+  if (self->priv->probe != NULL)
+    return;
+
+  probe = g_slice_new0 (EvdConnectionPoolProbe);
+  probe->pool = g_object_ref (self);
+  self->priv->probe = probe;
+
+  probe->socket = evd_socket_new ();
+  g_object_set (probe->socket,
+                "io-stream-type", EVD_TYPE_CONNECTION,
+                NULL);
+
+  probe->timeout_src_id =
+    evd_timeout_add (NULL,
+                     self->priv->health_check_timeout,
+                     G_PRIORITY_DEFAULT,
+                     evd_connection_pool_probe_on_timeout,
+                     probe);
+
+  evd_socket_connect_to (probe->socket,
+                         self->priv->target,
+                         NULL,
+                         evd_connection_pool_probe_on_connect,
+                         probe);
+}
+
+static gboolean
+evd_connection_pool_on_health_check (gpointer user_data)
+{
+  EvdConnectionPool *self = EVD_CONNECTION_POOL (user_data);
+
+  /* ejected targets are already being probed by the back-off timer */
+  if (self->priv->healthy)
+    evd_connection_pool_probe_start (self);
+
+  return TRUE;
+}
+
 static void
 evd_connection_pool_socket_on_connect (GObject      *obj,
                                        GAsyncResult *res,
@@ -446,13 +983,23 @@ evd_connection_pool_socket_on_connect (GObject      *obj,
   EvdSocket *socket = EVD_SOCKET (obj);
   GIOStream *io_stream;
   GError *error = NULL;
+  guint timeout_src_id;
 
   self->priv->connecting_sockets--;
 
+  timeout_src_id =
+    GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (socket),
+                                         CONNECT_TIMEOUT_DATA_KEY));
+  if (timeout_src_id != 0)
+    g_source_remove (timeout_src_id);
+
   if ( (io_stream = evd_socket_connect_finish (socket,
                                                res,
                                                &error)) != NULL)
     {
+      gint64 latency;
+      guint bucket = 0;
+
       /* remove any retry timoeut source */
       if (self->priv->retry_src_id != 0)
         {
@@ -460,6 +1007,19 @@ evd_connection_pool_socket_on_connect (GObject      *obj,
           self->priv->retry_src_id = 0;
         }
 
+      /* bucket 0 is below 1ms, then powers of two of miliseconds */
+      latency = get_elapsed_time (socket) / 1000;
+      while (latency > 0 && bucket < EVD_CONNECTION_POOL_LATENCY_BUCKETS - 1)
+        {
+          latency >>= 1;
+          bucket++;
+        }
+      self->priv->connect_latency[bucket]++;
+
+      /* a custom health check decides on its own whether to recover */
+      if (self->priv->healthy || self->priv->health_check_payload == NULL)
+        evd_connection_pool_on_success (self);
+
       evd_io_stream_group_add (EVD_IO_STREAM_GROUP (self), io_stream);
       g_object_unref (io_stream);
     }
@@ -469,24 +1029,37 @@ evd_connection_pool_socket_on_connect (GObject      *obj,
       g_print ("Connection pool error: %s\n", error->message);
       g_error_free (error);
 
-      /* retry after a timeout */
-      self->priv->retry_src_id =
-        evd_timeout_add (NULL,
-                         RETRY_TIMEOUT,
-                         G_PRIORITY_LOW,
-                         evd_connection_pool_create_min_conns,
-                         self);
+      /* retry after a timeout, ejecting the target if it keeps failing */
+      evd_connection_pool_on_failure (self);
     }
 
   g_object_unref (socket);
   g_object_unref (self);
 }
 
+static gboolean
+evd_connection_pool_socket_on_timeout (gpointer user_data)
+{
+  EvdSocket *socket = EVD_SOCKET (user_data);
+
+  g_object_set_data (G_OBJECT (socket), CONNECT_TIMEOUT_DATA_KEY, NULL);
+
+  /* closing completes the pending connect with an error, which is
+     handled as any other failure. That drops the last reference to
+     the socket before evd_socket_close() returns */
+  g_object_ref (socket);
+  evd_socket_close (socket, NULL);
+  g_object_unref (socket);
+
+  return FALSE;
+}
+
 static void
 evd_connection_pool_create_new_socket (EvdConnectionPool *self)
 {
   EvdSocket *socket;
   EvdConnectionPoolClass *class;
+  guint timeout_src_id;
 
   socket = evd_socket_new ();
 
@@ -506,8 +1079,23 @@ evd_connection_pool_create_new_socket (EvdConnectionPool *self)
                 "io-stream-type", self->priv->connection_type,
                 NULL);
 
+  set_timestamp (socket);
   self->priv->connecting_sockets++;
 
+  /* the socket is referenced until the connect completes, which also
+     removes the timeout */
+  if (self->priv->connect_timeout > 0)
+    {
+      timeout_src_id = evd_timeout_add (NULL,
+                                        self->priv->connect_timeout,
+                                        G_PRIORITY_DEFAULT,
+                                        evd_connection_pool_socket_on_timeout,
+                                        socket);
+      g_object_set_data (G_OBJECT (socket),
+                         CONNECT_TIMEOUT_DATA_KEY,
+                         GUINT_TO_POINTER (timeout_src_id));
+    }
+
   g_object_ref (self);
   evd_socket_connect_to (socket,
                          self->priv->target,
@@ -558,11 +1146,26 @@ evd_connection_pool_get_connection (EvdConnectionPool   *self,
                                    user_data,
                                    evd_connection_pool_get_connection);
 
-  if (g_queue_get_length (self->priv->conns) > 0)
+  if (! self->priv->healthy && g_queue_get_length (self->priv->conns) == 0)
+    {
+      /* don't let callers wait for an ejected target */
+      g_simple_async_result_set_error (res,
+                                       G_IO_ERROR,
+                                       G_IO_ERROR_HOST_UNREACHABLE,
+                                       "Target '%s' is not available",
+                                       self->priv->target);
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+    }
+  else if (g_queue_get_length (self->priv->conns) > 0)
     {
       EvdConnection *conn;
 
-      conn = EVD_CONNECTION (g_queue_pop_head (self->priv->conns));
+      self->priv->hits++;
+      evd_connection_pool_add_wait_sample (self, 0);
+
+      /* most recently used first, so that surplus connections age out */
+      conn = EVD_CONNECTION (g_queue_pop_tail (self->priv->conns));
       evd_connection_pool_finish_request (self, conn, res);
       g_object_unref (conn);
 
@@ -570,6 +1173,9 @@ evd_connection_pool_get_connection (EvdConnectionPool   *self,
     }
   else
     {
+      self->priv->misses++;
+
+      set_timestamp (res);
       g_queue_push_tail (self->priv->requests, res);
 
       evd_connection_pool_create_min_conns (self);
@@ -688,3 +1294,122 @@ evd_connection_pool_get_tls_credentials (EvdConnectionPool *self)
 
   return self->priv->tls_cred;
 }
+
+/**
+ * evd_connection_pool_is_healthy:
+ *
+ * Returns: %FALSE if the target has been ejected after too many consecutive
+ * connection or health check failures, %TRUE otherwise.
+ **/
+gboolean
+evd_connection_pool_is_healthy (EvdConnectionPool *self)
+{
+  g_return_val_if_fail (EVD_IS_CONNECTION_POOL (self), FALSE);
+
+  return self->priv->healthy;
+}
+
+/**
+ * evd_connection_pool_set_health_check:
+ * @interval: miliseconds between probes, or 0 to disable active checks
+ * @timeout: miliseconds a probe has to succeed
+ * @payload: (allow-none): data to send once connected, or %NULL to just
+ * check that the target accepts connections
+ * @expect: (allow-none): prefix the response to @payload must start with,
+ * or %NULL to accept any response
+ *
+ * Sets up active health checks. Failed probes count towards
+ * #EvdConnectionPool:max-failures like failed connections do. Once ejected,
+ * the target is probed again with exponential back-off until it recovers.
+ **/
+void
+evd_connection_pool_set_health_check (EvdConnectionPool *self,
+                                      guint              interval,
+                                      guint              timeout,
+                                      const gchar       *payload,
+                                      const gchar       *expect)
+{
+  g_return_if_fail (EVD_IS_CONNECTION_POOL (self));
+  g_return_if_fail (timeout > 0);
+
+  self->priv->health_check_interval = interval;
+  self->priv->health_check_timeout = timeout;
+
+  g_free (self->priv->health_check_payload);
+  self->priv->health_check_payload = g_strdup (payload);
+
+  g_free (self->priv->health_check_expect);
+  self->priv->health_check_expect = g_strdup (expect);
+
+  if (self->priv->health_check_src_id != 0)
+    {
+      g_source_remove (self->priv->health_check_src_id);
+      self->priv->health_check_src_id = 0;
+    }
+
+  if (interval > 0)
+    self->priv->health_check_src_id =
+      evd_timeout_add (NULL,
+                       interval,
+                       G_PRIORITY_LOW,
+                       evd_connection_pool_on_health_check,
+                       self);
+}
+
+/**
+ * evd_connection_pool_set_idle_timeout:
+ * @timeout: miliseconds, or 0 to never close idle connections
+ *
+ * Connections left idle for longer than @timeout are closed, as long as
+ * #EvdConnectionPool:min-conns remain open.
+ **/
+void
+evd_connection_pool_set_idle_timeout (EvdConnectionPool *self,
+                                      guint              timeout)
+{
+  g_return_if_fail (EVD_IS_CONNECTION_POOL (self));
+
+  self->priv->idle_timeout = timeout;
+
+  if (self->priv->reap_src_id != 0)
+    {
+      g_source_remove (self->priv->reap_src_id);
+      self->priv->reap_src_id = 0;
+    }
+
+  if (timeout > 0)
+    self->priv->reap_src_id =
+      evd_timeout_add (NULL,
+                       MAX (timeout / 2, 1),
+                       G_PRIORITY_LOW,
+                       evd_connection_pool_reap_idle,
+                       self);
+}
+
+/**
+ * evd_connection_pool_get_stats:
+ * @stats: (out caller-allocates):
+ *
+ * Fills @stats with the current state of the pool and its counters since
+ * it was created.
+ **/
+void
+evd_connection_pool_get_stats (EvdConnectionPool      *self,
+                               EvdConnectionPoolStats *stats)
+{
+  g_return_if_fail (EVD_IS_CONNECTION_POOL (self));
+  g_return_if_fail (stats != NULL);
+
+  stats->idle_conns = g_queue_get_length (self->priv->conns);
+  stats->connecting = self->priv->connecting_sockets;
+  stats->target_conns = self->priv->target_conns;
+  stats->waiting_requests = g_queue_get_length (self->priv->requests);
+
+  stats->hits = self->priv->hits;
+  stats->misses = self->priv->misses;
+  stats->avg_wait = self->priv->avg_wait / G_USEC_PER_SEC;
+
+  memcpy (stats->connect_latency,
+          self->priv->connect_latency,
+          sizeof (stats->connect_latency));
+}
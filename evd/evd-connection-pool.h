@@ -37,6 +37,26 @@ typedef struct _EvdConnectionPool EvdConnectionPool;
 typedef struct _EvdConnectionPoolClass EvdConnectionPoolClass;
 typedef struct _EvdConnectionPoolPrivate EvdConnectionPoolPrivate;
 
+#define EVD_CONNECTION_POOL_LATENCY_BUCKETS 12
+
+typedef struct
+{
+  guint idle_conns;
+  guint connecting;
+  guint target_conns;
+  guint waiting_requests;
+
+  guint64 hits;
+  guint64 misses;
+
+  /* moving average of the time requests wait for a connection, in seconds */
+  gdouble avg_wait;
+
+  /* connect times: bucket 0 is below 1ms, bucket i is below 2^i ms, and
+     the last one collects everything above */
+  guint64 connect_latency[EVD_CONNECTION_POOL_LATENCY_BUCKETS];
+} EvdConnectionPoolStats;
+
 struct _EvdConnectionPool
 {
   EvdIoStreamGroup parent;
@@ -94,6 +114,19 @@ void                   evd_connection_pool_set_tls_credentials      (EvdConnecti
                                                                      EvdTlsCredentials *credentials);
 EvdTlsCredentials     *evd_connection_pool_get_tls_credentials      (EvdConnectionPool *self);
 
+void                   evd_connection_pool_set_idle_timeout         (EvdConnectionPool *self,
+                                                                     guint              timeout);
+
+void                   evd_connection_pool_get_stats                (EvdConnectionPool      *self,
+                                                                     EvdConnectionPoolStats *stats);
+
+gboolean               evd_connection_pool_is_healthy               (EvdConnectionPool *self);
+void                   evd_connection_pool_set_health_check         (EvdConnectionPool *self,
+                                                                     guint              interval,
+                                                                     guint              timeout,
+                                                                     const gchar       *payload,
+                                                                     const gchar       *expect);
+
 G_END_DECLS
 
 #endif /* __EVD_CONNECTION_POOL_H__ */
@@ -73,6 +73,7 @@ struct _EvdConnectionPrivate
   gint close_src_id;
 
   gboolean tls_handshaking;
+  gboolean tls_handshake_pending;
   gboolean tls_active;
   EvdTlsSession *tls_session;
   GSimpleAsyncResult *async_result;
@@ -148,6 +149,8 @@ static void           evd_connection_delay_write              (EvdThrottledOutpu
                                                                guint                     wait,
                                                                gpointer                  user_data);
 
+static void           evd_connection_tls_handshake            (EvdConnection *self);
+
 static void
 evd_connection_class_init (EvdConnectionClass *class)
 {
@@ -214,6 +217,7 @@ evd_connection_init (EvdConnection *self)
   self->priv = priv;
 
   priv->tls_handshaking = FALSE;
+  priv->tls_handshake_pending = FALSE;
 
   priv->delayed_close = FALSE;
   priv->close_locked = FALSE;
@@ -548,23 +552,12 @@ evd_connection_close_in_idle (EvdConnection *self)
 }
 
 static void
-evd_connection_tls_handshake (EvdConnection *self)
+evd_connection_tls_handshake_done (EvdConnection *self,
+                                   gint           result,
+                                   GError        *error)
 {
-  GError *error = NULL;
-  GIOCondition direction;
-  gint result;
   GSimpleAsyncResult *res;
 
-  direction = evd_tls_session_get_direction (TLS_SESSION (self));
-  if ( (direction == G_IO_IN && self->priv->read_src_id != 0) ||
-       (direction == G_IO_OUT && self->priv->write_src_id != 0) )
-    return;
-
-  result = evd_tls_session_handshake (TLS_SESSION (self), &error);
-
-  if (result == 0)
-    return;
-
   self->priv->tls_handshaking = FALSE;
 
   res = self->priv->async_result;
@@ -594,6 +587,78 @@ evd_connection_tls_handshake (EvdConnection *self)
     }
 }
 
+static void
+evd_connection_tls_on_handshake (GObject      *obj,
+                                 GAsyncResult *res,
+                                 gpointer      user_data)
+{
+  EvdConnection *self = EVD_CONNECTION (user_data);
+  GError *error = NULL;
+  gint result;
+
+  result = evd_tls_session_handshake_finish (EVD_TLS_SESSION (obj),
+                                             res,
+                                             &error);
+
+  self->priv->tls_handshake_pending = FALSE;
+
+  if (! self->priv->tls_handshaking || CLOSED (self))
+    {
+      /* connection was closed or reset while the handshake was running */
+      if (error != NULL)
+        g_error_free (error);
+    }
+  else if (result == 0)
+    {
+      /* more data may have arrived while the handshake was offloaded */
+      if (self->priv->cond & G_IO_IN)
+        evd_connection_tls_handshake (self);
+    }
+  else
+    {
+      evd_connection_tls_handshake_done (self, result, error);
+    }
+
+  g_object_unref (self);
+}
+
+static void
+evd_connection_tls_handshake (EvdConnection *self)
+{
+  GError *error = NULL;
+  GIOCondition direction;
+  gint result;
+  EvdTlsSession *session;
+
+  if (self->priv->tls_handshake_pending)
+    return;
+
+  session = TLS_SESSION (self);
+
+  direction = evd_tls_session_get_direction (session);
+  if ( (direction == G_IO_IN && self->priv->read_src_id != 0) ||
+       (direction == G_IO_OUT && self->priv->write_src_id != 0) )
+    return;
+
+  if (evd_tls_session_get_offload_handshake (session))
+    {
+      self->priv->tls_handshake_pending = TRUE;
+
+      evd_tls_session_handshake_async (session,
+                                       NULL,
+                                       evd_connection_tls_on_handshake,
+                                       g_object_ref (self));
+      return;
+    }
+
+  result = evd_tls_session_handshake (session, &error);
+
+  if (result == 0)
+    return;
+
+  evd_connection_tls_handshake_done (self, result, error);
+}
+
 static void
 evd_connection_manage_read_condition (EvdConnection *self)
 {
@@ -613,7 +678,13 @@ evd_connection_manage_write_condition (EvdConnection *self)
     evd_buffered_output_stream_notify_write (self->priv->buf_output_stream);
 
   if (! CLOSED (self) && self->priv->tls_output_stream != NULL)
-    evd_buffered_output_stream_notify_write (EVD_BUFFERED_OUTPUT_STREAM (self->priv->tls_output_stream));
+    {
+      /* records a previous write left in the session go first */
+      if (self->priv->tls_active && ! self->priv->tls_handshaking)
+        evd_tls_session_flush (self->priv->tls_session, NULL);
+
+      evd_buffered_output_stream_notify_write (EVD_BUFFERED_OUTPUT_STREAM (self->priv->tls_output_stream));
+    }
 
   if (! self->priv->tls_handshaking &&
       evd_connection_get_max_writable (self) > 0)
@@ -1276,6 +1347,169 @@ evd_connection_flush_and_shutdown (EvdConnection  *self,
                             self);
 }
 
+/**
+ * evd_connection_writev:
+ * @vectors: (array length=n_vectors):
+ *
+ * Writes several buffers to the connection as a single write. When TLS is
+ * not active and nothing is pending in the output buffer, the buffers are
+ * sent to the socket with one syscall and without being concatenated first.
+ *
+ * Returns: The number of bytes written or buffered, or -1 on error.
+ **/
+gssize
+evd_connection_writev (EvdConnection        *self,
+                       const GOutputVector  *vectors,
+                       gint                  n_vectors,
+                       GError              **error)
+{
+  g_return_val_if_fail (EVD_IS_CONNECTION (self), -1);
+
+  if (g_io_stream_is_closed (G_IO_STREAM (self)))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_CLOSED,
+                           "Connection is closed");
+      return -1;
+    }
+
+  return evd_buffered_output_stream_writev (self->priv->buf_output_stream,
+                                            vectors,
+                                            n_vectors,
+                                            NULL,
+                                            error);
+}
+
+static gssize
+evd_connection_send_fd (EvdConnection  *self,
+                        gint            fd,
+                        goffset        *offset,
+                        gsize           size,
+                        GError        **error)
+{
+  if (g_io_stream_is_closed (G_IO_STREAM (self)))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_CLOSED,
+                           "Connection is closed");
+      return -1;
+    }
+
+  if (self->priv->tls_active)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_SUPPORTED,
+                           "Cannot send files over a TLS connection");
+      return -1;
+    }
+
+  if (offset != NULL)
+    return evd_buffered_output_stream_sendfile (self->priv->buf_output_stream,
+                                                fd,
+                                                offset,
+                                                size,
+                                                error);
+  else
+    return evd_buffered_output_stream_splice_from (self->priv->buf_output_stream,
+                                                   fd,
+                                                   size,
+                                                   error);
+}
+
+/**
+ * evd_connection_sendfile:
+ * @offset: (inout):
+ *
+ * Sends up to @size bytes of the file referred by @fd, starting at @offset,
+ * with zero copies, and advances @offset by the amount sent. Fails with
+ * %G_IO_ERROR_NOT_SUPPORTED if TLS is active, in which case the caller
+ * should fall back to reading and writing the file contents, and with
+ * %G_IO_ERROR_WOULD_BLOCK if the connection is not writable at the moment.
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_connection_sendfile (EvdConnection  *self,
+                         gint            fd,
+                         goffset        *offset,
+                         gsize           size,
+                         GError        **error)
+{
+  g_return_val_if_fail (EVD_IS_CONNECTION (self), -1);
+  g_return_val_if_fail (offset != NULL, -1);
+
+  return evd_connection_send_fd (self, fd, offset, size, error);
+}
+
+/**
+ * evd_connection_splice_from:
+ * @fd: the read end of a pipe
+ *
+ * Moves up to @size bytes from the pipe referred by @fd into the
+ * connection, without copying them to user-space. The pipe is typically
+ * filled from another connection with evd_connection_splice(). Fails like
+ * evd_connection_sendfile().
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_connection_splice_from (EvdConnection  *self,
+                            gint            fd,
+                            gsize           size,
+                            GError        **error)
+{
+  g_return_val_if_fail (EVD_IS_CONNECTION (self), -1);
+
+  return evd_connection_send_fd (self, fd, NULL, size, error);
+}
+
+/**
+ * evd_connection_splice:
+ * @fd: the write end of a pipe
+ *
+ * Moves up to @size bytes of the connection's input into the pipe referred
+ * by @fd, without copying them to user-space. The pipe can then be drained
+ * into another connection with evd_connection_splice_from(). Fails with
+ * %G_IO_ERROR_NOT_SUPPORTED if TLS is active, and with
+ * %G_IO_ERROR_WOULD_BLOCK if there is no input available at the moment.
+ *
+ * Returns: The number of bytes moved, 0 on end-of-stream, or -1 on error.
+ **/
+gssize
+evd_connection_splice (EvdConnection  *self,
+                       gint            fd,
+                       gsize           size,
+                       GError        **error)
+{
+  g_return_val_if_fail (EVD_IS_CONNECTION (self), -1);
+
+  if (g_io_stream_is_closed (G_IO_STREAM (self)))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_CLOSED,
+                           "Connection is closed");
+      return -1;
+    }
+
+  if (self->priv->tls_active)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_SUPPORTED,
+                           "Cannot splice from a TLS connection");
+      return -1;
+    }
+
+  return evd_buffered_input_stream_splice (self->priv->buf_input_stream,
+                                           fd,
+                                           size,
+                                           error);
+}
+
 gchar *
 evd_connection_get_remote_address_as_string (EvdConnection  *self,
                                              GError        **error)
@@ -109,6 +109,24 @@ void               evd_connection_unlock_close         (EvdConnection *self);
 void               evd_connection_flush_and_shutdown   (EvdConnection  *self,
                                                         GCancellable   *cancellable);
 
+gssize             evd_connection_writev               (EvdConnection        *self,
+                                                        const GOutputVector  *vectors,
+                                                        gint                  n_vectors,
+                                                        GError              **error);
+gssize             evd_connection_sendfile             (EvdConnection  *self,
+                                                        gint            fd,
+                                                        goffset        *offset,
+                                                        gsize           size,
+                                                        GError        **error);
+gssize             evd_connection_splice_from          (EvdConnection  *self,
+                                                        gint            fd,
+                                                        gsize           size,
+                                                        GError        **error);
+gssize             evd_connection_splice               (EvdConnection  *self,
+                                                        gint            fd,
+                                                        gsize           size,
+                                                        GError        **error);
+
 gchar *            evd_connection_get_remote_address_as_string (EvdConnection  *self,
                                                                 GError        **error);
 
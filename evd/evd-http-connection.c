@@ -805,39 +805,116 @@ static gboolean
 evd_http_connection_write_chunk (EvdHttpConnection   *self,
                                  const gchar         *buffer,
                                  gsize                size,
+                                 gboolean             last,
                                  GError            **error)
 {
-  gchar *chunk_hdr;
-  GError *_error = NULL;
-  gboolean result = TRUE;
+  gchar chunk_hdr[24];
+  GOutputVector vectors[4];
+  gint n_vectors = 0;
+  gsize total_size = 0;
+  gssize size_written;
+  gint i;
 
-  self->priv->encoding = SOUP_ENCODING_EOF;
+  /* chunk header, payload, trailing CRLF and possibly the last-chunk
+     marker all go out in a single vectored write */
+  if (size > 0)
+    {
+      vectors[0].buffer = chunk_hdr;
+      vectors[0].size = g_snprintf (chunk_hdr,
+                                    sizeof (chunk_hdr),
+                                    "%x\r\n",
+                                    (guint) size);
+      vectors[1].buffer = buffer;
+      vectors[1].size = size;
+      vectors[2].buffer = "\r\n";
+      vectors[2].size = 2;
+
+      n_vectors = 3;
+    }
 
-  chunk_hdr = g_strdup_printf ("%x\r\n", (guint) size);
-  result = evd_http_connection_write_content (self,
-                                              chunk_hdr,
-                                              strlen (chunk_hdr),
-                                              TRUE,
-                                              &_error);
+  if (last)
+    {
+      vectors[n_vectors].buffer = "0\r\n\r\n";
+      vectors[n_vectors].size = 5;
+      n_vectors++;
+    }
 
-  if (result && size > 0)
-    result = evd_http_connection_write_content (self,
-                                                buffer,
-                                                size,
-                                                TRUE,
-                                                _error == NULL ? &_error : NULL);
+  if (n_vectors == 0)
+    return TRUE;
 
-  if (result)
-    result = evd_http_connection_write_content (self, "\r\n", 2, TRUE,
-                                                _error == NULL ? &_error : NULL);
+  for (i = 0; i < n_vectors; i++)
+    total_size += vectors[i].size;
 
-  self->priv->encoding = SOUP_ENCODING_CHUNKED;
+  size_written = evd_connection_writev (EVD_CONNECTION (self),
+                                        vectors,
+                                        n_vectors,
+                                        error);
+  if (size_written < 0)
+    {
+      return FALSE;
+    }
+  else if (size_written < total_size)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_AGAIN,
+                   "Resource temporarily unavailable, output buffer full");
+      return FALSE;
+    }
+  else
+    {
+      return TRUE;
+    }
+}
 
-  g_free (chunk_hdr);
-  if (_error != NULL)
-    g_propagate_error (error, _error);
+static GString *
+evd_http_connection_build_response_headers (EvdHttpConnection  *self,
+                                            SoupHTTPVersion     version,
+                                            guint               status_code,
+                                            const gchar        *reason_phrase,
+                                            SoupMessageHeaders *headers)
+{
+  gchar *st;
+  GString *buf;
 
-  return result;
+  buf = g_string_new ("");
+
+  if (reason_phrase == NULL)
+    reason_phrase = soup_status_get_phrase (status_code);
+
+  /* send status line */
+  st = g_strdup_printf ("HTTP/1.%d %d %s\r\n",
+                        version,
+                        status_code,
+                        reason_phrase);
+  g_string_append_len (buf, st, strlen (st));
+  g_free (st);
+
+  /* send headers, if any */
+  if (headers != NULL)
+    {
+      SoupMessageHeadersIter iter;
+      const gchar *name;
+      const gchar *value;
+
+      soup_message_headers_iter_init (&iter, headers);
+      while (soup_message_headers_iter_next (&iter, &name, &value))
+        {
+          st = g_strdup_printf ("%s: %s\r\n", name, value);
+          g_string_append_len (buf, st, strlen (st));
+          g_free (st);
+        }
+
+      self->priv->encoding = soup_message_headers_get_encoding (headers);
+    }
+  else
+    {
+      self->priv->encoding = SOUP_ENCODING_EOF;
+    }
+
+  g_string_append_len (buf, "\r\n", 2);
+
+  return buf;
 }
 
 /* public methods */
@@ -997,48 +1074,15 @@ evd_http_connection_write_response_headers (EvdHttpConnection   *self,
 {
   GOutputStream *stream;
   gboolean result = TRUE;
-
-  gchar *st;
   GString *buf;
 
   g_return_val_if_fail (EVD_IS_HTTP_CONNECTION (self), FALSE);
 
-  buf = g_string_new ("");
-
-  if (reason_phrase == NULL)
-    reason_phrase = soup_status_get_phrase (status_code);
-
-  /* send status line */
-  st = g_strdup_printf ("HTTP/1.%d %d %s\r\n",
-                        version,
-                        status_code,
-                        reason_phrase);
-  g_string_append_len (buf, st, strlen (st));
-  g_free (st);
-
-  /* send headers, if any */
-  if (headers != NULL)
-    {
-      SoupMessageHeadersIter iter;
-      const gchar *name;
-      const gchar *value;
-
-      soup_message_headers_iter_init (&iter, headers);
-      while (soup_message_headers_iter_next (&iter, &name, &value))
-        {
-          st = g_strdup_printf ("%s: %s\r\n", name, value);
-          g_string_append_len (buf, st, strlen (st));
-          g_free (st);
-        }
-
-      self->priv->encoding = soup_message_headers_get_encoding (headers);
-    }
-  else
-    {
-      self->priv->encoding = SOUP_ENCODING_EOF;
-    }
-
-  g_string_append_len (buf, "\r\n", 2);
+  buf = evd_http_connection_build_response_headers (self,
+                                                    version,
+                                                    status_code,
+                                                    reason_phrase,
+                                                    headers);
 
   stream = g_io_stream_get_output_stream (G_IO_STREAM (self));
   if (g_output_stream_write (stream, buf->str, buf->len, NULL, error) < 0)
@@ -1060,23 +1104,11 @@ evd_http_connection_write_content (EvdHttpConnection  *self,
 
   if (self->priv->encoding == SOUP_ENCODING_CHUNKED)
     {
-       if (size == 0 || evd_http_connection_write_chunk (self,
-                                                         buffer,
-                                                         size,
-                                                         error))
-        {
-          if (! more)
-            return evd_http_connection_write_chunk (self,
-                                                    NULL,
-                                                    0,
-                                                    error);
-          else
-            return TRUE;
-        }
-      else
-        {
-          return FALSE;
-        }
+      return evd_http_connection_write_chunk (self,
+                                              buffer,
+                                              size,
+                                              ! more,
+                                              error);
     }
   else
     {
@@ -1351,22 +1383,50 @@ evd_http_connection_respond (EvdHttpConnection   *self,
 
   soup_message_headers_set_content_length (_headers, size);
 
-  if (evd_http_connection_write_response_headers (self,
-                                                  ver,
-                                                  status_code,
-                                                  reason_phrase,
-                                                  _headers,
-                                                  error))
+  if (content == NULL)
     {
-      if (content == NULL ||
-          evd_http_connection_write_content (self,
-                                             content,
-                                             size,
-                                             FALSE,
-                                             error))
+      result = evd_http_connection_write_response_headers (self,
+                                                           ver,
+                                                           status_code,
+                                                           reason_phrase,
+                                                           _headers,
+                                                           error);
+    }
+  else
+    {
+      GString *buf;
+      GOutputVector vectors[2];
+      gssize size_written;
+
+      /* headers and content go out in one write */
+      buf = evd_http_connection_build_response_headers (self,
+                                                        ver,
+                                                        status_code,
+                                                        reason_phrase,
+                                                        _headers);
+
+      vectors[0].buffer = buf->str;
+      vectors[0].size = buf->len;
+      vectors[1].buffer = content;
+      vectors[1].size = size;
+
+      size_written = evd_connection_writev (EVD_CONNECTION (self),
+                                            vectors,
+                                            2,
+                                            error);
+      if (size_written >= 0 && size_written < buf->len + size)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_AGAIN,
+                       "Resource temporarily unavailable, output buffer full");
+        }
+      else if (size_written >= 0)
         {
           result = TRUE;
         }
+
+      g_string_free (buf, TRUE);
     }
 
   if (headers == NULL)
@@ -20,7 +20,13 @@
  * for more details.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <gio/gio.h>
@@ -30,7 +36,11 @@
 #include "evd-error.h"
 #include "evd-utils.h"
 
-#define DEFAULT_MAX_FDS 1000 /* maximum number of file descriptors to poll */
+#define DEFAULT_BATCH_SIZE      1000 /* epoll events retrieved per wait */
+#define DEFAULT_MAX_BATCH_SIZE 16000 /* limit for the adaptive growth */
+
+#define DEFAULT_THREADS    1
+#define MAX_THREADS       64
 
 G_DEFINE_TYPE (EvdPoll, evd_poll, G_TYPE_OBJECT)
 
@@ -38,54 +48,160 @@ G_DEFINE_TYPE (EvdPoll, evd_poll, G_TYPE_OBJECT)
                                    EVD_TYPE_POLL, \
                                    EvdPollPrivate))
 
-/* private data */
-struct _EvdPollPrivate
+typedef struct _EvdPollThread EvdPollThread;
+typedef struct _EvdPollQueue EvdPollQueue;
+typedef struct _EvdPollQueueKey EvdPollQueueKey;
+
+/* a poll thread owns an epoll set and the main context that watches it */
+struct _EvdPollThread
 {
+  EvdPoll *self;
+  guint index;
+
   gint epoll_fd;
   GThread *thread;
-  gboolean started;
-  guint max_fds;
 
+  GMainContext *main_context;
   GMainLoop *main_loop;
+  GSource *src;
+
+  gint cpu;
+
+  struct epoll_event *events;
+  gint events_size;
+  gint base_size;
 
-  struct epoll_event events[DEFAULT_MAX_FDS];
-  gint nr_events;
+  guint64 waits;
+  guint64 events_total;
+  guint64 capacity_total;
 
-  gint interrupt_fds[2];
+  volatile gint n_sessions;
+
+  /* deleted sessions whose epoll reference is still to be released */
+  GAsyncQueue *released;
 };
 
+/* private data */
+struct _EvdPollPrivate
+{
+  volatile gint started;
+
+  volatile gint batch_size;
+  volatile gint max_batch_size;
+
+  guint n_threads;
+  EvdPollThread *threads;
+  volatile gint next_thread;
+  gboolean least_loaded;
+  gboolean cpu_affinity;
+
+  gboolean batch_delivery;
+  GHashTable *queues;
+};
+
+/* In batch delivery mode, every main context and priority receiving
+   callbacks has a queue source. Poll threads append ready sessions to
+   'pending' and only wake up the context when it was empty; the context
+   then swaps the two arrays and delivers the whole batch in one pass.
+   Queues are shared by all the sessions added with the same context and
+   priority, hold a reference to their context, and are removed from the
+   poll as soon as the last of those sessions is freed. */
+struct _EvdPollQueueKey
+{
+  GMainContext *main_context;
+  guint priority;
+};
+
+struct _EvdPollQueue
+{
+  GSource src;
+
+  EvdPollQueueKey key;
+  guint n_sessions;
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  GMutex *mutex;
+#else
+  GMutex  mutex;
+#endif
+
+  GPtrArray *pending;
+  GPtrArray *draining;
+  volatile gint len;
+};
+
+/* Sessions are shared between the poll thread that dispatches them and the
+   thread running their main context, without any lock. 'active' is cleared
+   when the session is deleted, 'cond_out' accumulates conditions until the
+   callback consumes them, and 'pending' tells whether a callback source is
+   already queued. The reference held by the epoll set is always released
+   from the poll thread, after any event that could still point to the
+   session has been processed. */
 struct _EvdPollSession
 {
-  gint ref_count;
+  volatile gint ref_count;
 
   EvdPoll *self;
+  EvdPollThread *thread;
   gint fd;
   GIOCondition cond_in;
-  GIOCondition cond_out;
+  volatile gint cond_out;
+  volatile gint active;
+  volatile gint pending;
   GMainContext *main_context;
+  EvdPollQueue *queue;
   guint priority;
   EvdPollCallback callback;
   gpointer user_data;
   GDestroyNotify user_data_free_func;
-  gint src_id;
+};
+
+/* properties */
+enum
+{
+  PROP_0,
+  PROP_THREADS,
+  PROP_LEAST_LOADED,
+  PROP_BATCH_DELIVERY,
+  PROP_BATCH_SIZE,
+  PROP_MAX_BATCH_SIZE,
+  PROP_CPU_AFFINITY
 };
 
 G_LOCK_DEFINE_STATIC (epoll_mutex);
-G_LOCK_DEFINE_STATIC (interrupt_mutex);
+G_LOCK_DEFINE_STATIC (queues_mutex);
 
 static EvdPoll *evd_poll_default = NULL;
 
 static void     evd_poll_class_init   (EvdPollClass *class);
 static void     evd_poll_init         (EvdPoll *self);
+static void     evd_poll_constructed  (GObject *obj);
 static void     evd_poll_finalize     (GObject *obj);
 
+static void     evd_poll_set_property (GObject      *obj,
+                                       guint         prop_id,
+                                       const GValue *value,
+                                       GParamSpec   *pspec);
+static void     evd_poll_get_property (GObject    *obj,
+                                       guint       prop_id,
+                                       GValue     *value,
+                                       GParamSpec *pspec);
+
 static void     evd_poll_stop         (EvdPoll *self);
 
-static gboolean evd_poll_epoll_ctl    (EvdPoll      *self,
-                                       gint          fd,
-                                       gint          op,
-                                       GIOCondition  cond,
-                                       gpointer      data);
+static gboolean evd_poll_epoll_ctl    (EvdPollThread *thread,
+                                       gint           fd,
+                                       gint           op,
+                                       GIOCondition   cond,
+                                       gpointer       data);
+
+static void     evd_poll_queue_free   (EvdPollQueue *queue);
+
+static guint    evd_poll_queue_key_hash  (gconstpointer key);
+static gboolean evd_poll_queue_key_equal (gconstpointer a,
+                                          gconstpointer b);
+static void     evd_poll_queue_release   (EvdPoll      *self,
+                                          EvdPollQueue *queue);
 
 static void
 evd_poll_class_init (EvdPollClass *class)
@@ -94,7 +210,67 @@ evd_poll_class_init (EvdPollClass *class)
 
   obj_class = G_OBJECT_CLASS (class);
 
+  obj_class->constructed = evd_poll_constructed;
   obj_class->finalize = evd_poll_finalize;
+  obj_class->get_property = evd_poll_get_property;
+  obj_class->set_property = evd_poll_set_property;
+
+  g_object_class_install_property (obj_class, PROP_THREADS,
+                                   g_param_spec_uint ("threads",
+                                                      "Number of threads",
+                                                      "The number of threads the poll is sharded into, each one with its own epoll set and main context. Callbacks still run in the context sessions are added from",
+                                                      1,
+                                                      MAX_THREADS,
+                                                      DEFAULT_THREADS,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT_ONLY |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_LEAST_LOADED,
+                                   g_param_spec_boolean ("least-loaded",
+                                                         "Least loaded",
+                                                         "Whether new sessions are assigned to the thread with fewer sessions instead of round-robin",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_BATCH_DELIVERY,
+                                   g_param_spec_boolean ("batch-delivery",
+                                                         "Batch delivery",
+                                                         "Whether ready sessions are delivered to their main context in batches through a single source, instead of one source per event",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_BATCH_SIZE,
+                                   g_param_spec_int ("batch-size",
+                                                     "Batch size",
+                                                     "The number of events retrieved from an epoll set in one wait, before adaptive growth",
+                                                     1,
+                                                     G_MAXINT,
+                                                     DEFAULT_BATCH_SIZE,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_MAX_BATCH_SIZE,
+                                   g_param_spec_int ("max-batch-size",
+                                                     "Maximum batch size",
+                                                     "The size up to which the batch grows when a wait returns it full",
+                                                     1,
+                                                     G_MAXINT,
+                                                     DEFAULT_MAX_BATCH_SIZE,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_CPU_AFFINITY,
+                                   g_param_spec_boolean ("cpu-affinity",
+                                                         "CPU affinity",
+                                                         "Whether each poll thread is pinned to a different CPU",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
 
   g_type_class_add_private (obj_class, sizeof (EvdPollPrivate));
 }
@@ -108,22 +284,70 @@ evd_poll_init (EvdPoll *self)
   self->priv = priv;
 
   priv->started = FALSE;
-  priv->thread = NULL;
 
-  priv->max_fds = DEFAULT_MAX_FDS;
+  priv->batch_size = DEFAULT_BATCH_SIZE;
+  priv->max_batch_size = DEFAULT_MAX_BATCH_SIZE;
+
+  priv->n_threads = DEFAULT_THREADS;
+  priv->threads = NULL;
+  priv->next_thread = 0;
+  priv->least_loaded = FALSE;
+  priv->cpu_affinity = FALSE;
+
+  priv->batch_delivery = FALSE;
+  priv->queues = g_hash_table_new_full (evd_poll_queue_key_hash,
+                                        evd_poll_queue_key_equal,
+                                        NULL,
+                                        (GDestroyNotify) evd_poll_queue_free);
+}
+
+static void
+evd_poll_constructed (GObject *obj)
+{
+  EvdPoll *self = EVD_POLL (obj);
+  glong n_cpus;
+  guint i;
+
+  self->priv->threads = g_new0 (EvdPollThread, self->priv->n_threads);
+
+  n_cpus = MAX (sysconf (_SC_NPROCESSORS_ONLN), 1);
+
+  for (i = 0; i < self->priv->n_threads; i++)
+    {
+      EvdPollThread *thread = &self->priv->threads[i];
+
+      thread->self = self;
+      thread->index = i;
+      thread->epoll_fd = -1;
+      thread->cpu = self->priv->cpu_affinity ? (gint) (i % n_cpus) : -1;
 
-  priv->main_loop = NULL;
+      /* created here so that it can be retrieved with
+         evd_poll_get_thread_context() before the poll is started */
+      thread->main_context = g_main_context_new ();
+
+      thread->released = g_async_queue_new ();
+    }
+
+  G_OBJECT_CLASS (evd_poll_parent_class)->constructed (obj);
 }
 
 static void
 evd_poll_finalize (GObject *obj)
 {
   EvdPoll *self = EVD_POLL (obj);
+  guint i;
 
   evd_poll_stop (self);
 
-  if (self->priv->main_loop != NULL)
-    g_main_loop_unref (self->priv->main_loop);
+  g_hash_table_destroy (self->priv->queues);
+
+  for (i = 0; i < self->priv->n_threads; i++)
+    {
+      g_main_context_unref (self->priv->threads[i].main_context);
+      g_async_queue_unref (self->priv->threads[i].released);
+      g_free (self->priv->threads[i].events);
+    }
+  g_free (self->priv->threads);
 
   G_OBJECT_CLASS (evd_poll_parent_class)->finalize (obj);
 
@@ -134,203 +358,537 @@ evd_poll_finalize (GObject *obj)
 }
 
 static void
-evd_poll_session_ref (EvdPollSession *session)
+evd_poll_set_property (GObject      *obj,
+                       guint         prop_id,
+                       const GValue *value,
+                       GParamSpec   *pspec)
+{
+  EvdPoll *self;
+
+  self = EVD_POLL (obj);
+
+  switch (prop_id)
+    {
+    case PROP_THREADS:
+      self->priv->n_threads = g_value_get_uint (value);
+      break;
+
+    case PROP_LEAST_LOADED:
+      self->priv->least_loaded = g_value_get_boolean (value);
+      break;
+
+    case PROP_BATCH_DELIVERY:
+      self->priv->batch_delivery = g_value_get_boolean (value);
+      break;
+
+    case PROP_BATCH_SIZE:
+      g_atomic_int_set (&self->priv->batch_size, g_value_get_int (value));
+      break;
+
+    case PROP_MAX_BATCH_SIZE:
+      g_atomic_int_set (&self->priv->max_batch_size, g_value_get_int (value));
+      break;
+
+    case PROP_CPU_AFFINITY:
+      self->priv->cpu_affinity = g_value_get_boolean (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+evd_poll_get_property (GObject    *obj,
+                       guint       prop_id,
+                       GValue     *value,
+                       GParamSpec *pspec)
+{
+  EvdPoll *self;
+
+  self = EVD_POLL (obj);
+
+  switch (prop_id)
+    {
+    case PROP_THREADS:
+      g_value_set_uint (value, self->priv->n_threads);
+      break;
+
+    case PROP_LEAST_LOADED:
+      g_value_set_boolean (value, self->priv->least_loaded);
+      break;
+
+    case PROP_BATCH_DELIVERY:
+      g_value_set_boolean (value, self->priv->batch_delivery);
+      break;
+
+    case PROP_BATCH_SIZE:
+      g_value_set_int (value, g_atomic_int_get (&self->priv->batch_size));
+      break;
+
+    case PROP_MAX_BATCH_SIZE:
+      g_value_set_int (value, g_atomic_int_get (&self->priv->max_batch_size));
+      break;
+
+    case PROP_CPU_AFFINITY:
+      g_value_set_boolean (value, self->priv->cpu_affinity);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+      break;
+    }
+}
+
+static gint
+evd_poll_atomic_add (volatile gint *atomic, gint val)
 {
 #if (! GLIB_CHECK_VERSION(2, 31, 0))
-  g_atomic_int_exchange_and_add (&session->ref_count, 1);
+  return g_atomic_int_exchange_and_add (atomic, val);
 #else
-  g_atomic_int_add (&session->ref_count, 1);
+  return g_atomic_int_add (atomic, val);
 #endif
 }
 
-static gboolean
+static void
+evd_poll_session_ref (EvdPollSession *session)
+{
+  evd_poll_atomic_add (&session->ref_count, 1);
+}
+
+static void
 evd_poll_session_unref (EvdPollSession *session)
 {
-  gint old_ref;
+  if (! g_atomic_int_dec_and_test (&session->ref_count))
+    return;
+
+  if (session->queue != NULL)
+    evd_poll_queue_release (session->self, session->queue);
+
+  g_main_context_unref (session->main_context);
+
+  if (session->user_data != NULL && session->user_data_free_func != NULL)
+    session->user_data_free_func (session->user_data);
+
+  g_slice_free (EvdPollSession, session);
+}
+
+static void
+evd_poll_thread_release_sessions (EvdPollThread *thread)
+{
+  EvdPollSession *session;
+
+  while ( (session = g_async_queue_try_pop (thread->released)) != NULL)
+    evd_poll_session_unref (session);
+}
+
+static gboolean
+evd_poll_session_release (gpointer user_data)
+{
+  EvdPollThread *thread = user_data;
+
+  evd_poll_thread_release_sessions (thread);
+
+  return FALSE;
+}
+
+static void
+evd_poll_session_add_cond (EvdPollSession *session, GIOCondition cond)
+{
+  gint old_cond;
+
+  do
+    old_cond = g_atomic_int_get (&session->cond_out);
+  while (! g_atomic_int_compare_and_exchange (&session->cond_out,
+                                              old_cond,
+                                              old_cond | cond));
+}
+
+static GIOCondition
+evd_poll_session_take_cond (EvdPollSession *session)
+{
+  gint old_cond;
 
-  old_ref = g_atomic_int_get (&session->ref_count);
-  if (old_ref > 1)
+  do
+    old_cond = g_atomic_int_get (&session->cond_out);
+  while (! g_atomic_int_compare_and_exchange (&session->cond_out,
+                                              old_cond,
+                                              0));
+
+  return (GIOCondition) old_cond;
+}
+
+static gboolean
+evd_poll_callback_wrapper (gpointer user_data)
+{
+  EvdPollSession *session = user_data;
+  GIOCondition cond_out;
+  EvdPollCallback callback;
+
+  /* 'pending' is cleared before taking the conditions, so anything added
+     after this point will queue a new callback */
+  g_atomic_int_set (&session->pending, FALSE);
+  cond_out = evd_poll_session_take_cond (session);
+
+  callback = session->callback;
+
+  if (cond_out != 0 &&
+      callback != NULL &&
+      g_atomic_int_get (&session->active))
     {
-      g_atomic_int_compare_and_exchange (&session->ref_count, old_ref, old_ref - 1);
-      return TRUE;
+      callback (session->self, cond_out, session->user_data);
     }
-  else
-    {
-      if (session->src_id != 0)
-        {
-          g_source_remove (session->src_id);
-          session->src_id = 0;
-        }
 
-      g_main_context_unref (session->main_context);
+  evd_poll_session_unref (session);
 
-      if (session->user_data != NULL && session->user_data_free_func != NULL)
-        session->user_data_free_func (session->user_data);
+  return FALSE;
+}
 
-      g_slice_free (EvdPollSession, session);
+static void
+evd_poll_queue_lock (EvdPollQueue *queue)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_lock (queue->mutex);
+#else
+  g_mutex_lock (&queue->mutex);
+#endif
+}
 
-      return FALSE;
-    }
+static void
+evd_poll_queue_unlock (EvdPollQueue *queue)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_unlock (queue->mutex);
+#else
+  g_mutex_unlock (&queue->mutex);
+#endif
 }
 
 static gboolean
-evd_poll_callback_wrapper (gpointer user_data)
+evd_poll_queue_prepare (GSource *src, gint *timeout)
 {
-  EvdPollSession *session;
-  GIOCondition cond_out = 0;
-  EvdPollCallback callback = NULL;
+  EvdPollQueue *queue = (EvdPollQueue *) src;
 
-  G_LOCK (epoll_mutex);
+  *timeout = -1;
 
-  session = (EvdPollSession *) user_data;
+  return g_atomic_int_get (&queue->len) > 0;
+}
 
-  session->src_id = 0;
+static gboolean
+evd_poll_queue_check (GSource *src)
+{
+  EvdPollQueue *queue = (EvdPollQueue *) src;
 
-  if (evd_poll_session_unref (session))
-    {
-      callback = session->callback;
+  return g_atomic_int_get (&queue->len) > 0;
+}
 
-      cond_out = session->cond_out;
+static gboolean
+evd_poll_queue_dispatch (GSource     *src,
+                         GSourceFunc  callback,
+                         gpointer     user_data)
+{
+  EvdPollQueue *queue = (EvdPollQueue *) src;
+  GPtrArray *batch;
+  guint i;
 
-      session->cond_out = 0;
-    }
+  evd_poll_queue_lock (queue);
 
-  G_UNLOCK (epoll_mutex);
+  batch = queue->pending;
+  queue->pending = queue->draining;
+  queue->draining = batch;
+  g_atomic_int_set (&queue->len, 0);
 
-  if (callback != NULL)
-    callback (session->self, cond_out, session->user_data);
+  evd_poll_queue_unlock (queue);
 
-  return FALSE;
+  for (i = 0; i < batch->len; i++)
+    evd_poll_callback_wrapper (g_ptr_array_index (batch, i));
+
+  g_ptr_array_set_size (batch, 0);
+
+  return TRUE;
+}
+
+static void
+evd_poll_queue_finalize (GSource *src)
+{
+  EvdPollQueue *queue = (EvdPollQueue *) src;
+
+  g_ptr_array_foreach (queue->pending,
+                       (GFunc) evd_poll_session_unref,
+                       NULL);
+  g_ptr_array_free (queue->pending, TRUE);
+  g_ptr_array_free (queue->draining, TRUE);
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_free (queue->mutex);
+#else
+  g_mutex_clear (&queue->mutex);
+#endif
+
+  g_main_context_unref (queue->key.main_context);
+}
+
+static GSourceFuncs evd_poll_queue_funcs =
+  {
+    evd_poll_queue_prepare,
+    evd_poll_queue_check,
+    evd_poll_queue_dispatch,
+    evd_poll_queue_finalize
+  };
+
+static guint
+evd_poll_queue_key_hash (gconstpointer key)
+{
+  const EvdPollQueueKey *queue_key = key;
+
+  return g_direct_hash (queue_key->main_context) ^ queue_key->priority;
 }
 
 static gboolean
-evd_poll_check_and_consume_interrupt_event (EvdPoll            *self,
-                                            struct epoll_event  event)
+evd_poll_queue_key_equal (gconstpointer a, gconstpointer b)
 {
-  if (* (gint *) event.data.ptr == self->priv->interrupt_fds[0])
-    {
-      static gchar buf[1024];
+  const EvdPollQueueKey *key_a = a;
+  const EvdPollQueueKey *key_b = b;
 
-      /* self-pipe trick, here we just read long enough to guarantee that pipe
-         is empty, and next call to write will edge-trigger a read event again */
-      return read (self->priv->interrupt_fds[0], buf, 1024) > 0;
-    }
-  else
+  return key_a->main_context == key_b->main_context &&
+    key_a->priority == key_b->priority;
+}
+
+static EvdPollQueue *
+evd_poll_queue_new (GMainContext *main_context, guint priority)
+{
+  EvdPollQueue *queue;
+
+  queue = (EvdPollQueue *) g_source_new (&evd_poll_queue_funcs,
+                                         sizeof (EvdPollQueue));
+
+  /* the reference keeps the context's address from being reused by a
+     different context while the queue is still in the poll */
+  queue->key.main_context = g_main_context_ref (main_context);
+  queue->key.priority = priority;
+  queue->n_sessions = 0;
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  queue->mutex = g_mutex_new ();
+#else
+  g_mutex_init (&queue->mutex);
+#endif
+
+  queue->pending = g_ptr_array_new ();
+  queue->draining = g_ptr_array_new ();
+  queue->len = 0;
+
+  g_source_set_priority ((GSource *) queue, (gint) priority);
+  g_source_attach ((GSource *) queue, main_context);
+
+  return queue;
+}
+
+static void
+evd_poll_queue_free (EvdPollQueue *queue)
+{
+  g_source_destroy ((GSource *) queue);
+  g_source_unref ((GSource *) queue);
+}
+
+static void
+evd_poll_queue_push (EvdPollQueue *queue, EvdPollSession *session)
+{
+  guint len;
+
+  evd_poll_queue_lock (queue);
+
+  g_ptr_array_add (queue->pending, session);
+  len = queue->pending->len;
+  g_atomic_int_set (&queue->len, len);
+
+  evd_poll_queue_unlock (queue);
+
+  /* only the first session of a batch needs to wake up the context */
+  if (len == 1)
+    g_main_context_wakeup (g_source_get_context ((GSource *) queue));
+}
+
+static EvdPollQueue *
+evd_poll_get_queue (EvdPoll      *self,
+                    GMainContext *main_context,
+                    guint         priority)
+{
+  EvdPollQueue *queue;
+  EvdPollQueueKey key;
+
+  key.main_context = main_context;
+  key.priority = priority;
+
+  G_LOCK (queues_mutex);
+
+  queue = g_hash_table_lookup (self->priv->queues, &key);
+  if (queue == NULL)
     {
-      return FALSE;
+      queue = evd_poll_queue_new (main_context, priority);
+      g_hash_table_insert (self->priv->queues, &queue->key, queue);
     }
+  queue->n_sessions++;
+
+  G_UNLOCK (queues_mutex);
+
+  return queue;
+}
+
+static void
+evd_poll_queue_release (EvdPoll *self, EvdPollQueue *queue)
+{
+  gboolean last;
+
+  G_LOCK (queues_mutex);
+
+  queue->n_sessions--;
+  last = queue->n_sessions == 0;
+  if (last)
+    g_hash_table_steal (self->priv->queues, &queue->key);
+
+  G_UNLOCK (queues_mutex);
+
+  /* a session waiting in the queue holds a reference to itself, so nothing
+     can be pending in it by now */
+  if (last)
+    evd_poll_queue_free (queue);
+}
+
+static void
+evd_poll_thread_resize_events (EvdPollThread *thread, gint size)
+{
+  thread->events = g_renew (struct epoll_event, thread->events, size);
+  thread->events_size = size;
 }
 
 static gboolean
-evd_poll_dispatch (gpointer user_data)
+evd_poll_dispatch (GIOChannel   *channel,
+                   GIOCondition  condition,
+                   gpointer      user_data)
 {
-  EvdPoll *self = EVD_POLL (user_data);
+  EvdPollThread *thread = user_data;
+  EvdPoll *self = thread->self;
   gint i;
   gint nfds;
-  gboolean started;
+  gint batch_size;
   struct epoll_event *events;
 
-  G_LOCK (interrupt_mutex);
-  self->priv->nr_events = epoll_wait (self->priv->epoll_fd,
-                                      self->priv->events,
-                                      self->priv->max_fds,
-                                      -1);
-  G_UNLOCK (interrupt_mutex);
-
-  G_LOCK (epoll_mutex);
+  /* 'batch-size' changed, start over from the new size */
+  batch_size = g_atomic_int_get (&self->priv->batch_size);
+  if (batch_size != thread->base_size)
+    {
+      thread->base_size = batch_size;
+      evd_poll_thread_resize_events (thread, batch_size);
+    }
 
-  events = self->priv->events;
-  nfds = self->priv->nr_events;
+  /* the epoll set is watched by the thread's main context, so by the time
+     we get here there are events pending and epoll_wait() won't block */
+  events = thread->events;
+  nfds = epoll_wait (thread->epoll_fd,
+                     events,
+                     thread->events_size,
+                     0);
 
-  started = self->priv->started;
+  if (nfds >= 0)
+    {
+      thread->waits++;
+      thread->events_total += nfds;
+      thread->capacity_total += thread->events_size;
+    }
 
-  if (started && nfds > 0)
-    for (i=0; i < nfds; i++)
-      {
-        EvdPollSession *session;
-        GIOCondition cond = 0;
+  for (i = 0; i < nfds; i++)
+    {
+      EvdPollSession *session;
+      GIOCondition cond = 0;
 
-        session = (EvdPollSession *) events[i].data.ptr;
+      session = (EvdPollSession *) events[i].data.ptr;
 
-        if (session == NULL ||
-            evd_poll_check_and_consume_interrupt_event (self, events[i]) ||
-            ! evd_poll_session_unref (session))
-          {
-            continue;
-          }
-        else
-          {
-            evd_poll_session_ref (session);
-          }
+      /* a deleted session is still valid memory here, since its last
+         reference is released from this same thread */
+      if (! g_atomic_int_get (&session->active))
+        continue;
 
-        if ( (events[i].events & EPOLLIN) > 0 ||
-             (events[i].events & EPOLLPRI) > 0)
-          cond |= G_IO_IN;
+      if ( (events[i].events & EPOLLIN) > 0 ||
+           (events[i].events & EPOLLPRI) > 0)
+        cond |= G_IO_IN;
 
-        if (events[i].events & EPOLLOUT)
-          cond |= G_IO_OUT;
+      if (events[i].events & EPOLLOUT)
+        cond |= G_IO_OUT;
 
-        if ( (events[i].events & EPOLLHUP) > 0 ||
-             (events[i].events & EPOLLRDHUP) > 0)
-          cond |= G_IO_HUP;
+      if ( (events[i].events & EPOLLHUP) > 0 ||
+           (events[i].events & EPOLLRDHUP) > 0)
+        cond |= G_IO_HUP;
 
-        if (events[i].events & EPOLLERR)
-          cond |= G_IO_ERR;
+      if (events[i].events & EPOLLERR)
+        cond |= G_IO_ERR;
 
-        session->cond_out |= cond;
+      evd_poll_session_add_cond (session, cond);
 
-        if (session->src_id == 0)
-          {
-            evd_poll_session_ref (session);
-            session->src_id = evd_timeout_add (session->main_context,
-                                               0,
-                                               session->priority,
-                                               evd_poll_callback_wrapper,
-                                               session);
-          }
-      }
+      if (g_atomic_int_compare_and_exchange (&session->pending, FALSE, TRUE))
+        {
+          evd_poll_session_ref (session);
+
+          if (session->queue != NULL)
+            evd_poll_queue_push (session->queue, session);
+          else
+            evd_timeout_add (session->main_context,
+                             0,
+                             session->priority,
+                             evd_poll_callback_wrapper,
+                             session);
+        }
+    }
 
-  self->priv->nr_events = 0;
+  /* a full batch means more events were likely left in the set, so grow
+     the batch for the next wait. 'events' is not used beyond this point */
+  if (nfds == thread->events_size)
+    {
+      gint max_batch_size;
 
-  G_UNLOCK (epoll_mutex);
+      max_batch_size = g_atomic_int_get (&self->priv->max_batch_size);
+      if (thread->events_size < max_batch_size)
+        evd_poll_thread_resize_events (thread,
+                                       MIN (thread->events_size * 2,
+                                            max_batch_size));
+    }
 
-  return started;
+  return g_atomic_int_get (&self->priv->started);
 }
 
 static gpointer
 evd_poll_thread_loop (gpointer data)
 {
-  EvdPoll *self = data;
-  GMainContext *main_context;
+  EvdPollThread *thread = data;
 
-  main_context = g_main_context_new ();
-  g_main_context_push_thread_default (main_context);
+  if (thread->cpu >= 0)
+    {
+      cpu_set_t cpu_set;
 
-  self->priv->main_loop = g_main_loop_new (main_context, FALSE);
-  g_main_context_unref (main_context);
+      CPU_ZERO (&cpu_set);
+      CPU_SET (thread->cpu, &cpu_set);
 
-  evd_timeout_add (main_context,
-                   0,
-                   G_PRIORITY_HIGH,
-                   evd_poll_dispatch,
-                   self);
+      /* pid 0 means the calling thread. Pinning is best effort */
+      sched_setaffinity (0, sizeof (cpu_set_t), &cpu_set);
+    }
 
-  g_main_loop_run (self->priv->main_loop);
+  g_main_context_push_thread_default (thread->main_context);
 
-  g_main_context_pop_thread_default (main_context);
+  g_main_loop_run (thread->main_loop);
 
-  g_main_loop_unref (self->priv->main_loop);
-  self->priv->main_loop = NULL;
+  g_main_context_pop_thread_default (thread->main_context);
 
   return NULL;
 }
 
 static gboolean
-evd_poll_start (EvdPoll *self, GError **error)
+evd_poll_thread_start (EvdPollThread *thread, GError **error)
 {
-  self->priv->started = TRUE;
+  GIOChannel *channel;
+  gchar *name;
 
-  if ( (self->priv->epoll_fd = epoll_create (DEFAULT_MAX_FDS)) == -1)
+  if ( (thread->epoll_fd = epoll_create (DEFAULT_BATCH_SIZE)) == -1)
     {
       g_set_error_literal (error,
                            G_IO_ERROR,
@@ -340,49 +898,142 @@ evd_poll_start (EvdPoll *self, GError **error)
       return FALSE;
     }
 
-  errno = 0;
-  if (pipe (self->priv->interrupt_fds) != 0 ||
-      ! evd_poll_epoll_ctl (self,
-                            self->priv->interrupt_fds[0],
-                            EPOLL_CTL_ADD, G_IO_IN | G_IO_OUT,
-                            &self->priv->interrupt_fds[0]))
-    {
-      g_set_error_literal (error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           "Failed to setup epoll's interrupt pipe");
-      return FALSE;
-    }
+  /* the epoll fd is itself pollable, so it is attached to the thread's main
+     context like any other source. This lets sessions whose callbacks are
+     delivered to this same context be dispatched by the thread as well */
+  channel = g_io_channel_unix_new (thread->epoll_fd);
+  thread->src = g_io_create_watch (channel, G_IO_IN);
+  g_io_channel_unref (channel);
+
+  g_source_set_priority (thread->src, G_PRIORITY_HIGH);
+  g_source_set_callback (thread->src,
+                         (GSourceFunc) evd_poll_dispatch,
+                         thread,
+                         NULL);
+  g_source_attach (thread->src, thread->main_context);
+
+  thread->main_loop = g_main_loop_new (thread->main_context, FALSE);
+
+  name = g_strdup_printf ("EvdPollThread%u", thread->index);
 
 #if (! GLIB_CHECK_VERSION(2, 31, 0))
   if (! g_thread_get_initialized ())
     g_thread_init (NULL);
 
-  self->priv->thread = g_thread_create (evd_poll_thread_loop,
-                                        (gpointer) self,
-                                        TRUE,
-                                        error);
+  thread->thread = g_thread_create (evd_poll_thread_loop,
+                                    (gpointer) thread,
+                                    TRUE,
+                                    error);
 #else
-  self->priv->thread = g_thread_new ("EvdPollThread",
-                                     evd_poll_thread_loop,
-                                     self);
+  thread->thread = g_thread_new (name,
+                                 evd_poll_thread_loop,
+                                 thread);
 #endif
 
-  return self->priv->thread != NULL;
+  g_free (name);
+
+  return thread->thread != NULL;
+}
+
+static gboolean
+evd_poll_thread_quit (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return FALSE;
+}
+
+static void
+evd_poll_thread_stop (EvdPollThread *thread)
+{
+  /* quit from within the loop, since a quit issued before the thread got
+     to run it would be lost */
+  if (thread->thread != NULL)
+    evd_timeout_add (thread->main_context,
+                     0,
+                     G_PRIORITY_HIGH,
+                     evd_poll_thread_quit,
+                     thread->main_loop);
+}
+
+static void
+evd_poll_thread_join (EvdPollThread *thread)
+{
+  if (thread->thread != NULL)
+    {
+      g_thread_join (thread->thread);
+      thread->thread = NULL;
+    }
+
+  if (thread->main_loop != NULL)
+    {
+      g_main_loop_unref (thread->main_loop);
+      thread->main_loop = NULL;
+    }
+
+  if (thread->src != NULL)
+    {
+      g_source_destroy (thread->src);
+      g_source_unref (thread->src);
+      thread->src = NULL;
+    }
+
+  if (thread->epoll_fd != -1)
+    {
+      close (thread->epoll_fd);
+      thread->epoll_fd = -1;
+    }
+
+  /* nothing can point to these sessions anymore, release the ones whose
+     release source was not dispatched before the thread stopped */
+  evd_poll_thread_release_sessions (thread);
+}
+
+static gboolean
+evd_poll_start (EvdPoll *self, GError **error)
+{
+  gboolean result = TRUE;
+  guint i;
+
+  G_LOCK (epoll_mutex);
+
+  if (! g_atomic_int_get (&self->priv->started))
+    {
+      for (i = 0; i < self->priv->n_threads && result; i++)
+        result = evd_poll_thread_start (&self->priv->threads[i], error);
+
+      if (! result)
+        {
+          guint j;
+
+          /* stop the threads already running, including whatever the
+             failed one left behind, so that a later start begins anew */
+          for (j = 0; j < i; j++)
+            evd_poll_thread_stop (&self->priv->threads[j]);
+          for (j = 0; j < i; j++)
+            evd_poll_thread_join (&self->priv->threads[j]);
+        }
+
+      g_atomic_int_set (&self->priv->started, result);
+    }
+
+  G_UNLOCK (epoll_mutex);
+
+  return result;
 }
 
 static gboolean
-evd_poll_epoll_ctl (EvdPoll      *self,
-                    gint          fd,
-                    gint          op,
-                    GIOCondition  cond,
-                    gpointer      data)
+evd_poll_epoll_ctl (EvdPollThread *thread,
+                    gint           fd,
+                    gint           op,
+                    GIOCondition   cond,
+                    gpointer       data)
 {
   gboolean result;
 
   if (op == EPOLL_CTL_DEL)
     {
-      result = epoll_ctl (self->priv->epoll_fd, EPOLL_CTL_DEL, fd, NULL) != -1;
+      result = epoll_ctl (thread->epoll_fd, EPOLL_CTL_DEL, fd, NULL) != -1;
     }
   else
     {
@@ -398,46 +1049,63 @@ evd_poll_epoll_ctl (EvdPoll      *self,
       ev.data.fd = fd;
       ev.data.ptr = (void *) data;
 
-      result = (epoll_ctl (self->priv->epoll_fd, op, fd, &ev) == 0);
+      result = (epoll_ctl (thread->epoll_fd, op, fd, &ev) == 0);
     }
 
   return result;
 }
 
-static gboolean
-evd_poll_interrupt_epoll_wait (EvdPoll *self)
-{
-  const gchar *buf = " ";
-
-  /* self-pipe trick, here we write to pipe to wake up epoll_wait */
-  return write (self->priv->interrupt_fds[1], buf, 1) > 0;
-}
-
 static void
 evd_poll_stop (EvdPoll *self)
 {
-  G_LOCK (epoll_mutex);
+  guint i;
 
-  self->priv->started = FALSE;
+  G_LOCK (epoll_mutex);
 
-  evd_poll_interrupt_epoll_wait (self);
+  g_atomic_int_set (&self->priv->started, FALSE);
 
-  if (self->priv->main_loop != NULL)
-    g_main_loop_quit (self->priv->main_loop);
+  for (i = 0; i < self->priv->n_threads; i++)
+    evd_poll_thread_stop (&self->priv->threads[i]);
 
   G_UNLOCK (epoll_mutex);
 
-  if (self->priv->thread != NULL)
+  for (i = 0; i < self->priv->n_threads; i++)
+    evd_poll_thread_join (&self->priv->threads[i]);
+}
+
+static EvdPollThread *
+evd_poll_pick_thread (EvdPoll *self, GMainContext *main_context)
+{
+  EvdPollThread *thread;
+  guint i;
+
+  if (self->priv->n_threads == 1)
+    return &self->priv->threads[0];
+
+  /* a session created from within a poll thread stays in that thread,
+     so that its callbacks never have to hop to a different one */
+  for (i = 0; i < self->priv->n_threads; i++)
+    if (self->priv->threads[i].main_context == main_context)
+      return &self->priv->threads[i];
+
+  if (self->priv->least_loaded)
     {
-      g_thread_join (self->priv->thread);
-      self->priv->thread = NULL;
-    }
+      thread = &self->priv->threads[0];
 
-  close (self->priv->epoll_fd);
-  self->priv->epoll_fd = 0;
+      for (i = 1; i < self->priv->n_threads; i++)
+        if (g_atomic_int_get (&self->priv->threads[i].n_sessions) <
+            g_atomic_int_get (&thread->n_sessions))
+          {
+            thread = &self->priv->threads[i];
+          }
+    }
+  else
+    {
+      i = (guint) evd_poll_atomic_add (&self->priv->next_thread, 1);
+      thread = &self->priv->threads[i % self->priv->n_threads];
+    }
 
-  close (self->priv->interrupt_fds[0]);
-  close (self->priv->interrupt_fds[1]);
+  return thread;
 }
 
 /* public methods */
@@ -452,9 +1120,28 @@ evd_poll_new (void)
   return self;
 }
 
+EvdPoll *
+evd_poll_new_with_threads (guint n_threads)
+{
+  EvdPoll *self;
+
+  g_return_val_if_fail (n_threads > 0 && n_threads <= MAX_THREADS, NULL);
+
+  self = g_object_new (EVD_TYPE_POLL,
+                       "threads", n_threads,
+                       NULL);
+
+  return self;
+}
+
 /**
  * evd_poll_get_default:
  *
+ * The number of threads of the default poll can be set with the
+ * EVD_POLL_THREADS environment variable. Batch delivery and CPU affinity
+ * are enabled by defining EVD_POLL_BATCH_DELIVERY and EVD_POLL_CPU_AFFINITY,
+ * respectively.
+ *
  * Returns: (transfer full):
  **/
 EvdPoll *
@@ -463,62 +1150,175 @@ evd_poll_get_default (void)
   G_LOCK (epoll_mutex);
 
   if (evd_poll_default == NULL)
-    evd_poll_default = evd_poll_new ();
+    {
+      const gchar *env;
+      guint n_threads = DEFAULT_THREADS;
+
+      env = g_getenv ("EVD_POLL_THREADS");
+      if (env != NULL)
+        n_threads = CLAMP (atoi (env), 1, MAX_THREADS);
+
+      evd_poll_default =
+        g_object_new (EVD_TYPE_POLL,
+                      "threads", n_threads,
+                      "batch-delivery", g_getenv ("EVD_POLL_BATCH_DELIVERY") != NULL,
+                      "cpu-affinity", g_getenv ("EVD_POLL_CPU_AFFINITY") != NULL,
+                      NULL);
+    }
   else
-    g_object_ref (evd_poll_default);
+    {
+      g_object_ref (evd_poll_default);
+    }
 
   G_UNLOCK (epoll_mutex);
 
   return evd_poll_default;
 }
 
+guint
+evd_poll_get_n_threads (EvdPoll *self)
+{
+  g_return_val_if_fail (EVD_IS_POLL (self), 0);
+
+  return self->priv->n_threads;
+}
+
 /**
- * evd_poll_add:
+ * evd_poll_get_thread_context:
  *
- * Returns: (type any) (transfer none):
+ * Returns the main context that runs in the poll thread at @index.
+ * Sessions added while this context is the thread-default one are
+ * assigned to that same poll thread, and their callbacks are invoked
+ * there too.
+ *
+ * Returns: (transfer none):
  **/
-EvdPollSession *
-evd_poll_add (EvdPoll          *self,
-              gint              fd,
-              GIOCondition      condition,
-              guint             priority,
-              EvdPollCallback   callback,
-              gpointer          user_data,
-              GDestroyNotify    user_data_free_func,
-              GError          **error)
+GMainContext *
+evd_poll_get_thread_context (EvdPoll *self, guint index)
 {
-  EvdPollSession *session;
-
   g_return_val_if_fail (EVD_IS_POLL (self), NULL);
-  g_return_val_if_fail (fd > 0, NULL);
-  g_return_val_if_fail (callback != NULL, NULL);
+  g_return_val_if_fail (index < self->priv->n_threads, NULL);
 
-  G_LOCK (epoll_mutex);
+  return self->priv->threads[index].main_context;
+}
+
+/**
+ * evd_poll_get_thread_n_sessions:
+ *
+ * Returns: the number of sessions currently watched by the poll thread at
+ * @index.
+ **/
+guint
+evd_poll_get_thread_n_sessions (EvdPoll *self, guint index)
+{
+  g_return_val_if_fail (EVD_IS_POLL (self), 0);
+  g_return_val_if_fail (index < self->priv->n_threads, 0);
+
+  return (guint) g_atomic_int_get (&self->priv->threads[index].n_sessions);
+}
+
+/**
+ * evd_poll_get_thread_cpu:
+ *
+ * Returns: the CPU the poll thread at @index is (or will be, once started)
+ * pinned to, or -1 if #EvdPoll:cpu-affinity is not enabled.
+ **/
+gint
+evd_poll_get_thread_cpu (EvdPoll *self, guint index)
+{
+  g_return_val_if_fail (EVD_IS_POLL (self), -1);
+  g_return_val_if_fail (index < self->priv->n_threads, -1);
+
+  return self->priv->threads[index].cpu;
+}
 
-  if (! self->priv->started)
-    if (! evd_poll_start (self, error))
+/**
+ * evd_poll_get_batch_fill_ratio:
+ *
+ * Returns the ratio between the events retrieved and the batch capacity
+ * offered, over all waits of all threads so far. A value close to 1.0
+ * means the batch is frequently full. The value is approximate, since
+ * counters are updated by the poll threads without synchronization.
+ **/
+gdouble
+evd_poll_get_batch_fill_ratio (EvdPoll *self)
+{
+  guint64 events = 0;
+  guint64 capacity = 0;
+  guint i;
+
+  g_return_val_if_fail (EVD_IS_POLL (self), 0.0);
+
+  for (i = 0; i < self->priv->n_threads; i++)
+    {
+      events += self->priv->threads[i].events_total;
+      capacity += self->priv->threads[i].capacity_total;
+    }
+
+  if (capacity == 0)
+    return 0.0;
+  else
+    return (gdouble) events / (gdouble) capacity;
+}
+
+static EvdPollSession *
+evd_poll_add_internal (EvdPoll          *self,
+                       gint              thread_index,
+                       GMainContext     *main_context,
+                       gint              fd,
+                       GIOCondition      condition,
+                       guint             priority,
+                       EvdPollCallback   callback,
+                       gpointer          user_data,
+                       GDestroyNotify    user_data_free_func,
+                       GError          **error)
+{
+  EvdPollSession *session;
+
+  if (! g_atomic_int_get (&self->priv->started) &&
+      ! evd_poll_start (self, error))
+    {
       return NULL;
+    }
 
   session = g_slice_new0 (EvdPollSession);
-  session->ref_count = 1;
+
+  /* one reference for the caller and one for the epoll set */
+  session->ref_count = 2;
 
   session->self = self;
   session->fd = fd;
   session->cond_in = condition;
   session->cond_out = 0;
+  session->active = TRUE;
+  session->pending = FALSE;
 
-  session->main_context = g_main_context_get_thread_default ();
+  if (main_context != NULL)
+    session->main_context = main_context;
+  else
+    session->main_context = g_main_context_get_thread_default ();
   if (session->main_context == NULL)
     session->main_context = g_main_context_default ();
   g_main_context_ref (session->main_context);
 
+  if (thread_index >= 0)
+    session->thread = &self->priv->threads[thread_index % self->priv->n_threads];
+  else
+    session->thread = evd_poll_pick_thread (self, session->main_context);
+
+  /* the queue is chosen by the priority the session is added with, a
+     later change with evd_poll_mod() does not move it to a different one */
+  if (self->priv->batch_delivery)
+    session->queue = evd_poll_get_queue (self,
+                                         session->main_context,
+                                         priority);
+
   session->priority = priority;
   session->callback = callback;
   session->user_data = user_data;
   session->user_data_free_func = user_data_free_func;
-  session->src_id = 0;
 
-  if (! evd_poll_epoll_ctl (self,
+  if (! evd_poll_epoll_ctl (session->thread,
                             fd,
                             EPOLL_CTL_ADD,
                             condition,
@@ -529,19 +1329,130 @@ evd_poll_add (EvdPoll          *self,
                            G_IO_ERROR_FAILED,
                            "Failed to add file descriptor to epoll set");
 
+      session->ref_count = 1;
       evd_poll_session_unref (session);
-      session = NULL;
-    }
-  else
-    {
-      evd_poll_session_ref (session);
+
+      return NULL;
     }
 
-  G_UNLOCK (epoll_mutex);
+  evd_poll_atomic_add (&session->thread->n_sessions, 1);
 
   return session;
 }
 
+/**
+ * evd_poll_add:
+ *
+ * Watches @fd for @condition. @callback is invoked in the thread-default
+ * main context of the caller, no matter which poll thread the session is
+ * assigned to, so only waiting on the epoll sets is spread across threads.
+ * To also handle readiness in parallel, add sessions from within the
+ * contexts returned by evd_poll_get_thread_context(), or use
+ * evd_poll_add_in_thread().
+ *
+ * Returns: (type any) (transfer none):
+ **/
+EvdPollSession *
+evd_poll_add (EvdPoll          *self,
+              gint              fd,
+              GIOCondition      condition,
+              guint             priority,
+              EvdPollCallback   callback,
+              gpointer          user_data,
+              GDestroyNotify    user_data_free_func,
+              GError          **error)
+{
+  g_return_val_if_fail (EVD_IS_POLL (self), NULL);
+  g_return_val_if_fail (fd > 0, NULL);
+  g_return_val_if_fail (callback != NULL, NULL);
+
+  return evd_poll_add_internal (self,
+                                -1,
+                                NULL,
+                                fd,
+                                condition,
+                                priority,
+                                callback,
+                                user_data,
+                                user_data_free_func,
+                                error);
+}
+
+/**
+ * evd_poll_add_to_thread:
+ *
+ * Like evd_poll_add(), but the session is watched by the poll thread at
+ * @thread_index (modulo the number of threads) instead of the automatically
+ * chosen one. Callbacks are still delivered to the thread-default context.
+ *
+ * Returns: (type any) (transfer none):
+ **/
+EvdPollSession *
+evd_poll_add_to_thread (EvdPoll          *self,
+                        guint             thread_index,
+                        gint              fd,
+                        GIOCondition      condition,
+                        guint             priority,
+                        EvdPollCallback   callback,
+                        gpointer          user_data,
+                        GDestroyNotify    user_data_free_func,
+                        GError          **error)
+{
+  g_return_val_if_fail (EVD_IS_POLL (self), NULL);
+  g_return_val_if_fail (fd > 0, NULL);
+  g_return_val_if_fail (callback != NULL, NULL);
+
+  return evd_poll_add_internal (self,
+                                thread_index % self->priv->n_threads,
+                                NULL,
+                                fd,
+                                condition,
+                                priority,
+                                callback,
+                                user_data,
+                                user_data_free_func,
+                                error);
+}
+
+/**
+ * evd_poll_add_in_thread:
+ *
+ * Like evd_poll_add_to_thread(), but @callback is invoked by the poll thread
+ * itself, from the context returned by evd_poll_get_thread_context(),
+ * instead of in the thread-default context of the caller. Anything
+ * @callback touches has to be safe to use from that thread.
+ *
+ * Returns: (type any) (transfer none):
+ **/
+EvdPollSession *
+evd_poll_add_in_thread (EvdPoll          *self,
+                        guint             thread_index,
+                        gint              fd,
+                        GIOCondition      condition,
+                        guint             priority,
+                        EvdPollCallback   callback,
+                        gpointer          user_data,
+                        GDestroyNotify    user_data_free_func,
+                        GError          **error)
+{
+  g_return_val_if_fail (EVD_IS_POLL (self), NULL);
+  g_return_val_if_fail (fd > 0, NULL);
+  g_return_val_if_fail (callback != NULL, NULL);
+
+  thread_index %= self->priv->n_threads;
+
+  return evd_poll_add_internal (self,
+                                thread_index,
+                                self->priv->threads[thread_index].main_context,
+                                fd,
+                                condition,
+                                priority,
+                                callback,
+                                user_data,
+                                user_data_free_func,
+                                error);
+}
+
 gboolean
 evd_poll_mod (EvdPoll         *self,
               EvdPollSession  *session,
@@ -549,33 +1460,31 @@ evd_poll_mod (EvdPoll         *self,
               guint            priority,
               GError         **error)
 {
-  gboolean result = TRUE;
-
   g_return_val_if_fail (EVD_IS_POLL (self), FALSE);
   g_return_val_if_fail (session != NULL, FALSE);
 
-  G_LOCK (epoll_mutex);
-
   session->priority = priority;
 
   if (session->cond_in != condition)
     {
       session->cond_in = condition;
 
-      if (! evd_poll_epoll_ctl (self, session->fd, EPOLL_CTL_MOD, condition, session))
+      if (! evd_poll_epoll_ctl (session->thread,
+                                session->fd,
+                                EPOLL_CTL_MOD,
+                                condition,
+                                session))
         {
           g_set_error_literal (error,
                                G_IO_ERROR,
                                G_IO_ERROR_FAILED,
                                "Failed to modify watched conditions in epoll set");
 
-          result = FALSE;
+          return FALSE;
         }
     }
 
-  G_UNLOCK (epoll_mutex);
-
-  return result;
+  return TRUE;
 }
 
 gboolean
@@ -583,39 +1492,19 @@ evd_poll_del (EvdPoll         *self,
               EvdPollSession  *session,
               GError         **error)
 {
-  gboolean result;
-  gint i;
+  gboolean result = TRUE;
 
   g_return_val_if_fail (EVD_IS_POLL (self), FALSE);
   g_return_val_if_fail (session != NULL, FALSE);
 
-  G_LOCK (epoll_mutex);
-
-  if (! G_TRYLOCK (interrupt_mutex))
-    {
-      evd_poll_interrupt_epoll_wait (self);
-
-      G_LOCK (interrupt_mutex);
-    }
-
-  for (i = 0; i < self->priv->nr_events; i++)
-    if (self->priv->events[i].data.ptr == session)
-      self->priv->events[i].data.ptr = NULL;
-
-  if (session->src_id != 0)
-    {
-      g_source_remove (session->src_id);
-      session->src_id = 0;
-      evd_poll_session_unref (session);
-    }
+  /* a callback already queued will find the session inactive
+     and simply drop its reference */
+  g_atomic_int_set (&session->active, FALSE);
   session->callback = NULL;
 
-  if (evd_poll_epoll_ctl (self, session->fd, EPOLL_CTL_DEL, 0, NULL))
-    {
-      evd_poll_session_unref (session);
-      result = TRUE;
-    }
-  else
+  evd_poll_atomic_add (&session->thread->n_sessions, -1);
+
+  if (! evd_poll_epoll_ctl (session->thread, session->fd, EPOLL_CTL_DEL, 0, NULL))
     {
       g_set_error_literal (error,
                            G_IO_ERROR,
@@ -625,10 +1514,24 @@ evd_poll_del (EvdPoll         *self,
       result = FALSE;
     }
 
-  evd_poll_session_unref (session);
+  /* the epoll set's reference is released from the poll thread, since it
+     might be holding events for this session that are not processed yet.
+     Sessions still queued when the thread stops are released then */
+  if (g_atomic_int_get (&self->priv->started))
+    {
+      g_async_queue_push (session->thread->released, session);
+      evd_timeout_add (session->thread->main_context,
+                       0,
+                       G_PRIORITY_HIGH,
+                       evd_poll_session_release,
+                       session->thread);
+    }
+  else
+    {
+      evd_poll_session_unref (session);
+    }
 
-  G_UNLOCK (interrupt_mutex);
-  G_UNLOCK (epoll_mutex);
+  evd_poll_session_unref (session);
 
   return result;
 }
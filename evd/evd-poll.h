@@ -59,9 +59,20 @@ struct _EvdPollClass
 GType              evd_poll_get_type      (void) G_GNUC_CONST;
 
 EvdPoll           *evd_poll_new           (void);
+EvdPoll           *evd_poll_new_with_threads (guint n_threads);
 
 EvdPoll           *evd_poll_get_default   (void);
 
+guint              evd_poll_get_n_threads (EvdPoll *self);
+GMainContext      *evd_poll_get_thread_context (EvdPoll *self,
+                                                guint    index);
+gint               evd_poll_get_thread_cpu (EvdPoll *self,
+                                            guint    index);
+guint              evd_poll_get_thread_n_sessions (EvdPoll *self,
+                                                   guint    index);
+
+gdouble            evd_poll_get_batch_fill_ratio (EvdPoll *self);
+
 EvdPollSession    *evd_poll_add           (EvdPoll          *self,
                                            gint              fd,
                                            GIOCondition      condition,
@@ -71,6 +82,26 @@ EvdPollSession    *evd_poll_add           (EvdPoll          *self,
                                            GDestroyNotify    user_data_free_func,
                                            GError          **error);
 
+EvdPollSession    *evd_poll_add_to_thread (EvdPoll          *self,
+                                           guint             thread_index,
+                                           gint              fd,
+                                           GIOCondition      condition,
+                                           guint             priority,
+                                           EvdPollCallback   callback,
+                                           gpointer          user_data,
+                                           GDestroyNotify    user_data_free_func,
+                                           GError          **error);
+
+EvdPollSession    *evd_poll_add_in_thread (EvdPoll          *self,
+                                           guint             thread_index,
+                                           gint              fd,
+                                           GIOCondition      condition,
+                                           guint             priority,
+                                           EvdPollCallback   callback,
+                                           gpointer          user_data,
+                                           GDestroyNotify    user_data_free_func,
+                                           GError          **error);
+
 gboolean           evd_poll_mod           (EvdPoll         *self,
                                            EvdPollSession  *session,
                                            GIOCondition     condition,
@@ -20,6 +20,14 @@
  * for more details.
  */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "evd-reproxy.h"
 
 #include "evd-utils.h"
@@ -35,9 +43,26 @@ G_DEFINE_TYPE (EvdReproxy, evd_reproxy, EVD_TYPE_SERVICE)
 #define DEFAULT_BACKEND_MIN_CONNS   1
 #define DEFAULT_BACKEND_MAX_CONNS   2
 
+/* a backend is taken out of rotation after this many consecutive failed
+   connections, and probed until it recovers */
+#define DEFAULT_BACKEND_MAX_FAILURES 1
+
 #define BRIDGE_BLOCK_SIZE           8193
+#define BRIDGE_PIPE_SIZE            65536
 
 #define BRIDGE_DATA_KEY "org.eventdance.lib.reproxy.bridge"
+#define RETRIES_DATA_KEY "org.eventdance.lib.reproxy.retries"
+
+/* backends a client connection is offered to before giving up */
+#define MAX_DISPATCH_RETRIES        3
+
+#define DEFAULT_BACKEND_WEIGHT      1
+
+/* weight of a new sample in the latency moving average */
+#define LATENCY_EWMA_ALPHA          0.2
+
+/* points in the consistent hashing ring per unit of backend weight */
+#define HASH_RING_POINTS            40
 
 typedef struct _EvdReproxySocketData EvdReproxySocketData;
 
@@ -51,13 +76,54 @@ struct _EvdReproxyPrivate
   guint backend_min_conns;
 
   GQueue *conns;
+
+  EvdReproxyBalance balance;
+
+  GArray *hash_ring;
+  gboolean hash_ring_dirty;
 };
 
+typedef struct
+{
+  EvdConnectionPool *pool;
+  gchar *address;
+  gint ref_count;
+
+  guint weight;
+  gint current_weight;
+
+  guint active_bridges;
+  guint64 total_bridges;
+
+  /* moving average of the response latency, in microseconds */
+  gdouble latency;
+
+  /* requests still waiting for a response, and the sum of the times
+     they were sent at */
+  guint pending_requests;
+  gint64 pending_time_sum;
+} EvdReproxyBackend;
+
+typedef struct
+{
+  guint32 hash;
+  EvdReproxyBackend *backend;
+} EvdReproxyRingPoint;
+
 typedef struct
 {
   EvdConnection *conn;
   gchar *buf;
   gsize size;
+
+  /* only set on the bridge reading from a backend */
+  EvdReproxyBackend *backend;
+  gint64 request_time;
+
+  /* plaintext bridges move data through a pipe with splice() */
+  gboolean splice;
+  gint pipe[2];
+  gsize pipe_size;
 } EvdReproxyBridge;
 
 static void     evd_reproxy_class_init            (EvdReproxyClass *class);
@@ -70,6 +136,10 @@ static void     evd_reproxy_connection_accepted   (EvdService    *service,
                                                    EvdConnection *conn);
 
 static gboolean evd_reproxy_bridge_read           (gpointer user_data);
+static void     evd_reproxy_bridge_splice         (EvdConnection *conn0);
+
+static void     evd_reproxy_dispatch              (EvdReproxy    *self,
+                                                   EvdConnection *conn);
 
 static void
 evd_reproxy_class_init (EvdReproxyClass *class)
@@ -105,14 +175,37 @@ evd_reproxy_init (EvdReproxy *self)
   priv->next_backend_node = NULL;
 
   priv->conns = g_queue_new ();
+
+  priv->balance = EVD_REPROXY_BALANCE_ROUND_ROBIN;
+
+  priv->hash_ring = g_array_new (FALSE, FALSE, sizeof (EvdReproxyRingPoint));
+  priv->hash_ring_dirty = TRUE;
+}
+
+static EvdReproxyBackend *
+evd_reproxy_backend_ref (EvdReproxyBackend *backend)
+{
+  backend->ref_count++;
+
+  return backend;
 }
 
 static void
-evd_reproxy_free_backend (gpointer data, gpointer user_data)
+evd_reproxy_backend_unref (EvdReproxyBackend *backend)
 {
-  EvdConnectionPool *backend = EVD_CONNECTION_POOL (data);
+  backend->ref_count--;
+  if (backend->ref_count > 0)
+    return;
+
+  g_object_unref (backend->pool);
+  g_free (backend->address);
+  g_slice_free (EvdReproxyBackend, backend);
+}
 
-  g_object_unref (backend);
+static void
+evd_reproxy_free_backend (gpointer data, gpointer user_data)
+{
+  evd_reproxy_backend_unref ((EvdReproxyBackend *) data);
 }
 
 static void
@@ -133,6 +226,9 @@ evd_reproxy_dispose (GObject *obj)
                   NULL);
   g_list_free (self->priv->backends);
   self->priv->backends = NULL;
+  self->priv->next_backend_node = NULL;
+
+  g_array_set_size (self->priv->hash_ring, 0);
 
   G_OBJECT_CLASS (evd_reproxy_parent_class)->dispose (obj);
 }
@@ -147,14 +243,35 @@ evd_reproxy_finalize (GObject *obj)
                    NULL);
   g_queue_free (self->priv->conns);
 
+  g_array_free (self->priv->hash_ring, TRUE);
+
   G_OBJECT_CLASS (evd_reproxy_parent_class)->finalize (obj);
 }
 
-static EvdConnectionPool *
+static EvdReproxyBackend *
 evd_reproxy_get_backend_from_node (GList *backend_node)
 {
   return (backend_node != NULL) ?
-    EVD_CONNECTION_POOL (backend_node->data) : NULL;
+    (EvdReproxyBackend *) backend_node->data : NULL;
+}
+
+static EvdReproxyBackend *
+evd_reproxy_find_backend (EvdReproxy *self, EvdConnectionPool *pool)
+{
+  GList *node;
+
+  node = self->priv->backends;
+  while (node != NULL)
+    {
+      EvdReproxyBackend *backend = node->data;
+
+      if (backend->pool == pool)
+        return backend;
+
+      node = node->next;
+    }
+
+  return NULL;
 }
 
 static GList *
@@ -189,10 +306,16 @@ evd_reproxy_enqueue_connection (EvdReproxy    *self,
   g_queue_push_tail (self->priv->conns, (gpointer) conn);
 }
 
-static EvdConnectionPool *
+static gboolean
+evd_reproxy_backend_is_healthy (EvdReproxyBackend *backend)
+{
+  return evd_connection_pool_is_healthy (backend->pool);
+}
+
+static EvdReproxyBackend *
 evd_reproxy_get_backend_with_free_connections (EvdReproxy *self)
 {
-  EvdConnectionPool *backend;
+  EvdReproxyBackend *backend;
   GList *orig_node;
 
   if (self->priv->next_backend_node == NULL)
@@ -205,7 +328,8 @@ evd_reproxy_get_backend_with_free_connections (EvdReproxy *self)
       backend =
         evd_reproxy_get_backend_from_node (self->priv->next_backend_node);
 
-      if (evd_connection_pool_has_free_connections (backend))
+      if (evd_reproxy_backend_is_healthy (backend) &&
+          evd_connection_pool_has_free_connections (backend->pool))
         return backend;
       else
         evd_reproxy_hop_backend (self);
@@ -215,6 +339,356 @@ evd_reproxy_get_backend_with_free_connections (EvdReproxy *self)
   return NULL;
 }
 
+static EvdReproxyBackend *
+evd_reproxy_select_round_robin (EvdReproxy *self)
+{
+  EvdReproxyBackend *backend;
+  GList *orig_node;
+
+  backend = evd_reproxy_get_backend_with_free_connections (self);
+  if (backend != NULL)
+    return backend;
+
+  orig_node = self->priv->next_backend_node;
+  do
+    {
+      backend = evd_reproxy_get_backend_from_node (self->priv->next_backend_node);
+      evd_reproxy_hop_backend (self);
+
+      if (evd_reproxy_backend_is_healthy (backend))
+        return backend;
+    }
+  while (self->priv->next_backend_node != orig_node);
+
+  return NULL;
+}
+
+static gdouble
+evd_reproxy_get_mean_latency (EvdReproxy *self)
+{
+  GList *node;
+  gdouble sum = 0;
+  guint count = 0;
+
+  for (node = self->priv->backends; node != NULL; node = node->next)
+    {
+      EvdReproxyBackend *backend = node->data;
+
+      if (backend->latency > 0)
+        {
+          sum += backend->latency;
+          count++;
+        }
+    }
+
+  return count > 0 ? sum / count : 0;
+}
+
+static gdouble
+evd_reproxy_get_backend_latency (EvdReproxyBackend *backend,
+                                 gdouble            mean_latency,
+                                 gint64             now)
+{
+  gdouble latency;
+
+  if (backend->latency > 0)
+    latency = backend->latency;
+  else if (backend->active_bridges == 0)
+    /* an idle backend without samples yet gets one bridge to take one */
+    latency = 0;
+  else
+    /* until then, it is assumed to be as fast as the average backend */
+    latency = mean_latency;
+
+  /* requests that have been waiting longer than the average response time
+     are a better estimate of how the backend is doing now */
+  if (backend->pending_requests > 0)
+    {
+      gdouble in_flight;
+
+      in_flight = (gdouble) (now * backend->pending_requests -
+                             backend->pending_time_sum) /
+        backend->pending_requests;
+
+      latency = MAX (latency, in_flight);
+    }
+
+  /* at least one microsecond, so the number of bridges still counts */
+  return MAX (latency, 1.0);
+}
+
+static gdouble
+evd_reproxy_get_backend_load (EvdReproxy        *self,
+                              EvdReproxyBackend *backend,
+                              gdouble            mean_latency,
+                              gint64             now)
+{
+  gdouble load;
+
+  load = (gdouble) (backend->active_bridges + 1) / backend->weight;
+
+  if (self->priv->balance == EVD_REPROXY_BALANCE_LEAST_LATENCY)
+    load *= evd_reproxy_get_backend_latency (backend, mean_latency, now);
+
+  return load;
+}
+
+static EvdReproxyBackend *
+evd_reproxy_select_least_loaded (EvdReproxy *self)
+{
+  EvdReproxyBackend *best = NULL;
+  gdouble best_load = 0;
+  gdouble mean_latency = 0;
+  gint64 now = 0;
+  GList *node;
+
+  if (self->priv->balance == EVD_REPROXY_BALANCE_LEAST_LATENCY)
+    {
+      mean_latency = evd_reproxy_get_mean_latency (self);
+      now = g_get_monotonic_time ();
+    }
+
+  /* start from a rotating node so that ties are spread evenly */
+  node = self->priv->next_backend_node;
+  do
+    {
+      EvdReproxyBackend *backend;
+      gdouble load;
+
+      backend = evd_reproxy_get_backend_from_node (node);
+      load = evd_reproxy_get_backend_load (self, backend, mean_latency, now);
+
+      if (evd_reproxy_backend_is_healthy (backend) &&
+          (best == NULL || load < best_load))
+        {
+          best = backend;
+          best_load = load;
+        }
+
+      node = evd_reproxy_get_next_backend_node (self, node);
+    }
+  while (node != self->priv->next_backend_node);
+
+  evd_reproxy_hop_backend (self);
+
+  return best;
+}
+
+static EvdReproxyBackend *
+evd_reproxy_select_weighted (EvdReproxy *self)
+{
+  EvdReproxyBackend *best = NULL;
+  gint total = 0;
+  GList *node;
+
+  /* smooth weighted round-robin, which interleaves the picks instead of
+     sending bursts to the heaviest backend */
+  node = self->priv->backends;
+  while (node != NULL)
+    {
+      EvdReproxyBackend *backend = node->data;
+
+      node = node->next;
+
+      if (! evd_reproxy_backend_is_healthy (backend))
+        continue;
+
+      backend->current_weight += backend->weight;
+      total += backend->weight;
+
+      if (best == NULL || backend->current_weight > best->current_weight)
+        best = backend;
+    }
+
+  if (best != NULL)
+    best->current_weight -= total;
+
+  return best;
+}
+
+static guint32
+evd_reproxy_hash (const gchar *str, guint32 seed)
+{
+  guint32 hash = 2166136261U ^ seed;
+
+  /* FNV-1a, with a final avalanche so that similar keys spread
+     over the whole ring */
+  while (*str != '\0')
+    {
+      hash ^= (guchar) *str;
+      hash *= 16777619U;
+      str++;
+    }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35U;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+static gint
+evd_reproxy_compare_ring_points (gconstpointer a, gconstpointer b)
+{
+  const EvdReproxyRingPoint *p1 = a;
+  const EvdReproxyRingPoint *p2 = b;
+
+  if (p1->hash < p2->hash)
+    return -1;
+  else
+    return p1->hash > p2->hash ? 1 : 0;
+}
+
+static void
+evd_reproxy_build_hash_ring (EvdReproxy *self)
+{
+  GList *node;
+
+  g_array_set_size (self->priv->hash_ring, 0);
+
+  node = self->priv->backends;
+  while (node != NULL)
+    {
+      EvdReproxyBackend *backend = node->data;
+      guint i;
+
+      for (i = 0; i < backend->weight * HASH_RING_POINTS; i++)
+        {
+          EvdReproxyRingPoint point;
+
+          point.hash = evd_reproxy_hash (backend->address, i);
+          point.backend = backend;
+
+          g_array_append_val (self->priv->hash_ring, point);
+        }
+
+      node = node->next;
+    }
+
+  g_array_sort (self->priv->hash_ring, evd_reproxy_compare_ring_points);
+
+  self->priv->hash_ring_dirty = FALSE;
+}
+
+static EvdReproxyBackend *
+evd_reproxy_select_hashed (EvdReproxy *self, EvdConnection *conn)
+{
+  GArray *ring;
+  gchar *addr;
+  guint32 hash;
+  guint low;
+  guint high;
+  guint i;
+
+  addr = evd_connection_get_remote_address_as_string (conn, NULL);
+  if (addr == NULL)
+    return evd_reproxy_select_round_robin (self);
+
+  hash = evd_reproxy_hash (addr, 0);
+  g_free (addr);
+
+  if (self->priv->hash_ring_dirty)
+    evd_reproxy_build_hash_ring (self);
+
+  /* first point clockwise from the hash, wrapping around */
+  ring = self->priv->hash_ring;
+  low = 0;
+  high = ring->len;
+  while (low < high)
+    {
+      guint mid = low + (high - low) / 2;
+
+      if (g_array_index (ring, EvdReproxyRingPoint, mid).hash < hash)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  /* ejected backends hand their keys over to the next ones */
+  for (i = 0; i < ring->len; i++)
+    {
+      EvdReproxyBackend *backend;
+
+      backend = g_array_index (ring,
+                               EvdReproxyRingPoint,
+                               (low + i) % ring->len).backend;
+      if (evd_reproxy_backend_is_healthy (backend))
+        return backend;
+    }
+
+  return NULL;
+}
+
+static EvdReproxyBackend *
+evd_reproxy_select_backend (EvdReproxy *self, EvdConnection *conn)
+{
+  if (self->priv->next_backend_node == NULL)
+    return NULL;
+
+  switch (self->priv->balance)
+    {
+    case EVD_REPROXY_BALANCE_LEAST_CONNECTIONS:
+    case EVD_REPROXY_BALANCE_LEAST_LATENCY:
+      return evd_reproxy_select_least_loaded (self);
+
+    case EVD_REPROXY_BALANCE_WEIGHTED_ROUND_ROBIN:
+      return evd_reproxy_select_weighted (self);
+
+    case EVD_REPROXY_BALANCE_ADDRESS_HASH:
+      return evd_reproxy_select_hashed (self, conn);
+
+    default:
+      return evd_reproxy_select_round_robin (self);
+    }
+}
+
+static void
+evd_reproxy_bridge_end_request (EvdReproxyBridge *bridge)
+{
+  bridge->backend->pending_requests--;
+  bridge->backend->pending_time_sum -= bridge->request_time;
+
+  bridge->request_time = 0;
+}
+
+static void
+evd_reproxy_bridge_on_data (EvdReproxyBridge *bridge)
+{
+  if (bridge->backend != NULL)
+    {
+      /* first response bytes since the last request */
+      if (bridge->request_time > 0)
+        {
+          EvdReproxyBackend *backend = bridge->backend;
+          gdouble sample;
+
+          sample = g_get_monotonic_time () - bridge->request_time;
+          if (backend->latency == 0)
+            backend->latency = sample;
+          else
+            backend->latency += LATENCY_EWMA_ALPHA * (sample - backend->latency);
+
+          evd_reproxy_bridge_end_request (bridge);
+        }
+    }
+  else
+    {
+      EvdReproxyBridge *peer;
+
+      /* a request towards a backend, time it on the backend's bridge */
+      peer = g_object_get_data (G_OBJECT (bridge->conn), BRIDGE_DATA_KEY);
+      if (peer != NULL && peer->backend != NULL && peer->request_time == 0)
+        {
+          peer->request_time = g_get_monotonic_time ();
+
+          peer->backend->pending_requests++;
+          peer->backend->pending_time_sum += peer->request_time;
+        }
+    }
+}
+
 static gboolean
 evd_reproxy_bridge_write (gpointer user_data)
 {
@@ -272,11 +746,27 @@ evd_reproxy_bridge_on_read (GObject      *obj,
 
   if ( (size = g_input_stream_read_finish (G_INPUT_STREAM (obj),
                                            res,
-                                           &error)) > 0)
+                                           &error)) > 0 && bridge != NULL)
     {
-      bridge->size = (gsize) size;
+      evd_reproxy_bridge_on_data (bridge);
 
-      evd_reproxy_bridge_write (conn0);
+      if (bridge->splice)
+        {
+          /* input is available again, push back what the probe read
+             and keep splicing */
+          evd_buffered_input_stream_unread (EVD_BUFFERED_INPUT_STREAM (obj),
+                                            bridge->buf,
+                                            size,
+                                            NULL,
+                                            NULL);
+          evd_reproxy_bridge_splice (conn0);
+        }
+      else
+        {
+          bridge->size = (gsize) size;
+
+          evd_reproxy_bridge_write (conn0);
+        }
     }
   else if (size < 0)
     {
@@ -292,8 +782,14 @@ evd_reproxy_bridge_read (gpointer user_data)
   EvdReproxyBridge *bridge;
 
   bridge = g_object_get_data (G_OBJECT (conn0), BRIDGE_DATA_KEY);
+  if (bridge == NULL)
+    return FALSE;
 
-  if (evd_connection_get_max_writable (bridge->conn) > 0)
+  if (bridge->splice)
+    {
+      evd_reproxy_bridge_splice (conn0);
+    }
+  else if (evd_connection_get_max_writable (bridge->conn) > 0)
     {
       GInputStream *stream;
 
@@ -316,6 +812,95 @@ evd_reproxy_bridge_read (gpointer user_data)
   return FALSE;
 }
 
+static void
+evd_reproxy_bridge_splice (EvdConnection *conn0)
+{
+  EvdReproxyBridge *bridge;
+  GInputStream *stream;
+  GError *error = NULL;
+  gssize size;
+
+  bridge = g_object_get_data (G_OBJECT (conn0), BRIDGE_DATA_KEY);
+  if (bridge == NULL)
+    return;
+
+  /* a probe read is waiting for input */
+  stream = g_io_stream_get_input_stream (G_IO_STREAM (conn0));
+  if (g_input_stream_has_pending (stream))
+    return;
+
+  while (TRUE)
+    {
+      /* whatever is left in the pipe goes first */
+      if (bridge->pipe_size > 0)
+        {
+          size = evd_connection_splice_from (bridge->conn,
+                                             bridge->pipe[0],
+                                             bridge->pipe_size,
+                                             &error);
+          if (size < 0)
+            {
+              if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+                {
+                  g_clear_error (&error);
+                  evd_connection_lock_close (conn0);
+                }
+              break;
+            }
+
+          bridge->pipe_size -= size;
+          if (bridge->pipe_size > 0)
+            {
+              /* resumed by the 'write' signal of the other end */
+              evd_connection_lock_close (conn0);
+              break;
+            }
+        }
+
+      if (evd_connection_get_max_writable (bridge->conn) == 0)
+        {
+          evd_connection_lock_close (conn0);
+          break;
+        }
+
+      size = evd_connection_splice (conn0,
+                                    bridge->pipe[1],
+                                    BRIDGE_PIPE_SIZE,
+                                    &error);
+      if (size < 0)
+        {
+          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              g_clear_error (&error);
+
+              /* input is only watched while a read is pending, so wait for
+                 it with a tiny regular read */
+              g_input_stream_read_async (stream,
+                                         bridge->buf,
+                                         1,
+                                         evd_connection_get_priority (conn0),
+                                         NULL,
+                                         evd_reproxy_bridge_on_read,
+                                         conn0);
+            }
+          break;
+        }
+      else if (size == 0)
+        {
+          break;
+        }
+
+      evd_reproxy_bridge_on_data (bridge);
+      bridge->pipe_size = size;
+    }
+
+  if (error != NULL)
+    {
+      g_debug ("reproxy splice error: %s", error->message);
+      g_error_free (error);
+    }
+}
+
 static void
 evd_reproxy_bridge_on_write (EvdConnection *bridge, gpointer user_data)
 {
@@ -337,6 +922,15 @@ evd_reproxy_connection_setup_bridge (EvdReproxy    *self,
 
   bridge->buf = g_new (gchar, BRIDGE_BLOCK_SIZE);
 
+#ifdef __linux__
+  if (! evd_connection_get_tls_active (conn0) &&
+      ! evd_connection_get_tls_active (conn1) &&
+      pipe2 (bridge->pipe, O_NONBLOCK | O_CLOEXEC) == 0)
+    {
+      bridge->splice = TRUE;
+    }
+#endif
+
   g_object_set_data (G_OBJECT (conn0), BRIDGE_DATA_KEY, bridge);
 
   g_signal_connect (conn1,
@@ -362,6 +956,23 @@ evd_reproxy_connection_on_flush (GObject      *obj,
   if (! g_io_stream_is_closed (G_IO_STREAM (conn)))
     g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
 
+#ifdef __linux__
+  if (bridge->splice)
+    {
+      close (bridge->pipe[0]);
+      close (bridge->pipe[1]);
+    }
+#endif
+
+  if (bridge->backend != NULL)
+    {
+      if (bridge->request_time > 0)
+        evd_reproxy_bridge_end_request (bridge);
+
+      bridge->backend->active_bridges--;
+      evd_reproxy_backend_unref (bridge->backend);
+    }
+
   g_free (bridge->buf);
   g_free (bridge);
 
@@ -375,6 +986,7 @@ evd_reproxy_connection_on_close (EvdConnection *conn, gpointer user_data)
   GOutputStream *stream;
 
   bridge = g_object_get_data (G_OBJECT (conn), BRIDGE_DATA_KEY);
+  g_object_set_data (G_OBJECT (conn), BRIDGE_DATA_KEY, NULL);
 
   stream = g_io_stream_get_output_stream (G_IO_STREAM (bridge->conn));
   g_output_stream_flush_async (stream,
@@ -390,9 +1002,12 @@ evd_reproxy_backend_on_connection (GObject      *obj,
                                    gpointer      user_data)
 {
   EvdReproxy *self = EVD_REPROXY (user_data);
+  EvdReproxyBackend *backend;
   EvdConnection *conn1;
   GError *error = NULL;
 
+  backend = evd_reproxy_find_backend (self, EVD_CONNECTION_POOL (obj));
+
   if ( (conn1 =
         evd_connection_pool_get_connection_finish (EVD_CONNECTION_POOL (obj),
                                                    res,
@@ -415,31 +1030,69 @@ evd_reproxy_backend_on_connection (GObject      *obj,
       evd_reproxy_connection_setup_bridge (self, conn0, conn1);
       evd_reproxy_connection_setup_bridge (self, conn1, conn0);
 
+      if (backend != NULL)
+        {
+          EvdReproxyBridge *bridge;
+
+          /* the backend's bridge holds the outstanding count until closed */
+          bridge = g_object_get_data (G_OBJECT (conn1), BRIDGE_DATA_KEY);
+          bridge->backend = evd_reproxy_backend_ref (backend);
+          backend->total_bridges++;
+        }
+
       g_object_unref (conn0);
     }
   else
     {
+      EvdConnection *conn0;
+      guint retries;
+
+      if (backend != NULL)
+        backend->active_bridges--;
+
       g_debug ("reproxy new conn error: %s", error->message);
       g_error_free (error);
 
-      /* @TODO: retry, but wisely */
+      /* offer the waiting client to another backend, which won't be this
+         one if it has just been ejected */
+      conn0 = g_queue_pop_head (self->priv->conns);
+      if (conn0 == NULL)
+        return;
+
+      retries = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (conn0),
+                                                     RETRIES_DATA_KEY));
+      if (retries < MAX_DISPATCH_RETRIES &&
+          ! g_io_stream_is_closed (G_IO_STREAM (conn0)))
+        {
+          g_object_set_data (G_OBJECT (conn0),
+                             RETRIES_DATA_KEY,
+                             GUINT_TO_POINTER (retries + 1));
+          evd_reproxy_dispatch (self, conn0);
+        }
+      else
+        {
+          g_io_stream_close (G_IO_STREAM (conn0), NULL, NULL);
+        }
+
+      g_object_unref (conn0);
     }
 }
 
 static void
-evd_reproxy_connection_accepted (EvdService *service, EvdConnection *conn)
+evd_reproxy_dispatch (EvdReproxy *self, EvdConnection *conn)
 {
-  EvdReproxy *self = EVD_REPROXY (service);
-  EvdConnectionPool *backend;
+  EvdReproxyBackend *backend;
 
-  backend = evd_reproxy_get_backend_with_free_connections (self);
+  backend = evd_reproxy_select_backend (self, conn);
   if (backend == NULL)
     {
-      backend = evd_reproxy_get_backend_from_node (self->priv->next_backend_node);
-      evd_reproxy_hop_backend (self);
+      g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
+      return;
     }
 
-  evd_connection_pool_get_connection (backend,
+  backend->active_bridges++;
+
+  evd_connection_pool_get_connection (backend->pool,
                                       NULL,
                                       evd_reproxy_backend_on_connection,
                                       self);
@@ -447,6 +1100,12 @@ evd_reproxy_connection_accepted (EvdService *service, EvdConnection *conn)
   evd_reproxy_enqueue_connection (self, conn);
 }
 
+static void
+evd_reproxy_connection_accepted (EvdService *service, EvdConnection *conn)
+{
+  evd_reproxy_dispatch (EVD_REPROXY (service), conn);
+}
+
 /* public methods */
 
 EvdReproxy *
@@ -468,26 +1127,144 @@ evd_reproxy_new (void)
 EvdConnectionPool *
 evd_reproxy_add_backend (EvdReproxy *self, const gchar *address)
 {
-  EvdConnectionPool *backend;
+  EvdReproxyBackend *backend;
 
   g_return_val_if_fail (EVD_IS_REPROXY (self), NULL);
   g_return_val_if_fail (address != NULL, NULL);
 
-  backend = evd_connection_pool_new (address, EVD_TYPE_CONNECTION);
+  backend = g_slice_new0 (EvdReproxyBackend);
+  backend->pool = g_object_new (EVD_TYPE_CONNECTION_POOL,
+                                "address", address,
+                                "connection-type", EVD_TYPE_CONNECTION,
+                                "min-conns", self->priv->backend_min_conns,
+                                "max-conns", self->priv->backend_max_conns,
+                                "max-failures", DEFAULT_BACKEND_MAX_FAILURES,
+                                NULL);
+  backend->address = g_strdup (address);
+  backend->ref_count = 1;
+  backend->weight = DEFAULT_BACKEND_WEIGHT;
 
   self->priv->backends = g_list_append (self->priv->backends, backend);
 
   if (self->priv->next_backend_node == NULL)
     self->priv->next_backend_node = self->priv->backends;
 
-  return backend;
+  self->priv->hash_ring_dirty = TRUE;
+
+  return backend->pool;
 }
 
 void
-evd_reproxy_remove_backend (EvdReproxy *self, EvdConnectionPool *backend)
+evd_reproxy_remove_backend (EvdReproxy *self, EvdConnectionPool *pool)
 {
+  EvdReproxyBackend *backend;
+
   g_return_if_fail (EVD_IS_REPROXY (self));
-  g_return_if_fail (EVD_IS_CONNECTION_POOL (self));
+  g_return_if_fail (EVD_IS_CONNECTION_POOL (pool));
+
+  backend = evd_reproxy_find_backend (self, pool);
+  if (backend == NULL)
+    return;
+
+  if (self->priv->next_backend_node != NULL &&
+      self->priv->next_backend_node->data == backend)
+    {
+      evd_reproxy_hop_backend (self);
+    }
+
+  self->priv->backends = g_list_remove (self->priv->backends, backend);
+
+  if (self->priv->backends == NULL)
+    self->priv->next_backend_node = NULL;
+
+  self->priv->hash_ring_dirty = TRUE;
+
+  evd_reproxy_backend_unref (backend);
+}
+
+/**
+ * evd_reproxy_set_balance:
+ *
+ * Sets the strategy used to choose the backend for each new connection:
+ * plain round-robin over backends with free connections (the default),
+ * fewest outstanding bridges, lowest moving average of response latency
+ * times outstanding bridges, smooth weighted round-robin, or consistent
+ * hashing on the client address. Loads are scaled by backend weights.
+ **/
+void
+evd_reproxy_set_balance (EvdReproxy *self, EvdReproxyBalance balance)
+{
+  g_return_if_fail (EVD_IS_REPROXY (self));
+
+  self->priv->balance = balance;
+}
+
+EvdReproxyBalance
+evd_reproxy_get_balance (EvdReproxy *self)
+{
+  g_return_val_if_fail (EVD_IS_REPROXY (self),
+                        EVD_REPROXY_BALANCE_ROUND_ROBIN);
+
+  return self->priv->balance;
+}
+
+/**
+ * evd_reproxy_set_backend_weight:
+ * @weight: relative capacity of the backend, 1 by default
+ *
+ **/
+void
+evd_reproxy_set_backend_weight (EvdReproxy        *self,
+                                EvdConnectionPool *pool,
+                                guint              weight)
+{
+  EvdReproxyBackend *backend;
+
+  g_return_if_fail (EVD_IS_REPROXY (self));
+  g_return_if_fail (EVD_IS_CONNECTION_POOL (pool));
+  g_return_if_fail (weight > 0);
+
+  backend = evd_reproxy_find_backend (self, pool);
+  g_return_if_fail (backend != NULL);
+
+  backend->weight = weight;
+  backend->current_weight = 0;
+
+  self->priv->hash_ring_dirty = TRUE;
+}
+
+/**
+ * evd_reproxy_get_backend_stats:
+ * @active_bridges: (out) (allow-none): connections currently bridged to, or
+ * waiting for, the backend
+ * @total_bridges: (out) (allow-none): connections bridged so far
+ * @latency: (out) (allow-none): moving average of the time between a
+ * request and the first bytes of its response, in seconds
+ *
+ * Returns: %TRUE if @pool is a backend of @self, %FALSE otherwise.
+ **/
+gboolean
+evd_reproxy_get_backend_stats (EvdReproxy        *self,
+                               EvdConnectionPool *pool,
+                               guint             *active_bridges,
+                               guint64           *total_bridges,
+                               gdouble           *latency)
+{
+  EvdReproxyBackend *backend;
+
+  g_return_val_if_fail (EVD_IS_REPROXY (self), FALSE);
+  g_return_val_if_fail (EVD_IS_CONNECTION_POOL (pool), FALSE);
+
+  backend = evd_reproxy_find_backend (self, pool);
+  if (backend == NULL)
+    return FALSE;
+
+  if (active_bridges != NULL)
+    *active_bridges = backend->active_bridges;
+  if (total_bridges != NULL)
+    *total_bridges = backend->total_bridges;
+  if (latency != NULL)
+    *latency = backend->latency / G_USEC_PER_SEC;
 
-  self->priv->backends = g_list_remove_all (self->priv->backends, backend);
+  return TRUE;
 }
@@ -32,6 +32,15 @@
 
 G_BEGIN_DECLS
 
+typedef enum
+{
+  EVD_REPROXY_BALANCE_ROUND_ROBIN          = 0,
+  EVD_REPROXY_BALANCE_LEAST_CONNECTIONS    = 1,
+  EVD_REPROXY_BALANCE_LEAST_LATENCY        = 2,
+  EVD_REPROXY_BALANCE_WEIGHTED_ROUND_ROBIN = 3,
+  EVD_REPROXY_BALANCE_ADDRESS_HASH         = 4
+} EvdReproxyBalance;
+
 typedef struct _EvdReproxy EvdReproxy;
 typedef struct _EvdReproxyClass EvdReproxyClass;
 typedef struct _EvdReproxyPrivate EvdReproxyPrivate;
@@ -66,15 +75,28 @@ struct _EvdReproxyClass
 #define EVD_REPROXY_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), EVD_TYPE_REPROXY, EvdReproxyClass))
 
 
-GType              evd_reproxy_get_type          (void) G_GNUC_CONST;
+GType              evd_reproxy_get_type           (void) G_GNUC_CONST;
+
+EvdReproxy        *evd_reproxy_new                (void);
+
+EvdConnectionPool *evd_reproxy_add_backend        (EvdReproxy  *self,
+                                                   const gchar *address);
 
-EvdReproxy        *evd_reproxy_new               (void);
+void               evd_reproxy_remove_backend     (EvdReproxy        *self,
+                                                   EvdConnectionPool *backend);
 
-EvdConnectionPool *evd_reproxy_add_backend       (EvdReproxy  *self,
-                                                  const gchar *address);
+void               evd_reproxy_set_balance        (EvdReproxy        *self,
+                                                   EvdReproxyBalance  balance);
+EvdReproxyBalance  evd_reproxy_get_balance        (EvdReproxy        *self);
 
-void               evd_reproxy_remove_backend    (EvdReproxy        *self,
-                                                  EvdConnectionPool *backend);
+void               evd_reproxy_set_backend_weight (EvdReproxy        *self,
+                                                   EvdConnectionPool *backend,
+                                                   guint              weight);
+gboolean           evd_reproxy_get_backend_stats  (EvdReproxy        *self,
+                                                   EvdConnectionPool *backend,
+                                                   guint             *active_bridges,
+                                                   guint64           *total_bridges,
+                                                   gdouble           *latency);
 
 G_END_DECLS
 
@@ -26,20 +26,89 @@
 
 #include "evd-resolver.h"
 
+#define DEFAULT_CACHE_TTL          30 /* seconds */
+#define DEFAULT_NEGATIVE_CACHE_TTL  5 /* seconds */
+
+#define MAX_CACHE_ENTRIES 1024
+
 G_DEFINE_TYPE (EvdResolver, evd_resolver, G_TYPE_OBJECT)
 
+#define EVD_RESOLVER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), \
+                                       EVD_TYPE_RESOLVER, \
+                                       EvdResolverPrivate))
+
+/* private data */
+struct _EvdResolverPrivate
+{
+  /* "host:port" -> EvdResolverCacheEntry */
+  GHashTable *cache;
+  /* "host:port" -> EvdResolverLookup, for lookups in flight */
+  GHashTable *lookups;
+
+  guint cache_ttl;
+  guint negative_cache_ttl;
+
+  guint64 hits;
+  guint64 misses;
+  guint64 coalesced;
+};
+
+typedef struct _EvdResolverLookup EvdResolverLookup;
+
 typedef struct
 {
   guint16 port;
   GList *addresses;
   EvdResolver *resolver;
+  GCancellable *cancellable;
+  gulong cancelled_id;
+
+  /* the shared lookup this request waits on, if any */
+  EvdResolverLookup *lookup;
 } EvdResolverData;
 
+typedef struct
+{
+  GList *addresses;
+  GError *error;
+  gint64 expires;
+} EvdResolverCacheEntry;
+
+struct _EvdResolverLookup
+{
+  gchar *key;
+  guint16 port;
+  EvdResolver *resolver;
+  GCancellable *cancellable;
+  GList *results;
+};
+
+/* properties */
+enum
+{
+  PROP_0,
+  PROP_CACHE_TTL,
+  PROP_NEGATIVE_CACHE_TTL
+};
+
+/* the cache and the lookups in flight are shared by the contexts
+   of all threads resolving through the same resolver */
+G_LOCK_DEFINE_STATIC (cache_mutex);
+
 static void     evd_resolver_class_init         (EvdResolverClass *class);
 static void     evd_resolver_init               (EvdResolver *self);
 
 static void     evd_resolver_finalize           (GObject *obj);
 
+static void     evd_resolver_set_property       (GObject      *obj,
+                                                 guint         prop_id,
+                                                 const GValue *value,
+                                                 GParamSpec   *pspec);
+static void     evd_resolver_get_property       (GObject    *obj,
+                                                 guint       prop_id,
+                                                 GValue     *value,
+                                                 GParamSpec *pspec);
+
 static EvdResolver *evd_resolver_default = NULL;
 
 /**
@@ -66,22 +135,133 @@ evd_resolver_class_init (EvdResolverClass *class)
   obj_class = G_OBJECT_CLASS (class);
 
   obj_class->finalize = evd_resolver_finalize;
+  obj_class->get_property = evd_resolver_get_property;
+  obj_class->set_property = evd_resolver_set_property;
+
+  g_object_class_install_property (obj_class, PROP_CACHE_TTL,
+                                   g_param_spec_uint ("cache-ttl",
+                                                      "Cache TTL",
+                                                      "Seconds a successful lookup is kept in the cache, 0 disables caching",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_CACHE_TTL,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_NEGATIVE_CACHE_TTL,
+                                   g_param_spec_uint ("negative-cache-ttl",
+                                                      "Negative cache TTL",
+                                                      "Seconds a failed lookup is kept in the cache, 0 disables negative caching",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_NEGATIVE_CACHE_TTL,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_type_class_add_private (obj_class, sizeof (EvdResolverPrivate));
+}
+
+static void
+evd_resolver_free_cache_entry (gpointer data)
+{
+  EvdResolverCacheEntry *entry = data;
+
+  evd_resolver_free_addresses (entry->addresses);
+  if (entry->error != NULL)
+    g_error_free (entry->error);
+
+  g_slice_free (EvdResolverCacheEntry, entry);
 }
 
 static void
 evd_resolver_init (EvdResolver *self)
 {
+  EvdResolverPrivate *priv;
+
+  priv = EVD_RESOLVER_GET_PRIVATE (self);
+  self->priv = priv;
+
+  priv->cache = g_hash_table_new_full (g_str_hash,
+                                       g_str_equal,
+                                       g_free,
+                                       evd_resolver_free_cache_entry);
+  priv->lookups = g_hash_table_new (g_str_hash, g_str_equal);
+
+  priv->cache_ttl = DEFAULT_CACHE_TTL;
+  priv->negative_cache_ttl = DEFAULT_NEGATIVE_CACHE_TTL;
+
+  priv->hits = 0;
+  priv->misses = 0;
+  priv->coalesced = 0;
 }
 
 static void
 evd_resolver_finalize (GObject *obj)
 {
+  EvdResolver *self = EVD_RESOLVER (obj);
+
+  /* lookups in flight hold a reference, so there are none left here */
+  g_hash_table_destroy (self->priv->lookups);
+  g_hash_table_destroy (self->priv->cache);
+
   G_OBJECT_CLASS (evd_resolver_parent_class)->finalize (obj);
 
   if (obj == G_OBJECT (evd_resolver_default))
     evd_resolver_default = NULL;
 }
 
+static void
+evd_resolver_set_property (GObject      *obj,
+                           guint         prop_id,
+                           const GValue *value,
+                           GParamSpec   *pspec)
+{
+  EvdResolver *self;
+
+  self = EVD_RESOLVER (obj);
+
+  switch (prop_id)
+    {
+    case PROP_CACHE_TTL:
+      evd_resolver_set_cache_ttl (self, g_value_get_uint (value));
+      break;
+
+    case PROP_NEGATIVE_CACHE_TTL:
+      evd_resolver_set_negative_cache_ttl (self, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+evd_resolver_get_property (GObject    *obj,
+                           guint       prop_id,
+                           GValue     *value,
+                           GParamSpec *pspec)
+{
+  EvdResolver *self;
+
+  self = EVD_RESOLVER (obj);
+
+  switch (prop_id)
+    {
+    case PROP_CACHE_TTL:
+      g_value_set_uint (value, evd_resolver_get_cache_ttl (self));
+      break;
+
+    case PROP_NEGATIVE_CACHE_TTL:
+      g_value_set_uint (value, evd_resolver_get_negative_cache_ttl (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+      break;
+    }
+}
+
 static void
 evd_resolver_free_data (gpointer _data)
 {
@@ -89,6 +269,14 @@ evd_resolver_free_data (gpointer _data)
 
   g_object_unref (data->resolver);
 
+  if (data->cancellable != NULL)
+    {
+      if (data->cancelled_id != 0)
+        g_cancellable_disconnect (data->cancellable, data->cancelled_id);
+
+      g_object_unref (data->cancellable);
+    }
+
   if (data->addresses != NULL)
     {
       g_list_foreach (data->addresses, (GFunc) g_object_unref, NULL);
@@ -98,49 +286,343 @@ evd_resolver_free_data (gpointer _data)
   g_slice_free (EvdResolverData, data);
 }
 
+static GList *
+evd_resolver_copy_addresses (GList *addresses)
+{
+  GList *copy;
+
+  copy = g_list_copy (addresses);
+  g_list_foreach (copy, (GFunc) g_object_ref, NULL);
+
+  return copy;
+}
+
+static gboolean
+evd_resolver_cache_entry_is_expired (gpointer key,
+                                     gpointer value,
+                                     gpointer user_data)
+{
+  EvdResolverCacheEntry *entry = value;
+  gint64 *now = user_data;
+
+  return entry->expires <= *now;
+}
+
+/* must be called with the cache lock held */
+static gboolean
+evd_resolver_cache_lookup (EvdResolver        *self,
+                           const gchar        *key,
+                           GSimpleAsyncResult *res)
+{
+  EvdResolverCacheEntry *entry;
+  EvdResolverData *data;
+
+  entry = g_hash_table_lookup (self->priv->cache, key);
+  if (entry == NULL)
+    return FALSE;
+
+  if (entry->expires <= g_get_monotonic_time ())
+    {
+      g_hash_table_remove (self->priv->cache, key);
+      return FALSE;
+    }
+
+  if (entry->error != NULL)
+    {
+      g_simple_async_result_set_from_error (res, entry->error);
+    }
+  else
+    {
+      data = g_simple_async_result_get_op_res_gpointer (res);
+      data->addresses = evd_resolver_copy_addresses (entry->addresses);
+    }
+
+  return TRUE;
+}
+
+/* must be called with the cache lock held */
+static void
+evd_resolver_cache_store (EvdResolver  *self,
+                          const gchar  *key,
+                          GList        *addresses,
+                          const GError *error)
+{
+  EvdResolverCacheEntry *entry;
+  guint ttl;
+  gint64 now;
+
+  if (error == NULL)
+    ttl = self->priv->cache_ttl;
+  else if (error->domain == G_RESOLVER_ERROR)
+    ttl = self->priv->negative_cache_ttl;
+  else
+    ttl = 0;
+
+  if (ttl == 0)
+    return;
+
+  now = g_get_monotonic_time ();
+
+  if (g_hash_table_size (self->priv->cache) >= MAX_CACHE_ENTRIES)
+    {
+      g_hash_table_foreach_remove (self->priv->cache,
+                                   evd_resolver_cache_entry_is_expired,
+                                   &now);
+
+      if (g_hash_table_size (self->priv->cache) >= MAX_CACHE_ENTRIES)
+        return;
+    }
+
+  entry = g_slice_new0 (EvdResolverCacheEntry);
+  entry->expires = now + (gint64) ttl * G_USEC_PER_SEC;
+
+  if (error != NULL)
+    entry->error = g_error_copy (error);
+  else
+    entry->addresses = evd_resolver_copy_addresses (addresses);
+
+  g_hash_table_replace (self->priv->cache, g_strdup (key), entry);
+}
+
 static void
 evd_resolver_on_resolver_result (GResolver    *resolver,
                                  GAsyncResult *async_result,
                                  gpointer      user_data)
 {
+  EvdResolverLookup *lookup = user_data;
+  EvdResolver *self = lookup->resolver;
   GList *result = NULL;
+  GList *addresses = NULL;
+  GList *results;
+  GList *node;
   GError *error = NULL;
-  GSimpleAsyncResult *res;
-  EvdResolverData *data;
-
-  res = G_SIMPLE_ASYNC_RESULT (user_data);
-  data = (EvdResolverData *) g_simple_async_result_get_op_res_gpointer (res);
 
   if ((result = g_resolver_lookup_by_name_finish (resolver,
 						  async_result,
 						  &error)) != NULL)
     {
-      GList *node = result;
       GInetAddress *inet_addr;
       GSocketAddress *addr;
 
+      node = result;
       while (node != NULL)
         {
           inet_addr = G_INET_ADDRESS (node->data);
 
-          addr = g_inet_socket_address_new (inet_addr, data->port);
-          data->addresses = g_list_append (data->addresses, addr);
+          addr = g_inet_socket_address_new (inet_addr, lookup->port);
+          addresses = g_list_prepend (addresses, addr);
 
           node = node->next;
         }
+      addresses = g_list_reverse (addresses);
 
       g_resolver_free_addresses (result);
     }
-  else
+
+  G_LOCK (cache_mutex);
+
+  /* a lookup whose waiters all went away is no longer in the table,
+     and an identical one may have replaced it */
+  if (g_hash_table_lookup (self->priv->lookups, lookup->key) == lookup)
+    g_hash_table_remove (self->priv->lookups, lookup->key);
+
+  evd_resolver_cache_store (self, lookup->key, addresses, error);
+
+  results = lookup->results;
+  lookup->results = NULL;
+
+  node = results;
+  while (node != NULL)
+    {
+      EvdResolverData *data;
+
+      data = g_simple_async_result_get_op_res_gpointer (node->data);
+      data->lookup = NULL;
+
+      node = node->next;
+    }
+
+  G_UNLOCK (cache_mutex);
+
+  /* all the requests that were coalesced into this lookup */
+  node = results;
+  while (node != NULL)
     {
-      g_simple_async_result_set_from_error (res, error);
-      g_error_free (error);
+      GSimpleAsyncResult *res;
+      EvdResolverData *data;
+      GError *_error = NULL;
+
+      res = G_SIMPLE_ASYNC_RESULT (node->data);
+      data = g_simple_async_result_get_op_res_gpointer (res);
+
+      if (data->cancellable != NULL &&
+          g_cancellable_set_error_if_cancelled (data->cancellable, &_error))
+        {
+          g_simple_async_result_set_from_error (res, _error);
+          g_error_free (_error);
+        }
+      else if (error != NULL)
+        {
+          g_simple_async_result_set_from_error (res, error);
+        }
+      else
+        {
+          data->addresses = evd_resolver_copy_addresses (addresses);
+        }
+
+      /* requests may come from other threads' contexts */
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+
+      node = node->next;
     }
+  g_list_free (results);
+
+  evd_resolver_free_addresses (addresses);
+  if (error != NULL)
+    g_error_free (error);
+
+  g_object_unref (lookup->cancellable);
+  g_object_unref (lookup->resolver);
+  g_free (lookup->key);
+  g_slice_free (EvdResolverLookup, lookup);
+}
+
+static void
+evd_resolver_on_request_cancelled (GCancellable *cancellable,
+                                   gpointer      user_data)
+{
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+  EvdResolverData *data;
+  EvdResolverLookup *lookup;
+  GList *node;
+
+  data = g_simple_async_result_get_op_res_gpointer (res);
 
-  g_simple_async_result_complete (res);
+  G_LOCK (cache_mutex);
+
+  /* NULL if the lookup completed and already took this request */
+  lookup = data->lookup;
+  if (lookup == NULL)
+    {
+      G_UNLOCK (cache_mutex);
+      return;
+    }
+
+  node = g_list_find (lookup->results, res);
+  g_assert (node != NULL);
+  lookup->results = g_list_delete_link (lookup->results, node);
+  data->lookup = NULL;
+
+  /* nobody else waits on it, so the lookup itself goes away; new requests
+     for the same address start a fresh one */
+  if (lookup->results == NULL)
+    {
+      if (g_hash_table_lookup (data->resolver->priv->lookups,
+                               lookup->key) == lookup)
+        {
+          g_hash_table_remove (data->resolver->priv->lookups, lookup->key);
+        }
+
+      g_cancellable_cancel (lookup->cancellable);
+    }
+
+  G_UNLOCK (cache_mutex);
+
+  g_simple_async_result_set_error (res,
+                                   G_IO_ERROR,
+                                   G_IO_ERROR_CANCELLED,
+                                   "Operation was cancelled");
+  g_simple_async_result_complete_in_idle (res);
   g_object_unref (res);
 }
 
+static void
+evd_resolver_wait_lookup (EvdResolverLookup  *lookup,
+                          GSimpleAsyncResult *res)
+{
+  EvdResolverData *data;
+
+  data = g_simple_async_result_get_op_res_gpointer (res);
+
+  data->lookup = lookup;
+  lookup->results = g_list_append (lookup->results, g_object_ref (res));
+}
+
+static void
+evd_resolver_lookup (EvdResolver        *self,
+                     const gchar        *domain,
+                     guint16             port,
+                     GSimpleAsyncResult *res)
+{
+  EvdResolverLookup *lookup;
+  EvdResolverData *data;
+  gchar *key;
+  gchar *host;
+
+  host = g_ascii_strdown (domain, -1);
+  key = g_strdup_printf ("%s:%u", host, port);
+  g_free (host);
+
+  G_LOCK (cache_mutex);
+
+  if (evd_resolver_cache_lookup (self, key, res))
+    {
+      self->priv->hits++;
+
+      G_UNLOCK (cache_mutex);
+
+      g_simple_async_result_complete_in_idle (res);
+      g_free (key);
+      return;
+    }
+
+  self->priv->misses++;
+
+  lookup = g_hash_table_lookup (self->priv->lookups, key);
+  if (lookup != NULL)
+    {
+      self->priv->coalesced++;
+      evd_resolver_wait_lookup (lookup, res);
+
+      G_UNLOCK (cache_mutex);
+
+      g_free (key);
+    }
+  else
+    {
+      lookup = g_slice_new0 (EvdResolverLookup);
+      lookup->key = key;
+      lookup->port = port;
+      lookup->resolver = g_object_ref (self);
+      lookup->cancellable = g_cancellable_new ();
+      evd_resolver_wait_lookup (lookup, res);
+
+      g_hash_table_insert (self->priv->lookups, lookup->key, lookup);
+
+      G_UNLOCK (cache_mutex);
+
+      /* the lookup is shared, so it has its own cancellable, which is
+         cancelled when the last request waiting on it is */
+      g_resolver_lookup_by_name_async (g_resolver_get_default (),
+                          domain,
+                          lookup->cancellable,
+                          (GAsyncReadyCallback) evd_resolver_on_resolver_result,
+                          lookup);
+    }
+
+  /* a cancelled request completes right away instead of waiting for the
+     lookup; connected outside the lock, since the handler runs now if
+     the request is already cancelled */
+  data = g_simple_async_result_get_op_res_gpointer (res);
+  if (data->cancellable != NULL)
+    data->cancelled_id =
+      g_cancellable_connect (data->cancellable,
+                             G_CALLBACK (evd_resolver_on_request_cancelled),
+                             res,
+                             NULL);
+}
+
 /* public methods */
 
 EvdResolver *
@@ -171,6 +653,8 @@ evd_resolver_resolve (EvdResolver         *self,
   data = g_slice_new0 (EvdResolverData);
   data->resolver = self;
   g_object_ref (self);
+  if (cancellable != NULL)
+    data->cancellable = g_object_ref (cancellable);
 
   g_simple_async_result_set_op_res_gpointer (res,
                                              data,
@@ -233,13 +717,10 @@ evd_resolver_resolve (EvdResolver         *self,
             }
           else
             {
-              g_resolver_lookup_by_name_async (g_resolver_get_default (),
-                          domain,
-                          cancellable,
-                          (GAsyncReadyCallback) evd_resolver_on_resolver_result,
-                          (gpointer) res);
+              evd_resolver_lookup (self, domain, port, res);
 
               g_free (domain);
+              g_object_unref (res);
 
               return;
             }
@@ -309,3 +790,80 @@ evd_resolver_free_addresses (GList *addresses)
 
   g_list_free (addresses);
 }
+
+void
+evd_resolver_set_cache_ttl (EvdResolver *self, guint ttl)
+{
+  g_return_if_fail (EVD_IS_RESOLVER (self));
+
+  self->priv->cache_ttl = ttl;
+}
+
+guint
+evd_resolver_get_cache_ttl (EvdResolver *self)
+{
+  g_return_val_if_fail (EVD_IS_RESOLVER (self), 0);
+
+  return self->priv->cache_ttl;
+}
+
+void
+evd_resolver_set_negative_cache_ttl (EvdResolver *self, guint ttl)
+{
+  g_return_if_fail (EVD_IS_RESOLVER (self));
+
+  self->priv->negative_cache_ttl = ttl;
+}
+
+guint
+evd_resolver_get_negative_cache_ttl (EvdResolver *self)
+{
+  g_return_val_if_fail (EVD_IS_RESOLVER (self), 0);
+
+  return self->priv->negative_cache_ttl;
+}
+
+/**
+ * evd_resolver_flush_cache:
+ *
+ * Drops all cached lookups, successful or failed. Lookups in flight are
+ * not affected.
+ **/
+void
+evd_resolver_flush_cache (EvdResolver *self)
+{
+  g_return_if_fail (EVD_IS_RESOLVER (self));
+
+  G_LOCK (cache_mutex);
+  g_hash_table_remove_all (self->priv->cache);
+  G_UNLOCK (cache_mutex);
+}
+
+/**
+ * evd_resolver_get_cache_stats:
+ * @hits: (out) (allow-none): lookups answered from the cache
+ * @misses: (out) (allow-none): lookups not found in the cache
+ * @coalesced: (out) (allow-none): misses that joined an identical lookup
+ *             already in flight instead of starting a new one
+ *
+ * Numeric and unix addresses are never looked up, so they don't count.
+ **/
+void
+evd_resolver_get_cache_stats (EvdResolver *self,
+                              guint64     *hits,
+                              guint64     *misses,
+                              guint64     *coalesced)
+{
+  g_return_if_fail (EVD_IS_RESOLVER (self));
+
+  G_LOCK (cache_mutex);
+
+  if (hits != NULL)
+    *hits = self->priv->hits;
+  if (misses != NULL)
+    *misses = self->priv->misses;
+  if (coalesced != NULL)
+    *coalesced = self->priv->coalesced;
+
+  G_UNLOCK (cache_mutex);
+}
@@ -30,10 +30,13 @@ G_BEGIN_DECLS
 
 typedef struct _EvdResolver EvdResolver;
 typedef struct _EvdResolverClass EvdResolverClass;
+typedef struct _EvdResolverPrivate EvdResolverPrivate;
 
 struct _EvdResolver
 {
   GObject parent;
+
+  EvdResolverPrivate *priv;
 };
 
 struct _EvdResolverClass
@@ -65,6 +68,20 @@ GList              *evd_resolver_resolve_finish       (EvdResolver   *self,
 
 void                evd_resolver_free_addresses       (GList *addresses);
 
+void                evd_resolver_set_cache_ttl        (EvdResolver *self,
+                                                       guint        ttl);
+guint               evd_resolver_get_cache_ttl        (EvdResolver *self);
+void                evd_resolver_set_negative_cache_ttl (EvdResolver *self,
+                                                         guint        ttl);
+guint               evd_resolver_get_negative_cache_ttl (EvdResolver *self);
+
+void                evd_resolver_flush_cache          (EvdResolver *self);
+
+void                evd_resolver_get_cache_stats      (EvdResolver *self,
+                                                       guint64     *hits,
+                                                       guint64     *misses,
+                                                       guint64     *coalesced);
+
 G_END_DECLS
 
 #endif /* __EVD_RESOLVER_H__ */
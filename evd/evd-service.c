@@ -36,6 +36,9 @@ G_DEFINE_TYPE (EvdService, evd_service, EVD_TYPE_IO_STREAM_GROUP)
 
 #define VALIDATION_HINT_KEY "org.eventdance.lib.Service.VALIDATION_HINT"
 
+#define DEFAULT_REUSE_PORT_LISTENERS  1
+#define MAX_REUSE_PORT_LISTENERS     64
+
 /* private data */
 struct _EvdServicePrivate
 {
@@ -45,8 +48,17 @@ struct _EvdServicePrivate
 
   gboolean tls_autostart;
   EvdTlsCredentials *tls_cred;
+  gboolean tls_offload_handshake;
+
+  guint reuse_port_listeners;
 };
 
+typedef struct
+{
+  GSimpleAsyncResult *async_res;
+  guint listeners;
+} ListenData;
+
 /* signals */
 enum
 {
@@ -60,7 +72,9 @@ enum
 {
   PROP_0,
   PROP_TLS_AUTOSTART,
-  PROP_TLS_CREDENTIALS
+  PROP_TLS_CREDENTIALS,
+  PROP_TLS_OFFLOAD_HANDSHAKE,
+  PROP_REUSE_PORT_LISTENERS
 };
 
 static guint evd_service_signals[SIGNAL_LAST] = { 0 };
@@ -157,6 +171,24 @@ evd_service_class_init (EvdServiceClass *class)
                                                         G_PARAM_READWRITE |
                                                         G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (obj_class, PROP_TLS_OFFLOAD_HANDSHAKE,
+                                   g_param_spec_boolean ("tls-offload-handshake",
+                                                         "Offload TLS handshakes",
+                                                         "Whether the TLS handshake of incoming connections runs in a worker thread",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_REUSE_PORT_LISTENERS,
+                                   g_param_spec_uint ("reuse-port-listeners",
+                                                      "Listeners per address",
+                                                      "Number of SO_REUSEPORT sockets opened per listening address, each one accepting from a different poll thread",
+                                                      1,
+                                                      MAX_REUSE_PORT_LISTENERS,
+                                                      DEFAULT_REUSE_PORT_LISTENERS,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
   /* add private structure */
   g_type_class_add_private (obj_class, sizeof (EvdServicePrivate));
 }
@@ -178,6 +210,9 @@ evd_service_init (EvdService *self)
 
   priv->tls_autostart = FALSE;
   priv->tls_cred = NULL;
+  priv->tls_offload_handshake = FALSE;
+
+  priv->reuse_port_listeners = DEFAULT_REUSE_PORT_LISTENERS;
 }
 
 static void
@@ -225,6 +260,14 @@ evd_service_set_property (GObject      *obj,
       evd_service_set_tls_credentials (self, g_value_get_object (value));
       break;
 
+    case PROP_TLS_OFFLOAD_HANDSHAKE:
+      evd_service_set_tls_offload_handshake (self, g_value_get_boolean (value));
+      break;
+
+    case PROP_REUSE_PORT_LISTENERS:
+      evd_service_set_reuse_port_listeners (self, g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -251,6 +294,14 @@ evd_service_get_property (GObject    *obj,
       g_value_set_object (value, evd_service_get_tls_credentials (self));
       break;
 
+    case PROP_TLS_OFFLOAD_HANDSHAKE:
+      g_value_set_boolean (value, evd_service_get_tls_offload_handshake (self));
+      break;
+
+    case PROP_REUSE_PORT_LISTENERS:
+      g_value_set_uint (value, evd_service_get_reuse_port_listeners (self));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -455,6 +506,8 @@ evd_service_connection_starttls (EvdService    *self,
   tls_session = evd_connection_get_tls_session (conn);
   tls_cred = evd_service_get_tls_credentials (self);
   evd_tls_session_set_credentials (tls_session, tls_cred);
+  evd_tls_session_set_offload_handshake (tls_session,
+                                         self->priv->tls_offload_handshake);
 
   evd_connection_starttls (conn,
                            EVD_TLS_MODE_SERVER,
@@ -487,12 +540,97 @@ evd_service_add (EvdIoStreamGroup *group, GIOStream *io_stream)
   return TRUE;
 }
 
+static EvdSocket *
+evd_service_new_listener (EvdService *self, guint index, guint listeners)
+{
+  EvdSocket *socket;
+
+  socket = evd_socket_new ();
+
+  /* with more than one listener, the kernel balances incoming
+     connections between them, and each one accepts from a different
+     poll thread. Accepted connections are handed back to the service's
+     context, where all their I/O is still dispatched */
+  if (listeners > 1)
+    g_object_set (socket,
+                  "reuse-port", TRUE,
+                  "poll-thread", index,
+                  "accept-in-poll-thread", TRUE,
+                  NULL);
+
+  return socket;
+}
+
+static void
+evd_service_drop_listener (EvdService *self, EvdSocket *socket)
+{
+  g_object_ref (socket);
+
+  evd_service_remove_listener (self, socket);
+  evd_socket_close (socket, NULL);
+
+  g_object_unref (socket);
+}
+
+static gboolean
+evd_service_listen_siblings (EvdService  *self,
+                             EvdSocket   *first,
+                             guint        listeners,
+                             GError     **error)
+{
+  GSocketAddress *address;
+  gboolean result = TRUE;
+  GList *siblings = NULL;
+  guint i;
+
+  /* the rest of the listeners bind to the address actually bound by the
+     first one, so that a port 0 is resolved only once for all of them */
+  address = evd_socket_get_local_address (first, error);
+  if (address == NULL)
+    return FALSE;
+
+  for (i = 1; i < listeners; i++)
+    {
+      EvdSocket *socket;
+
+      socket = evd_service_new_listener (self, i, listeners);
+
+      result = evd_socket_listen_addr (socket, address, error);
+      if (result)
+        {
+          evd_service_add_listener (self, socket);
+          siblings = g_list_prepend (siblings, socket);
+        }
+
+      g_object_unref (socket);
+
+      if (! result)
+        break;
+    }
+
+  g_object_unref (address);
+
+  /* all or nothing, the caller drops the first listener */
+  if (! result)
+    {
+      GList *node;
+
+      for (node = siblings; node != NULL; node = node->next)
+        evd_service_drop_listener (self, EVD_SOCKET (node->data));
+    }
+
+  g_list_free (siblings);
+
+  return result;
+}
+
 static void
 evd_service_socket_on_listen (GObject      *obj,
                               GAsyncResult *result,
                               gpointer      user_data)
 {
-  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+  ListenData *data = user_data;
+  GSimpleAsyncResult *res = data->async_res;
   EvdService *self;
   GError *error = NULL;
 
@@ -507,12 +645,24 @@ evd_service_socket_on_listen (GObject      *obj,
   else
     {
       evd_service_add_listener (self, EVD_SOCKET (obj));
-      g_object_unref (obj);
+
+      if (data->listeners > 1 &&
+          ! evd_service_listen_siblings (self,
+                                         EVD_SOCKET (obj),
+                                         data->listeners,
+                                         &error))
+        {
+          evd_service_drop_listener (self, EVD_SOCKET (obj));
+          g_simple_async_result_take_error (res, error);
+        }
     }
+  g_object_unref (obj);
 
   g_simple_async_result_complete (res);
   g_object_unref (res);
 
+  g_slice_free (ListenData, data);
+
   /* this is because g_async_result_get_source_object() increases reference
      count */
   g_object_unref (self);
@@ -576,6 +726,30 @@ evd_service_get_tls_credentials (EvdService *self)
   return self->priv->tls_cred;
 }
 
+/**
+ * evd_service_set_tls_offload_handshake:
+ *
+ * Controls whether the TLS handshake of connections auto-started by this
+ * service runs its key exchange in a worker thread instead of in the
+ * service's main context. See #EvdTlsSession:offload-handshake. Credentials
+ * with a certificate callback always handshake in the main context.
+ **/
+void
+evd_service_set_tls_offload_handshake (EvdService *self, gboolean offload)
+{
+  g_return_if_fail (EVD_IS_SERVICE (self));
+
+  self->priv->tls_offload_handshake = offload;
+}
+
+gboolean
+evd_service_get_tls_offload_handshake (EvdService *self)
+{
+  g_return_val_if_fail (EVD_IS_SERVICE (self), FALSE);
+
+  return self->priv->tls_offload_handshake;
+}
+
 void
 evd_service_set_io_stream_type (EvdService *self, GType io_stream_type)
 {
@@ -625,6 +799,23 @@ evd_service_add_listener (EvdService  *self, EvdSocket *socket)
   g_object_set_data (G_OBJECT (socket), "evd-service", self);
 }
 
+void
+evd_service_set_reuse_port_listeners (EvdService *self, guint listeners)
+{
+  g_return_if_fail (EVD_IS_SERVICE (self));
+  g_return_if_fail (listeners > 0 && listeners <= MAX_REUSE_PORT_LISTENERS);
+
+  self->priv->reuse_port_listeners = listeners;
+}
+
+guint
+evd_service_get_reuse_port_listeners (EvdService *self)
+{
+  g_return_val_if_fail (EVD_IS_SERVICE (self), 0);
+
+  return self->priv->reuse_port_listeners;
+}
+
 gboolean
 evd_service_remove_listener (EvdService *self, EvdSocket *socket)
 {
@@ -647,24 +838,28 @@ evd_service_listen (EvdService          *self,
                     GAsyncReadyCallback  callback,
                     gpointer             user_data)
 {
+  ListenData *data;
   EvdSocket *socket;
-  GSimpleAsyncResult *res;
 
   g_return_if_fail (EVD_IS_SERVICE (self));
   g_return_if_fail (address != NULL);
 
-  socket = evd_socket_new ();
+  data = g_slice_new0 (ListenData);
+  data->async_res = g_simple_async_result_new (G_OBJECT (self),
+                                               callback,
+                                               user_data,
+                                               evd_service_listen);
+  data->listeners = self->priv->reuse_port_listeners;
 
-  res = g_simple_async_result_new (G_OBJECT (self),
-                                   callback,
-                                   user_data,
-                                   evd_service_listen);
+  /* only the first listener resolves the address, the rest are bound
+     once it is listening, see evd_service_listen_siblings() */
+  socket = evd_service_new_listener (self, 0, data->listeners);
 
   evd_socket_listen (socket,
                      address,
                      cancellable,
                      evd_service_socket_on_listen,
-                     res);
+                     data);
 }
 
 gboolean
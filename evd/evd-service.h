@@ -96,10 +96,18 @@ void               evd_service_set_tls_credentials (EvdService        *self,
                                                     EvdTlsCredentials *credentials);
 EvdTlsCredentials *evd_service_get_tls_credentials (EvdService *self);
 
+void               evd_service_set_tls_offload_handshake (EvdService *self,
+                                                          gboolean    offload);
+gboolean           evd_service_get_tls_offload_handshake (EvdService *self);
+
 void               evd_service_set_io_stream_type  (EvdService *self,
                                                     GType       io_stream_type);
 GType              evd_service_get_io_stream_type  (EvdService *self);
 
+void               evd_service_set_reuse_port_listeners (EvdService *self,
+                                                         guint       listeners);
+guint              evd_service_get_reuse_port_listeners (EvdService *self);
+
 void               evd_service_add_listener        (EvdService  *self,
                                                     EvdSocket   *socket);
 
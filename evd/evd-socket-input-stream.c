@@ -20,6 +20,15 @@
  * for more details.
  */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "evd-error.h"
 #include "evd-socket-input-stream.h"
 
@@ -68,6 +77,8 @@ static void     evd_socket_input_stream_get_property       (GObject    *obj,
                                                             GValue     *value,
                                                             GParamSpec *pspec);
 
+static void     evd_socket_input_stream_notify_drained     (EvdSocketInputStream *self);
+
 static gssize   evd_socket_input_stream_read               (GInputStream  *stream,
                                                             void          *buffer,
                                                             gsize          size,
@@ -249,18 +260,22 @@ evd_socket_input_stream_read (GInputStream  *stream,
     }
 
   if (drained)
-    {
-      g_object_ref (self);
-      g_signal_emit (self,
-                     evd_socket_input_stream_signals[SIGNAL_DRAINED],
-                     0,
-                     NULL);
-      g_object_unref (self);
-    }
+    evd_socket_input_stream_notify_drained (self);
 
   return actual_size + bag_size;
 }
 
+static void
+evd_socket_input_stream_notify_drained (EvdSocketInputStream *self)
+{
+  g_object_ref (self);
+  g_signal_emit (self,
+                 evd_socket_input_stream_signals[SIGNAL_DRAINED],
+                 0,
+                 NULL);
+  g_object_unref (self);
+}
+
 /* public methods */
 
 EvdSocketInputStream *
@@ -303,3 +318,105 @@ evd_socket_input_stream_get_socket (EvdSocketInputStream *self)
 
   return self->priv->socket;
 }
+
+/**
+ * evd_socket_input_stream_splice:
+ * @fd: the write end of a pipe
+ *
+ * Moves up to @size bytes received on the socket into the pipe referred by
+ * @fd with splice(), without copying them to user-space. The pipe is
+ * expected to have room for @size bytes. Only available on Linux,
+ * %G_IO_ERROR_NOT_SUPPORTED is returned elsewhere.
+ *
+ * Returns: The number of bytes moved, 0 on end-of-stream, or -1 on error.
+ **/
+gssize
+evd_socket_input_stream_splice (EvdSocketInputStream  *self,
+                                gint                   fd,
+                                gsize                  size,
+                                GError               **error)
+{
+#ifdef __linux__
+  GSocket *socket;
+  gssize actual_size;
+  gssize bag_size = 0;
+
+  g_return_val_if_fail (EVD_IS_SOCKET_INPUT_STREAM (self), -1);
+
+  if (size == 0)
+    return 0;
+
+  socket = evd_socket_get_socket (self->priv->socket);
+  if (socket == NULL)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_INITIALIZED,
+                           "Input stream socket not initialized");
+      return -1;
+    }
+
+  /* the byte read ahead by a previous read goes first */
+  if (self->priv->has_bag)
+    {
+      if (write (fd, &self->priv->bag, 1) != 1)
+        {
+          gint errsv = errno;
+
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errsv),
+                       "Error writing to pipe: %s",
+                       g_strerror (errsv));
+          return -1;
+        }
+
+      self->priv->has_bag = FALSE;
+      bag_size = 1;
+      size--;
+
+      if (size == 0)
+        return bag_size;
+    }
+
+  do
+    actual_size = splice (g_socket_get_fd (socket),
+                          NULL,
+                          fd,
+                          NULL,
+                          size,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  while (actual_size == -1 && errno == EINTR);
+
+  if (actual_size < 0)
+    {
+      gint errsv = errno;
+
+      if (errsv == EAGAIN)
+        evd_socket_input_stream_notify_drained (self);
+
+      if (bag_size > 0)
+        return bag_size;
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Error splicing from socket: %s",
+                   g_strerror (errsv));
+      return -1;
+    }
+
+  /* a short transfer may also be due to the pipe capacity, but a spurious
+     'drained' only causes the socket condition to be re-checked */
+  if (actual_size > 0 && actual_size < size)
+    evd_socket_input_stream_notify_drained (self);
+
+  return actual_size + bag_size;
+#else
+  g_set_error_literal (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_NOT_SUPPORTED,
+                       "splice() is not supported on this platform");
+  return -1;
+#endif
+}
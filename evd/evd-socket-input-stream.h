@@ -65,6 +65,11 @@ EvdSocket            *evd_socket_input_stream_get_socket                   (EvdS
 void                  evd_socket_input_stream_set_socket                   (EvdSocketInputStream *self,
                                                                             EvdSocket            *socket);
 
+gssize                evd_socket_input_stream_splice                       (EvdSocketInputStream  *self,
+                                                                            gint                   fd,
+                                                                            gsize                  size,
+                                                                            GError               **error);
+
 G_END_DECLS
 
 #endif /* __EVD_SOCKET_INPUT_STREAM_H__ */
@@ -20,6 +20,15 @@
  * for more details.
  */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#endif
+
 #include "evd-error.h"
 #include "evd-socket-output-stream.h"
 
@@ -168,6 +177,17 @@ evd_socket_output_stream_get_property (GObject    *obj,
     }
 }
 
+static void
+evd_socket_output_stream_notify_filled (EvdSocketOutputStream *self)
+{
+  g_object_ref (self);
+  g_signal_emit (self,
+                 evd_socket_output_stream_signals[SIGNAL_FILLED],
+                 0,
+                 NULL);
+  g_object_unref (self);
+}
+
 static gssize
 evd_socket_output_stream_write (GOutputStream  *stream,
                                 const void     *buffer,
@@ -211,14 +231,7 @@ evd_socket_output_stream_write (GOutputStream  *stream,
     }
 
   if (filled)
-    {
-      g_object_ref (self);
-      g_signal_emit (self,
-                     evd_socket_output_stream_signals[SIGNAL_FILLED],
-                     0,
-                     NULL);
-      g_object_unref (self);
-    }
+    evd_socket_output_stream_notify_filled (self);
 
   return actual_size;
 }
@@ -265,3 +278,201 @@ evd_socket_output_stream_get_socket (EvdSocketOutputStream *self)
 
   return self->priv->socket;
 }
+
+/**
+ * evd_socket_output_stream_writev:
+ * @vectors: (array length=n_vectors):
+ * @cancellable: (allow-none):
+ *
+ * Sends all @vectors in a single sendmsg() call, without first
+ * concatenating them.
+ *
+ * Returns: The number of bytes written, which can be less than the sum of
+ * all vectors sizes, or -1 on error.
+ **/
+gssize
+evd_socket_output_stream_writev (EvdSocketOutputStream  *self,
+                                 const GOutputVector    *vectors,
+                                 gint                    n_vectors,
+                                 GCancellable           *cancellable,
+                                 GError                **error)
+{
+  GSocket *socket;
+  gssize actual_size;
+  gsize size = 0;
+  gint i;
+  GError *_error = NULL;
+  gboolean filled = FALSE;
+
+  g_return_val_if_fail (EVD_IS_SOCKET_OUTPUT_STREAM (self), -1);
+  g_return_val_if_fail (vectors != NULL || n_vectors == 0, -1);
+
+  for (i = 0; i < n_vectors; i++)
+    size += vectors[i].size;
+
+  if (size == 0)
+    return 0;
+
+  socket = evd_socket_get_socket (self->priv->socket);
+  if (socket == NULL)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_INITIALIZED,
+                           "Output stream socket not initialized");
+      return -1;
+    }
+
+  if (! g_output_stream_set_pending (G_OUTPUT_STREAM (self), error))
+    return -1;
+
+  actual_size = g_socket_send_message (socket,
+                                       NULL,
+                                       (GOutputVector *) vectors,
+                                       n_vectors,
+                                       NULL,
+                                       0,
+                                       G_SOCKET_MSG_NONE,
+                                       cancellable,
+                                       &_error);
+
+  g_output_stream_clear_pending (G_OUTPUT_STREAM (self));
+
+  if (actual_size < 0)
+    {
+      if (g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        filled = TRUE;
+
+      g_propagate_error (error, _error);
+    }
+  else if (actual_size < size)
+    {
+      filled = TRUE;
+    }
+
+  if (filled)
+    evd_socket_output_stream_notify_filled (self);
+
+  return actual_size;
+}
+
+static gssize
+evd_socket_output_stream_send_fd (EvdSocketOutputStream  *self,
+                                  gint                    fd,
+                                  goffset                *offset,
+                                  gsize                   size,
+                                  GError                **error)
+{
+#ifdef __linux__
+  GSocket *socket;
+  off_t off;
+  gssize actual_size;
+
+  if (size == 0)
+    return 0;
+
+  socket = evd_socket_get_socket (self->priv->socket);
+  if (socket == NULL)
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_INITIALIZED,
+                           "Output stream socket not initialized");
+      return -1;
+    }
+
+  do
+    {
+      if (offset != NULL)
+        {
+          off = *offset;
+          actual_size = sendfile (g_socket_get_fd (socket), fd, &off, size);
+        }
+      else
+        {
+          actual_size = splice (fd,
+                                NULL,
+                                g_socket_get_fd (socket),
+                                NULL,
+                                size,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+    }
+  while (actual_size == -1 && errno == EINTR);
+
+  if (actual_size < 0)
+    {
+      gint errsv = errno;
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Error sending file: %s",
+                   g_strerror (errsv));
+
+      if (errsv == EAGAIN)
+        evd_socket_output_stream_notify_filled (self);
+
+      return -1;
+    }
+
+  if (offset != NULL)
+    *offset = off;
+
+  if (actual_size < size)
+    evd_socket_output_stream_notify_filled (self);
+
+  return actual_size;
+#else
+  g_set_error_literal (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_NOT_SUPPORTED,
+                       "sendfile() is not supported on this platform");
+  return -1;
+#endif
+}
+
+/**
+ * evd_socket_output_stream_sendfile:
+ * @offset: (inout):
+ *
+ * Sends up to @size bytes from file descriptor @fd starting at @offset,
+ * straight from the kernel page cache into the socket, and advances @offset
+ * by the amount sent. Only available on Linux, %G_IO_ERROR_NOT_SUPPORTED is
+ * returned elsewhere.
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_socket_output_stream_sendfile (EvdSocketOutputStream  *self,
+                                   gint                    fd,
+                                   goffset                *offset,
+                                   gsize                   size,
+                                   GError                **error)
+{
+  g_return_val_if_fail (EVD_IS_SOCKET_OUTPUT_STREAM (self), -1);
+  g_return_val_if_fail (offset != NULL, -1);
+
+  return evd_socket_output_stream_send_fd (self, fd, offset, size, error);
+}
+
+/**
+ * evd_socket_output_stream_splice_from:
+ * @fd: the read end of a pipe
+ *
+ * Moves up to @size bytes from the pipe referred by @fd into the socket
+ * with splice(), without copying them to user-space. Only available on
+ * Linux, %G_IO_ERROR_NOT_SUPPORTED is returned elsewhere.
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_socket_output_stream_splice_from (EvdSocketOutputStream  *self,
+                                      gint                    fd,
+                                      gsize                   size,
+                                      GError                **error)
+{
+  g_return_val_if_fail (EVD_IS_SOCKET_OUTPUT_STREAM (self), -1);
+
+  return evd_socket_output_stream_send_fd (self, fd, NULL, size, error);
+}
@@ -65,6 +65,22 @@ void                   evd_socket_output_stream_set_socket                  (Evd
                                                                              EvdSocket             *socket);
 EvdSocket             *evd_socket_output_stream_get_socket                  (EvdSocketOutputStream *self);
 
+gssize                 evd_socket_output_stream_writev                      (EvdSocketOutputStream  *self,
+                                                                             const GOutputVector    *vectors,
+                                                                             gint                    n_vectors,
+                                                                             GCancellable           *cancellable,
+                                                                             GError                **error);
+
+gssize                 evd_socket_output_stream_sendfile                    (EvdSocketOutputStream  *self,
+                                                                             gint                    fd,
+                                                                             goffset                *offset,
+                                                                             gsize                   size,
+                                                                             GError                **error);
+gssize                 evd_socket_output_stream_splice_from                 (EvdSocketOutputStream  *self,
+                                                                             gint                    fd,
+                                                                             gsize                   size,
+                                                                             GError                **error);
+
 G_END_DECLS
 
 #endif /* __EVD_SOCKET_OUTPUT_STREAM_H__ */
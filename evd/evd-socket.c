@@ -29,6 +29,9 @@
  *
  **/
 
+#include <errno.h>
+#include <sys/socket.h>
+
 #include "evd-socket.h"
 
 #ifdef HAVE_GIO_UNIX
@@ -49,6 +52,10 @@ G_DEFINE_TYPE (EvdSocket, evd_socket, G_TYPE_OBJECT)
                                      EVD_TYPE_SOCKET, \
                                      EvdSocketPrivate))
 
+#define DEFAULT_ACCEPT_BUDGET 64 /* max connections accepted per wake-up */
+
+#define DEFAULT_CONNECT_ATTEMPT_DELAY 250 /* milliseconds, as in RFC 8305 */
+
 #define SOCKET_ACTIVE(socket)       (socket->priv->status == EVD_SOCKET_STATE_CONNECTED || \
                                      (socket->priv->status == EVD_SOCKET_STATE_BOUND && \
                                       socket->priv->protocol == G_SOCKET_PROTOCOL_UDP))
@@ -70,6 +77,12 @@ struct _EvdSocketPrivate
   gint priority;
 
   gboolean bind_allow_reuse;
+  gboolean reuse_port;
+
+  guint accept_budget;
+  GSource *accept_src;
+  gboolean accept_in_poll_thread;
+  struct _EvdSocketAcceptor *acceptor;
 
   EvdSocketNotifyConditionCallback notify_cond_cb;
   gpointer notify_cond_user_data;
@@ -82,8 +95,50 @@ struct _EvdSocketPrivate
 
   EvdPoll *poll;
   EvdPollSession *poll_session;
+  gint poll_thread;
+
+  /* staggered connection attempts to several resolved addresses */
+  guint connect_attempt_delay;
+  GList *connect_attempts;
+  GList *connect_addresses;
+  GSource *connect_attempt_src;
+  GError *connect_error;
 };
 
+typedef struct
+{
+  EvdSocket *self;
+  GSocket *socket;
+  GSocketAddress *address;
+  EvdPollSession *poll_session;
+} EvdSocketConnectAttempt;
+
+/* accepts connections from a poll thread on behalf of a listening socket.
+   Only 'socket' is touched from the poll thread, always under the lock;
+   accepted sockets are handed to 'context', where 'self' lives */
+typedef struct _EvdSocketAcceptor
+{
+  volatile gint ref_count;
+
+  EvdSocket *self;
+  GMainContext *context;
+  gint priority;
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  GMutex *mutex;
+#else
+  GMutex mutex;
+#endif
+  GSocket *socket;
+} EvdSocketAcceptor;
+
+typedef struct
+{
+  EvdSocketAcceptor *acceptor;
+  GSocket *client_socket;
+  GError *error;
+} EvdSocketAccepted;
+
 /* signals */
 enum
 {
@@ -106,7 +161,12 @@ enum
   PROP_PROTOCOL,
   PROP_PRIORITY,
   PROP_STATUS,
-  PROP_IO_STREAM_TYPE
+  PROP_IO_STREAM_TYPE,
+  PROP_REUSE_PORT,
+  PROP_POLL_THREAD,
+  PROP_ACCEPT_BUDGET,
+  PROP_ACCEPT_IN_POLL_THREAD,
+  PROP_CONNECT_ATTEMPT_DELAY
 };
 
 static void       evd_socket_class_init                 (EvdSocketClass *class);
@@ -153,6 +213,12 @@ static void       evd_socket_handle_condition           (EvdSocket    *self,
 
 static EvdSocket *evd_socket_accept                     (EvdSocket  *self,
                                                          GError    **error);
+static void       evd_socket_accept_batch               (EvdSocket *self);
+static gboolean   evd_socket_acceptor_watch             (EvdSocket  *self,
+                                                         GError    **error);
+static void       evd_socket_acceptor_stop              (EvdSocket *self);
+
+static void       evd_socket_connect_race_next          (EvdSocket *self);
 
 static void
 evd_socket_class_init (EvdSocketClass *class)
@@ -276,6 +342,52 @@ evd_socket_class_init (EvdSocketClass *class)
                                                        G_PARAM_READWRITE |
                                                        G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (obj_class, PROP_REUSE_PORT,
+                                   g_param_spec_boolean ("reuse-port",
+                                                         "Reuse port",
+                                                         "Whether SO_REUSEPORT is set before binding, so that several sockets can listen on the same address",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_POLL_THREAD,
+                                   g_param_spec_int ("poll-thread",
+                                                     "Poll thread",
+                                                     "Index of the poll thread that watches the socket, or -1 to let the poll choose",
+                                                     -1,
+                                                     G_MAXINT,
+                                                     -1,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_ACCEPT_BUDGET,
+                                   g_param_spec_uint ("accept-budget",
+                                                      "Accept budget",
+                                                      "Maximum number of connections accepted per wake-up of a listening socket, or 0 for no limit",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_ACCEPT_BUDGET,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_ACCEPT_IN_POLL_THREAD,
+                                   g_param_spec_boolean ("accept-in-poll-thread",
+                                                         "Accept in poll thread",
+                                                         "Whether a listening socket with a 'poll-thread' accepts connections from that thread, handing them to the context it listens from",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_CONNECT_ATTEMPT_DELAY,
+                                   g_param_spec_uint ("connect-attempt-delay",
+                                                      "Connection attempt delay",
+                                                      "Milliseconds to wait for a connection attempt before also trying the next resolved address",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_CONNECT_ATTEMPT_DELAY,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
   /* add private structure */
   g_type_class_add_private (obj_class, sizeof (EvdSocketPrivate));
 }
@@ -311,6 +423,20 @@ evd_socket_init (EvdSocket *self)
 
   priv->poll = evd_poll_get_default ();
   priv->poll_session = NULL;
+  priv->poll_thread = -1;
+
+  priv->reuse_port = FALSE;
+
+  priv->accept_budget = DEFAULT_ACCEPT_BUDGET;
+  priv->accept_src = NULL;
+  priv->accept_in_poll_thread = FALSE;
+  priv->acceptor = NULL;
+
+  priv->connect_attempt_delay = DEFAULT_CONNECT_ATTEMPT_DELAY;
+  priv->connect_attempts = NULL;
+  priv->connect_addresses = NULL;
+  priv->connect_attempt_src = NULL;
+  priv->connect_error = NULL;
 }
 
 static void
@@ -367,6 +493,26 @@ evd_socket_set_property (GObject      *obj,
       self->priv->io_stream_type = g_value_get_gtype (value);
       break;
 
+    case PROP_REUSE_PORT:
+      self->priv->reuse_port = g_value_get_boolean (value);
+      break;
+
+    case PROP_POLL_THREAD:
+      self->priv->poll_thread = g_value_get_int (value);
+      break;
+
+    case PROP_ACCEPT_BUDGET:
+      self->priv->accept_budget = g_value_get_uint (value);
+      break;
+
+    case PROP_ACCEPT_IN_POLL_THREAD:
+      self->priv->accept_in_poll_thread = g_value_get_boolean (value);
+      break;
+
+    case PROP_CONNECT_ATTEMPT_DELAY:
+      self->priv->connect_attempt_delay = g_value_get_uint (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -427,6 +573,26 @@ evd_socket_get_property (GObject    *obj,
       g_value_set_gtype (value, self->priv->io_stream_type);
       break;
 
+    case PROP_REUSE_PORT:
+      g_value_set_boolean (value, self->priv->reuse_port);
+      break;
+
+    case PROP_POLL_THREAD:
+      g_value_set_int (value, self->priv->poll_thread);
+      break;
+
+    case PROP_ACCEPT_BUDGET:
+      g_value_set_uint (value, self->priv->accept_budget);
+      break;
+
+    case PROP_ACCEPT_IN_POLL_THREAD:
+      g_value_set_boolean (value, self->priv->accept_in_poll_thread);
+      break;
+
+    case PROP_CONNECT_ATTEMPT_DELAY:
+      g_value_set_uint (value, self->priv->connect_attempt_delay);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -486,15 +652,27 @@ static evd_socket_watch (EvdSocket *self, GIOCondition cond, GError **error)
 
   if (self->priv->poll_session == NULL)
     {
-      self->priv->poll_session =
-        evd_poll_add (self->priv->poll,
-                      g_socket_get_fd (self->priv->socket),
-                      cond,
-                      self->priv->actual_priority,
-                      evd_socket_on_condition,
-                      self,
-                      NULL,
-                      error);
+      if (self->priv->poll_thread >= 0)
+        self->priv->poll_session =
+          evd_poll_add_to_thread (self->priv->poll,
+                                  self->priv->poll_thread,
+                                  g_socket_get_fd (self->priv->socket),
+                                  cond,
+                                  self->priv->actual_priority,
+                                  evd_socket_on_condition,
+                                  self,
+                                  NULL,
+                                  error);
+      else
+        self->priv->poll_session =
+          evd_poll_add (self->priv->poll,
+                        g_socket_get_fd (self->priv->socket),
+                        cond,
+                        self->priv->actual_priority,
+                        evd_socket_on_condition,
+                        self,
+                        NULL,
+                        error);
 
       return (self->priv->poll_session != NULL);
     }
@@ -610,6 +788,53 @@ evd_socket_deliver_async_result_error (EvdSocket           *self,
   g_object_unref (res);
 }
 
+static gboolean
+evd_socket_set_reuse_port (EvdSocket *self, GError **error)
+{
+#ifdef SO_REUSEPORT
+  gint fd;
+  gint one = 1;
+
+  fd = g_socket_get_fd (self->priv->socket);
+
+  if (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one)) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "Failed to set SO_REUSEPORT: %s",
+                   g_strerror (errno));
+
+      return FALSE;
+    }
+
+#ifdef SO_INCOMING_CPU
+  /* hint the kernel to hand this listener the connections arriving on the
+     CPU its poll thread is pinned to, if any */
+  if (self->priv->poll_thread >= 0)
+    {
+      gint cpu;
+      guint n_threads;
+
+      n_threads = evd_poll_get_n_threads (self->priv->poll);
+      cpu = evd_poll_get_thread_cpu (self->priv->poll,
+                                     self->priv->poll_thread % n_threads);
+      if (cpu >= 0)
+        setsockopt (fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof (cpu));
+    }
+#endif
+
+  return TRUE;
+#else
+  g_set_error_literal (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_NOT_SUPPORTED,
+                       "SO_REUSEPORT is not supported in this platform");
+
+  return FALSE;
+#endif
+}
+
 static gboolean
 evd_socket_bind_addr_internal (EvdSocket       *self,
                                GSocketAddress  *address,
@@ -625,6 +850,12 @@ evd_socket_bind_addr_internal (EvdSocket       *self,
   if (! evd_socket_setup (self, error))
     return FALSE;
 
+  if (self->priv->reuse_port && ! evd_socket_set_reuse_port (self, error))
+    {
+      evd_socket_cleanup (self, NULL);
+      return FALSE;
+    }
+
   if (! g_socket_bind (self->priv->socket,
                        address,
                        allow_reuse,
@@ -663,7 +894,7 @@ evd_socket_listen_addr_internal (EvdSocket *self, GSocketAddress *address, GErro
   g_socket_set_listen_backlog (self->priv->socket, 10000); /* TODO: change by a max-conn prop */
   if (g_socket_listen (self->priv->socket, error))
     {
-      if (evd_socket_watch (self, G_IO_IN, error))
+      if (evd_socket_acceptor_watch (self, error))
         {
           self->priv->cond = 0;
           self->priv->actual_priority = G_PRIORITY_HIGH + 1;
@@ -738,6 +969,372 @@ evd_socket_connect_addr_internal (EvdSocket        *self,
     }
 }
 
+static void
+evd_socket_connect_race_stop_timer (EvdSocket *self)
+{
+  /* the timer is attached to the thread-default context, so it is
+     destroyed directly rather than removed by id */
+  if (self->priv->connect_attempt_src != NULL)
+    {
+      g_source_destroy (self->priv->connect_attempt_src);
+      g_source_unref (self->priv->connect_attempt_src);
+      self->priv->connect_attempt_src = NULL;
+    }
+}
+
+static void
+evd_socket_connect_attempt_free (EvdSocketConnectAttempt *attempt)
+{
+  if (attempt->poll_session != NULL)
+    evd_poll_del (attempt->self->priv->poll, attempt->poll_session, NULL);
+
+  if (attempt->socket != NULL)
+    {
+      g_socket_close (attempt->socket, NULL);
+      g_object_unref (attempt->socket);
+    }
+
+  g_object_unref (attempt->address);
+
+  g_slice_free (EvdSocketConnectAttempt, attempt);
+}
+
+static void
+evd_socket_connect_race_cancel (EvdSocket *self)
+{
+  evd_socket_connect_race_stop_timer (self);
+
+  g_list_foreach (self->priv->connect_attempts,
+                  (GFunc) evd_socket_connect_attempt_free,
+                  NULL);
+  g_list_free (self->priv->connect_attempts);
+  self->priv->connect_attempts = NULL;
+
+  evd_resolver_free_addresses (self->priv->connect_addresses);
+  self->priv->connect_addresses = NULL;
+
+  if (self->priv->connect_error != NULL)
+    {
+      g_error_free (self->priv->connect_error);
+      self->priv->connect_error = NULL;
+    }
+}
+
+static void
+evd_socket_connect_race_fail (EvdSocket *self, GError *error)
+{
+  evd_socket_connect_race_cancel (self);
+
+  if (self->priv->async_result != NULL)
+    {
+      evd_socket_deliver_async_result_error (self,
+                                             self->priv->async_result,
+                                             error,
+                                             NULL,
+                                             NULL,
+                                             TRUE);
+      self->priv->async_result = NULL;
+    }
+
+  evd_socket_throw_error (self, error);
+  evd_socket_close (self, NULL);
+}
+
+static void
+evd_socket_connect_race_win (EvdSocket               *self,
+                             EvdSocketConnectAttempt *attempt)
+{
+  GSocket *socket;
+  GError *error = NULL;
+
+  self->priv->connect_attempts =
+    g_list_remove (self->priv->connect_attempts, attempt);
+
+  socket = attempt->socket;
+  attempt->socket = NULL;
+  self->priv->family = g_socket_address_get_family (attempt->address);
+
+  evd_socket_connect_attempt_free (attempt);
+
+  /* the rest of attempts lose */
+  evd_socket_connect_race_cancel (self);
+
+  evd_socket_set_socket (self, socket);
+
+  /* the socket is already writable, so the poll notifies it right away
+     and the connection completes the usual way */
+  if (! evd_socket_watch (self, G_IO_IN | G_IO_OUT, &error))
+    evd_socket_connect_race_fail (self, error);
+}
+
+static GIOCondition
+evd_socket_connect_attempt_on_condition (EvdPoll      *poll,
+                                         GIOCondition  condition,
+                                         gpointer      user_data)
+{
+  EvdSocketConnectAttempt *attempt = user_data;
+  EvdSocket *self = attempt->self;
+  gint err = 0;
+  socklen_t len = sizeof (err);
+
+  if (getsockopt (g_socket_get_fd (attempt->socket),
+                  SOL_SOCKET,
+                  SO_ERROR,
+                  &err,
+                  &len) != 0)
+    {
+      err = errno;
+    }
+  else if (err == 0 && (condition & G_IO_ERR) > 0)
+    {
+      err = ECONNREFUSED;
+    }
+
+  if (err == 0 && (condition & G_IO_OUT) == 0)
+    return condition;
+
+  g_object_ref (self);
+
+  if (err == 0)
+    {
+      evd_socket_connect_race_win (self, attempt);
+    }
+  else
+    {
+      if (self->priv->connect_error != NULL)
+        g_error_free (self->priv->connect_error);
+      self->priv->connect_error = g_error_new (G_IO_ERROR,
+                                               g_io_error_from_errno (err),
+                                               "Failed to connect: %s",
+                                               g_strerror (err));
+
+      self->priv->connect_attempts =
+        g_list_remove (self->priv->connect_attempts, attempt);
+      evd_socket_connect_attempt_free (attempt);
+
+      /* don't wait for the delay to try the next address */
+      evd_socket_connect_race_next (self);
+    }
+
+  g_object_unref (self);
+
+  return condition;
+}
+
+static EvdSocketConnectAttempt *
+evd_socket_connect_attempt_new (EvdSocket       *self,
+                                GSocketAddress  *address,
+                                GError         **error)
+{
+  EvdSocketConnectAttempt *attempt;
+  GSocket *socket;
+  GError *_error = NULL;
+
+  socket = g_socket_new (g_socket_address_get_family (address),
+                         self->priv->type,
+                         self->priv->protocol,
+                         error);
+  if (socket == NULL)
+    return NULL;
+
+  /* same options the winner gets when adopted, so they already apply
+     while connecting */
+  g_object_set (socket,
+                "blocking", FALSE,
+                "keepalive", TRUE,
+                NULL);
+
+  if (! g_socket_connect (socket, address, NULL, &_error) &&
+      ! g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_PENDING))
+    {
+      g_propagate_error (error, _error);
+      g_object_unref (socket);
+      return NULL;
+    }
+  g_clear_error (&_error);
+
+  attempt = g_slice_new0 (EvdSocketConnectAttempt);
+  attempt->self = self;
+  attempt->socket = socket;
+  attempt->address = g_object_ref (address);
+
+  if (self->priv->poll_thread >= 0)
+    attempt->poll_session =
+      evd_poll_add_to_thread (self->priv->poll,
+                              self->priv->poll_thread,
+                              g_socket_get_fd (socket),
+                              G_IO_OUT,
+                              self->priv->actual_priority,
+                              evd_socket_connect_attempt_on_condition,
+                              attempt,
+                              NULL,
+                              error);
+  else
+    attempt->poll_session =
+      evd_poll_add (self->priv->poll,
+                    g_socket_get_fd (socket),
+                    G_IO_OUT,
+                    self->priv->actual_priority,
+                    evd_socket_connect_attempt_on_condition,
+                    attempt,
+                    NULL,
+                    error);
+
+  if (attempt->poll_session == NULL)
+    {
+      evd_socket_connect_attempt_free (attempt);
+      return NULL;
+    }
+
+  return attempt;
+}
+
+static gboolean
+evd_socket_connect_race_on_delay (gpointer user_data)
+{
+  EvdSocket *self = EVD_SOCKET (user_data);
+
+  /* the source holds a reference on the socket until it is done */
+  g_source_unref (self->priv->connect_attempt_src);
+  self->priv->connect_attempt_src = NULL;
+
+  evd_socket_connect_race_next (self);
+
+  return FALSE;
+}
+
+static void
+evd_socket_connect_race_next (EvdSocket *self)
+{
+  EvdSocketConnectAttempt *attempt = NULL;
+  GSocketAddress *address;
+  GError *error = NULL;
+
+  evd_socket_connect_race_stop_timer (self);
+
+  /* addresses that can't even start connecting are skipped right away */
+  while (attempt == NULL && self->priv->connect_addresses != NULL)
+    {
+      address = G_SOCKET_ADDRESS (self->priv->connect_addresses->data);
+      self->priv->connect_addresses =
+        g_list_delete_link (self->priv->connect_addresses,
+                            self->priv->connect_addresses);
+
+      attempt = evd_socket_connect_attempt_new (self, address, &error);
+      if (attempt != NULL)
+        {
+          self->priv->connect_attempts =
+            g_list_append (self->priv->connect_attempts, attempt);
+        }
+      else
+        {
+          if (self->priv->connect_error != NULL)
+            g_error_free (self->priv->connect_error);
+          self->priv->connect_error = error;
+          error = NULL;
+        }
+
+      g_object_unref (address);
+    }
+
+  if (self->priv->connect_attempts == NULL)
+    {
+      /* every address failed, report the last error */
+      error = self->priv->connect_error;
+      self->priv->connect_error = NULL;
+
+      evd_socket_connect_race_fail (self, error);
+    }
+  else if (self->priv->connect_addresses != NULL)
+    {
+      self->priv->connect_attempt_src =
+        g_timeout_source_new (self->priv->connect_attempt_delay);
+      g_source_set_priority (self->priv->connect_attempt_src,
+                             self->priv->actual_priority);
+      g_source_set_callback (self->priv->connect_attempt_src,
+                             evd_socket_connect_race_on_delay,
+                             g_object_ref (self),
+                             g_object_unref);
+      g_source_attach (self->priv->connect_attempt_src,
+                       g_main_context_get_thread_default ());
+    }
+}
+
+static gboolean
+evd_socket_can_race (EvdSocket *self, GList *addresses)
+{
+  GList *node;
+
+  if (self->priv->sub_status != EVD_SOCKET_STATE_CONNECTING ||
+      self->priv->family != G_SOCKET_FAMILY_INVALID ||
+      self->priv->type == G_SOCKET_TYPE_DATAGRAM ||
+      self->priv->protocol == G_SOCKET_PROTOCOL_UDP ||
+      addresses->next == NULL)
+    {
+      return FALSE;
+    }
+
+  for (node = addresses; node != NULL; node = node->next)
+    if (! G_IS_INET_SOCKET_ADDRESS (node->data))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Connects to several resolved addresses at once, RFC 8305 style. The
+   addresses are interleaved by family, starting with that of the first
+   one (the resolver's preference), and a new attempt is started every
+   'connect-attempt-delay' milliseconds, or as soon as one fails, until a
+   socket connects. */
+static void
+evd_socket_connect_race_start (EvdSocket *self, GList *addresses)
+{
+  GList *first = NULL;
+  GList *second = NULL;
+  GSocketFamily family;
+  GList *node;
+
+  family = g_socket_address_get_family (G_SOCKET_ADDRESS (addresses->data));
+  for (node = addresses; node != NULL; node = node->next)
+    {
+      if (g_socket_address_get_family (G_SOCKET_ADDRESS (node->data)) == family)
+        first = g_list_prepend (first, g_object_ref (node->data));
+      else
+        second = g_list_prepend (second, g_object_ref (node->data));
+    }
+  first = g_list_reverse (first);
+  second = g_list_reverse (second);
+
+  while (first != NULL || second != NULL)
+    {
+      if (first != NULL)
+        {
+          self->priv->connect_addresses =
+            g_list_prepend (self->priv->connect_addresses, first->data);
+          first = g_list_delete_link (first, first);
+        }
+
+      if (second != NULL)
+        {
+          self->priv->connect_addresses =
+            g_list_prepend (self->priv->connect_addresses, second->data);
+          second = g_list_delete_link (second, second);
+        }
+    }
+  self->priv->connect_addresses =
+    g_list_reverse (self->priv->connect_addresses);
+
+  if (self->priv->type == G_SOCKET_TYPE_INVALID)
+    self->priv->type = G_SOCKET_TYPE_STREAM;
+  if (self->priv->protocol == G_SOCKET_PROTOCOL_UNKNOWN)
+    self->priv->protocol = G_SOCKET_PROTOCOL_DEFAULT;
+
+  self->priv->actual_priority = G_PRIORITY_HIGH + 2;
+  evd_socket_set_status (self, EVD_SOCKET_STATE_CONNECTING);
+
+  evd_socket_connect_race_next (self);
+}
+
 static void
 evd_socket_on_address_resolved (GObject      *obj,
                                 GAsyncResult *res,
@@ -758,8 +1355,11 @@ evd_socket_on_address_resolved (GObject      *obj,
       GSocketAddress *socket_address;
       GList *node = addresses;
       gboolean match = FALSE;
+      gboolean racing;
+
+      racing = evd_socket_can_race (self, addresses);
 
-      while (node != NULL)
+      while (! racing && node != NULL)
         {
           socket_address = G_SOCKET_ADDRESS (node->data);
           if (evd_socket_check_address (self, socket_address, NULL))
@@ -771,7 +1371,13 @@ evd_socket_on_address_resolved (GObject      *obj,
             node = node->next;
         }
 
-      if (match)
+      if (racing)
+        {
+          self->priv->sub_status = EVD_SOCKET_STATE_CLOSED;
+
+          evd_socket_connect_race_start (self, addresses);
+        }
+      else if (match)
         {
           gint sub_status;
 
@@ -877,9 +1483,13 @@ evd_socket_resolve_address (EvdSocket       *self,
 static void
 evd_socket_copy_properties (EvdSocket *self, EvdSocket *target)
 {
-  evd_socket_set_priority (target, self->priv->priority);
+  target->priv->priority = self->priv->priority;
+  target->priv->actual_priority = self->priv->priority;
 
   target->priv->io_stream_type = self->priv->io_stream_type;
+
+  /* accepted sockets stay in the listener's poll thread */
+  target->priv->poll_thread = self->priv->poll_thread;
 }
 
 static gboolean
@@ -942,6 +1552,90 @@ evd_socket_throw_error (EvdSocket *self, GError *error)
   g_error_free (error);
 }
 
+static gboolean
+evd_socket_resume_accept (gpointer user_data)
+{
+  EvdSocket *self = EVD_SOCKET (user_data);
+
+  g_source_unref (self->priv->accept_src);
+  self->priv->accept_src = NULL;
+
+  g_object_ref (self);
+  evd_socket_accept_batch (self);
+  g_object_unref (self);
+
+  return FALSE;
+}
+
+static void
+evd_socket_emit_new_connection (EvdSocket *self, EvdSocket *client)
+{
+  GIOStream *conn;
+
+  conn = g_object_new (self->priv->io_stream_type,
+                       "socket", client,
+                       NULL);
+
+  /* fire 'new-connection' signal */
+  g_signal_emit (self,
+                 evd_socket_signals[SIGNAL_NEW_CONNECTION],
+                 0,
+                 G_IO_STREAM (conn),
+                 NULL);
+
+  g_object_unref (conn);
+}
+
+static void
+evd_socket_accept_batch (EvdSocket *self)
+{
+  EvdSocket *client;
+  GError *error = NULL;
+  guint accepted = 0;
+
+  while (self->priv->status == EVD_SOCKET_STATE_LISTENING &&
+         (self->priv->accept_budget == 0 ||
+          accepted < self->priv->accept_budget) &&
+         (client = evd_socket_accept (self, &error)) != NULL)
+    {
+      accepted++;
+
+      evd_socket_emit_new_connection (self, client);
+      g_object_unref (client);
+    }
+
+  if (error != NULL)
+    {
+      if (error->code != G_IO_ERROR_WOULD_BLOCK)
+        {
+          evd_socket_throw_error (self, error);
+
+          /* @TODO: even on error, we should continue
+             accepting new connection until EAGAIN */
+        }
+      else
+        {
+          g_error_free (error);
+        }
+    }
+  else if (self->priv->status == EVD_SOCKET_STATE_LISTENING &&
+           self->priv->accept_src == NULL)
+    {
+      /* budget exhausted with clients possibly still queued. The socket is
+         edge-triggered and won't notify again, so accepting is resumed from
+         an idle source at the socket's regular priority, letting already
+         established connections be served in between */
+      self->priv->accept_src = g_idle_source_new ();
+      g_source_set_priority (self->priv->accept_src, self->priv->priority);
+      g_source_set_callback (self->priv->accept_src,
+                             evd_socket_resume_accept,
+                             self,
+                             NULL);
+      g_source_attach (self->priv->accept_src,
+                       g_main_context_get_thread_default ());
+    }
+}
+
 static void
 evd_socket_handle_condition (EvdSocket *self, GIOCondition condition)
 {
@@ -956,45 +1650,9 @@ evd_socket_handle_condition (EvdSocket *self, GIOCondition condition)
 
   if (self->priv->status == EVD_SOCKET_STATE_LISTENING)
     {
-      EvdSocket *client;
-      GIOStream *conn;
-
       self->priv->cond &= ~G_IO_IN;
 
-      while ( (self->priv->status == EVD_SOCKET_STATE_LISTENING) &&
-              ((client = evd_socket_accept (self, &error)) != NULL) )
-        {
-          evd_socket_copy_properties (self, client);
-
-          conn = g_object_new (self->priv->io_stream_type,
-                               "socket", client,
-                               NULL);
-
-          /* fire 'new-connection' signal */
-          g_signal_emit (self,
-                         evd_socket_signals[SIGNAL_NEW_CONNECTION],
-                         0,
-                         G_IO_STREAM (conn),
-                         NULL);
-
-          g_object_unref (conn);
-          g_object_unref (client);
-        }
-
-      if (error != NULL)
-        {
-          if (error->code != G_IO_ERROR_WOULD_BLOCK)
-            {
-              evd_socket_throw_error (self, error);
-
-              /* @TODO: even on error, we should continue
-                 accepting new connection until EAGAIN */
-            }
-          else
-            {
-              g_error_free (error);
-            }
-        }
+      evd_socket_accept_batch (self);
     }
   else
     {
@@ -1071,6 +1729,18 @@ evd_socket_cleanup_internal (EvdSocket *self, GError **error)
 
   self->priv->cond = 0;
 
+  evd_socket_connect_race_cancel (self);
+
+  if (self->priv->accept_src != NULL)
+    {
+      g_source_destroy (self->priv->accept_src);
+      g_source_unref (self->priv->accept_src);
+      self->priv->accept_src = NULL;
+    }
+
+  /* the poll thread must be done with the socket before it is closed */
+  evd_socket_acceptor_stop (self);
+
   if (self->priv->socket != NULL)
     {
       if (! evd_socket_unwatch (self, error) ||
@@ -1093,28 +1763,274 @@ evd_socket_cleanup_internal (EvdSocket *self, GError **error)
   return result;
 }
 
+static EvdSocket *
+evd_socket_new_client (EvdSocket  *self,
+                       GSocket    *client_socket,
+                       GError    **error)
+{
+  EvdSocket *client;
+
+  client = EVD_SOCKET (g_object_new (G_OBJECT_TYPE (self), NULL, NULL));
+  evd_socket_set_socket (client, client_socket);
+
+  /* properties are copied before watching, so that the poll session is
+     created with the right priority and poll thread from the start */
+  evd_socket_copy_properties (self, client);
+
+  if (evd_socket_watch (client, G_IO_IN | G_IO_OUT, error))
+    {
+      evd_socket_set_status (client, EVD_SOCKET_STATE_CONNECTED);
+
+      return client;
+    }
+
+  g_object_unref (client);
+
+  return NULL;
+}
+
 static EvdSocket *
 evd_socket_accept (EvdSocket *self, GError **error)
 {
-  EvdSocket *client = NULL;
   GSocket *client_socket;
 
   g_return_val_if_fail (EVD_IS_SOCKET (self), FALSE);
 
-  if ( (client_socket = g_socket_accept (self->priv->socket, NULL, error)) != NULL)
+  if ( (client_socket = g_socket_accept (self->priv->socket, NULL, error)) == NULL)
+    return NULL;
+
+  return evd_socket_new_client (self, client_socket, error);
+}
+
+static void
+evd_socket_acceptor_lock (EvdSocketAcceptor *acceptor)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_lock (acceptor->mutex);
+#else
+  g_mutex_lock (&acceptor->mutex);
+#endif
+}
+
+static void
+evd_socket_acceptor_unlock (EvdSocketAcceptor *acceptor)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_unlock (acceptor->mutex);
+#else
+  g_mutex_unlock (&acceptor->mutex);
+#endif
+}
+
+static EvdSocketAcceptor *
+evd_socket_acceptor_new (EvdSocket *self)
+{
+  EvdSocketAcceptor *acceptor;
+  GMainContext *context;
+
+  context = g_main_context_get_thread_default ();
+  if (context == NULL)
+    context = g_main_context_default ();
+
+  acceptor = g_slice_new0 (EvdSocketAcceptor);
+  acceptor->ref_count = 1;
+
+  acceptor->self = self;
+  acceptor->context = g_main_context_ref (context);
+  acceptor->priority = self->priv->priority;
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  acceptor->mutex = g_mutex_new ();
+#else
+  g_mutex_init (&acceptor->mutex);
+#endif
+  acceptor->socket = g_object_ref (self->priv->socket);
+
+  return acceptor;
+}
+
+static EvdSocketAcceptor *
+evd_socket_acceptor_ref (EvdSocketAcceptor *acceptor)
+{
+  g_atomic_int_inc (&acceptor->ref_count);
+
+  return acceptor;
+}
+
+static void
+evd_socket_acceptor_unref (EvdSocketAcceptor *acceptor)
+{
+  if (! g_atomic_int_dec_and_test (&acceptor->ref_count))
+    return;
+
+  if (acceptor->socket != NULL)
+    g_object_unref (acceptor->socket);
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_free (acceptor->mutex);
+#else
+  g_mutex_clear (&acceptor->mutex);
+#endif
+
+  g_main_context_unref (acceptor->context);
+
+  g_slice_free (EvdSocketAcceptor, acceptor);
+}
+
+static gboolean
+evd_socket_acceptor_deliver (gpointer user_data)
+{
+  EvdSocketAccepted *accepted = user_data;
+  EvdSocket *self = accepted->acceptor->self;
+  GError *error = accepted->error;
+
+  if (self != NULL && self->priv->status == EVD_SOCKET_STATE_LISTENING)
     {
-      client = EVD_SOCKET (g_object_new (G_OBJECT_TYPE (self), NULL, NULL));
-      evd_socket_set_socket (client, client_socket);
+      g_object_ref (self);
 
-      if (evd_socket_watch (client, G_IO_IN | G_IO_OUT, error))
+      if (accepted->client_socket != NULL)
         {
-          evd_socket_set_status (client, EVD_SOCKET_STATE_CONNECTED);
+          EvdSocket *client;
 
-          return client;
+          client = evd_socket_new_client (self,
+                                          accepted->client_socket,
+                                          &error);
+          if (client != NULL)
+            {
+              evd_socket_emit_new_connection (self, client);
+              g_object_unref (client);
+            }
         }
+
+      if (error != NULL)
+        evd_socket_throw_error (self, error);
+
+      g_object_unref (self);
     }
+  else
+    {
+      /* the listener was closed after this connection was accepted */
+      if (accepted->client_socket != NULL)
+        {
+          g_socket_close (accepted->client_socket, NULL);
+          g_object_unref (accepted->client_socket);
+        }
 
-  return NULL;
+      if (error != NULL)
+        g_error_free (error);
+    }
+
+  evd_socket_acceptor_unref (accepted->acceptor);
+  g_slice_free (EvdSocketAccepted, accepted);
+
+  return FALSE;
+}
+
+static void
+evd_socket_acceptor_hand_over (EvdSocketAcceptor *acceptor,
+                               GSocket           *client_socket,
+                               GError            *error)
+{
+  EvdSocketAccepted *accepted;
+
+  accepted = g_slice_new (EvdSocketAccepted);
+  accepted->acceptor = evd_socket_acceptor_ref (acceptor);
+  accepted->client_socket = client_socket;
+  accepted->error = error;
+
+  evd_timeout_add (acceptor->context,
+                   0,
+                   acceptor->priority,
+                   evd_socket_acceptor_deliver,
+                   accepted);
+}
+
+/* runs in the poll thread */
+static GIOCondition
+evd_socket_acceptor_on_condition (EvdPoll      *poll,
+                                  GIOCondition  condition,
+                                  gpointer      user_data)
+{
+  EvdSocketAcceptor *acceptor = user_data;
+  GSocket *client_socket;
+  GError *error = NULL;
+
+  evd_socket_acceptor_lock (acceptor);
+
+  /* the socket is edge-triggered, so the backlog is drained completely.
+     Nothing else is served from here, hence there is no budget */
+  while (acceptor->socket != NULL &&
+         (client_socket = g_socket_accept (acceptor->socket,
+                                           NULL,
+                                           &error)) != NULL)
+    {
+      evd_socket_acceptor_hand_over (acceptor, client_socket, NULL);
+    }
+
+  evd_socket_acceptor_unlock (acceptor);
+
+  if (error != NULL)
+    {
+      if (error->code != G_IO_ERROR_WOULD_BLOCK)
+        evd_socket_acceptor_hand_over (acceptor, NULL, error);
+      else
+        g_error_free (error);
+    }
+
+  return condition;
+}
+
+static gboolean
+evd_socket_acceptor_watch (EvdSocket *self, GError **error)
+{
+  EvdSocketAcceptor *acceptor;
+
+  if (! self->priv->accept_in_poll_thread || self->priv->poll_thread < 0)
+    return evd_socket_watch (self, G_IO_IN, error);
+
+  acceptor = evd_socket_acceptor_new (self);
+
+  self->priv->poll_session =
+    evd_poll_add_in_thread (self->priv->poll,
+                            self->priv->poll_thread,
+                            g_socket_get_fd (self->priv->socket),
+                            G_IO_IN,
+                            self->priv->priority,
+                            evd_socket_acceptor_on_condition,
+                            evd_socket_acceptor_ref (acceptor),
+                            (GDestroyNotify) evd_socket_acceptor_unref,
+                            error);
+
+  self->priv->acceptor = acceptor;
+
+  if (self->priv->poll_session == NULL)
+    {
+      evd_socket_acceptor_stop (self);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+evd_socket_acceptor_stop (EvdSocket *self)
+{
+  EvdSocketAcceptor *acceptor = self->priv->acceptor;
+
+  if (acceptor == NULL)
+    return;
+
+  self->priv->acceptor = NULL;
+
+  evd_socket_acceptor_lock (acceptor);
+  g_object_unref (acceptor->socket);
+  acceptor->socket = NULL;
+  evd_socket_acceptor_unlock (acceptor);
+
+  /* connections still on their way are closed on arrival */
+  acceptor->self = NULL;
+
+  evd_socket_acceptor_unref (acceptor);
 }
 
 /* public methods */
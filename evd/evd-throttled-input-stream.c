@@ -21,6 +21,7 @@
  */
 
 #include "evd-throttled-input-stream.h"
+#include "evd-socket-input-stream.h"
 
 G_DEFINE_TYPE (EvdThrottledInputStream, evd_throttled_input_stream, G_TYPE_FILTER_INPUT_STREAM)
 
@@ -264,3 +265,79 @@ evd_throttled_input_stream_remove_throttle (EvdThrottledInputStream *self,
       g_object_unref (throttle);
     }
 }
+
+/**
+ * evd_throttled_input_stream_splice:
+ *
+ * Like evd_socket_input_stream_splice(), but limited by the stream
+ * throttles. Fails with %G_IO_ERROR_NOT_SUPPORTED if the base stream is not
+ * an #EvdSocketInputStream.
+ *
+ * Returns: The number of bytes moved, 0 on end-of-stream, or -1 on error.
+ **/
+gssize
+evd_throttled_input_stream_splice (EvdThrottledInputStream  *self,
+                                   gint                      fd,
+                                   gsize                     size,
+                                   GError                  **error)
+{
+  GInputStream *base_stream;
+  gssize actual_size;
+  gsize limited_size;
+  guint wait = 0;
+
+  g_return_val_if_fail (EVD_IS_THROTTLED_INPUT_STREAM (self), -1);
+
+  base_stream =
+    g_filter_input_stream_get_base_stream (G_FILTER_INPUT_STREAM (self));
+
+  if (! EVD_IS_SOCKET_INPUT_STREAM (base_stream))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_SUPPORTED,
+                           "Base stream doesn't support splicing");
+      return -1;
+    }
+
+  if (size == 0)
+    return 0;
+
+  limited_size = evd_throttled_input_stream_get_max_readable_priv (self,
+                                                                   size,
+                                                                   &wait);
+  if (limited_size > 0)
+    {
+      actual_size =
+        evd_socket_input_stream_splice (EVD_SOCKET_INPUT_STREAM (base_stream),
+                                        fd,
+                                        limited_size,
+                                        error);
+
+      if (actual_size > 0)
+        {
+          g_list_foreach (self->priv->stream_throttles,
+                          (GFunc) evd_throttled_input_stream_report_size,
+                          &actual_size);
+        }
+    }
+  else
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_WOULD_BLOCK,
+                           "Resource temporarily unavailable");
+      actual_size = -1;
+    }
+
+  if (wait > 0)
+    {
+      g_signal_emit (self,
+                     evd_throttled_input_stream_signals[SIGNAL_DELAY_READ],
+                     0,
+                     wait,
+                     NULL);
+    }
+
+  return actual_size;
+}
@@ -75,6 +75,11 @@ void                     evd_throttled_input_stream_add_throttle     (EvdThrottl
 void                     evd_throttled_input_stream_remove_throttle  (EvdThrottledInputStream *self,
                                                                       EvdStreamThrottle       *throttle);
 
+gssize                   evd_throttled_input_stream_splice           (EvdThrottledInputStream  *self,
+                                                                      gint                      fd,
+                                                                      gsize                     size,
+                                                                      GError                  **error);
+
 G_END_DECLS
 
 #endif /* __EVD_THROTTLED_INPUT_STREAM_H__ */
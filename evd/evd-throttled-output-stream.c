@@ -21,6 +21,7 @@
  */
 
 #include "evd-throttled-output-stream.h"
+#include "evd-socket-output-stream.h"
 
 G_DEFINE_TYPE (EvdThrottledOutputStream, evd_throttled_output_stream, G_TYPE_FILTER_OUTPUT_STREAM)
 
@@ -338,3 +339,198 @@ evd_throttled_output_stream_remove_throttle (EvdThrottledOutputStream *self,
       g_object_unref (throttle);
     }
 }
+
+/**
+ * evd_throttled_output_stream_writev:
+ * @vectors: (array length=n_vectors):
+ * @cancellable: (allow-none):
+ *
+ * Writes @vectors to the base stream as a single operation, limited by the
+ * stream throttles. When the base stream is an #EvdSocketOutputStream the
+ * vectors are sent with one syscall, otherwise only the first non-empty
+ * vector is written, which callers must handle as a partial write.
+ *
+ * Returns: The number of bytes written, or -1 on error.
+ **/
+gssize
+evd_throttled_output_stream_writev (EvdThrottledOutputStream  *self,
+                                    const GOutputVector       *vectors,
+                                    gint                       n_vectors,
+                                    GCancellable              *cancellable,
+                                    GError                   **error)
+{
+  GOutputStream *base_stream;
+  GOutputVector *limited_vectors;
+  gint n_limited = 0;
+  gsize size = 0;
+  gsize limited_size;
+  gssize actual_size;
+  gint i;
+
+  g_return_val_if_fail (EVD_IS_THROTTLED_OUTPUT_STREAM (self), -1);
+  g_return_val_if_fail (vectors != NULL || n_vectors == 0, -1);
+
+  for (i = 0; i < n_vectors; i++)
+    size += vectors[i].size;
+
+  if (size == 0)
+    return 0;
+
+  base_stream =
+    g_filter_output_stream_get_base_stream (G_FILTER_OUTPUT_STREAM (self));
+
+  if (! EVD_IS_SOCKET_OUTPUT_STREAM (base_stream))
+    {
+      for (i = 0; vectors[i].size == 0; i++);
+
+      return evd_throttled_output_stream_write (G_OUTPUT_STREAM (self),
+                                                vectors[i].buffer,
+                                                vectors[i].size,
+                                                cancellable,
+                                                error);
+    }
+
+  limited_size = evd_throttled_output_stream_get_max_writable_priv (self,
+                                                                    size,
+                                                                    NULL);
+  if (limited_size == 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_WOULD_BLOCK,
+                   "Resource temporarily unavailable");
+      return -1;
+    }
+
+  /* trim the vectors to what the throttles allow */
+  limited_vectors = g_newa (GOutputVector, n_vectors);
+  size = 0;
+  for (i = 0; i < n_vectors && size < limited_size; i++)
+    {
+      limited_vectors[n_limited].buffer = vectors[i].buffer;
+      limited_vectors[n_limited].size = MIN (vectors[i].size,
+                                             limited_size - size);
+
+      size += limited_vectors[n_limited].size;
+      n_limited++;
+    }
+
+  actual_size =
+    evd_socket_output_stream_writev (EVD_SOCKET_OUTPUT_STREAM (base_stream),
+                                     limited_vectors,
+                                     n_limited,
+                                     cancellable,
+                                     error);
+
+  if (actual_size > 0)
+    {
+      g_list_foreach (self->priv->stream_throttles,
+                      (GFunc) evd_throttled_output_stream_report_size,
+                      &actual_size);
+    }
+
+  return actual_size;
+}
+
+static gssize
+evd_throttled_output_stream_send_fd (EvdThrottledOutputStream  *self,
+                                     gint                       fd,
+                                     goffset                   *offset,
+                                     gsize                      size,
+                                     GError                   **error)
+{
+  GOutputStream *base_stream;
+  gssize actual_size;
+
+  base_stream =
+    g_filter_output_stream_get_base_stream (G_FILTER_OUTPUT_STREAM (self));
+
+  if (! EVD_IS_SOCKET_OUTPUT_STREAM (base_stream))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_NOT_SUPPORTED,
+                           "Base stream doesn't support sending files");
+      return -1;
+    }
+
+  if (size == 0)
+    return 0;
+
+  size = evd_throttled_output_stream_get_max_writable_priv (self, size, NULL);
+  if (size == 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_WOULD_BLOCK,
+                   "Resource temporarily unavailable");
+      return -1;
+    }
+
+  if (offset != NULL)
+    actual_size =
+      evd_socket_output_stream_sendfile (EVD_SOCKET_OUTPUT_STREAM (base_stream),
+                                         fd,
+                                         offset,
+                                         size,
+                                         error);
+  else
+    actual_size =
+      evd_socket_output_stream_splice_from (EVD_SOCKET_OUTPUT_STREAM (base_stream),
+                                            fd,
+                                            size,
+                                            error);
+
+  if (actual_size > 0)
+    {
+      g_list_foreach (self->priv->stream_throttles,
+                      (GFunc) evd_throttled_output_stream_report_size,
+                      &actual_size);
+    }
+
+  return actual_size;
+}
+
+/**
+ * evd_throttled_output_stream_sendfile:
+ * @offset: (inout):
+ *
+ * Like evd_socket_output_stream_sendfile(), but limited by the stream
+ * throttles. Fails with %G_IO_ERROR_NOT_SUPPORTED if the base stream is not
+ * an #EvdSocketOutputStream.
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_throttled_output_stream_sendfile (EvdThrottledOutputStream  *self,
+                                      gint                       fd,
+                                      goffset                   *offset,
+                                      gsize                      size,
+                                      GError                   **error)
+{
+  g_return_val_if_fail (EVD_IS_THROTTLED_OUTPUT_STREAM (self), -1);
+  g_return_val_if_fail (offset != NULL, -1);
+
+  return evd_throttled_output_stream_send_fd (self, fd, offset, size, error);
+}
+
+/**
+ * evd_throttled_output_stream_splice_from:
+ * @fd: the read end of a pipe
+ *
+ * Like evd_socket_output_stream_splice_from(), but limited by the stream
+ * throttles. Fails with %G_IO_ERROR_NOT_SUPPORTED if the base stream is not
+ * an #EvdSocketOutputStream.
+ *
+ * Returns: The number of bytes sent, or -1 on error.
+ **/
+gssize
+evd_throttled_output_stream_splice_from (EvdThrottledOutputStream  *self,
+                                         gint                       fd,
+                                         gsize                      size,
+                                         GError                   **error)
+{
+  g_return_val_if_fail (EVD_IS_THROTTLED_OUTPUT_STREAM (self), -1);
+
+  return evd_throttled_output_stream_send_fd (self, fd, NULL, size, error);
+}
@@ -75,6 +75,21 @@ void                     evd_throttled_output_stream_add_throttle     (EvdThrott
 void                     evd_throttled_output_stream_remove_throttle  (EvdThrottledOutputStream *self,
                                                                        EvdStreamThrottle        *throttle);
 
+gssize                   evd_throttled_output_stream_writev           (EvdThrottledOutputStream  *self,
+                                                                       const GOutputVector       *vectors,
+                                                                       gint                       n_vectors,
+                                                                       GCancellable              *cancellable,
+                                                                       GError                   **error);
+gssize                   evd_throttled_output_stream_sendfile         (EvdThrottledOutputStream  *self,
+                                                                       gint                       fd,
+                                                                       goffset                   *offset,
+                                                                       gsize                      size,
+                                                                       GError                   **error);
+gssize                   evd_throttled_output_stream_splice_from      (EvdThrottledOutputStream  *self,
+                                                                       gint                       fd,
+                                                                       gsize                      size,
+                                                                       GError                   **error);
+
 G_END_DECLS
 
 #endif /* __EVD_THROTTLED_OUTPUT_STREAM_H__ */
@@ -20,6 +20,7 @@
  * for more details.
  */
 
+#include <string.h>
 #include <gnutls/openpgp.h>
 #include <gnutls/x509.h>
 
@@ -35,6 +36,9 @@ G_DEFINE_TYPE (EvdTlsCredentials, evd_tls_credentials, G_TYPE_OBJECT)
 
 #define MAX_DYNAMIC_CERTS 8
 
+#define DEFAULT_TICKET_KEY_LIFETIME 3600 /* in seconds */
+#define SESSION_CACHE_TTL           3600 /* in seconds */
+
 /* private data */
 struct _EvdTlsCredentialsPrivate
 {
@@ -58,8 +62,33 @@ struct _EvdTlsCredentialsPrivate
 
   GList *x509_privkeys;
   GList *openpgp_privkeys;
+
+  /* session resumption */
+  gboolean session_tickets;
+  guint ticket_key_lifetime;
+  gnutls_datum_t ticket_key;
+  gint64 ticket_key_time;
+
+  guint session_cache_size;
+  GHashTable *session_cache;
+  GQueue session_cache_lru;
+
+  /* server sessions may bind and use the cache from handshake threads */
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  GMutex *resumption_mutex;
+#else
+  GMutex  resumption_mutex;
+#endif
 };
 
+typedef struct
+{
+  gchar *key;
+  gnutls_datum_t data;
+  gint64 time;
+  GList link;
+} EvdTlsCredentialsCacheEntry;
+
 struct CertData
 {
   gchar *cert_file;
@@ -79,7 +108,10 @@ static guint evd_tls_credentials_signals[SIGNAL_LAST] = { 0 };
 enum
 {
   PROP_0,
-  PROP_DH_BITS
+  PROP_DH_BITS,
+  PROP_SESSION_TICKETS,
+  PROP_TICKET_KEY_LIFETIME,
+  PROP_SESSION_CACHE_SIZE
 };
 
 static void     evd_tls_credentials_class_init         (EvdTlsCredentialsClass *class);
@@ -100,6 +132,14 @@ static void     evd_tls_credentials_get_property       (GObject    *obj,
 static void     evd_tls_credentials_free_x509_key      (gpointer data);
 static void     evd_tls_credentials_free_openpgp_key   (gpointer data);
 
+static void     evd_tls_credentials_cache_evict        (EvdTlsCredentials *self,
+                                                        guint              max_entries);
+
+static void     evd_tls_credentials_resumption_lock    (EvdTlsCredentials *self);
+static void     evd_tls_credentials_resumption_unlock  (EvdTlsCredentials *self);
+
+static void     evd_tls_credentials_free_ticket_key    (gnutls_datum_t *key);
+
 static void
 evd_tls_credentials_class_init (EvdTlsCredentialsClass *class)
 {
@@ -132,6 +172,34 @@ evd_tls_credentials_class_init (EvdTlsCredentialsClass *class)
                                                       G_PARAM_READWRITE |
                                                       G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (obj_class, PROP_SESSION_TICKETS,
+                                   g_param_spec_boolean ("session-tickets",
+                                                         "Session tickets",
+                                                         "Whether server sessions issue tickets clients can use to resume them without a full handshake",
+                                                         TRUE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_TICKET_KEY_LIFETIME,
+                                   g_param_spec_uint ("ticket-key-lifetime",
+                                                      "Ticket key lifetime",
+                                                      "Seconds after which the key that encrypts session tickets is replaced by a new one",
+                                                      1,
+                                                      G_MAXUINT,
+                                                      DEFAULT_TICKET_KEY_LIFETIME,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_SESSION_CACHE_SIZE,
+                                   g_param_spec_uint ("session-cache-size",
+                                                      "Session cache size",
+                                                      "Maximum number of server sessions kept for resumption by session ID, 0 to disable",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
   /* add private structure */
   g_type_class_add_private (obj_class, sizeof (EvdTlsCredentialsPrivate));
 }
@@ -160,6 +228,21 @@ evd_tls_credentials_init (EvdTlsCredentials *self)
 
   priv->x509_privkeys = NULL;
   priv->openpgp_privkeys = NULL;
+
+  priv->session_tickets = TRUE;
+  priv->ticket_key_lifetime = DEFAULT_TICKET_KEY_LIFETIME;
+  priv->ticket_key.data = NULL;
+  priv->ticket_key.size = 0;
+
+  priv->session_cache_size = 0;
+  priv->session_cache = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&priv->session_cache_lru);
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  priv->resumption_mutex = g_mutex_new ();
+#else
+  g_mutex_init (&priv->resumption_mutex);
+#endif
 }
 
 static void
@@ -193,6 +276,17 @@ evd_tls_credentials_finalize (GObject *obj)
   g_list_free_full (self->priv->openpgp_privkeys,
                     evd_tls_credentials_free_openpgp_key);
 
+  evd_tls_credentials_free_ticket_key (&self->priv->ticket_key);
+
+  evd_tls_credentials_cache_evict (self, 0);
+  g_hash_table_destroy (self->priv->session_cache);
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_free (self->priv->resumption_mutex);
+#else
+  g_mutex_clear (&self->priv->resumption_mutex);
+#endif
+
   G_OBJECT_CLASS (evd_tls_credentials_parent_class)->finalize (obj);
 }
 
@@ -223,6 +317,21 @@ evd_tls_credentials_set_property (GObject      *obj,
         }
       break;
 
+    case PROP_SESSION_TICKETS:
+      self->priv->session_tickets = g_value_get_boolean (value);
+      break;
+
+    case PROP_TICKET_KEY_LIFETIME:
+      self->priv->ticket_key_lifetime = g_value_get_uint (value);
+      break;
+
+    case PROP_SESSION_CACHE_SIZE:
+      evd_tls_credentials_resumption_lock (self);
+      self->priv->session_cache_size = g_value_get_uint (value);
+      evd_tls_credentials_cache_evict (self, self->priv->session_cache_size);
+      evd_tls_credentials_resumption_unlock (self);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -245,6 +354,18 @@ evd_tls_credentials_get_property (GObject    *obj,
       g_value_set_uint (value, self->priv->dh_bits);
       break;
 
+    case PROP_SESSION_TICKETS:
+      g_value_set_boolean (value, self->priv->session_tickets);
+      break;
+
+    case PROP_TICKET_KEY_LIFETIME:
+      g_value_set_uint (value, self->priv->ticket_key_lifetime);
+      break;
+
+    case PROP_SESSION_CACHE_SIZE:
+      g_value_set_uint (value, self->priv->session_cache_size);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -408,6 +529,197 @@ add_certificate_from_file_thread (GSimpleAsyncResult *res,
   g_object_unref (res);
 }
 
+static void
+evd_tls_credentials_resumption_lock (EvdTlsCredentials *self)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_lock (self->priv->resumption_mutex);
+#else
+  g_mutex_lock (&self->priv->resumption_mutex);
+#endif
+}
+
+static void
+evd_tls_credentials_resumption_unlock (EvdTlsCredentials *self)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_unlock (self->priv->resumption_mutex);
+#else
+  g_mutex_unlock (&self->priv->resumption_mutex);
+#endif
+}
+
+static void
+evd_tls_credentials_free_ticket_key (gnutls_datum_t *key)
+{
+  if (key->data == NULL)
+    return;
+
+  memset (key->data, 0, key->size);
+  gnutls_free (key->data);
+  key->data = NULL;
+  key->size = 0;
+}
+
+static gchar *
+evd_tls_credentials_cache_key (const gnutls_datum_t *key)
+{
+  gchar *str;
+  guint i;
+
+  str = g_new (gchar, key->size * 2 + 1);
+  for (i = 0; i < key->size; i++)
+    g_snprintf (str + i * 2, 3, "%02x", key->data[i]);
+  str[key->size * 2] = '\0';
+
+  return str;
+}
+
+static void
+evd_tls_credentials_cache_remove (EvdTlsCredentials           *self,
+                                  EvdTlsCredentialsCacheEntry *entry)
+{
+  g_hash_table_remove (self->priv->session_cache, entry->key);
+  g_queue_unlink (&self->priv->session_cache_lru, &entry->link);
+
+  g_free (entry->key);
+  g_free (entry->data.data);
+  g_slice_free (EvdTlsCredentialsCacheEntry, entry);
+}
+
+static void
+evd_tls_credentials_cache_evict (EvdTlsCredentials *self, guint max_entries)
+{
+  while (self->priv->session_cache_lru.length > max_entries)
+    evd_tls_credentials_cache_remove (self,
+                                      self->priv->session_cache_lru.tail->data);
+}
+
+static gint
+evd_tls_credentials_cache_store (gpointer       ptr,
+                                 gnutls_datum_t key,
+                                 gnutls_datum_t data)
+{
+  EvdTlsCredentials *self = EVD_TLS_CREDENTIALS (ptr);
+  EvdTlsCredentialsCacheEntry *entry;
+  gchar *key_str;
+
+  evd_tls_credentials_resumption_lock (self);
+
+  if (self->priv->session_cache_size == 0)
+    {
+      evd_tls_credentials_resumption_unlock (self);
+      return -1;
+    }
+
+  key_str = evd_tls_credentials_cache_key (&key);
+
+  entry = g_hash_table_lookup (self->priv->session_cache, key_str);
+  if (entry != NULL)
+    evd_tls_credentials_cache_remove (self, entry);
+
+  entry = g_slice_new0 (EvdTlsCredentialsCacheEntry);
+  entry->key = key_str;
+  entry->data.data = g_memdup (data.data, data.size);
+  entry->data.size = data.size;
+  entry->time = g_get_monotonic_time ();
+  entry->link.data = entry;
+
+  g_hash_table_insert (self->priv->session_cache, entry->key, entry);
+  g_queue_push_head_link (&self->priv->session_cache_lru, &entry->link);
+
+  evd_tls_credentials_cache_evict (self, self->priv->session_cache_size);
+
+  evd_tls_credentials_resumption_unlock (self);
+
+  return 0;
+}
+
+/* GnuTLS keeps a single expiration per session, used both for entries of
+   the session cache and for tickets. Since 3.6.3 it also drives the
+   rotation of the keys derived for tickets, so when tickets are enabled
+   'ticket-key-lifetime' wins and the cache follows it */
+static guint
+evd_tls_credentials_get_session_lifetime (EvdTlsCredentials *self)
+{
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+  if (self->priv->session_tickets)
+    return self->priv->ticket_key_lifetime;
+#endif
+
+  return SESSION_CACHE_TTL;
+}
+
+static gnutls_datum_t
+evd_tls_credentials_cache_retrieve (gpointer       ptr,
+                                    gnutls_datum_t key)
+{
+  EvdTlsCredentials *self = EVD_TLS_CREDENTIALS (ptr);
+  EvdTlsCredentialsCacheEntry *entry;
+  gnutls_datum_t data = { NULL, 0 };
+  gchar *key_str;
+
+  key_str = evd_tls_credentials_cache_key (&key);
+
+  evd_tls_credentials_resumption_lock (self);
+
+  entry = g_hash_table_lookup (self->priv->session_cache, key_str);
+  g_free (key_str);
+
+  if (entry == NULL)
+    goto out;
+
+  if (g_get_monotonic_time () - entry->time >
+      (gint64) evd_tls_credentials_get_session_lifetime (self) * G_USEC_PER_SEC)
+    {
+      evd_tls_credentials_cache_remove (self, entry);
+      goto out;
+    }
+
+  g_queue_unlink (&self->priv->session_cache_lru, &entry->link);
+  g_queue_push_head_link (&self->priv->session_cache_lru, &entry->link);
+
+  /* GnuTLS takes ownership of the returned copy */
+  data.data = gnutls_malloc (entry->data.size);
+  if (data.data != NULL)
+    {
+      memcpy (data.data, entry->data.data, entry->data.size);
+      data.size = entry->data.size;
+    }
+
+ out:
+  evd_tls_credentials_resumption_unlock (self);
+
+  return data;
+}
+
+static gint
+evd_tls_credentials_cache_delete (gpointer       ptr,
+                                  gnutls_datum_t key)
+{
+  EvdTlsCredentials *self = EVD_TLS_CREDENTIALS (ptr);
+  EvdTlsCredentialsCacheEntry *entry;
+  gchar *key_str;
+  gint result = -1;
+
+  key_str = evd_tls_credentials_cache_key (&key);
+
+  evd_tls_credentials_resumption_lock (self);
+
+  entry = g_hash_table_lookup (self->priv->session_cache, key_str);
+  if (entry != NULL)
+    {
+      evd_tls_credentials_cache_remove (self, entry);
+      result = 0;
+    }
+
+  evd_tls_credentials_resumption_unlock (self);
+
+  g_free (key_str);
+
+  return result;
+}
+
 /* public methods */
 
 EvdTlsCredentials *
@@ -503,6 +815,20 @@ evd_tls_credentials_set_cert_callback (EvdTlsCredentials       *self,
   */
 }
 
+/**
+ * evd_tls_credentials_has_cert_callback:
+ *
+ * Returns: %TRUE if a certificate callback was set with
+ * evd_tls_credentials_set_cert_callback(), %FALSE otherwise.
+ **/
+gboolean
+evd_tls_credentials_has_cert_callback (EvdTlsCredentials *self)
+{
+  g_return_val_if_fail (EVD_IS_TLS_CREDENTIALS (self), FALSE);
+
+  return self->priv->cert_cb != NULL;
+}
+
 gboolean
 evd_tls_credentials_add_certificate (EvdTlsCredentials  *self,
                                      EvdTlsCertificate  *cert,
@@ -674,3 +1000,93 @@ evd_tls_credentials_add_certificate_from_file_finish (EvdTlsCredentials  *self,
     ! g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
                                              error);
 }
+
+/**
+ * evd_tls_credentials_bind_session_resumption: (skip)
+ * @session: a server side gnutls_session_t
+ *
+ * Enables resumption of @session, by session tickets and/or by session ID,
+ * as configured in @self.
+ *
+ * With GnuTLS 3.6.3 or newer, tickets are sealed with keys GnuTLS derives
+ * from a master key generated on first use. It rotates them based on
+ * #EvdTlsCredentials:ticket-key-lifetime, and keeps accepting tickets sealed
+ * under the previous key. Older versions can only decrypt with a single
+ * key, so the key is replaced after #EvdTlsCredentials:ticket-key-lifetime
+ * seconds and tickets sealed under the retired one fall back to a full
+ * handshake.
+ *
+ * Resumed sessions expire after one hour. With GnuTLS 3.6.3 or newer and
+ * session tickets enabled, they expire after
+ * #EvdTlsCredentials:ticket-key-lifetime instead, for tickets and session
+ * IDs alike.
+ *
+ * This may be called from a handshake thread.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ **/
+gboolean
+evd_tls_credentials_bind_session_resumption (EvdTlsCredentials  *self,
+                                             gpointer            session,
+                                             GError            **error)
+{
+  g_return_val_if_fail (EVD_IS_TLS_CREDENTIALS (self), FALSE);
+  g_return_val_if_fail (session != NULL, FALSE);
+
+  evd_tls_credentials_resumption_lock (self);
+
+  if (self->priv->session_tickets)
+    {
+      gint64 now;
+      gint err_code;
+
+      now = g_get_monotonic_time ();
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+      if (self->priv->ticket_key.data == NULL)
+#else
+      if (self->priv->ticket_key.data == NULL ||
+          now - self->priv->ticket_key_time >
+          (gint64) self->priv->ticket_key_lifetime * G_USEC_PER_SEC)
+#endif
+        {
+          evd_tls_credentials_free_ticket_key (&self->priv->ticket_key);
+
+          err_code = gnutls_session_ticket_key_generate (&self->priv->ticket_key);
+          if (evd_error_propagate_gnutls (err_code, error))
+            goto error;
+
+          self->priv->ticket_key_time = now;
+        }
+
+      /* the key is copied into the session */
+      err_code = gnutls_session_ticket_enable_server (session,
+                                                      &self->priv->ticket_key);
+      if (evd_error_propagate_gnutls (err_code, error))
+        goto error;
+    }
+
+  if (self->priv->session_cache_size > 0)
+    {
+      gnutls_db_set_retrieve_function (session,
+                                       evd_tls_credentials_cache_retrieve);
+      gnutls_db_set_store_function (session,
+                                    evd_tls_credentials_cache_store);
+      gnutls_db_set_remove_function (session,
+                                     evd_tls_credentials_cache_delete);
+      gnutls_db_set_ptr (session, self);
+    }
+
+  if (self->priv->session_cache_size > 0 || self->priv->session_tickets)
+    gnutls_db_set_cache_expiration (session,
+                                    evd_tls_credentials_get_session_lifetime (self));
+
+  evd_tls_credentials_resumption_unlock (self);
+
+  return TRUE;
+
+ error:
+  evd_tls_credentials_resumption_unlock (self);
+
+  return FALSE;
+}
@@ -93,6 +93,7 @@ void               evd_tls_credentials_set_cert_callback                (EvdTlsC
                                                                          EvdTlsCredentialsCertCb  callback,
                                                                          gpointer                 user_data,
                                                                          GDestroyNotify           user_data_free_func);
+gboolean           evd_tls_credentials_has_cert_callback                (EvdTlsCredentials *self);
 
 gboolean           evd_tls_credentials_add_certificate                  (EvdTlsCredentials  *self,
                                                                          EvdTlsCertificate  *cert,
@@ -108,6 +109,10 @@ gboolean           evd_tls_credentials_add_certificate_from_file_finish (EvdTlsC
                                                                          GAsyncResult       *result,
                                                                          GError            **error);
 
+gboolean           evd_tls_credentials_bind_session_resumption          (EvdTlsCredentials  *self,
+                                                                         gpointer            session,
+                                                                         GError            **error);
+
 
 void               evd_tls_session_set_credentials                      (EvdTlsSession     *self,
                                                                          EvdTlsCredentials *credentials);
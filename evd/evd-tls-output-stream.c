@@ -177,6 +177,10 @@ evd_tls_output_stream_push (EvdTlsSession  *session,
               NULL,
               error);
 
+  /* the buffer is full */
+  if (result == 0)
+    result = EVD_TLS_SESSION_WOULD_BLOCK;
+
   return result;
 }
 
@@ -32,6 +32,12 @@
 
 #define EVD_TLS_SESSION_DEFAULT_PRIORITY "NORMAL"
 
+#define READ_AHEAD_SIZE 16384
+
+/* corked records are pushed to the transport whenever this much is
+   collected, and encryption stops once the transport doesn't take it all */
+#define CORK_FLUSH_SIZE 16384
+
 G_DEFINE_TYPE (EvdTlsSession, evd_tls_session, G_TYPE_OBJECT)
 
 #define EVD_TLS_SESSION_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), \
@@ -64,6 +70,19 @@ struct _EvdTlsSessionPrivate
   gboolean write_shutdown;
 
   gchar *server_name;
+
+  /* state of a previous session a client tries to resume */
+  gchar *resumption_data;
+  gsize resumption_data_size;
+
+  GString *input;
+  GString *output;
+  gboolean input_eof;
+  gboolean pull_drained;
+  gboolean corked;
+
+  gboolean offload_handshake;
+  gboolean handshake_in_thread;
 };
 
 
@@ -74,7 +93,8 @@ enum
   PROP_CREDENTIALS,
   PROP_MODE,
   PROP_PRIORITY,
-  PROP_REQUIRE_PEER_CERT
+  PROP_REQUIRE_PEER_CERT,
+  PROP_OFFLOAD_HANDSHAKE
 };
 
 static void     evd_tls_session_class_init         (EvdTlsSessionClass *class);
@@ -138,6 +158,14 @@ evd_tls_session_class_init (EvdTlsSessionClass *class)
                                                          G_PARAM_READWRITE |
                                                          G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (obj_class, PROP_OFFLOAD_HANDSHAKE,
+                                   g_param_spec_boolean ("offload-handshake",
+                                                         "Offload handshake",
+                                                         "Controls whether asynchronous handshakes run the key exchange in a worker thread",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
   g_type_class_add_private (obj_class, sizeof (EvdTlsSessionPrivate));
 }
 
@@ -172,6 +200,18 @@ evd_tls_session_init (EvdTlsSession *self)
   priv->write_shutdown = FALSE;
 
   priv->server_name = NULL;
+
+  priv->resumption_data = NULL;
+  priv->resumption_data_size = 0;
+
+  priv->input = g_string_new ("");
+  priv->output = g_string_new ("");
+  priv->input_eof = FALSE;
+  priv->pull_drained = FALSE;
+  priv->corked = FALSE;
+
+  priv->offload_handshake = FALSE;
+  priv->handshake_in_thread = FALSE;
 }
 
 static void
@@ -220,6 +260,11 @@ evd_tls_session_finalize (GObject *obj)
   if (self->priv->server_name != NULL)
     g_free (self->priv->server_name);
 
+  g_free (self->priv->resumption_data);
+
+  g_string_free (self->priv->input, TRUE);
+  g_string_free (self->priv->output, TRUE);
+
   G_OBJECT_CLASS (evd_tls_session_parent_class)->finalize (obj);
 }
 
@@ -253,6 +298,10 @@ evd_tls_session_set_property (GObject      *obj,
       self->priv->require_peer_cert = g_value_get_boolean (value);
       break;
 
+    case PROP_OFFLOAD_HANDSHAKE:
+      self->priv->offload_handshake = g_value_get_boolean (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -287,28 +336,93 @@ evd_tls_session_get_property (GObject    *obj,
       g_value_set_boolean (value, self->priv->require_peer_cert);
       break;
 
+    case PROP_OFFLOAD_HANDSHAKE:
+      g_value_set_boolean (value, self->priv->offload_handshake);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
     }
 }
 
+static gboolean
+evd_tls_session_flush_output (EvdTlsSession  *self,
+                              GError        **error)
+{
+  GString *output = self->priv->output;
+  GError *_error = NULL;
+  gssize size;
+
+  while (output->len > 0)
+    {
+      size = self->priv->push_func (self,
+                                    output->str,
+                                    output->len,
+                                    self->priv->push_user_data,
+                                    &_error);
+      if (size == EVD_TLS_SESSION_WOULD_BLOCK || size == 0)
+        {
+          break;
+        }
+      else if (size < 0)
+        {
+          if (g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              g_error_free (_error);
+              break;
+            }
+
+          g_propagate_error (error, _error);
+          return FALSE;
+        }
+
+      g_string_erase (output, 0, size);
+    }
+
+  return TRUE;
+}
+
 static gssize
 evd_tls_session_push (gnutls_transport_ptr_t  ptr,
                       const void             *buf,
                       gsize                   size)
 {
   EvdTlsSession *self = EVD_TLS_SESSION (ptr);
-  gssize res;
+  gssize res = -1;
   GError *error = NULL;
 
-  res = self->priv->push_func (self,
-                               buf,
-                               size,
-                               self->priv->push_user_data,
-                               &error);
+  /* records are collected here while corked or while the handshake runs
+     in a worker thread, and pushed to the transport later in one go */
+  if (self->priv->corked || self->priv->handshake_in_thread)
+    {
+      g_string_append_len (self->priv->output, buf, size);
+      return size;
+    }
 
-  if (res < 0)
+  if (self->priv->output->len > 0 &&
+      evd_tls_session_flush_output (self, &error) &&
+      self->priv->output->len > 0)
+    {
+      /* keep records in order behind those not yet flushed */
+      g_string_append_len (self->priv->output, buf, size);
+      return size;
+    }
+
+  if (error == NULL)
+    res = self->priv->push_func (self,
+                                 buf,
+                                 size,
+                                 self->priv->push_user_data,
+                                 &error);
+
+  if (res == EVD_TLS_SESSION_WOULD_BLOCK ||
+      (res < 0 && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)))
+    {
+      gnutls_transport_set_errno (self->priv->session, EAGAIN);
+      res = -1;
+    }
+  else if (res < 0)
     {
       if (! self->priv->write_shutdown ||
           g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED))
@@ -316,13 +430,48 @@ evd_tls_session_push (gnutls_transport_ptr_t  ptr,
           /* @TODO: Handle transport error */
           g_debug ("TLS session transport error during push: %s", error->message);
         }
-
-      g_error_free (error);
     }
 
+  if (error != NULL)
+    g_error_free (error);
+
   return res;
 }
 
+static gssize
+evd_tls_session_take_input (EvdTlsSession *self,
+                            void          *buf,
+                            gsize          size)
+{
+  size = MIN (size, self->priv->input->len);
+  memcpy (buf, self->priv->input->str, size);
+  g_string_erase (self->priv->input, 0, size);
+
+  return size;
+}
+
+static gssize
+evd_tls_session_read_ahead (EvdTlsSession  *self,
+                            GError        **error)
+{
+  GString *input = self->priv->input;
+  gsize len;
+  gssize size;
+
+  len = input->len;
+  g_string_set_size (input, len + READ_AHEAD_SIZE);
+
+  size = self->priv->pull_func (self,
+                                input->str + len,
+                                READ_AHEAD_SIZE,
+                                self->priv->pull_user_data,
+                                error);
+
+  g_string_set_size (input, len + MAX (size, 0));
+
+  return size;
+}
+
 static gssize
 evd_tls_session_pull (gnutls_transport_ptr_t  ptr,
                       void                   *buf,
@@ -332,32 +481,65 @@ evd_tls_session_pull (gnutls_transport_ptr_t  ptr,
   gssize res;
   GError *error = NULL;
 
-  res = self->priv->pull_func (self,
-                               buf,
-                               size,
-                               self->priv->pull_user_data,
-                               &error);
+  /* serve what was read ahead first */
+  if (self->priv->input->len > 0)
+    return evd_tls_session_take_input (self, buf, size);
 
-  if (res < 0)
+  if (self->priv->handshake_in_thread && self->priv->input_eof)
+    return 0;
+
+  /* a short read earlier in this same call already drained the transport,
+     so don't bother asking again just to get a would-block error */
+  if (self->priv->handshake_in_thread || self->priv->pull_drained)
     {
-      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
-        {
-          gnutls_transport_set_errno (self->priv->session, EAGAIN);
-          res = -1;
-        }
-      else
+      gnutls_transport_set_errno (self->priv->session, EAGAIN);
+      return -1;
+    }
+
+  /* small reads (e.g, record headers) go through the read-ahead buffer,
+     so that several records are pulled from the transport at once */
+  if (size >= READ_AHEAD_SIZE)
+    {
+      res = self->priv->pull_func (self,
+                                   buf,
+                                   size,
+                                   self->priv->pull_user_data,
+                                   &error);
+      if (res > 0 && res < size)
+        self->priv->pull_drained = TRUE;
+    }
+  else
+    {
+      res = evd_tls_session_read_ahead (self, &error);
+      if (res > 0)
         {
-          /* @TODO: handle transport error */
-          g_debug ("TLS transport error during pull: %s", error->message);
+          if (res < READ_AHEAD_SIZE)
+            self->priv->pull_drained = TRUE;
+
+          res = evd_tls_session_take_input (self, buf, size);
         }
+    }
 
-      g_error_free (error);
+  if (res == EVD_TLS_SESSION_WOULD_BLOCK ||
+      (res < 0 && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)))
+    {
+      self->priv->pull_drained = TRUE;
+      gnutls_transport_set_errno (self->priv->session, EAGAIN);
+      res = -1;
+    }
+  else if (res < 0)
+    {
+      /* @TODO: handle transport error */
+      g_debug ("TLS transport error during pull: %s", error->message);
     }
   else if (res == 0)
     {
       /* @TODO: handle end of stream */
     }
 
+  if (error != NULL)
+    g_error_free (error);
+
   return res;
 }
 
@@ -367,6 +549,8 @@ evd_tls_session_handshake_internal (EvdTlsSession  *self,
 {
   gint err_code;
 
+  self->priv->pull_drained = FALSE;
+
   err_code = gnutls_handshake (self->priv->session);
   if (err_code == GNUTLS_E_SUCCESS)
     {
@@ -413,15 +597,19 @@ evd_tls_session_bind_credentials (EvdTlsSession      *self,
     }
 
   if (evd_error_propagate_gnutls (err_code, error))
+    return FALSE;
+
+  if (self->priv->mode == EVD_TLS_MODE_SERVER &&
+      ! evd_tls_credentials_bind_session_resumption (cred,
+                                                     self->priv->session,
+                                                     error))
     {
       return FALSE;
     }
-  else
-    {
-      self->priv->cred_bound = TRUE;
 
-      return TRUE;
-    }
+  self->priv->cred_bound = TRUE;
+
+  return TRUE;
 }
 
 static void
@@ -452,10 +640,13 @@ evd_tls_session_shutdown (EvdTlsSession           *self,
 {
   g_return_val_if_fail (EVD_IS_TLS_SESSION (self), FALSE);
 
-  if (self->priv->session != NULL)
+  /* the worker thread owns the session until the handshake step returns */
+  if (self->priv->session != NULL && ! self->priv->handshake_in_thread)
     {
       gint err_code;
 
+      self->priv->pull_drained = FALSE;
+
       err_code = gnutls_bye (self->priv->session, how);
       if (err_code < 0 && gnutls_error_is_fatal (err_code) != 0)
         {
@@ -509,6 +700,27 @@ evd_tls_session_set_server_name_internal (EvdTlsSession  *self,
   return TRUE;
 }
 
+static gboolean
+evd_tls_session_set_resumption_data_internal (EvdTlsSession  *self,
+                                              GError        **error)
+{
+  if (self->priv->session != NULL
+      && self->priv->resumption_data != NULL
+      && self->priv->mode == EVD_TLS_MODE_CLIENT)
+    {
+      gint err_code;
+
+      err_code = gnutls_session_set_data (self->priv->session,
+                                          self->priv->resumption_data,
+                                          self->priv->resumption_data_size);
+
+      if (evd_error_propagate_gnutls (err_code, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 /* public methods */
 
 EvdTlsSession *
@@ -604,15 +816,13 @@ evd_tls_session_set_transport_push_func (EvdTlsSession         *self,
   self->priv->push_user_data_free_func = user_data_free_func;
 }
 
-gint
-evd_tls_session_handshake (EvdTlsSession  *self,
-                           GError        **error)
+static gint
+evd_tls_session_setup (EvdTlsSession  *self,
+                       GError        **error)
 {
   EvdTlsCredentials *cred;
   gint err_code;
 
-  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), FALSE);
-
   if (self->priv->session == NULL)
     {
       err_code = gnutls_init (&self->priv->session, self->priv->mode);
@@ -625,6 +835,9 @@ evd_tls_session_handshake (EvdTlsSession  *self,
           if (! evd_tls_session_set_server_name_internal (self, error))
             return -1;
 
+          if (! evd_tls_session_set_resumption_data_internal (self, error))
+            return -1;
+
           err_code = gnutls_priority_set_direct (self->priv->session,
                                                  self->priv->priority,
                                                  NULL);
@@ -668,12 +881,242 @@ evd_tls_session_handshake (EvdTlsSession  *self,
         }
     }
 
-  if (self->priv->cred_bound)
-    return evd_tls_session_handshake_internal (self, error);
+  return self->priv->cred_bound ? 1 : 0;
+}
+
+static gboolean
+evd_tls_session_fill_handshake_input (EvdTlsSession  *self,
+                                      GError        **error)
+{
+  gssize size;
+  GError *_error = NULL;
+
+  do
+    {
+      size = evd_tls_session_read_ahead (self, &_error);
+      if (size == EVD_TLS_SESSION_WOULD_BLOCK)
+        {
+          break;
+        }
+      else if (size < 0)
+        {
+          if (g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              g_error_free (_error);
+              break;
+            }
+
+          g_propagate_error (error, _error);
+          return FALSE;
+        }
+      else if (size == 0)
+        {
+          self->priv->input_eof = TRUE;
+        }
+    }
+  while (size == READ_AHEAD_SIZE);
+
+  return TRUE;
+}
+
+static void
+evd_tls_session_handshake_thread (GSimpleAsyncResult *res,
+                                  GObject            *object,
+                                  GCancellable       *cancellable)
+{
+  EvdTlsSession *self = EVD_TLS_SESSION (object);
+  GError *error = NULL;
+  gint result;
+
+  result = evd_tls_session_handshake_internal (self, &error);
+  if (result < 0)
+    {
+      g_simple_async_result_set_from_error (res, error);
+      g_error_free (error);
+    }
+
+  g_simple_async_result_set_op_res_gssize (res, result);
+}
+
+static void
+evd_tls_session_on_handshake_thread (GObject      *obj,
+                                     GAsyncResult *result,
+                                     gpointer      user_data)
+{
+  EvdTlsSession *self = EVD_TLS_SESSION (obj);
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+  GError *error = NULL;
+  gboolean flushed;
+
+  self->priv->handshake_in_thread = FALSE;
+
+  /* flush even on error, there may be an alert for the peer */
+  flushed = evd_tls_session_flush_output (self, &error);
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
+                                             &error) || ! flushed)
+    {
+      g_simple_async_result_set_from_error (res, error);
+      g_error_free (error);
+    }
   else
+    {
+      g_simple_async_result_set_op_res_gssize (res,
+        g_simple_async_result_get_op_res_gssize (G_SIMPLE_ASYNC_RESULT (result)));
+    }
+
+  g_simple_async_result_complete (res);
+  g_object_unref (res);
+}
+
+gint
+evd_tls_session_handshake (EvdTlsSession  *self,
+                           GError        **error)
+{
+  gint result;
+
+  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), FALSE);
+
+  if (self->priv->handshake_in_thread)
     return 0;
+
+  result = evd_tls_session_setup (self, error);
+  if (result <= 0)
+    return result;
+
+  return evd_tls_session_handshake_internal (self, error);
+}
+
+/**
+ * evd_tls_session_handshake_async:
+ * @cancellable: (allow-none):
+ * @callback: (allow-none):
+ * @user_data: (allow-none):
+ *
+ * Performs one step of the handshake, like evd_tls_session_handshake().
+ * If #EvdTlsSession:offload-handshake is %TRUE, the data currently available
+ * from the transport is read ahead and the key exchange runs in a worker
+ * thread, so that expensive public-key operations don't block the calling
+ * context. Records produced by the handshake are pushed to the transport
+ * back in the thread-default context, before @callback is called.
+ * Credentials with a certificate callback are never offloaded, the callback
+ * is always called from the thread-default context.
+ *
+ * Only one handshake step can be in flight at a time.
+ **/
+void
+evd_tls_session_handshake_async (EvdTlsSession       *self,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  GSimpleAsyncResult *res;
+  GSimpleAsyncResult *thread_res;
+  GError *error = NULL;
+  gint result;
+
+  g_return_if_fail (EVD_IS_TLS_SESSION (self));
+
+  res = g_simple_async_result_new (G_OBJECT (self),
+                                   callback,
+                                   user_data,
+                                   evd_tls_session_handshake_async);
+
+  if (self->priv->handshake_in_thread)
+    {
+      g_simple_async_result_set_error (res,
+                                       G_IO_ERROR,
+                                       G_IO_ERROR_PENDING,
+                                       "A handshake is already in progress");
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+
+      return;
+    }
+
+  result = evd_tls_session_setup (self, &error);
+
+  /* the certificate callback keeps its state in the credentials, which
+     are shared among sessions, and user code expects it in this context */
+  if (result > 0 &&
+      self->priv->offload_handshake &&
+      ! evd_tls_credentials_has_cert_callback (self->priv->cred))
+    {
+      if (evd_tls_session_fill_handshake_input (self, &error))
+        {
+          self->priv->handshake_in_thread = TRUE;
+
+          thread_res =
+            g_simple_async_result_new (G_OBJECT (self),
+                                       evd_tls_session_on_handshake_thread,
+                                       res,
+                                       evd_tls_session_handshake_thread);
+
+          g_simple_async_result_run_in_thread (thread_res,
+                                               evd_tls_session_handshake_thread,
+                                               G_PRIORITY_DEFAULT,
+                                               cancellable);
+          g_object_unref (thread_res);
+
+          return;
+        }
+
+      result = -1;
+    }
+  else if (result > 0)
+    {
+      result = evd_tls_session_handshake_internal (self, &error);
+    }
+
+  if (result < 0)
+    {
+      g_simple_async_result_set_from_error (res, error);
+      g_error_free (error);
+    }
+
+  g_simple_async_result_set_op_res_gssize (res, result);
+  g_simple_async_result_complete_in_idle (res);
+  g_object_unref (res);
 }
 
+/**
+ * evd_tls_session_handshake_finish:
+ *
+ * Returns: 1 if the handshake completed, 0 if it needs more data from the
+ * transport, or -1 on error.
+ **/
+gint
+evd_tls_session_handshake_finish (EvdTlsSession  *self,
+                                  GAsyncResult   *result,
+                                  GError        **error)
+{
+  GSimpleAsyncResult *res;
+
+  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), -1);
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+                                                        G_OBJECT (self),
+                                                        evd_tls_session_handshake_async),
+                        -1);
+
+  res = G_SIMPLE_ASYNC_RESULT (result);
+
+  if (g_simple_async_result_propagate_error (res, error))
+    return -1;
+
+  return (gint) g_simple_async_result_get_op_res_gssize (res);
+}
+
+/**
+ * evd_tls_session_read:
+ * @buffer: (out caller-allocates) (array length=size):
+ *
+ * Decrypts as many records as are available and fit into @buffer. Running
+ * out of transport data is not an error: the data read so far, or 0, is
+ * returned instead.
+ *
+ * Returns: The number of bytes read, 0 if no data was available, or -1 on
+ * error.
+ **/
 gssize
 evd_tls_session_read (EvdTlsSession  *self,
                       gchar          *buffer,
@@ -681,12 +1124,31 @@ evd_tls_session_read (EvdTlsSession  *self,
                       GError        **error)
 {
   gssize result;
+  gsize total = 0;
 
   g_return_val_if_fail (EVD_IS_TLS_SESSION (self), -1);
   g_return_val_if_fail (size > 0, -1);
   g_return_val_if_fail (buffer != NULL, -1);
 
-  result = gnutls_record_recv (self->priv->session, buffer, size);
+  if (self->priv->handshake_in_thread)
+    return 0;
+
+  self->priv->pull_drained = FALSE;
+
+  do
+    {
+      result = gnutls_record_recv (self->priv->session,
+                                   buffer + total,
+                                   size - total);
+      if (result > 0)
+        total += result;
+    }
+  while (result > 0 && total < size);
+
+  /* an error or end-of-stream after some data will be hit again
+     by the next read */
+  if (total > 0)
+    return total;
 
   if (result == 0)
     {
@@ -708,19 +1170,82 @@ evd_tls_session_read (EvdTlsSession  *self,
   return result;
 }
 
+/**
+ * evd_tls_session_write:
+ * @buffer: (array length=size):
+ *
+ * Encrypts @buffer into records that are pushed to the transport in
+ * batches. Encryption stops as soon as the transport doesn't take a whole
+ * batch. The records it didn't take are kept in the session and pushed
+ * first by the next write, or by evd_tls_session_flush() once the transport
+ * is writable again.
+ *
+ * Returns: The number of bytes of @buffer consumed, which must not be
+ * written again, 0 if the operation would block, or -1 on error.
+ **/
 gssize
 evd_tls_session_write (EvdTlsSession  *self,
                        const gchar    *buffer,
                        gsize           size,
                        GError        **error)
 {
-  gssize result;
+  gssize result = 0;
+  gsize total = 0;
+  GError *_error = NULL;
 
   g_return_val_if_fail (EVD_IS_TLS_SESSION (self), -1);
   g_return_val_if_fail (size > 0, -1);
   g_return_val_if_fail (buffer != NULL, -1);
 
-  result = gnutls_record_send (self->priv->session, buffer, size);
+  if (self->priv->handshake_in_thread)
+    return 0;
+
+  /* records left over by a previous write go first, and nothing more is
+     encrypted until the transport has taken them all */
+  if (! evd_tls_session_flush_output (self, error))
+    return -1;
+  if (self->priv->output->len > 0)
+    return 0;
+
+  self->priv->corked = TRUE;
+  do
+    {
+      result = gnutls_record_send (self->priv->session,
+                                   buffer + total,
+                                   size - total);
+      if (result > 0)
+        {
+          total += result;
+
+          if (self->priv->output->len >= CORK_FLUSH_SIZE || total == size)
+            {
+              if (! evd_tls_session_flush_output (self, &_error))
+                break;
+
+              if (self->priv->output->len > 0)
+                break;
+            }
+        }
+    }
+  while (result > 0 && total < size);
+  self->priv->corked = FALSE;
+
+  /* what GnuTLS took is already encrypted and must not be written again,
+     so report it even if part of it is still waiting for the transport;
+     a transport error will show up again on the next write */
+  if (total > 0)
+    {
+      if (_error != NULL)
+        g_error_free (_error);
+
+      return total;
+    }
+
+  if (_error != NULL)
+    {
+      g_propagate_error (error, _error);
+      return -1;
+    }
 
   if (result < 0)
     {
@@ -738,13 +1263,39 @@ evd_tls_session_write (EvdTlsSession  *self,
   return result;
 }
 
+/**
+ * evd_tls_session_flush:
+ *
+ * Pushes to the transport the records that a previous write could not,
+ * e.g when the transport becomes writable again.
+ *
+ * Returns: %TRUE if all records were pushed, %FALSE if some are still
+ * pending or on error.
+ **/
+gboolean
+evd_tls_session_flush (EvdTlsSession  *self,
+                       GError        **error)
+{
+  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), FALSE);
+
+  if (self->priv->handshake_in_thread)
+    return FALSE;
+
+  if (! evd_tls_session_flush_output (self, error))
+    return FALSE;
+
+  return self->priv->output->len == 0;
+}
+
 GIOCondition
 evd_tls_session_get_direction (EvdTlsSession *self)
 {
   g_return_val_if_fail (EVD_IS_TLS_SESSION (self), 0);
 
-  if (self->priv->session == NULL)
+  if (self->priv->session == NULL || self->priv->handshake_in_thread)
     return 0;
+  else if (self->priv->output->len > 0)
+    return G_IO_OUT;
   else
     if (gnutls_record_get_direction (self->priv->session) == 0)
       return G_IO_IN;
@@ -775,6 +1326,7 @@ evd_tls_session_copy_properties (EvdTlsSession *self,
                 "credentials", evd_tls_session_get_credentials (self),
                 "priority", self->priv->priority,
                 "require-peer-cert", self->priv->require_peer_cert,
+                "offload-handshake", self->priv->offload_handshake,
                 NULL);
 }
 
@@ -905,6 +1457,7 @@ void
 evd_tls_session_reset (EvdTlsSession *self)
 {
   g_return_if_fail (EVD_IS_TLS_SESSION (self));
+  g_return_if_fail (! self->priv->handshake_in_thread);
 
   if (self->priv->session != NULL)
     {
@@ -921,11 +1474,19 @@ evd_tls_session_reset (EvdTlsSession *self)
       self->priv->session = NULL;
     }
 
+  g_string_truncate (self->priv->input, 0);
+  g_string_truncate (self->priv->output, 0);
+  self->priv->input_eof = FALSE;
+
   if (self->priv->server_name != NULL)
     {
       g_free (self->priv->server_name);
       self->priv->server_name = NULL;
     }
+
+  g_free (self->priv->resumption_data);
+  self->priv->resumption_data = NULL;
+  self->priv->resumption_data_size = 0;
 }
 
 gboolean
@@ -998,3 +1559,107 @@ evd_tls_session_get_server_name (EvdTlsSession *self)
 
   return self->priv->server_name;
 }
+
+/**
+ * evd_tls_session_is_resumed:
+ *
+ * Returns: %TRUE if the handshake resumed a previous session (by ticket or
+ * by session ID) instead of doing a full key exchange, %FALSE otherwise.
+ **/
+gboolean
+evd_tls_session_is_resumed (EvdTlsSession *self)
+{
+  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), FALSE);
+
+  if (self->priv->session == NULL)
+    return FALSE;
+
+  return gnutls_session_is_resumed (self->priv->session) != 0;
+}
+
+void
+evd_tls_session_set_offload_handshake (EvdTlsSession *self,
+                                       gboolean       offload)
+{
+  g_return_if_fail (EVD_IS_TLS_SESSION (self));
+
+  self->priv->offload_handshake = offload;
+}
+
+gboolean
+evd_tls_session_get_offload_handshake (EvdTlsSession *self)
+{
+  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), FALSE);
+
+  return self->priv->offload_handshake;
+}
+
+/**
+ * evd_tls_session_get_resumption_data:
+ * @size: (out): return location for the size of the returned data
+ *
+ * Gets the state a client needs to resume this session later, by passing
+ * it to evd_tls_session_set_resumption_data() on a new session before its
+ * handshake. Servers that issue tickets may send them after the handshake,
+ * so this is best called once some data has been received.
+ *
+ * Returns: (transfer full): a newly allocated buffer to be freed with
+ * g_free(), or %NULL on error.
+ **/
+gpointer
+evd_tls_session_get_resumption_data (EvdTlsSession  *self,
+                                     gsize          *size,
+                                     GError        **error)
+{
+  gnutls_datum_t data = { NULL, 0 };
+  gpointer result;
+  gint err_code;
+
+  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), NULL);
+  g_return_val_if_fail (size != NULL, NULL);
+
+  if (! evd_tls_session_check_initialized (self, error))
+    return NULL;
+
+  err_code = gnutls_session_get_data2 (self->priv->session, &data);
+  if (evd_error_propagate_gnutls (err_code, error))
+    return NULL;
+
+  result = g_memdup (data.data, data.size);
+  *size = data.size;
+  gnutls_free (data.data);
+
+  return result;
+}
+
+/**
+ * evd_tls_session_set_resumption_data:
+ * @data: (allow-none): data obtained from
+ * evd_tls_session_get_resumption_data(), or %NULL to do a full handshake
+ * @size: size of @data
+ *
+ * Makes a client session try to resume a previous session. If the server
+ * doesn't accept it, a full handshake is done instead.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ **/
+gboolean
+evd_tls_session_set_resumption_data (EvdTlsSession  *self,
+                                     gconstpointer   data,
+                                     gsize           size,
+                                     GError        **error)
+{
+  g_return_val_if_fail (EVD_IS_TLS_SESSION (self), FALSE);
+
+  g_free (self->priv->resumption_data);
+  self->priv->resumption_data = NULL;
+  self->priv->resumption_data_size = 0;
+
+  if (data != NULL)
+    {
+      self->priv->resumption_data = g_memdup (data, size);
+      self->priv->resumption_data_size = size;
+    }
+
+  return evd_tls_session_set_resumption_data_internal (self, error);
+}
@@ -39,6 +39,10 @@ typedef struct _EvdTlsSession EvdTlsSession;
 typedef struct _EvdTlsSessionClass EvdTlsSessionClass;
 typedef struct _EvdTlsSessionPrivate EvdTlsSessionPrivate;
 
+/* value a transport pull or push function can return when the operation
+   would block, instead of setting a G_IO_ERROR_WOULD_BLOCK error */
+#define EVD_TLS_SESSION_WOULD_BLOCK -2
+
 typedef gssize (* EvdTlsSessionPullFunc) (EvdTlsSession  *self,
                                           gchar          *buf,
                                           gsize           size,
@@ -95,6 +99,13 @@ void               evd_tls_session_set_transport_push_func (EvdTlsSession
 
 gint               evd_tls_session_handshake               (EvdTlsSession   *self,
                                                             GError         **error);
+void               evd_tls_session_handshake_async         (EvdTlsSession       *self,
+                                                            GCancellable        *cancellable,
+                                                            GAsyncReadyCallback  callback,
+                                                            gpointer             user_data);
+gint               evd_tls_session_handshake_finish        (EvdTlsSession  *self,
+                                                            GAsyncResult   *result,
+                                                            GError        **error);
 
 gssize             evd_tls_session_read                    (EvdTlsSession  *self,
                                                             gchar          *buffer,
@@ -104,6 +115,8 @@ gssize             evd_tls_session_write                   (EvdTlsSession  *self
                                                             const gchar    *buffer,
                                                             gsize           size,
                                                             GError        **error);
+gboolean           evd_tls_session_flush                   (EvdTlsSession  *self,
+                                                            GError        **error);
 
 GIOCondition       evd_tls_session_get_direction           (EvdTlsSession *self);
 
@@ -129,6 +142,19 @@ gboolean           evd_tls_session_set_server_name         (EvdTlsSession  *self
                                                             GError        **error);
 const gchar       *evd_tls_session_get_server_name         (EvdTlsSession  *self);
 
+gboolean           evd_tls_session_is_resumed              (EvdTlsSession *self);
+gpointer           evd_tls_session_get_resumption_data     (EvdTlsSession  *self,
+                                                            gsize          *size,
+                                                            GError        **error);
+gboolean           evd_tls_session_set_resumption_data     (EvdTlsSession  *self,
+                                                            gconstpointer   data,
+                                                            gsize           size,
+                                                            GError        **error);
+
+void               evd_tls_session_set_offload_handshake   (EvdTlsSession *self,
+                                                            gboolean       offload);
+gboolean           evd_tls_session_get_offload_handshake   (EvdTlsSession *self);
+
 G_END_DECLS
 
 #endif /* __EVD_TLS_SESSION_H__ */
@@ -23,6 +23,10 @@
 #include <string.h>
 #include <libsoup/soup.h>
 
+#ifdef HAVE_GIO_UNIX
+#include <gio/gfiledescriptorbased.h>
+#endif
+
 #include "evd-web-dir.h"
 
 #define EVD_WEB_DIR_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), \
@@ -39,6 +43,38 @@ G_DEFINE_TYPE (EvdWebDir, evd_web_dir, EVD_TYPE_WEB_SERVICE)
 
 #define DEFAULT_DIRECTORY_INDEX "index.html"
 
+#define FILE_ATTRS "standard::content-type,standard::size,standard::type,time::modified,time::modified-usec,unix::device,unix::inode"
+
+#define DEFAULT_GZIP_STATIC  FALSE
+#define DEFAULT_GZIP_DYNAMIC FALSE
+
+#define DEFAULT_CACHE_SIZE          0 /* disabled */
+#define DEFAULT_CACHE_MAX_FILE_SIZE (64 * 1024)
+
+/* how long (in microseconds) a cached file is served without checking
+   its modification time on disk */
+#define CACHE_REVALIDATE_INTERVAL   G_USEC_PER_SEC
+
+typedef struct
+{
+  gchar *filename;
+  gchar *content;
+  gsize size;
+  guint64 mtime;
+  guint32 mtime_usec;
+  guint32 device;
+  guint64 inode;
+  gchar *content_type;
+  gchar *last_modified;
+  gchar *etag;
+  gboolean gzipped;
+  gchar *gzip_content;
+  gsize gzip_size;
+  gchar *gzip_etag;
+  gint64 check_time;
+  GList link;
+} EvdWebDirCacheEntry;
+
 /* private data */
 struct _EvdWebDirPrivate
 {
@@ -46,6 +82,15 @@ struct _EvdWebDirPrivate
   gchar *alias;
   gboolean allow_put;
   gchar *dir_index;
+
+  GHashTable *cache;
+  GQueue cache_lru;
+  gsize cache_used;
+  guint cache_size;
+  guint cache_max_file_size;
+
+  gboolean gzip_static;
+  gboolean gzip_dynamic;
 };
 
 typedef struct
@@ -62,6 +107,12 @@ typedef struct
   guint response_status_code;
   SoupMessageHeaders *response_headers;
   gboolean response_headers_sent;
+  goffset file_size;
+  goffset file_offset;
+  gboolean use_sendfile;
+  GFileInfo *file_info;
+  GFile *gzip_file;
+  gboolean gzipped;
 } EvdWebDirBinding;
 
 /* properties */
@@ -70,7 +121,11 @@ enum
   PROP_0,
   PROP_ROOT,
   PROP_ALIAS,
-  PROP_ALLOW_PUT
+  PROP_ALLOW_PUT,
+  PROP_CACHE_SIZE,
+  PROP_CACHE_MAX_FILE_SIZE,
+  PROP_GZIP_STATIC,
+  PROP_GZIP_DYNAMIC
 };
 
 static void     evd_web_dir_class_init           (EvdWebDirClass *class);
@@ -93,6 +148,7 @@ static void     evd_web_dir_request_handler      (EvdWebService     *self,
                                                   EvdHttpRequest    *request);
 
 static void     evd_web_dir_file_read_block      (EvdWebDirBinding *binding);
+static void     evd_web_dir_file_send_block      (EvdWebDirBinding *binding);
 
 static void     evd_web_dir_conn_on_write        (EvdConnection *conn,
                                                   gpointer       user_data);
@@ -101,6 +157,9 @@ static void     evd_web_dir_request_file         (EvdWebDir        *self,
                                                   const gchar      *filename,
                                                   EvdWebDirBinding *binding);
 
+static void     evd_web_dir_cache_evict          (EvdWebDir *self,
+                                                  gsize      max_size);
+
 static void
 evd_web_dir_class_init (EvdWebDirClass *class)
 {
@@ -138,6 +197,42 @@ evd_web_dir_class_init (EvdWebDirClass *class)
                                                          G_PARAM_READWRITE |
                                                          G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (obj_class, PROP_CACHE_SIZE,
+                                   g_param_spec_uint ("cache-size",
+                                                      "Cache size",
+                                                      "Maximum amount of memory in bytes used to cache file contents, 0 disables the cache",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_CACHE_SIZE,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_CACHE_MAX_FILE_SIZE,
+                                   g_param_spec_uint ("cache-max-file-size",
+                                                      "Cache maximum file size",
+                                                      "Files bigger than this size in bytes are never cached",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      DEFAULT_CACHE_MAX_FILE_SIZE,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_GZIP_STATIC,
+                                   g_param_spec_boolean ("gzip-static",
+                                                         "Serve pre-compressed files",
+                                                         "Whether to serve a file's '.gz' sibling to clients accepting gzip encoding",
+                                                         DEFAULT_GZIP_STATIC,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class, PROP_GZIP_DYNAMIC,
+                                   g_param_spec_boolean ("gzip-dynamic",
+                                                         "Compress cached files",
+                                                         "Whether to gzip compressible files when they are loaded into the cache",
+                                                         DEFAULT_GZIP_DYNAMIC,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
   g_type_class_add_private (obj_class, sizeof (EvdWebDirPrivate));
 }
 
@@ -153,6 +248,15 @@ evd_web_dir_init (EvdWebDir *self)
 
   priv->dir_index = g_strdup (DEFAULT_DIRECTORY_INDEX);
 
+  priv->cache = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&priv->cache_lru);
+  priv->cache_used = 0;
+  priv->cache_size = DEFAULT_CACHE_SIZE;
+  priv->cache_max_file_size = DEFAULT_CACHE_MAX_FILE_SIZE;
+
+  priv->gzip_static = DEFAULT_GZIP_STATIC;
+  priv->gzip_dynamic = DEFAULT_GZIP_DYNAMIC;
+
   evd_service_set_io_stream_type (EVD_SERVICE (self), EVD_TYPE_HTTP_CONNECTION);
 }
 
@@ -171,6 +275,9 @@ evd_web_dir_finalize (GObject *obj)
   g_free (self->priv->alias);
   g_free (self->priv->dir_index);
 
+  evd_web_dir_cache_evict (self, 0);
+  g_hash_table_unref (self->priv->cache);
+
   G_OBJECT_CLASS (evd_web_dir_parent_class)->finalize (obj);
 }
 
@@ -198,6 +305,23 @@ evd_web_dir_set_property (GObject      *obj,
       self->priv->allow_put = g_value_get_boolean (value);
       break;
 
+    case PROP_CACHE_SIZE:
+      self->priv->cache_size = g_value_get_uint (value);
+      evd_web_dir_cache_evict (self, self->priv->cache_size);
+      break;
+
+    case PROP_CACHE_MAX_FILE_SIZE:
+      self->priv->cache_max_file_size = g_value_get_uint (value);
+      break;
+
+    case PROP_GZIP_STATIC:
+      self->priv->gzip_static = g_value_get_boolean (value);
+      break;
+
+    case PROP_GZIP_DYNAMIC:
+      self->priv->gzip_dynamic = g_value_get_boolean (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
@@ -228,12 +352,249 @@ evd_web_dir_get_property (GObject    *obj,
       g_value_set_boolean (value, self->priv->allow_put);
       break;
 
+    case PROP_CACHE_SIZE:
+      g_value_set_uint (value, self->priv->cache_size);
+      break;
+
+    case PROP_CACHE_MAX_FILE_SIZE:
+      g_value_set_uint (value, self->priv->cache_max_file_size);
+      break;
+
+    case PROP_GZIP_STATIC:
+      g_value_set_boolean (value, self->priv->gzip_static);
+      break;
+
+    case PROP_GZIP_DYNAMIC:
+      g_value_set_boolean (value, self->priv->gzip_dynamic);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
       break;
     }
 }
 
+static EvdWebDirCacheEntry *
+evd_web_dir_cache_entry_new (const gchar *filename,
+                             gchar       *content,
+                             gsize        size,
+                             GFileInfo   *info)
+{
+  EvdWebDirCacheEntry *entry;
+  SoupDate *sdate;
+  gchar *checksum;
+
+  entry = g_slice_new0 (EvdWebDirCacheEntry);
+
+  entry->filename = g_strdup (filename);
+  entry->content = content;
+  entry->size = size;
+  entry->mtime = g_file_info_get_attribute_uint64 (info, "time::modified");
+  entry->mtime_usec =
+    g_file_info_get_attribute_uint32 (info, "time::modified-usec");
+  entry->device = g_file_info_get_attribute_uint32 (info, "unix::device");
+  entry->inode = g_file_info_get_attribute_uint64 (info, "unix::inode");
+  entry->content_type = g_strdup (g_file_info_get_content_type (info));
+
+  sdate = soup_date_new_from_time_t (entry->mtime);
+  entry->last_modified = soup_date_to_string (sdate, SOUP_DATE_HTTP);
+  soup_date_free (sdate);
+
+  /* strong validator, derived from the actual content */
+  checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+                                          (const guchar *) content,
+                                          size);
+  entry->etag = g_strdup_printf ("\"%s\"", checksum);
+  g_free (checksum);
+
+  entry->check_time = g_get_monotonic_time ();
+  entry->link.data = entry;
+
+  return entry;
+}
+
+static gboolean
+evd_web_dir_cache_entry_is_valid (EvdWebDirCacheEntry *entry,
+                                  GFileInfo           *info)
+{
+  /* seconds alone miss writes within the same second, and the inode
+     catches files replaced by a rename (e.g, deploys) that keep the
+     same size and modification time */
+  return
+    entry->mtime == g_file_info_get_attribute_uint64 (info, "time::modified") &&
+    entry->mtime_usec ==
+      g_file_info_get_attribute_uint32 (info, "time::modified-usec") &&
+    entry->device == g_file_info_get_attribute_uint32 (info, "unix::device") &&
+    entry->inode == g_file_info_get_attribute_uint64 (info, "unix::inode") &&
+    entry->size == (gsize) g_file_info_get_size (info);
+}
+
+static void
+evd_web_dir_cache_entry_free (EvdWebDirCacheEntry *entry)
+{
+  g_free (entry->filename);
+  g_free (entry->content);
+  g_free (entry->content_type);
+  g_free (entry->last_modified);
+  g_free (entry->etag);
+  g_free (entry->gzip_content);
+  g_free (entry->gzip_etag);
+
+  g_slice_free (EvdWebDirCacheEntry, entry);
+}
+
+static void
+evd_web_dir_cache_remove (EvdWebDir           *self,
+                          EvdWebDirCacheEntry *entry)
+{
+  g_hash_table_remove (self->priv->cache, entry->filename);
+  g_queue_unlink (&self->priv->cache_lru, &entry->link);
+  self->priv->cache_used -= entry->size + entry->gzip_size;
+
+  evd_web_dir_cache_entry_free (entry);
+}
+
+static void
+evd_web_dir_cache_evict (EvdWebDir *self, gsize max_size)
+{
+  /* drop least recently used entries until the cache fits in 'max_size' */
+  while (self->priv->cache_lru.tail != NULL &&
+         (max_size == 0 || self->priv->cache_used > max_size))
+    {
+      evd_web_dir_cache_remove (self, self->priv->cache_lru.tail->data);
+    }
+}
+
+static EvdWebDirCacheEntry *
+evd_web_dir_cache_lookup (EvdWebDir *self, const gchar *filename)
+{
+  EvdWebDirCacheEntry *entry;
+
+  entry = g_hash_table_lookup (self->priv->cache, filename);
+  if (entry != NULL)
+    {
+      g_queue_unlink (&self->priv->cache_lru, &entry->link);
+      g_queue_push_head_link (&self->priv->cache_lru, &entry->link);
+    }
+
+  return entry;
+}
+
+static gboolean
+evd_web_dir_cache_insert (EvdWebDir *self, EvdWebDirCacheEntry *entry)
+{
+  EvdWebDirCacheEntry *old_entry;
+
+  if (self->priv->cache_size == 0 ||
+      entry->size > self->priv->cache_max_file_size ||
+      entry->size > self->priv->cache_size)
+    {
+      return FALSE;
+    }
+
+  old_entry = g_hash_table_lookup (self->priv->cache, entry->filename);
+  if (old_entry != NULL)
+    evd_web_dir_cache_remove (self, old_entry);
+
+  if (entry->size + entry->gzip_size > self->priv->cache_size)
+    {
+      /* not enough room for both, keep the original content only */
+      g_free (entry->gzip_content);
+      entry->gzip_content = NULL;
+      entry->gzip_size = 0;
+    }
+
+  evd_web_dir_cache_evict (self,
+                           self->priv->cache_size -
+                           entry->size -
+                           entry->gzip_size);
+
+  g_hash_table_insert (self->priv->cache, entry->filename, entry);
+  g_queue_push_head_link (&self->priv->cache_lru, &entry->link);
+  self->priv->cache_used += entry->size + entry->gzip_size;
+
+  return TRUE;
+}
+
+static gboolean
+evd_web_dir_accepts_gzip (EvdHttpRequest *request)
+{
+  SoupMessageHeaders *headers;
+  const gchar *accept_encoding;
+  GSList *codings;
+  GSList *unacceptable = NULL;
+  gboolean result;
+
+  headers = evd_http_message_get_headers (EVD_HTTP_MESSAGE (request));
+
+  accept_encoding = soup_message_headers_get_list (headers, "Accept-Encoding");
+  if (accept_encoding == NULL)
+    return FALSE;
+
+  codings = soup_header_parse_quality_list (accept_encoding, &unacceptable);
+
+  result =
+    (g_slist_find_custom (codings, "gzip", (GCompareFunc) g_ascii_strcasecmp) != NULL ||
+     g_slist_find_custom (codings, "*", (GCompareFunc) g_strcmp0) != NULL) &&
+    g_slist_find_custom (unacceptable, "gzip", (GCompareFunc) g_ascii_strcasecmp) == NULL;
+
+  soup_header_free_list (codings);
+  soup_header_free_list (unacceptable);
+
+  return result;
+}
+
+static gboolean
+evd_web_dir_is_compressible (const gchar *content_type)
+{
+  return content_type != NULL &&
+    (g_str_has_prefix (content_type, "text/") ||
+     g_strcmp0 (content_type, "application/javascript") == 0 ||
+     g_strcmp0 (content_type, "application/x-javascript") == 0 ||
+     g_strcmp0 (content_type, "application/json") == 0 ||
+     g_strcmp0 (content_type, "application/xml") == 0 ||
+     g_strcmp0 (content_type, "image/svg+xml") == 0);
+}
+
+static gchar *
+evd_web_dir_gzip_compress (const gchar *content,
+                           gsize        size,
+                           gsize       *out_size)
+{
+  GConverter *compressor;
+  GConverterResult result;
+  gchar *out;
+  gsize bytes_read;
+  gsize bytes_written;
+
+  compressor =
+    G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+
+  /* output is limited to the input size, since a compressed copy that
+     is not smaller is useless */
+  out = g_malloc (size);
+  result = g_converter_convert (compressor,
+                                content,
+                                size,
+                                out,
+                                size,
+                                G_CONVERTER_INPUT_AT_END,
+                                &bytes_read,
+                                &bytes_written,
+                                NULL);
+  g_object_unref (compressor);
+
+  if (result != G_CONVERTER_FINISHED)
+    {
+      g_free (out);
+      return NULL;
+    }
+
+  *out_size = bytes_written;
+
+  return out;
+}
+
 static void
 evd_web_dir_finish_request (EvdWebDirBinding *binding)
 {
@@ -267,6 +628,12 @@ evd_web_dir_finish_request (EvdWebDirBinding *binding)
   if (binding->response_headers != NULL)
     soup_message_headers_free (binding->response_headers);
 
+  if (binding->file_info != NULL)
+    g_object_unref (binding->file_info);
+
+  if (binding->gzip_file != NULL)
+    g_object_unref (binding->gzip_file);
+
   g_free (binding->filename);
 
   g_slice_free (EvdWebDirBinding, binding);
@@ -373,6 +740,64 @@ evd_web_dir_file_read_block (EvdWebDirBinding *binding)
     }
 }
 
+static void
+evd_web_dir_file_send_block (EvdWebDirBinding *binding)
+{
+#ifdef HAVE_GIO_UNIX
+  EvdConnection *conn = EVD_CONNECTION (binding->conn);
+  gint fd;
+  gssize size;
+  GError *error = NULL;
+
+  fd = g_file_descriptor_based_get_fd (
+                     G_FILE_DESCRIPTOR_BASED (binding->file_input_stream));
+
+  while (evd_connection_get_max_writable (conn) > 0)
+    {
+      size = evd_connection_sendfile (conn,
+                                      fd,
+                                      &binding->file_offset,
+                                      binding->file_size - binding->file_offset,
+                                      &error);
+      if (size < 0)
+        {
+          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              /* wait for the connection's 'write' signal */
+              g_error_free (error);
+            }
+          else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED) &&
+                   binding->file_offset == 0)
+            {
+              g_error_free (error);
+
+              /* fall back to the buffered path */
+              binding->use_sendfile = FALSE;
+              binding->buffer = g_slice_alloc (BLOCK_SIZE);
+              evd_web_dir_file_read_block (binding);
+            }
+          else
+            {
+              g_debug ("Error sending file: %s", error->message);
+              evd_web_dir_handle_content_error (binding, error);
+              g_error_free (error);
+            }
+
+          return;
+        }
+
+      binding->response_content_size += size;
+
+      /* a zero-sized send means the file was truncated under us */
+      if (size == 0 || binding->file_offset >= binding->file_size)
+        {
+          evd_web_dir_finish_request (binding);
+          return;
+        }
+    }
+#endif
+}
+
 static void
 evd_web_dir_file_on_open (GObject      *object,
                           GAsyncResult *res,
@@ -417,6 +842,19 @@ evd_web_dir_file_on_open (GObject      *object,
   binding->response_headers_sent = TRUE;
   binding->response_status_code = SOUP_STATUS_OK;
 
+#ifdef HAVE_GIO_UNIX
+  /* send the file from the page cache straight into the socket, unless
+     TLS needs to see (and encrypt) the contents */
+  if (! evd_connection_get_tls_active (EVD_CONNECTION (binding->conn)) &&
+      G_IS_FILE_DESCRIPTOR_BASED (binding->file_input_stream))
+    {
+      binding->use_sendfile = TRUE;
+      evd_web_dir_file_send_block (binding);
+
+      return;
+    }
+#endif
+
   /* start reading */
   binding->buffer = g_slice_alloc (BLOCK_SIZE);
   evd_web_dir_file_read_block (binding);
@@ -475,75 +913,245 @@ evd_web_dir_check_not_modified (EvdWebDir          *self,
   return result;
 }
 
-static void
-evd_web_dir_file_on_info (GObject      *object,
-                          GAsyncResult *res,
-                          gpointer      user_data)
+static gboolean
+evd_web_dir_etag_matches (const gchar *if_none_match, const gchar *etag)
 {
-  EvdWebDirBinding *binding = user_data;
-  EvdWebDir *self = binding->web_dir;
-  GFile *file = G_FILE (object);
-  EvdHttpConnection *conn = binding->conn;
+  gchar **tags;
+  gint i;
+  gboolean result = FALSE;
+
+  tags = g_strsplit (if_none_match, ",", 0);
+  for (i = 0; tags[i] != NULL && ! result; i++)
+    {
+      gchar *tag;
+
+      tag = g_strstrip (tags[i]);
+
+      /* If-None-Match uses weak comparison */
+      if (g_str_has_prefix (tag, "W/"))
+        tag += 2;
+
+      result = g_strcmp0 (tag, "*") == 0 || g_strcmp0 (tag, etag) == 0;
+    }
+  g_strfreev (tags);
+
+  return result;
+}
+
+static gboolean
+evd_web_dir_check_etag (EvdWebDir           *self,
+                        EvdHttpConnection   *conn,
+                        EvdHttpRequest      *request,
+                        SoupMessageHeaders  *response_headers,
+                        SoupHTTPVersion      http_version,
+                        const gchar         *etag,
+                        guint64              mtime)
+{
+  SoupMessageHeaders *req_headers;
+  const gchar *if_none_match;
   GError *error = NULL;
-  GFileInfo *info;
-  SoupHTTPVersion ver;
-  EvdHttpRequest *request;
-  GFileType file_type;
-  SoupMessageHeaders *headers = NULL;
 
-  guint64 file_modified_date_int;
-  SoupDate *sdate;
-  gchar *date;
+  req_headers = evd_http_message_get_headers (EVD_HTTP_MESSAGE (request));
 
-  request = binding->request;
-  ver = evd_http_message_get_version (EVD_HTTP_MESSAGE (request));
+  /* If-None-Match takes precedence over If-Modified-Since */
+  if_none_match = soup_message_headers_get_one (req_headers, "If-None-Match");
+  if (if_none_match == NULL)
+    return evd_web_dir_check_not_modified (self,
+                                           conn,
+                                           request,
+                                           response_headers,
+                                           http_version,
+                                           mtime);
+
+  if (! evd_web_dir_etag_matches (if_none_match, etag))
+    return FALSE;
 
-  info = g_file_query_info_finish (G_FILE (object), res, &error);
-  if (info == NULL)
+  if (! evd_web_service_respond (EVD_WEB_SERVICE (self),
+                                 conn,
+                                 SOUP_STATUS_NOT_MODIFIED,
+                                 response_headers,
+                                 NULL,
+                                 0,
+                                 &error))
     {
-      evd_web_dir_handle_content_error (binding, error);
+      g_debug ("Error sending NOT-MODIFIED response headers: %s",
+               error->message);
       g_error_free (error);
-      return;
     }
 
-  file_type = g_file_info_get_file_type (info);
+  return TRUE;
+}
 
-  /* file is a directory */
-  if (file_type == G_FILE_TYPE_DIRECTORY)
+static void
+evd_web_dir_set_cors_headers (EvdWebDir          *self,
+                              EvdHttpRequest     *request,
+                              SoupMessageHeaders *headers)
+{
+  if (evd_http_request_is_cross_origin (request))
     {
-      if (self->priv->dir_index != NULL)
+      const gchar *origin;
+
+      origin = evd_http_request_get_origin (request);
+
+      /* check if this origin is allowed */
+      if (evd_web_service_origin_allowed (EVD_WEB_SERVICE (self), origin))
         {
-          gchar *new_filename;
+          soup_message_headers_replace (headers,
+                                        "Access-Control-Allow-Origin",
+                                        origin);
+        }
+    }
+}
 
-          new_filename = g_strdup_printf ("%s/%s",
-                                          binding->filename,
-                                          self->priv->dir_index);
+static void
+evd_web_dir_serve_cached (EvdWebDirBinding    *binding,
+                          EvdWebDirCacheEntry *entry)
+{
+  EvdWebDir *self = binding->web_dir;
+  SoupMessageHeaders *headers;
+  SoupHTTPVersion ver;
+  GError *error = NULL;
+  gboolean use_gzip;
+  const gchar *content;
+  gsize size;
+  const gchar *etag;
 
-          evd_web_dir_request_file (self, new_filename, binding);
+  ver = evd_http_message_get_version (EVD_HTTP_MESSAGE (binding->request));
 
-          g_free (new_filename);
-        }
-      else
+  use_gzip = entry->gzip_content != NULL &&
+    evd_web_dir_accepts_gzip (binding->request);
+  if (use_gzip)
+    {
+      content = entry->gzip_content;
+      size = entry->gzip_size;
+      etag = entry->gzip_etag;
+    }
+  else
+    {
+      content = entry->content;
+      size = entry->size;
+      etag = entry->etag;
+    }
+
+  headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  soup_message_headers_replace (headers, "Last-Modified", entry->last_modified);
+  soup_message_headers_replace (headers, "ETag", etag);
+  if (self->priv->gzip_static || self->priv->gzip_dynamic)
+    soup_message_headers_replace (headers, "Vary", "Accept-Encoding");
+  if (use_gzip || entry->gzipped)
+    soup_message_headers_replace (headers, "Content-Encoding", "gzip");
+  evd_web_dir_set_cors_headers (self, binding->request, headers);
+
+  if (evd_web_dir_check_etag (self,
+                              binding->conn,
+                              binding->request,
+                              headers,
+                              ver,
+                              etag,
+                              entry->mtime))
+    {
+      binding->response_status_code = SOUP_STATUS_NOT_MODIFIED;
+    }
+  else
+    {
+      soup_message_headers_set_content_type (headers,
+                                             entry->content_type,
+                                             NULL);
+
+      binding->response_status_code = SOUP_STATUS_OK;
+      binding->response_content_size = size;
+
+      /* headers and content are written at once */
+      if (! evd_web_service_respond (EVD_WEB_SERVICE (self),
+                                     binding->conn,
+                                     SOUP_STATUS_OK,
+                                     headers,
+                                     content,
+                                     size,
+                                     &error))
         {
-          /* @TODO: respond with 404 Not Found */
+          g_debug ("Error sending cached file: %s", error->message);
+          g_error_free (error);
         }
-
-      goto out;
     }
-  /* file is a symbolic link */
-  else if (file_type == G_FILE_TYPE_SYMBOLIC_LINK)
+
+  soup_message_headers_free (headers);
+
+  evd_web_dir_finish_request (binding);
+}
+
+static void
+evd_web_dir_file_on_load (GObject      *object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  EvdWebDirBinding *binding = user_data;
+  EvdWebDir *self = binding->web_dir;
+  EvdWebDirCacheEntry *entry;
+  gchar *content;
+  gsize size;
+  gboolean cached;
+  GError *error = NULL;
+
+  if (! g_file_load_contents_finish (G_FILE (object),
+                                     res,
+                                     &content,
+                                     &size,
+                                     NULL,
+                                     &error))
     {
-      /* @TODO: check if we allow following symlinks */
-      goto out;
+      evd_web_dir_handle_content_error (binding, error);
+      g_error_free (error);
+
+      return;
     }
-  /* file is not a regular file */
-  else if (file_type != G_FILE_TYPE_REGULAR)
+
+  entry = evd_web_dir_cache_entry_new (binding->filename,
+                                       content,
+                                       size,
+                                       binding->file_info);
+  entry->gzipped = binding->gzipped;
+
+  /* keep a compressed copy along, for clients accepting gzip */
+  if (self->priv->gzip_dynamic &&
+      ! entry->gzipped &&
+      evd_web_dir_is_compressible (entry->content_type))
     {
-      /* @TODO: respond with 404 Not Found */
-      goto out;
+      entry->gzip_content = evd_web_dir_gzip_compress (entry->content,
+                                                       entry->size,
+                                                       &entry->gzip_size);
+      if (entry->gzip_content != NULL)
+        entry->gzip_etag = g_strdup_printf ("%.*s-gzip\"",
+                                            (gint) strlen (entry->etag) - 1,
+                                            entry->etag);
     }
 
-  /* file is a regular file */
+  /* file might have grown since it was stat'ed, in which case it is
+     served but not cached */
+  cached = evd_web_dir_cache_insert (self, entry);
+
+  evd_web_dir_serve_cached (binding, entry);
+
+  if (! cached)
+    evd_web_dir_cache_entry_free (entry);
+}
+
+static void
+evd_web_dir_serve_file (EvdWebDirBinding *binding, GFileInfo *info)
+{
+  EvdWebDir *self = binding->web_dir;
+  GFile *file = binding->file;
+  EvdHttpConnection *conn = binding->conn;
+  EvdHttpRequest *request = binding->request;
+  SoupHTTPVersion ver;
+  SoupMessageHeaders *headers = NULL;
+
+  guint64 file_modified_date_int;
+  SoupDate *sdate;
+  gchar *date;
+
+  ver = evd_http_message_get_version (EVD_HTTP_MESSAGE (request));
+
   headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
 
   if (evd_http_connection_get_keepalive (conn))
@@ -551,10 +1159,51 @@ evd_web_dir_file_on_info (GObject      *object,
   else
     soup_message_headers_replace (headers, "Connection", "close");
 
+  if (self->priv->gzip_static || self->priv->gzip_dynamic)
+    soup_message_headers_replace (headers, "Vary", "Accept-Encoding");
+  if (binding->gzipped)
+    soup_message_headers_replace (headers, "Content-Encoding", "gzip");
+
   /* obtain last-modified value from file info */
   file_modified_date_int =
     g_file_info_get_attribute_uint64 (info, "time::modified");
 
+  /* serve from memory if the file is cached and hasn't changed on disk,
+     or load it into the cache if it is small enough */
+  if (self->priv->cache_size > 0)
+    {
+      EvdWebDirCacheEntry *entry;
+      goffset size;
+
+      size = g_file_info_get_size (info);
+
+      entry = evd_web_dir_cache_lookup (self, binding->filename);
+      if (entry != NULL)
+        {
+          if (evd_web_dir_cache_entry_is_valid (entry, info))
+            {
+              entry->check_time = g_get_monotonic_time ();
+              evd_web_dir_serve_cached (binding, entry);
+
+              goto out;
+            }
+
+          evd_web_dir_cache_remove (self, entry);
+        }
+
+      if (size <= self->priv->cache_max_file_size &&
+          size <= self->priv->cache_size)
+        {
+          binding->file_info = g_object_ref (info);
+          g_file_load_contents_async (file,
+                                      NULL,
+                                      evd_web_dir_file_on_load,
+                                      binding);
+
+          goto out;
+        }
+    }
+
   /* check last-modified time */
   if (evd_web_dir_check_not_modified (self,
                                       conn,
@@ -576,26 +1225,13 @@ evd_web_dir_file_on_info (GObject      *object,
   soup_date_free (sdate);
 
   /* check cross origin */
-  if (evd_http_request_is_cross_origin (request))
-    {
-      const gchar *origin;
-
-      origin = evd_http_request_get_origin (request);
-
-      /* check if this origin is allowed */
-      if (evd_web_service_origin_allowed (EVD_WEB_SERVICE (self), origin))
-        {
-          soup_message_headers_replace (headers,
-                                        "Access-Control-Allow-Origin",
-                                        origin);
-        }
-    }
+  evd_web_dir_set_cors_headers (self, request, headers);
 
   soup_message_headers_set_content_type (headers,
                                          g_file_info_get_content_type (info),
                                          NULL);
-  soup_message_headers_set_content_length (headers,
-                                           g_file_info_get_size (info));
+  binding->file_size = g_file_info_get_size (info);
+  soup_message_headers_set_content_length (headers, binding->file_size);
 
   /* now open file */
   g_file_read_async (file,
@@ -610,6 +1246,142 @@ evd_web_dir_file_on_info (GObject      *object,
  out:
   if (headers != NULL)
     soup_message_headers_free (headers);
+}
+
+static void
+evd_web_dir_gzip_file_on_info (GObject      *object,
+                               GAsyncResult *res,
+                               gpointer      user_data)
+{
+  EvdWebDirBinding *binding = user_data;
+  GFileInfo *info;
+  GFileInfo *orig_info;
+
+  orig_info = binding->file_info;
+  binding->file_info = NULL;
+
+  /* any error here just means there is no usable compressed sibling */
+  info = g_file_query_info_finish (G_FILE (object), res, NULL);
+
+  if (info != NULL &&
+      g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR &&
+      g_file_info_get_attribute_uint64 (info, "time::modified") >=
+      g_file_info_get_attribute_uint64 (orig_info, "time::modified"))
+    {
+      /* serve the compressed file with the original's content type */
+      g_file_info_set_content_type (info,
+                                    g_file_info_get_content_type (orig_info));
+
+      g_object_unref (binding->file);
+      binding->file = binding->gzip_file;
+      binding->gzip_file = NULL;
+
+      g_free (binding->filename);
+      binding->filename = g_file_get_path (binding->file);
+
+      binding->gzipped = TRUE;
+
+      evd_web_dir_serve_file (binding, info);
+    }
+  else
+    {
+      evd_web_dir_serve_file (binding, orig_info);
+    }
+
+  if (info != NULL)
+    g_object_unref (info);
+  g_object_unref (orig_info);
+}
+
+static void
+evd_web_dir_file_on_info (GObject      *object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  EvdWebDirBinding *binding = user_data;
+  EvdWebDir *self = binding->web_dir;
+  EvdHttpConnection *conn = binding->conn;
+  GError *error = NULL;
+  GFileInfo *info;
+  EvdHttpRequest *request;
+  GFileType file_type;
+
+  request = binding->request;
+
+  info = g_file_query_info_finish (G_FILE (object), res, &error);
+  if (info == NULL)
+    {
+      evd_web_dir_handle_content_error (binding, error);
+      g_error_free (error);
+      return;
+    }
+
+  file_type = g_file_info_get_file_type (info);
+
+  /* file is a directory */
+  if (file_type == G_FILE_TYPE_DIRECTORY)
+    {
+      if (self->priv->dir_index != NULL)
+        {
+          gchar *new_filename;
+
+          new_filename = g_strdup_printf ("%s/%s",
+                                          binding->filename,
+                                          self->priv->dir_index);
+
+          evd_web_dir_request_file (self, new_filename, binding);
+
+          g_free (new_filename);
+        }
+      else
+        {
+          /* @TODO: respond with 404 Not Found */
+        }
+
+      goto out;
+    }
+  /* file is a symbolic link */
+  else if (file_type == G_FILE_TYPE_SYMBOLIC_LINK)
+    {
+      /* @TODO: check if we allow following symlinks */
+      goto out;
+    }
+  /* file is not a regular file */
+  else if (file_type != G_FILE_TYPE_REGULAR)
+    {
+      /* @TODO: respond with 404 Not Found */
+      goto out;
+    }
+
+  /* file is a regular file */
+
+  /* look for a pre-compressed sibling first */
+  if (self->priv->gzip_static &&
+      ! g_str_has_suffix (binding->filename, ".gz") &&
+      evd_web_dir_accepts_gzip (request))
+    {
+      gchar *gz_filename;
+
+      binding->file_info = g_object_ref (info);
+
+      gz_filename = g_strconcat (binding->filename, ".gz", NULL);
+      binding->gzip_file = g_file_new_for_path (gz_filename);
+      g_free (gz_filename);
+
+      g_file_query_info_async (binding->gzip_file,
+                               FILE_ATTRS,
+                               G_FILE_QUERY_INFO_NONE,
+                               evd_connection_get_priority (EVD_CONNECTION (conn)),
+                               NULL,
+                               evd_web_dir_gzip_file_on_info,
+                               binding);
+
+      goto out;
+    }
+
+  evd_web_dir_serve_file (binding, info);
+
+ out:
   g_object_unref (info);
 }
 
@@ -618,7 +1390,12 @@ evd_web_dir_conn_on_write (EvdConnection *conn, gpointer user_data)
 {
   EvdWebDirBinding *binding = (EvdWebDirBinding *) user_data;
 
-  if (binding->file_input_stream != NULL)
+  if (binding->file_input_stream == NULL)
+    return;
+
+  if (binding->use_sendfile)
+    evd_web_dir_file_send_block (binding);
+  else
     evd_web_dir_file_read_block (binding);
 }
 
@@ -635,8 +1412,6 @@ evd_web_dir_request_file (EvdWebDir        *self,
                           EvdWebDirBinding *binding)
 {
   GFile *file;
-  const gchar *FILE_ATTRS =
-    "standard::content-type,standard::size,standard::type,time::modified";
 
   g_free (binding->filename);
   binding->filename = g_strdup (filename);
@@ -647,6 +1422,32 @@ evd_web_dir_request_file (EvdWebDir        *self,
     g_object_unref (binding->file);
   binding->file = file;
 
+  /* recently validated cache entries are served without touching disk */
+  if (self->priv->cache_size > 0)
+    {
+      EvdWebDirCacheEntry *entry = NULL;
+
+      if (self->priv->gzip_static &&
+          evd_web_dir_accepts_gzip (binding->request))
+        {
+          gchar *gz_filename;
+
+          gz_filename = g_strconcat (filename, ".gz", NULL);
+          entry = evd_web_dir_cache_lookup (self, gz_filename);
+          g_free (gz_filename);
+        }
+
+      if (entry == NULL)
+        entry = evd_web_dir_cache_lookup (self, filename);
+
+      if (entry != NULL &&
+          g_get_monotonic_time () - entry->check_time < CACHE_REVALIDATE_INTERVAL)
+        {
+          evd_web_dir_serve_cached (binding, entry);
+          return;
+        }
+    }
+
   g_file_query_info_async (file,
                            FILE_ATTRS,
                            G_FILE_QUERY_INFO_NONE,
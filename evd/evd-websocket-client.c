@@ -41,6 +41,9 @@ struct _EvdWebsocketClientPrivate
 {
   gboolean standalone;
 
+  gboolean deflate_enabled;
+  EvdWebsocketDeflateOptions deflate;
+
   EvdHttpConnection *peer_arg_conn;
   SoupMessageHeaders *peer_arg_headers;
 };
@@ -139,6 +142,10 @@ evd_websocket_client_init (EvdWebsocketClient *self)
   self->priv = priv;
 
   priv->standalone = DEFAULT_STANDALONE;
+
+  priv->deflate_enabled = FALSE;
+  priv->deflate.max_window_bits = 15;
+  priv->deflate.no_context_takeover = FALSE;
 }
 
 static gboolean
@@ -548,6 +555,8 @@ on_handshake_response (GObject      *obj,
                                                           status_code,
                                                           res_headers,
                                                           conn_data->handshake_key,
+                                                          conn_data->self->priv->deflate_enabled ?
+                                                          &conn_data->self->priv->deflate : NULL,
                                                           &error))
     {
       goto out;
@@ -620,6 +629,8 @@ start_opening_handshake (EvdWebsocketClient *self, EvdHttpConnection *conn)
     evd_websocket_protocol_create_handshake_request (data->address,
                                                      NULL,
                                                      NULL,
+                                                     self->priv->deflate_enabled ?
+                                                     &self->priv->deflate : NULL,
                                                      &data->handshake_key);
 
   evd_http_connection_write_request_headers (conn,
@@ -766,3 +777,50 @@ evd_websocket_client_get_validate_peer_arguments (EvdWebsocketClient  *self,
   if (response_headers != NULL)
     *response_headers = self->priv->peer_arg_headers;
 }
+
+/**
+ * evd_websocket_client_set_deflate:
+ * @enabled: whether to negotiate permessage-deflate compression
+ * @max_window_bits: base-2 logarithm of the compression window, 9 to 15
+ * @no_context_takeover: whether to compress each message independently
+ *
+ * Configures RFC 7692 permessage-deflate compression for connections
+ * established from then on. A smaller window and no context takeover save
+ * memory and CPU at the expense of the compression ratio. The server
+ * can restrict them further during negotiation. Disabled by default.
+ **/
+void
+evd_websocket_client_set_deflate (EvdWebsocketClient *self,
+                                  gboolean            enabled,
+                                  guint8              max_window_bits,
+                                  gboolean            no_context_takeover)
+{
+  g_return_if_fail (EVD_IS_WEBSOCKET_CLIENT (self));
+  g_return_if_fail (max_window_bits >= 9 && max_window_bits <= 15);
+
+  self->priv->deflate_enabled = enabled;
+  self->priv->deflate.max_window_bits = max_window_bits;
+  self->priv->deflate.no_context_takeover = no_context_takeover;
+}
+
+/**
+ * evd_websocket_client_get_deflate:
+ * @max_window_bits: (out) (allow-none):
+ * @no_context_takeover: (out) (allow-none):
+ *
+ * Returns: %TRUE if permessage-deflate compression is enabled
+ **/
+gboolean
+evd_websocket_client_get_deflate (EvdWebsocketClient *self,
+                                  guint8             *max_window_bits,
+                                  gboolean           *no_context_takeover)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_CLIENT (self), FALSE);
+
+  if (max_window_bits != NULL)
+    *max_window_bits = self->priv->deflate.max_window_bits;
+  if (no_context_takeover != NULL)
+    *no_context_takeover = self->priv->deflate.no_context_takeover;
+
+  return self->priv->deflate_enabled;
+}
@@ -21,20 +21,36 @@
  */
 
 #include <string.h>
+#include <zlib.h>
 #include <libsoup/soup-headers.h>
 
 #include "evd-websocket-protocol.h"
 
 #include "evd-utils.h"
 
+/* vectorized masking, selected at runtime from what the CPU supports */
+#if (defined (__x86_64__) || defined (__i386__)) && \
+  (defined (__clang__) || \
+   (defined (__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define HAVE_MASKING_SIMD
+#include <immintrin.h>
+#endif
+
 #define EVD_WEBSOCKET_MAGIC_UUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
 #define EVD_WEBSOCKET_DATA_KEY   "org.eventdance.lib.Websocket.CONN_DATA"
 
 #define BLOCK_SIZE        0x00000FFF
+#define MAX_READ_SIZE     0x00040000
 #define MAX_FRAGMENT_SIZE 0x10000000
 #define MAX_PAYLOAD_SIZE  0x40000000
 
+#define COALESCE_MAX_SIZE 0x00010000 /* written right away when reached */
+
+#define DEFLATE_EXTENSION  "permessage-deflate"
+#define DEFLATE_CHUNK_SIZE 0x4000
+#define DEFLATE_MIN_SIZE   64 /* smaller messages are sent uncompressed */
+
 /* websocket reading states */
 typedef enum
 {
@@ -52,6 +68,8 @@ typedef enum
 } EvdWebsocketReadingStates;
 
 static const guint16 HEADER_MASK_FIN         = (1 << 15);
+static const guint16 HEADER_MASK_RSV1        = (1 << 14);
+static const guint16 HEADER_MASK_RSV2_3      = ((1 << 13) | (1 << 12));
 static const guint16 HEADER_MASK_OPCODE      = ((1 << 8) | (1 << 9) | (1 << 10) | (1 << 11));
 static const guint16 HEADER_MASK_MASKED      = (1 << 7);
 static const guint16 HEADER_MASK_PAYLOAD_LEN = (0x00FF & ~(1 << 7));
@@ -84,6 +102,7 @@ typedef struct
 
   EvdWebsocketFrameCb frame_cb;
   EvdWebsocketCloseCb close_cb;
+  EvdWebsocketStreamCb stream_cb;
 
   gpointer user_data;
   GDestroyNotify user_data_destroy_notify;
@@ -94,12 +113,30 @@ typedef struct
   GString *buf;
   gsize buf_len;
   gsize offset;
+  gsize read_size;
+  gsize read_requested;
 
   guint8 opcode;
   gsize payload_len;
+  gsize payload_read;
   gchar *frame_data;
   gsize frame_len;
 
+  /* fragmented message being received */
+  guint8 message_opcode;
+  gsize message_len;
+  GString *message;
+  gsize max_message_size;
+
+  /* permessage-deflate, NULL when not negotiated */
+  z_stream *deflater;
+  z_stream *inflater;
+  guint8 deflate_window_bits;
+  gboolean deflate_no_context_takeover;
+  gboolean message_compressed;
+  gsize inflated_len;
+  GString *inflated;
+
   gboolean close_frame_sent;
   gboolean close_frame_received;
 
@@ -113,31 +150,295 @@ typedef struct
   gsize extension_len;
 
   guint close_timeout_src_id;
+
+  /* outbound frames, written together when coalescing */
+  GString *out_buf;
+  gboolean coalesce;
+  guint coalesce_max_latency;
+  guint flush_src_id;
 } EvdWebsocketData;
 
+struct _EvdWebsocketFrame
+{
+  volatile gint ref_count;
+
+  gchar *payload;
+  gsize payload_len;
+  EvdMessageType type;
+
+  /* serialized unmasked message, built before the frame is shared */
+  GString *serialized;
+
+  /* compressed with no context takeover, indexed by window bits. Built on
+     first use, under the lock, since connections sharing the frame may
+     live in different threads. */
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  GMutex *mutex;
+#else
+  GMutex  mutex;
+#endif
+  GString *compressed[16];
+};
+
 static void read_from_connection    (EvdWebsocketData *data);
 
 static void on_close_frame_received (EvdWebsocketData *data,
                                      guint16           code,
                                      const gchar      *reason);
 
+/* XORs a payload with the masking key, starting at the key byte given by
+   @offset. Handles whatever the vectorized versions leave behind, eight
+   bytes at a time. */
 static void
-apply_masking (gchar *frame, gsize frame_len, guint8 masking_key[4])
+apply_masking_word (guchar       *data,
+                    gsize         len,
+                    const guint8  masking_key[4],
+                    gsize         offset)
 {
+  guint8 key[8];
+  guint64 key64;
+  guint64 word;
   gsize i;
-  guint8 j;
 
-  for (i=0; i<frame_len; i++)
+  for (i = 0; i < 8; i++)
+    key[i] = masking_key[(offset + i) % 4];
+  memcpy (&key64, key, 8);
+
+  for (i = 0; i + 8 <= len; i += 8)
     {
-      j = i % 4;
-      frame[i] = frame[i] ^ masking_key[j];
+      memcpy (&word, data + i, 8);
+      word ^= key64;
+      memcpy (data + i, &word, 8);
     }
+
+  for (; i < len; i++)
+    data[i] ^= key[i % 4];
+}
+
+#ifdef HAVE_MASKING_SIMD
+
+/* Both return the number of bytes masked, always a multiple of 4 */
+
+__attribute__ ((target ("sse2")))
+static gsize
+apply_masking_sse2 (guchar *data, gsize len, guint32 key)
+{
+  __m128i mask;
+  __m128i block;
+  gsize i;
+
+  mask = _mm_set1_epi32 ((gint32) key);
+
+  for (i = 0; i + 16 <= len; i += 16)
+    {
+      block = _mm_loadu_si128 ((const __m128i *) (data + i));
+      _mm_storeu_si128 ((__m128i *) (data + i), _mm_xor_si128 (block, mask));
+    }
+
+  return i;
+}
+
+__attribute__ ((target ("avx2")))
+static gsize
+apply_masking_avx2 (guchar *data, gsize len, guint32 key)
+{
+  __m256i mask;
+  __m256i block;
+  gsize i;
+
+  mask = _mm256_set1_epi32 ((gint32) key);
+
+  for (i = 0; i + 32 <= len; i += 32)
+    {
+      block = _mm256_loadu_si256 ((const __m256i *) (data + i));
+      _mm256_storeu_si256 ((__m256i *) (data + i),
+                           _mm256_xor_si256 (block, mask));
+    }
+
+  return i;
+}
+
+static gsize
+apply_masking_none (guchar *data, gsize len, guint32 key)
+{
+  return 0;
+}
+
+static gsize (* apply_masking_simd) (guchar *data, gsize len, guint32 key) = NULL;
+
+static void
+apply_masking_simd_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      __builtin_cpu_init ();
+
+      if (__builtin_cpu_supports ("avx2"))
+        apply_masking_simd = apply_masking_avx2;
+      else if (__builtin_cpu_supports ("sse2"))
+        apply_masking_simd = apply_masking_sse2;
+      else
+        apply_masking_simd = apply_masking_none;
+
+      g_once_init_leave (&initialized, 1);
+    }
+}
+
+#endif /* HAVE_MASKING_SIMD */
+
+/**
+ * evd_websocket_protocol_apply_masking:
+ * @data: the payload to (un)mask in place
+ * @data_len: the length of @data
+ * @masking_key: the 4 bytes masking key of the frame
+ *
+ * XORs @data with @masking_key as described in RFC 6455, section 5.3.
+ * Masking and unmasking are the same operation. Uses SSE2 or AVX2 when the
+ * CPU supports it, selected at runtime.
+ **/
+void
+evd_websocket_protocol_apply_masking (gchar        *data,
+                                      gsize         data_len,
+                                      const guint8  masking_key[4])
+{
+  gsize done = 0;
+
+#ifdef HAVE_MASKING_SIMD
+  if (data_len >= 16)
+    {
+      guint32 key;
+
+      apply_masking_simd_init ();
+
+      memcpy (&key, masking_key, 4);
+      done = apply_masking_simd ((guchar *) data, data_len, key);
+    }
+#endif
+
+  apply_masking_word ((guchar *) data + done,
+                      data_len - done,
+                      masking_key,
+                      done);
+}
+
+static gboolean
+deflate_message (EvdWebsocketData *data,
+                 const gchar      *buf,
+                 gsize             len,
+                 GString          *out)
+{
+  z_stream *strm = data->deflater;
+  gsize offset = 0;
+  gint flush;
+
+  g_string_set_size (out, 0);
+
+  /* zlib counts input with 32 bits */
+  do
+    {
+      gsize in_len;
+
+      in_len = MIN (len - offset, G_MAXINT32);
+      strm->next_in = (Bytef *) buf + offset;
+      strm->avail_in = in_len;
+      offset += in_len;
+
+      flush = offset == len ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+      do
+        {
+          gsize out_len = out->len;
+
+          g_string_set_size (out, out_len + DEFLATE_CHUNK_SIZE);
+          strm->next_out = (Bytef *) out->str + out_len;
+          strm->avail_out = DEFLATE_CHUNK_SIZE;
+
+          if (deflate (strm, flush) == Z_STREAM_ERROR)
+            return FALSE;
+
+          g_string_set_size (out, out_len + DEFLATE_CHUNK_SIZE - strm->avail_out);
+        }
+      while (strm->avail_out == 0);
+    }
+  while (offset < len);
+
+  /* the sync flush marker is implied, RFC 7692 7.2.1 */
+  if (out->len >= 4 && memcmp (out->str + out->len - 4, "\x00\x00\xff\xff", 4) == 0)
+    g_string_truncate (out, out->len - 4);
+
+  if (data->deflate_no_context_takeover)
+    deflateReset (strm);
+
+  return TRUE;
+}
+
+/* Appends the inflated @buf to @out, failing if the message grows over
+   'max-message-size' */
+static gboolean
+inflate_append (EvdWebsocketData *data,
+                const gchar      *buf,
+                gsize             len,
+                GString          *out)
+{
+  z_stream *strm = data->inflater;
+  gsize offset = 0;
+  gint ret;
+
+  do
+    {
+      gsize in_len;
+
+      in_len = MIN (len - offset, G_MAXINT32);
+      strm->next_in = (Bytef *) buf + offset;
+      strm->avail_in = in_len;
+      offset += in_len;
+
+      do
+        {
+          gsize out_len = out->len;
+          gsize produced;
+
+          g_string_set_size (out, out_len + DEFLATE_CHUNK_SIZE);
+          strm->next_out = (Bytef *) out->str + out_len;
+          strm->avail_out = DEFLATE_CHUNK_SIZE;
+
+          ret = inflate (strm, Z_SYNC_FLUSH);
+
+          produced = DEFLATE_CHUNK_SIZE - strm->avail_out;
+          g_string_set_size (out, out_len + produced);
+
+          if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END)
+            return FALSE;
+
+          data->inflated_len += produced;
+          if (data->inflated_len > data->max_message_size)
+            return FALSE;
+
+          /* a final block ends the stream, the next message starts anew */
+          if (ret == Z_STREAM_END)
+            inflateReset (strm);
+        }
+      while (strm->avail_out == 0 ||
+             (ret == Z_STREAM_END && strm->avail_in > 0));
+    }
+  while (offset < len);
+
+  return TRUE;
+}
+
+static gboolean
+inflate_finish (EvdWebsocketData *data, GString *out)
+{
+  return inflate_append (data, "\x00\x00\xff\xff", 4, out);
 }
 
 static void
 build_frame (GString     *frame,
              gboolean     fin,
              guint8       opcode,
+             gboolean     compressed,
              gboolean     masked,
              const gchar *payload,
              gsize        payload_len)
@@ -147,12 +448,11 @@ build_frame (GString     *frame,
   guint8 payload_len_len; /* length of the extra bytes for payload length */
   guint32 masking_key;
 
-  /* @TODO: by now this method assumes no extension data */
-
   payload_len_hbo = 0;
   payload_len_len = 0;
 
   header = fin ? HEADER_MASK_FIN : 0;
+  header |= compressed ? HEADER_MASK_RSV1 : 0;
   header |= opcode << 8;
   header |= masked ? HEADER_MASK_MASKED : 0;
 
@@ -174,8 +474,8 @@ build_frame (GString     *frame,
     }
 
   g_string_set_size (frame, frame->len + 2);
-  frame->str[0] = (gchar) ((header & 0xFF00) >> 8);
-  frame->str[1] = (gchar) (header & 0x00FF);
+  frame->str[frame->len - 2] = (gchar) ((header & 0xFF00) >> 8);
+  frame->str[frame->len - 1] = (gchar) (header & 0x00FF);
 
   if (payload_len_len > 0)
     g_string_append_len (frame,
@@ -194,111 +494,193 @@ build_frame (GString     *frame,
 
   if (masked)
     {
-      apply_masking (frame->str + (frame->len - payload_len),
-                     payload_len,
-                     (guint8 *) &masking_key);
+      evd_websocket_protocol_apply_masking (frame->str + (frame->len - payload_len),
+                                            payload_len,
+                                            (guint8 *) &masking_key);
     }
 }
 
 static gboolean
-send_close_frame (EvdWebsocketData  *data,
-                  guint16            code,
-                  const gchar       *reason,
-                  GError           **error)
+write_frames (EvdWebsocketData *data, GError **error)
 {
-  gboolean result = TRUE;
-  GString *frame;
   GOutputStream *stream;
+  gboolean result = TRUE;
 
-  /* @TODO: send the code and reason. By now send no payload */
-  data->frame_data = NULL;
-  data->frame_len = 0;
-
-  frame = g_string_new ("");
-  build_frame (frame,
-               TRUE,
-               OPCODE_CLOSE,
-               (! data->server),
-               data->frame_data,
-               data->frame_len);
+  if (data->out_buf->len == 0)
+    return TRUE;
 
   stream = g_io_stream_get_output_stream (G_IO_STREAM (data->conn));
   if (g_output_stream_write (stream,
-                             frame->str,
-                             frame->len,
+                             data->out_buf->str,
+                             data->out_buf->len,
                              NULL,
                              error) < 0)
     {
       result = FALSE;
     }
 
-  g_string_free (frame, TRUE);
+  /* don't keep the memory of an unusually large burst around */
+  if (data->out_buf->allocated_len > MAX_READ_SIZE * 2)
+    {
+      g_string_free (data->out_buf, TRUE);
+      data->out_buf = g_string_sized_new (BLOCK_SIZE);
+    }
+  else
+    {
+      g_string_truncate (data->out_buf, 0);
+    }
 
   return result;
 }
 
 static gboolean
-send_data_frame (EvdWebsocketData  *data,
-                 const gchar       *frame,
-                 gsize              frame_len,
-                 EvdMessageType     frame_type,
-                 GError           **error)
+flush_timeout (gpointer user_data)
 {
-  gsize bytes_sent;
-  gsize bytes_left;
-  GString *frag;
-  GOutputStream *stream;
-  gboolean result = TRUE;
+  EvdWebsocketData *data = user_data;
+  EvdHttpConnection *conn = data->conn;
+  GError *error = NULL;
 
-  frag = g_string_new ("");
+  data->flush_src_id = 0;
 
-  stream = g_io_stream_get_output_stream (G_IO_STREAM (data->conn));
+  if (! write_frames (data, &error))
+    {
+      /* @TODO: log error properly */
+      g_print ("Error writing to WebSocket: %s\n", error->message);
+      g_error_free (error);
+
+      g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
+    }
+
+  g_object_unref (conn);
+
+  return FALSE;
+}
+
+/* Writes the frames queued in 'out_buf', right away unless coalescing. In
+   that case they are written along with any other frames queued within
+   'coalesce_max_latency' milliseconds, or within the current main loop
+   iteration if it is 0. */
+static gboolean
+queue_frames (EvdWebsocketData *data, GError **error)
+{
+  if (! data->coalesce || data->out_buf->len >= COALESCE_MAX_SIZE)
+    return write_frames (data, error);
+
+  if (data->flush_src_id == 0)
+    {
+      g_object_ref (data->conn);
+      data->flush_src_id = evd_timeout_add (NULL,
+                                            data->coalesce_max_latency,
+                                            G_PRIORITY_DEFAULT,
+                                            flush_timeout,
+                                            data);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+send_close_frame (EvdWebsocketData  *data,
+                  guint16            code,
+                  const gchar       *reason,
+                  GError           **error)
+{
+  /* @TODO: send the code and reason. By now send no payload */
+  data->frame_data = NULL;
+  data->frame_len = 0;
+
+  /* frames still queued go out first */
+  build_frame (data->out_buf,
+               TRUE,
+               OPCODE_CLOSE,
+               FALSE,
+               (! data->server),
+               data->frame_data,
+               data->frame_len);
+
+  return write_frames (data, error);
+}
+
+/* Serializes a message into @out, split in fragments of at most
+   MAX_FRAGMENT_SIZE bytes */
+static void
+build_message (GString        *out,
+               const gchar    *payload,
+               gsize           payload_len,
+               EvdMessageType  type,
+               gboolean        compressed,
+               gboolean        masked)
+{
+  gsize bytes_sent;
+  gsize bytes_left;
 
   bytes_sent = 0;
-  bytes_left = frame_len;
+  bytes_left = payload_len;
   while (bytes_left > 0)
     {
       gsize frag_len;
       gboolean fin;
       guint8 opcode;
-      gboolean masked;
 
       frag_len = MIN (MAX_FRAGMENT_SIZE, bytes_left);
 
       fin = frag_len >= bytes_left;
 
       opcode = bytes_sent == 0 ?
-        (frame_type == EVD_MESSAGE_TYPE_TEXT ? OPCODE_TEXT_FRAME : OPCODE_BINARY_FRAME) :
+        (type == EVD_MESSAGE_TYPE_TEXT ? OPCODE_TEXT_FRAME : OPCODE_BINARY_FRAME) :
         OPCODE_CONTINUATION;
 
-      masked = ! data->server;
-
-      build_frame (frag,
+      build_frame (out,
                    fin,
                    opcode,
+                   compressed && bytes_sent == 0,
                    masked,
-                   frame + bytes_sent,
+                   payload + bytes_sent,
                    frag_len);
 
-      if (! g_output_stream_write (stream,
-                                   frag->str,
-                                   frag->len,
-                                   NULL,
-                                   error) < 0)
-        {
-          result = FALSE;
-          break;
-        }
-
       bytes_sent += frag_len;
       bytes_left -= frag_len;
+    }
+}
 
-      g_string_set_size (frag, 0);
+static gboolean
+send_data_frame (EvdWebsocketData  *data,
+                 const gchar       *frame,
+                 gsize              frame_len,
+                 EvdMessageType     frame_type,
+                 GError           **error)
+{
+  GString *compressed = NULL;
+
+  if (data->deflater != NULL && frame_len >= DEFLATE_MIN_SIZE)
+    {
+      compressed = g_string_sized_new (frame_len / 2 + DEFLATE_MIN_SIZE);
+
+      if (! deflate_message (data, frame, frame_len, compressed))
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_FAILED,
+                       "Failed to compress websocket message");
+          g_string_free (compressed, TRUE);
+          return FALSE;
+        }
+
+      frame = compressed->str;
+      frame_len = compressed->len;
     }
 
-  g_string_free (frag, TRUE);
+  build_message (data->out_buf,
+                 frame,
+                 frame_len,
+                 frame_type,
+                 compressed != NULL,
+                 ! data->server);
 
-  return result;
+  if (compressed != NULL)
+    g_string_free (compressed, TRUE);
+
+  return queue_frames (data, error);
 }
 
 static gboolean
@@ -323,9 +705,145 @@ handle_control_frame (EvdWebsocketData *data)
   return TRUE;
 }
 
+static void
+fail_connection (EvdWebsocketData *data)
+{
+  data->state = EVD_WEBSOCKET_STATE_CLOSED;
+  data->reading_state = EVD_WEBSOCKET_READING_STATE_IDLE;
+  g_io_stream_close (G_IO_STREAM (data->conn), NULL, NULL);
+}
+
+static gboolean
+check_payload_len (EvdWebsocketData *data)
+{
+  if (data->opcode >= OPCODE_CLOSE)
+    {
+      /* control frames can't be fragmented nor carry more than 125 bytes */
+      if (! data->fin || data->payload_len > 125)
+        {
+          fail_connection (data);
+          return FALSE;
+        }
+    }
+  else if (data->payload_len > data->max_message_size ||
+           data->message_len > data->max_message_size - data->payload_len)
+    {
+      fail_connection (data);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+finish_data_frame (EvdWebsocketData *data)
+{
+  if (data->fin)
+    {
+      data->message_opcode = 0;
+      data->message_len = 0;
+    }
+  else
+    {
+      data->message_len += data->payload_len;
+    }
+
+  data->payload_read = 0;
+  data->reading_state = EVD_WEBSOCKET_READING_STATE_IDLE;
+}
+
+/* Returns the inflated @buf if the message being received is compressed,
+   or @buf itself otherwise. Returns NULL and fails the connection if the
+   payload is corrupt or inflates over 'max-message-size'. */
+static const gchar *
+inflate_payload (EvdWebsocketData *data,
+                 const gchar      *buf,
+                 gsize            *len,
+                 gboolean          is_last)
+{
+  if (! data->message_compressed)
+    return buf;
+
+  /* don't keep the memory of an unusually large message around */
+  if (data->inflated->allocated_len > MAX_READ_SIZE * 2)
+    {
+      g_string_free (data->inflated, TRUE);
+      data->inflated = g_string_sized_new (DEFLATE_CHUNK_SIZE);
+    }
+  g_string_truncate (data->inflated, 0);
+
+  if (! inflate_append (data, buf, *len, data->inflated) ||
+      (is_last && ! inflate_finish (data, data->inflated)))
+    {
+      fail_connection (data);
+      return NULL;
+    }
+
+  *len = data->inflated->len;
+
+  return data->inflated->str;
+}
+
+/* Hands the payload to the stream callback as it arrives, without waiting
+   for the whole frame nor buffering the fragments of a message */
+static gboolean
+read_payload_slice (EvdWebsocketData *data)
+{
+  gchar *slice;
+  gsize slice_len;
+  gboolean is_binary;
+  gboolean is_last;
+
+  slice_len = MIN (data->buf_len - data->offset,
+                   data->payload_len - data->payload_read);
+  if (slice_len == 0 && data->payload_read < data->payload_len)
+    return FALSE;
+
+  slice = data->buf->str + data->offset;
+
+  if (data->masked)
+    {
+      guint8 masking_key[4];
+      gint i;
+
+      /* the slice may start anywhere in the masking key cycle */
+      for (i = 0; i < 4; i++)
+        masking_key[i] = data->masking_key[(data->payload_read + i) % 4];
+
+      evd_websocket_protocol_apply_masking (slice, slice_len, masking_key);
+    }
+
+  data->offset += slice_len;
+  data->payload_read += slice_len;
+
+  is_binary = (data->opcode == OPCODE_CONTINUATION ?
+               data->message_opcode :
+               data->opcode) == OPCODE_BINARY_FRAME;
+  is_last = data->fin && data->payload_read == data->payload_len;
+
+  if (data->payload_read == data->payload_len)
+    finish_data_frame (data);
+
+  slice = inflate_payload (data, slice, &slice_len, is_last);
+  if (slice == NULL)
+    return TRUE;
+
+  data->stream_cb (EVD_HTTP_CONNECTION (data->conn),
+                   slice,
+                   slice_len,
+                   is_binary,
+                   is_last,
+                   data->user_data);
+
+  return data->reading_state == EVD_WEBSOCKET_READING_STATE_IDLE;
+}
+
 static gboolean
 read_payload (EvdWebsocketData *data)
 {
+  if (data->opcode < OPCODE_CLOSE && data->stream_cb != NULL)
+    return read_payload_slice (data);
+
   if (data->buf_len - data->offset < data->payload_len)
     return FALSE;
 
@@ -335,43 +853,70 @@ read_payload (EvdWebsocketData *data)
   data->frame_data = data->buf->str + data->offset + data->extension_len;
 
   if (data->masked)
-    apply_masking (data->frame_data, data->frame_len, data->masking_key);
+    evd_websocket_protocol_apply_masking (data->frame_data,
+                                          data->frame_len,
+                                          data->masking_key);
+
+  data->offset += data->payload_len;
 
   if (data->opcode >= OPCODE_CLOSE)
     {
       /* control frame */
+      data->reading_state = EVD_WEBSOCKET_READING_STATE_IDLE;
+
       handle_control_frame (data);
     }
+  else if (data->fin && data->opcode != OPCODE_CONTINUATION)
+    {
+      /* unfragmented data frame, delivered straight from the buffer */
+      const gchar *frame_data;
+      gsize frame_len = data->frame_len;
+
+      finish_data_frame (data);
+
+      frame_data = inflate_payload (data, data->frame_data, &frame_len, TRUE);
+      if (frame_data != NULL)
+        data->frame_cb (EVD_HTTP_CONNECTION (data->conn),
+                        frame_data,
+                        frame_len,
+                        data->opcode == OPCODE_BINARY_FRAME,
+                        data->user_data);
+    }
   else
     {
-      /* data frame */
+      /* fragment of a message, reassembled until the last one arrives */
+      guint8 opcode = data->message_opcode;
+
+      if (data->message == NULL)
+        data->message = g_string_sized_new (data->frame_len);
+      g_string_append_len (data->message, data->frame_data, data->frame_len);
+
+      finish_data_frame (data);
 
       if (data->fin)
         {
-          data->frame_cb (EVD_HTTP_CONNECTION (data->conn),
-                          data->frame_data,
-                          data->frame_len,
-                          data->opcode == OPCODE_BINARY_FRAME,
-                          data->user_data);
-        }
-      else
-        {
-          /* @TODO: handle fragmented frames */
-          g_warning ("Error, receiving fragmented frames is not yet implemented"
-                     " in websocket version 08");
-          data->state = EVD_WEBSOCKET_STATE_CLOSED;
-          g_io_stream_close (G_IO_STREAM (data->conn), NULL, NULL);
+          GString *message = data->message;
+          const gchar *message_data;
+          gsize message_len = message->len;
+
+          data->message = NULL;
+
+          message_data = inflate_payload (data,
+                                          message->str,
+                                          &message_len,
+                                          TRUE);
+          if (message_data != NULL)
+            data->frame_cb (EVD_HTTP_CONNECTION (data->conn),
+                            message_data,
+                            message_len,
+                            opcode == OPCODE_BINARY_FRAME,
+                            data->user_data);
+
+          g_string_free (message, TRUE);
         }
     }
 
-  /* reset state */
-  data->offset += data->payload_len;
-  data->reading_state = EVD_WEBSOCKET_READING_STATE_IDLE;
-
-  g_string_erase (data->buf, 0, data->offset);
-  data->buf_len -= data->offset;
-  data->offset = 0;
-
+  /* the buffer is compacted once all frames are parsed */
   return TRUE;
 }
 
@@ -420,7 +965,8 @@ read_payload_len (EvdWebsocketData *data)
       data->payload_len = (gsize) GUINT64_FROM_BE(len);
     }
 
-  /* @TODO: validated payload length against MAX_PAYLOAD_SIZE */
+  if (! check_payload_len (data))
+    return TRUE;
 
   if (data->masked)
     data->reading_state = EVD_WEBSOCKET_READING_STATE_MASKING_KEY;
@@ -455,18 +1001,85 @@ read_header (EvdWebsocketData *data)
   /* payload len */
   data->payload_len = header & HEADER_MASK_PAYLOAD_LEN;
 
-  /* @TODO: validate header values */
+  /* only permessage-deflate's RSV1 is understood, and only on the first
+     frame of a data message */
+  if ((header & HEADER_MASK_RSV2_3) != 0 ||
+      ((header & HEADER_MASK_RSV1) != 0 &&
+       (data->inflater == NULL ||
+        data->opcode == OPCODE_CONTINUATION ||
+        data->opcode >= OPCODE_CLOSE)))
+    {
+      fail_connection (data);
+      return TRUE;
+    }
+
+  /* a continuation must follow a non-final data frame, and a new message
+     can't start until the fragmented one is complete */
+  if (data->opcode == OPCODE_CONTINUATION)
+    {
+      if (data->message_opcode == 0)
+        {
+          fail_connection (data);
+          return TRUE;
+        }
+    }
+  else if (data->opcode < OPCODE_CLOSE)
+    {
+      if (data->message_opcode != 0)
+        {
+          fail_connection (data);
+          return TRUE;
+        }
+
+      if (! data->fin)
+        data->message_opcode = data->opcode;
+
+      data->message_compressed = (header & HEADER_MASK_RSV1) != 0;
+      data->inflated_len = 0;
+    }
 
   if (data->payload_len > 125)
-    data->reading_state = EVD_WEBSOCKET_READING_STATE_PAYLOAD_LEN;
-  else if (data->masked)
-    data->reading_state = EVD_WEBSOCKET_READING_STATE_MASKING_KEY;
+    {
+      data->reading_state = EVD_WEBSOCKET_READING_STATE_PAYLOAD_LEN;
+    }
   else
-    data->reading_state = EVD_WEBSOCKET_READING_STATE_PAYLOAD;
+    {
+      if (! check_payload_len (data))
+        return TRUE;
+
+      if (data->masked)
+        data->reading_state = EVD_WEBSOCKET_READING_STATE_MASKING_KEY;
+      else
+        data->reading_state = EVD_WEBSOCKET_READING_STATE_PAYLOAD;
+    }
 
   return TRUE;
 }
 
+static void
+compact_buffer (EvdWebsocketData *data)
+{
+  if (data->offset == 0)
+    return;
+
+  /* parsing state is kept in @data, not as pointers into the buffer, so
+     only the bytes not consumed yet need to be moved to the front */
+  if (data->offset < data->buf_len)
+    memmove (data->buf->str,
+             data->buf->str + data->offset,
+             data->buf_len - data->offset);
+
+  data->buf_len -= data->offset;
+  data->offset = 0;
+
+  /* release the memory taken by an unusually large frame */
+  if (data->buf_len == 0 && data->buf->len > MAX_READ_SIZE * 2)
+    {
+      g_string_free (data->buf, TRUE);
+      data->buf = g_string_sized_new (data->read_size);
+    }
+}
+
 static gboolean
 process_data (EvdWebsocketData *data)
 {
@@ -475,23 +1088,23 @@ process_data (EvdWebsocketData *data)
     {
       if (data->reading_state == EVD_WEBSOCKET_READING_STATE_IDLE)
         if (! read_header (data))
-          return TRUE;
+          goto out;
 
       switch (data->reading_state)
         {
         case EVD_WEBSOCKET_READING_STATE_PAYLOAD_LEN:
           if (! read_payload_len (data))
-            return TRUE;
+            goto out;
           break;
 
         case EVD_WEBSOCKET_READING_STATE_MASKING_KEY:
           if (! read_masking_key (data))
-            return TRUE;
+            goto out;
           break;
 
         case EVD_WEBSOCKET_READING_STATE_PAYLOAD:
           if (! read_payload (data))
-            return TRUE;
+            goto out;
           break;
 
         default:
@@ -501,7 +1114,13 @@ process_data (EvdWebsocketData *data)
         }
     }
 
-  return data->state != EVD_WEBSOCKET_STATE_CLOSED;
+ out:
+  if (data->state == EVD_WEBSOCKET_STATE_CLOSED)
+    return FALSE;
+
+  compact_buffer (data);
+
+  return TRUE;
 }
 
 static void
@@ -535,6 +1154,12 @@ on_connection_read (GObject      *obj,
     {
       data->buf_len += size;
 
+      /* grow the reads while they come full, shrink them when mostly empty */
+      if ((gsize) size == data->read_requested)
+        data->read_size = MIN (data->read_size * 2, MAX_READ_SIZE);
+      else if ((gsize) size < data->read_size / 4)
+        data->read_size = MAX (data->read_size / 2, BLOCK_SIZE);
+
       if (data->state != EVD_WEBSOCKET_STATE_CLOSED &&
           process_data (data))
         read_from_connection (data);
@@ -547,18 +1172,33 @@ static void
 read_from_connection (EvdWebsocketData *data)
 {
   GInputStream *stream;
+  gsize read_size;
 
   g_return_if_fail (data != NULL);
 
-  if (data->buf_len + BLOCK_SIZE >= data->buf->len)
-    g_string_set_size (data->buf, data->buf_len + BLOCK_SIZE);
+  read_size = data->read_size;
+
+  /* the rest of a large payload is read in as few rounds as possible */
+  if (data->reading_state == EVD_WEBSOCKET_READING_STATE_PAYLOAD &&
+      data->stream_cb == NULL &&
+      data->offset + data->payload_len > data->buf_len)
+    {
+      read_size = MAX (read_size,
+                       MIN (data->offset + data->payload_len - data->buf_len,
+                            MAX_READ_SIZE));
+    }
+
+  if (data->buf_len + read_size > data->buf->len)
+    g_string_set_size (data->buf, data->buf_len + read_size);
+
+  data->read_requested = read_size;
 
   stream = g_io_stream_get_input_stream (G_IO_STREAM (data->conn));
 
   g_object_ref (data->conn);
   g_input_stream_read_async (stream,
                              data->buf->str + data->buf_len,
-                             BLOCK_SIZE,
+                             read_size,
                              G_PRIORITY_DEFAULT,
                              NULL,
                              on_connection_read,
@@ -641,6 +1281,22 @@ free_websocket_connection_data (EvdWebsocketData *data)
   if (data->buf != NULL)
     g_string_free (data->buf, TRUE);
 
+  if (data->message != NULL)
+    g_string_free (data->message, TRUE);
+
+  if (data->deflater != NULL)
+    {
+      deflateEnd (data->deflater);
+      g_slice_free (z_stream, data->deflater);
+    }
+
+  if (data->inflater != NULL)
+    {
+      inflateEnd (data->inflater);
+      g_slice_free (z_stream, data->inflater);
+      g_string_free (data->inflated, TRUE);
+    }
+
   if (data->close_timeout_src_id != 0)
     {
       g_source_remove (data->close_timeout_src_id);
@@ -648,29 +1304,98 @@ free_websocket_connection_data (EvdWebsocketData *data)
       g_object_unref (data->conn);
     }
 
+  if (data->flush_src_id != 0)
+    {
+      g_source_remove (data->flush_src_id);
+      data->flush_src_id = 0;
+      g_object_unref (data->conn);
+    }
+
+  g_string_free (data->out_buf, TRUE);
+
   g_free (data->close_reason);
 
   g_slice_free (EvdWebsocketData, data);
 }
 
-static void
-setup_connection (EvdHttpConnection *conn,
-                  gboolean           is_server,
-                  EvdWebsocketState  state)
+/* @deflate_window_bits is the window our side compresses with, or 0 if
+   permessage-deflate was not negotiated */
+static gboolean
+setup_connection (EvdHttpConnection  *conn,
+                  gboolean            is_server,
+                  EvdWebsocketState   state,
+                  guint8              deflate_window_bits,
+                  gboolean            deflate_no_context_takeover,
+                  GError            **error)
 {
   EvdWebsocketData *data;
+  z_stream *deflater;
+  z_stream *inflater;
+  gint err;
+
+  data = g_slice_new0 (EvdWebsocketData);
+
+  data->conn = conn;
+  data->server = is_server;
+  data->state = state;
+  data->reading_state = EVD_WEBSOCKET_READING_STATE_IDLE;
+  data->max_message_size = EVD_WEBSOCKET_DEFAULT_MAX_MESSAGE_SIZE;
+  data->out_buf = g_string_sized_new (BLOCK_SIZE);
+
+  if (deflate_window_bits > 0)
+    {
+      /* raw deflate streams, hence the negative window bits. The peer may
+         compress with any window, so inflate with the largest. The streams
+         are only kept once initialized, so that they are never used or
+         ended half-way set up. */
+      deflater = g_slice_new0 (z_stream);
+      err = deflateInit2 (deflater,
+                          Z_DEFAULT_COMPRESSION,
+                          Z_DEFLATED,
+                          -deflate_window_bits,
+                          8,
+                          Z_DEFAULT_STRATEGY);
+      if (err != Z_OK)
+        {
+          g_slice_free (z_stream, deflater);
+          goto error;
+        }
+
+      inflater = g_slice_new0 (z_stream);
+      err = inflateInit2 (inflater, -15);
+      if (err != Z_OK)
+        {
+          g_slice_free (z_stream, inflater);
+          deflateEnd (deflater);
+          g_slice_free (z_stream, deflater);
+          goto error;
+        }
 
-  data = g_slice_new0 (EvdWebsocketData);
+      data->deflater = deflater;
+      data->deflate_window_bits = deflate_window_bits;
+      data->deflate_no_context_takeover = deflate_no_context_takeover;
 
-  data->conn = conn;
-  data->server = is_server;
-  data->state = state;
-  data->reading_state = EVD_WEBSOCKET_READING_STATE_IDLE;
+      data->inflater = inflater;
+      data->inflated = g_string_sized_new (DEFLATE_CHUNK_SIZE);
+    }
 
   g_object_set_data_full (G_OBJECT (conn),
                           EVD_WEBSOCKET_DATA_KEY,
                           data,
                           (GDestroyNotify) free_websocket_connection_data);
+
+  return TRUE;
+
+ error:
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_FAILED,
+               "Failed to set up permessage-deflate: %s",
+               zError (err));
+
+  free_websocket_connection_data (data);
+
+  return FALSE;
 }
 
 static void
@@ -745,13 +1470,206 @@ on_connection_flushed (GObject      *obj,
 
 /* public methods */
 
+typedef struct
+{
+  guint8 server_max_window_bits;
+  guint8 client_max_window_bits;
+  gboolean server_no_context_takeover;
+  gboolean client_no_context_takeover;
+} DeflateParams;
+
+static gboolean
+parse_window_bits (const gchar *value, guint8 *window_bits)
+{
+  gchar *end;
+  guint64 bits;
+
+  bits = g_ascii_strtoull (value, &end, 10);
+  if (end == value || *end != '\0' || bits < 8 || bits > 15)
+    return FALSE;
+
+  *window_bits = (guint8) bits;
+
+  return TRUE;
+}
+
+/* Parses one permessage-deflate offer or response, RFC 7692 section 7.
+   Window bits parameters given without a value are set to 15. Returns
+   FALSE if the element is not permessage-deflate or has invalid params. */
+static gboolean
+parse_deflate_params (const gchar   *element,
+                      DeflateParams *params)
+{
+  gchar **tokens;
+  gboolean result = TRUE;
+  gint i;
+
+  memset (params, 0, sizeof (DeflateParams));
+
+  tokens = g_strsplit (element, ";", -1);
+
+  if (tokens[0] == NULL ||
+      g_strcmp0 (g_strstrip (tokens[0]), DEFLATE_EXTENSION) != 0)
+    {
+      g_strfreev (tokens);
+      return FALSE;
+    }
+
+  for (i = 1; tokens[i] != NULL && result; i++)
+    {
+      gchar *name;
+      gchar *value;
+
+      name = g_strstrip (tokens[i]);
+      value = strchr (name, '=');
+      if (value != NULL)
+        {
+          *value = '\0';
+          value = g_strstrip (value + 1);
+          g_strchomp (name);
+
+          /* values may be quoted */
+          if (value[0] == '"' && strlen (value) > 1 &&
+              value[strlen (value) - 1] == '"')
+            {
+              value[strlen (value) - 1] = '\0';
+              value++;
+            }
+        }
+
+      if (g_strcmp0 (name, "server_no_context_takeover") == 0 &&
+          value == NULL && ! params->server_no_context_takeover)
+        {
+          params->server_no_context_takeover = TRUE;
+        }
+      else if (g_strcmp0 (name, "client_no_context_takeover") == 0 &&
+               value == NULL && ! params->client_no_context_takeover)
+        {
+          params->client_no_context_takeover = TRUE;
+        }
+      else if (g_strcmp0 (name, "server_max_window_bits") == 0 &&
+               value != NULL && params->server_max_window_bits == 0)
+        {
+          result = parse_window_bits (value, &params->server_max_window_bits);
+        }
+      else if (g_strcmp0 (name, "client_max_window_bits") == 0 &&
+               params->client_max_window_bits == 0)
+        {
+          if (value == NULL)
+            params->client_max_window_bits = 15;
+          else
+            result = parse_window_bits (value, &params->client_max_window_bits);
+        }
+      else
+        {
+          result = FALSE;
+        }
+    }
+
+  g_strfreev (tokens);
+
+  return result;
+}
+
+/* Picks permessage-deflate out of the server's Sec-WebSocket-Extensions
+   list, which may name other extensions too. Returns FALSE if it is not
+   there, appears more than once or has invalid params. */
+static gboolean
+find_deflate_response (const gchar   *header,
+                       DeflateParams *params)
+{
+  GSList *elements;
+  GSList *node;
+  guint found = 0;
+  gboolean valid = TRUE;
+
+  elements = soup_header_parse_list (header);
+
+  for (node = elements; node != NULL; node = node->next)
+    {
+      gchar *name;
+
+      name = g_strstrip (g_strndup (node->data, strcspn (node->data, ";")));
+
+      if (g_strcmp0 (name, DEFLATE_EXTENSION) == 0)
+        {
+          found++;
+          valid = parse_deflate_params (node->data, params) && valid;
+        }
+
+      g_free (name);
+    }
+
+  soup_header_free_list (elements);
+
+  return found == 1 && valid;
+}
+
+/* Accepts the first of the client's permessage-deflate offers that can be
+   satisfied. Returns the response to send, or NULL if none was accepted. */
+static gchar *
+negotiate_deflate (SoupMessageHeaders               *req_headers,
+                   const EvdWebsocketDeflateOptions *deflate,
+                   guint8                           *window_bits,
+                   gboolean                         *no_context_takeover)
+{
+  const gchar *header;
+  GSList *offers;
+  GSList *node;
+  gchar *response = NULL;
+
+  header = soup_message_headers_get_list (req_headers,
+                                          "Sec-WebSocket-Extensions");
+  if (header == NULL)
+    return NULL;
+
+  offers = soup_header_parse_list (header);
+
+  for (node = offers; node != NULL && response == NULL; node = node->next)
+    {
+      DeflateParams params;
+      GString *str;
+
+      if (! parse_deflate_params (node->data, &params))
+        continue;
+
+      *window_bits = deflate->max_window_bits;
+      if (params.server_max_window_bits > 0)
+        *window_bits = MIN (*window_bits, params.server_max_window_bits);
+
+      /* zlib can't produce raw deflate streams with a 256 bytes window */
+      if (*window_bits < 9)
+        continue;
+
+      *no_context_takeover = deflate->no_context_takeover ||
+        params.server_no_context_takeover;
+
+      str = g_string_new (DEFLATE_EXTENSION);
+      if (*no_context_takeover)
+        g_string_append (str, "; server_no_context_takeover");
+      if (params.server_max_window_bits > 0 || *window_bits < 15)
+        g_string_append_printf (str, "; server_max_window_bits=%u",
+                                *window_bits);
+
+      response = g_string_free (str, FALSE);
+    }
+
+  soup_header_free_list (offers);
+
+  return response;
+}
+
 gboolean
-evd_websocket_protocol_handle_handshake_request (EvdHttpConnection  *conn,
-                                                 EvdHttpRequest     *request,
-                                                 GError            **error)
+evd_websocket_protocol_handle_handshake_request (EvdHttpConnection                 *conn,
+                                                 EvdHttpRequest                    *request,
+                                                 const EvdWebsocketDeflateOptions  *deflate,
+                                                 GError                           **error)
 {
   guint8 version;
   gboolean result = FALSE;
+  gchar *extensions = NULL;
+  guint8 deflate_window_bits = 0;
+  gboolean deflate_no_context_takeover = FALSE;
 
   g_return_val_if_fail (EVD_IS_HTTP_CONNECTION (conn), FALSE);
   g_return_val_if_fail (EVD_IS_HTTP_REQUEST (request), FALSE);
@@ -810,6 +1728,29 @@ evd_websocket_protocol_handle_handshake_request (EvdHttpConnection  *conn,
 
   g_free (accept_key);
 
+  if (deflate != NULL)
+    extensions = negotiate_deflate (req_headers,
+                                    deflate,
+                                    &deflate_window_bits,
+                                    &deflate_no_context_takeover);
+  if (extensions != NULL)
+    soup_message_headers_replace (res_headers,
+                                  "Sec-WebSocket-Extensions",
+                                  extensions);
+  else
+    deflate_window_bits = 0;
+
+  /* setup the WebSocket connection before accepting the extensions */
+  if (! setup_connection (conn,
+                          TRUE,
+                          EVD_WEBSOCKET_STATE_OPENED,
+                          deflate_window_bits,
+                          deflate_no_context_takeover,
+                          error))
+    {
+      goto finish;
+    }
+
   /* send handshake response headers */
   if (! evd_http_connection_write_response_headers (conn,
                                                     SOUP_HTTP_1_1,
@@ -818,15 +1759,14 @@ evd_websocket_protocol_handle_handshake_request (EvdHttpConnection  *conn,
                                                     res_headers,
                                                     error))
     {
+      g_object_set_data (G_OBJECT (conn), EVD_WEBSOCKET_DATA_KEY, NULL);
       goto finish;
     }
 
-  /* success, setup the WebSocket connection */
-  setup_connection (conn, TRUE, EVD_WEBSOCKET_STATE_OPENED);
-
   result = TRUE;
 
  finish:
+  g_free (extensions);
 
   if (res_headers != NULL)
     soup_message_headers_free (res_headers);
@@ -840,10 +1780,11 @@ evd_websocket_protocol_handle_handshake_request (EvdHttpConnection  *conn,
  * Returns: (transfer full):
  **/
 EvdHttpRequest *
-evd_websocket_protocol_create_handshake_request (const gchar  *url,
-                                                 const gchar  *sub_protocol,
-                                                 const gchar  *origin,
-                                                 gchar       **key_base64)
+evd_websocket_protocol_create_handshake_request (const gchar                       *url,
+                                                 const gchar                       *sub_protocol,
+                                                 const gchar                       *origin,
+                                                 const EvdWebsocketDeflateOptions  *deflate,
+                                                 gchar                            **key_base64)
 {
   EvdHttpRequest *request;
   SoupMessageHeaders *headers;
@@ -869,6 +1810,22 @@ evd_websocket_protocol_create_handshake_request (const gchar  *url,
                                   "Sec-WebSocket-Origin",
                                   origin);
 
+  if (deflate != NULL)
+    {
+      GString *offer;
+
+      offer = g_string_new (DEFLATE_EXTENSION "; client_max_window_bits");
+      if (deflate->max_window_bits < 15)
+        g_string_append_printf (offer, "=%u", deflate->max_window_bits);
+      if (deflate->no_context_takeover)
+        g_string_append (offer, "; client_no_context_takeover");
+
+      soup_message_headers_replace (headers,
+                                    "Sec-WebSocket-Extensions",
+                                    offer->str);
+      g_string_free (offer, TRUE);
+    }
+
   for (i=0; i<4; i++)
     {
       guint32 rnd;
@@ -893,16 +1850,22 @@ evd_websocket_protocol_create_handshake_request (const gchar  *url,
 }
 
 gboolean
-evd_websocket_protocol_handle_handshake_response (EvdHttpConnection   *conn,
-                                                  SoupHTTPVersion      http_version,
-                                                  guint                status_code,
-                                                  SoupMessageHeaders  *headers,
-                                                  const gchar         *handshake_key,
-                                                  GError             **error)
+evd_websocket_protocol_handle_handshake_response (EvdHttpConnection                 *conn,
+                                                  SoupHTTPVersion                    http_version,
+                                                  guint                              status_code,
+                                                  SoupMessageHeaders                *headers,
+                                                  const gchar                       *handshake_key,
+                                                  const EvdWebsocketDeflateOptions  *deflate,
+                                                  GError                           **error)
 {
   const gchar *accept_key;
   gchar *expected_accept_key;
   gboolean result = TRUE;
+  const gchar *extensions;
+  DeflateParams params;
+  gboolean deflate_accepted = FALSE;
+  guint8 deflate_window_bits = 0;
+  gboolean deflate_no_context_takeover = FALSE;
 
   g_return_val_if_fail (EVD_IS_HTTP_CONNECTION (conn), FALSE);
 
@@ -934,6 +1897,34 @@ evd_websocket_protocol_handle_handshake_response (EvdHttpConnection   *conn,
       return FALSE;
     }
 
+  /* the server can only accept what was offered */
+  extensions = soup_message_headers_get_list (headers,
+                                              "Sec-WebSocket-Extensions");
+  if (extensions != NULL && deflate != NULL)
+    deflate_accepted = find_deflate_response (extensions, &params);
+
+  if (extensions != NULL)
+    {
+      if (! deflate_accepted ||
+          (params.client_max_window_bits > 0 &&
+           params.client_max_window_bits < 9))
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_DATA,
+                       "Received unsupported 'Sec-WebSocket-Extensions' header");
+          return FALSE;
+        }
+
+      deflate_window_bits = deflate->max_window_bits;
+      if (params.client_max_window_bits > 0)
+        deflate_window_bits = MIN (deflate_window_bits,
+                                   params.client_max_window_bits);
+
+      deflate_no_context_takeover = deflate->no_context_takeover ||
+        params.client_no_context_takeover;
+    }
+
   expected_accept_key = get_accept_key (handshake_key);
 
   if (g_strcmp0 (accept_key, expected_accept_key) != 0)
@@ -947,7 +1938,12 @@ evd_websocket_protocol_handle_handshake_response (EvdHttpConnection   *conn,
   else
     {
       /* setup websocket data on connection */
-      setup_connection (conn, FALSE, EVD_WEBSOCKET_STATE_OPENED);
+      result = setup_connection (conn,
+                                 FALSE,
+                                 EVD_WEBSOCKET_STATE_OPENED,
+                                 deflate_window_bits,
+                                 deflate_no_context_takeover,
+                                 error);
     }
 
   g_free (expected_accept_key);
@@ -985,6 +1981,7 @@ evd_websocket_protocol_bind (EvdHttpConnection   *conn,
   data->user_data_destroy_notify = user_data_destroy_notify;
 
   data->buf = g_string_new_len ("", BLOCK_SIZE);
+  data->read_size = BLOCK_SIZE;
 
   /* start reading from websocket endpoint */
   read_from_connection (data);
@@ -1003,6 +2000,7 @@ evd_websocket_protocol_unbind (EvdHttpConnection *conn)
 
   data->frame_cb = NULL;
   data->close_cb = NULL;
+  data->stream_cb = NULL;
 
   if (data->user_data != NULL && data->user_data_destroy_notify != NULL)
     data->user_data_destroy_notify (data->user_data);
@@ -1129,3 +2127,326 @@ evd_websocket_protocol_get_state (EvdHttpConnection *conn)
   else
     return data->state;
 }
+
+/**
+ * evd_websocket_protocol_set_max_message_size:
+ * @max_message_size: maximum size in bytes of a data message
+ *
+ * Sets the limit on the size of received messages, counting all the
+ * fragments of a fragmented one. The connection is closed if the peer
+ * exceeds it. Defaults to 1 GiB.
+ **/
+void
+evd_websocket_protocol_set_max_message_size (EvdHttpConnection *conn,
+                                             gsize              max_message_size)
+{
+  EvdWebsocketData *data;
+
+  g_return_if_fail (EVD_IS_HTTP_CONNECTION (conn));
+
+  data = g_object_get_data (G_OBJECT (conn), EVD_WEBSOCKET_DATA_KEY);
+  g_return_if_fail (data != NULL);
+
+  data->max_message_size = max_message_size;
+}
+
+/**
+ * evd_websocket_protocol_set_stream_cb:
+ * @stream_cb: (allow-none) (scope notified):
+ *
+ * Makes received data messages be handed to @stream_cb in slices, as they
+ * arrive from the network, instead of to the frame callback once complete.
+ * Slices are only valid during the call, and the last one of a message has
+ * the @is_last argument set. It is called with the user data given to
+ * evd_websocket_protocol_bind(). Passing %NULL restores delivery of whole
+ * messages.
+ **/
+void
+evd_websocket_protocol_set_stream_cb (EvdHttpConnection    *conn,
+                                      EvdWebsocketStreamCb  stream_cb)
+{
+  EvdWebsocketData *data;
+
+  g_return_if_fail (EVD_IS_HTTP_CONNECTION (conn));
+
+  data = g_object_get_data (G_OBJECT (conn), EVD_WEBSOCKET_DATA_KEY);
+  g_return_if_fail (data != NULL);
+
+  data->stream_cb = stream_cb;
+}
+
+/**
+ * evd_websocket_protocol_set_coalescing:
+ * @coalesce: whether to coalesce outbound frames
+ * @max_latency: maximum time in milliseconds a frame can wait to be written
+ *
+ * When enabled, frames sent are queued and written together, in a single
+ * operation, once @max_latency milliseconds have passed since the first
+ * one was queued, or at the end of the current main loop iteration if
+ * @max_latency is 0. Frames are written right away if a burst grows over
+ * 64 KiB, and when a close frame is sent. Disabling it writes the frames
+ * queued so far.
+ **/
+void
+evd_websocket_protocol_set_coalescing (EvdHttpConnection *conn,
+                                       gboolean           coalesce,
+                                       guint              max_latency)
+{
+  EvdWebsocketData *data;
+
+  g_return_if_fail (EVD_IS_HTTP_CONNECTION (conn));
+
+  data = g_object_get_data (G_OBJECT (conn), EVD_WEBSOCKET_DATA_KEY);
+  g_return_if_fail (data != NULL);
+
+  data->coalesce = coalesce;
+  data->coalesce_max_latency = max_latency;
+
+  if (! coalesce && data->flush_src_id != 0)
+    {
+      g_source_remove (data->flush_src_id);
+      flush_timeout (data);
+    }
+}
+
+/**
+ * evd_websocket_protocol_frame_new:
+ * @payload: (array length=payload_len):
+ *
+ * Creates a message that can be sent to any number of connections with
+ * evd_websocket_protocol_send_frame(). It is serialized only once for all
+ * the server side connections that share the same compression settings.
+ *
+ * Returns: (transfer full):
+ **/
+EvdWebsocketFrame *
+evd_websocket_protocol_frame_new (const gchar    *payload,
+                                  gsize           payload_len,
+                                  EvdMessageType  type)
+{
+  EvdWebsocketFrame *frame;
+
+  g_return_val_if_fail (payload != NULL || payload_len == 0, NULL);
+
+  frame = g_slice_new0 (EvdWebsocketFrame);
+  frame->ref_count = 1;
+
+  frame->payload = g_memdup (payload, payload_len);
+  frame->payload_len = payload_len;
+  frame->type = type;
+
+  frame->serialized = g_string_sized_new (payload_len + 14);
+  build_message (frame->serialized,
+                 payload,
+                 payload_len,
+                 type,
+                 FALSE,
+                 FALSE);
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  frame->mutex = g_mutex_new ();
+#else
+  g_mutex_init (&frame->mutex);
+#endif
+
+  return frame;
+}
+
+EvdWebsocketFrame *
+evd_websocket_protocol_frame_ref (EvdWebsocketFrame *frame)
+{
+  g_return_val_if_fail (frame != NULL, NULL);
+
+  g_atomic_int_inc (&frame->ref_count);
+
+  return frame;
+}
+
+void
+evd_websocket_protocol_frame_unref (EvdWebsocketFrame *frame)
+{
+  gint i;
+
+  g_return_if_fail (frame != NULL);
+
+  if (! g_atomic_int_dec_and_test (&frame->ref_count))
+    return;
+
+  g_string_free (frame->serialized, TRUE);
+
+  for (i = 0; i < 16; i++)
+    if (frame->compressed[i] != NULL)
+      g_string_free (frame->compressed[i], TRUE);
+
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_free (frame->mutex);
+#else
+  g_mutex_clear (&frame->mutex);
+#endif
+
+  g_free (frame->payload);
+
+  g_slice_free (EvdWebsocketFrame, frame);
+}
+
+static void
+frame_lock (EvdWebsocketFrame *frame)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_lock (frame->mutex);
+#else
+  g_mutex_lock (&frame->mutex);
+#endif
+}
+
+static void
+frame_unlock (EvdWebsocketFrame *frame)
+{
+#if (! GLIB_CHECK_VERSION(2, 31, 0))
+  g_mutex_unlock (frame->mutex);
+#else
+  g_mutex_unlock (&frame->mutex);
+#endif
+}
+
+/* Returns the serialization of @frame that fits the connection, or NULL
+   if it has to be built specifically for it */
+static GString *
+get_serialized_frame (EvdWebsocketData  *data,
+                      EvdWebsocketFrame *frame,
+                      GError           **error)
+{
+  GString **compressed_frame;
+  GString *compressed;
+  GString *serialized;
+
+  /* client frames are masked with a different key each, and compression
+     with context takeover depends on all previous messages */
+  if (! data->server ||
+      (data->deflater != NULL && ! data->deflate_no_context_takeover))
+    {
+      return NULL;
+    }
+
+  if (data->deflater == NULL || frame->payload_len < DEFLATE_MIN_SIZE)
+    return frame->serialized;
+
+  /* once built, a compressed form is never modified again, so it can be
+     used after unlocking */
+  frame_lock (frame);
+
+  compressed_frame = &frame->compressed[data->deflate_window_bits];
+  if (*compressed_frame == NULL)
+    {
+      /* the deflater has no context, so the output is the same for
+         every connection with this window */
+      compressed = g_string_sized_new (frame->payload_len / 2 +
+                                       DEFLATE_MIN_SIZE);
+      if (! deflate_message (data,
+                             frame->payload,
+                             frame->payload_len,
+                             compressed))
+        {
+          frame_unlock (frame);
+
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_FAILED,
+                       "Failed to compress websocket message");
+          g_string_free (compressed, TRUE);
+          return NULL;
+        }
+
+      *compressed_frame = g_string_sized_new (compressed->len + 14);
+      build_message (*compressed_frame,
+                     compressed->str,
+                     compressed->len,
+                     frame->type,
+                     TRUE,
+                     FALSE);
+
+      g_string_free (compressed, TRUE);
+    }
+
+  serialized = *compressed_frame;
+
+  frame_unlock (frame);
+
+  return serialized;
+}
+
+/**
+ * evd_websocket_protocol_send_frame:
+ *
+ * Sends a message created with evd_websocket_protocol_frame_new(). On
+ * server side connections, the bytes serialized for the first connection
+ * are reused as they are.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ **/
+gboolean
+evd_websocket_protocol_send_frame (EvdHttpConnection  *conn,
+                                   EvdWebsocketFrame  *frame,
+                                   GError            **error)
+{
+  EvdWebsocketData *data;
+  GString *serialized;
+  GError *_error = NULL;
+
+  g_return_val_if_fail (EVD_IS_HTTP_CONNECTION (conn), FALSE);
+  g_return_val_if_fail (frame != NULL, FALSE);
+
+  data = g_object_get_data (G_OBJECT (conn), EVD_WEBSOCKET_DATA_KEY);
+  if (data == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_INITIALIZED,
+                   "Given HTTP connection doesn't appear to be initialized for Websocket");
+      return FALSE;
+    }
+
+  if (data->state == EVD_WEBSOCKET_STATE_CLOSING ||
+      data->state == EVD_WEBSOCKET_STATE_CLOSED)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_CLOSED,
+                   "Websocket connection is closed");
+      return FALSE;
+    }
+
+  serialized = get_serialized_frame (data, frame, &_error);
+  if (serialized == NULL)
+    {
+      if (_error != NULL)
+        {
+          g_propagate_error (error, _error);
+          return FALSE;
+        }
+
+      return send_data_frame (data,
+                              frame->payload,
+                              frame->payload_len,
+                              frame->type,
+                              error);
+    }
+
+  /* write the shared bytes directly if nothing has to go before them */
+  if (data->out_buf->len == 0 && ! data->coalesce)
+    {
+      GOutputStream *stream;
+
+      stream = g_io_stream_get_output_stream (G_IO_STREAM (data->conn));
+
+      return g_output_stream_write (stream,
+                                    serialized->str,
+                                    serialized->len,
+                                    NULL,
+                                    error) >= 0;
+    }
+
+  g_string_append_len (data->out_buf, serialized->str, serialized->len);
+
+  return queue_frames (data, error);
+}
@@ -57,6 +57,19 @@ typedef enum
   EVD_WEBSOCKET_CLOSE_TLS_HANDSHAKE    = 1015
 } EvdWebsocketClose;
 
+/* received data messages larger than this are refused unless configured
+   otherwise, shared by the server and the protocol */
+#define EVD_WEBSOCKET_DEFAULT_MAX_MESSAGE_SIZE 0x40000000
+
+typedef struct _EvdWebsocketFrame EvdWebsocketFrame;
+
+/* permessage-deflate settings of our side of the connection, RFC 7692 */
+typedef struct
+{
+  guint8   max_window_bits;
+  gboolean no_context_takeover;
+} EvdWebsocketDeflateOptions;
+
 typedef void (* EvdWebsocketFrameCb)         (EvdHttpConnection *conn,
                                               const gchar       *frame,
                                               gsize              frame_length,
@@ -65,43 +78,75 @@ typedef void (* EvdWebsocketFrameCb)         (EvdHttpConnection *conn,
 typedef void (* EvdWebsocketCloseCb)         (EvdHttpConnection *conn,
                                               gboolean           gracefully,
                                               gpointer           user_data);
+typedef void (* EvdWebsocketStreamCb)        (EvdHttpConnection *conn,
+                                              const gchar       *data,
+                                              gsize              data_length,
+                                              gboolean           is_binary,
+                                              gboolean           is_last,
+                                              gpointer           user_data);
 
 
-gboolean          evd_websocket_protocol_handle_handshake_request  (EvdHttpConnection  *conn,
-                                                                    EvdHttpRequest     *request,
-                                                                    GError            **error);
-
-EvdHttpRequest *  evd_websocket_protocol_create_handshake_request  (const gchar  *url,
-                                                                    const gchar  *sub_protocol,
-                                                                    const gchar  *origin,
-                                                                    gchar       **key_base64);
-
-gboolean          evd_websocket_protocol_handle_handshake_response (EvdHttpConnection   *conn,
-                                                                    SoupHTTPVersion      http_version,
-                                                                    guint                status_code,
-                                                                    SoupMessageHeaders  *headers,
-                                                                    const gchar         *handshake_key,
-                                                                    GError             **error);
-
-void              evd_websocket_protocol_bind                      (EvdHttpConnection   *conn,
-                                                                    EvdWebsocketFrameCb  frame_cb,
-                                                                    EvdWebsocketCloseCb  close_cb,
-                                                                    gpointer             user_data,
-                                                                    GDestroyNotify       user_data_destroy_notify);
-void              evd_websocket_protocol_unbind                    (EvdHttpConnection *conn);
-
-gboolean          evd_websocket_protocol_close                     (EvdHttpConnection  *conn,
-                                                                    guint16             code,
-                                                                    const gchar        *reason,
-                                                                    GError            **error);
-
-gboolean          evd_websocket_protocol_send                      (EvdHttpConnection  *conn,
-                                                                    const gchar        *frame,
-                                                                    gsize               frame_len,
-                                                                    EvdMessageType      frame_type,
-                                                                    GError            **error);
-
-EvdWebsocketState evd_websocket_protocol_get_state                 (EvdHttpConnection *conn);
+gboolean           evd_websocket_protocol_handle_handshake_request  (EvdHttpConnection                 *conn,
+                                                                     EvdHttpRequest                    *request,
+                                                                     const EvdWebsocketDeflateOptions  *deflate,
+                                                                     GError                           **error);
+
+EvdHttpRequest *   evd_websocket_protocol_create_handshake_request  (const gchar                       *url,
+                                                                     const gchar                       *sub_protocol,
+                                                                     const gchar                       *origin,
+                                                                     const EvdWebsocketDeflateOptions  *deflate,
+                                                                     gchar                            **key_base64);
+
+gboolean           evd_websocket_protocol_handle_handshake_response (EvdHttpConnection                 *conn,
+                                                                     SoupHTTPVersion                    http_version,
+                                                                     guint                              status_code,
+                                                                     SoupMessageHeaders                *headers,
+                                                                     const gchar                       *handshake_key,
+                                                                     const EvdWebsocketDeflateOptions  *deflate,
+                                                                     GError                           **error);
+
+void               evd_websocket_protocol_bind                      (EvdHttpConnection   *conn,
+                                                                     EvdWebsocketFrameCb  frame_cb,
+                                                                     EvdWebsocketCloseCb  close_cb,
+                                                                     gpointer             user_data,
+                                                                     GDestroyNotify       user_data_destroy_notify);
+void               evd_websocket_protocol_unbind                    (EvdHttpConnection *conn);
+
+gboolean           evd_websocket_protocol_close                     (EvdHttpConnection  *conn,
+                                                                     guint16             code,
+                                                                     const gchar        *reason,
+                                                                     GError            **error);
+
+gboolean           evd_websocket_protocol_send                      (EvdHttpConnection  *conn,
+                                                                     const gchar        *frame,
+                                                                     gsize               frame_len,
+                                                                     EvdMessageType      frame_type,
+                                                                     GError            **error);
+
+EvdWebsocketState  evd_websocket_protocol_get_state                 (EvdHttpConnection *conn);
+
+void               evd_websocket_protocol_apply_masking             (gchar        *data,
+                                                                     gsize         data_len,
+                                                                     const guint8  masking_key[4]);
+
+void               evd_websocket_protocol_set_max_message_size      (EvdHttpConnection *conn,
+                                                                     gsize              max_message_size);
+void               evd_websocket_protocol_set_stream_cb             (EvdHttpConnection    *conn,
+                                                                     EvdWebsocketStreamCb  stream_cb);
+
+void               evd_websocket_protocol_set_coalescing            (EvdHttpConnection *conn,
+                                                                     gboolean           coalesce,
+                                                                     guint              max_latency);
+
+EvdWebsocketFrame *evd_websocket_protocol_frame_new                 (const gchar    *payload,
+                                                                     gsize           payload_len,
+                                                                     EvdMessageType  type);
+EvdWebsocketFrame *evd_websocket_protocol_frame_ref                 (EvdWebsocketFrame *frame);
+void               evd_websocket_protocol_frame_unref               (EvdWebsocketFrame *frame);
+
+gboolean           evd_websocket_protocol_send_frame                (EvdHttpConnection  *conn,
+                                                                     EvdWebsocketFrame  *frame,
+                                                                     GError            **error);
 
 G_END_DECLS
 
@@ -20,6 +20,7 @@
  * for more details.
  */
 
+#include <string.h>
 #include <libsoup/soup-headers.h>
 
 #include "evd-websocket-server.h"
@@ -33,6 +34,7 @@
 
 #define CONN_DATA_KEY      "org.eventdance.lib.WebsocketServer.CONN_DATA"
 #define PEER_DATA_KEY      "org.eventdance.lib.WebsocketServer.PEER_DATA"
+#define MORE_SLICES_KEY    "org.eventdance.lib.WebsocketServer.MORE_SLICES"
 #define HANDSHAKE_DATA_KEY "org.eventdance.lib.WebsocketServer.HANDSHAKE_DATA"
 
 #define DEFAULT_STANDALONE TRUE
@@ -41,8 +43,17 @@ struct _EvdWebsocketServerPrivate
 {
   gboolean standalone;
 
+  gboolean deflate_enabled;
+  EvdWebsocketDeflateOptions deflate;
+
   EvdHttpConnection *peer_arg_conn;
   EvdHttpRequest *peer_arg_request;
+
+  gsize max_message_size;
+  gboolean streaming;
+
+  gboolean coalesce;
+  guint coalesce_max_latency;
 };
 
 typedef struct
@@ -128,6 +139,15 @@ evd_websocket_server_init (EvdWebsocketServer *self)
 
   priv->standalone = DEFAULT_STANDALONE;
 
+  priv->deflate_enabled = FALSE;
+  priv->deflate.max_window_bits = 15;
+  priv->deflate.no_context_takeover = FALSE;
+  priv->max_message_size = EVD_WEBSOCKET_DEFAULT_MAX_MESSAGE_SIZE;
+  priv->streaming = FALSE;
+
+  priv->coalesce = FALSE;
+  priv->coalesce_max_latency = 0;
+
   evd_service_set_io_stream_type (EVD_SERVICE (self), EVD_TYPE_HTTP_CONNECTION);
 }
 
@@ -151,6 +171,32 @@ on_frame_received (EvdHttpConnection *conn,
   iface->receive (transport, peer, frame, frame_len);
 }
 
+static void
+on_slice_received (EvdHttpConnection *conn,
+                   const gchar       *slice,
+                   gsize              slice_len,
+                   gboolean           is_binary,
+                   gboolean           is_last,
+                   gpointer           user_data)
+{
+  EvdPeer *peer;
+
+  peer = EVD_PEER (g_object_get_data (G_OBJECT (conn), CONN_DATA_KEY));
+  if (peer == NULL || evd_peer_is_closed (peer))
+    return;
+
+  /* kept on the peer, since slices of several peers' messages interleave */
+  g_object_ref (peer);
+  g_object_set_data (G_OBJECT (peer),
+                     MORE_SLICES_KEY,
+                     GINT_TO_POINTER (! is_last));
+
+  on_frame_received (conn, slice, slice_len, is_binary, user_data);
+
+  g_object_set_data (G_OBJECT (peer), MORE_SLICES_KEY, NULL);
+  g_object_unref (peer);
+}
+
 static void
 on_close_requested (EvdHttpConnection *conn,
                     gboolean           gracefully,
@@ -209,6 +255,15 @@ on_websocket_connection_ready (EvdWebsocketServer *self,
                           conn,
                           g_object_unref);
 
+  evd_websocket_protocol_set_max_message_size (conn,
+                                               self->priv->max_message_size);
+  if (self->priv->streaming)
+    evd_websocket_protocol_set_stream_cb (conn, on_slice_received);
+  if (self->priv->coalesce)
+    evd_websocket_protocol_set_coalescing (conn,
+                                           TRUE,
+                                           self->priv->coalesce_max_latency);
+
   g_object_ref (self);
   evd_websocket_protocol_bind (conn,
                                on_frame_received,
@@ -344,6 +399,8 @@ evd_websocket_server_request_handler (EvdWebService     *web_service,
   /* let WebSocket protocol handle request */
   if (! evd_websocket_protocol_handle_handshake_request (conn,
                                                          request,
+                                                         self->priv->deflate_enabled ?
+                                                         &self->priv->deflate : NULL,
                                                          &error))
     {
       g_print ("%s\n", error->message);
@@ -467,6 +524,47 @@ evd_websocket_server_remove (EvdIoStreamGroup *io_stream_group,
   return TRUE;
 }
 
+static gboolean
+broadcast (EvdWebsocketServer  *self,
+           GList               *peers,
+           const gchar         *buffer,
+           gsize                size,
+           EvdMessageType       type,
+           GError             **error)
+{
+  EvdWebsocketFrame *frame;
+  GList *node;
+  gboolean result = TRUE;
+
+  frame = evd_websocket_protocol_frame_new (buffer, size, type);
+
+  for (node = peers; node != NULL; node = node->next)
+    {
+      EvdPeer *peer = EVD_PEER (node->data);
+      EvdHttpConnection *conn;
+      GError *_error = NULL;
+
+      conn = g_object_get_data (G_OBJECT (peer), PEER_DATA_KEY);
+
+      /* same fallback as evd_transport_send(), queue in peer's backlog */
+      if ((conn == NULL ||
+           ! evd_websocket_protocol_send_frame (conn, frame, NULL)) &&
+          ! evd_peer_push_message (peer, buffer, size, type, &_error))
+        {
+          if (result)
+            g_propagate_error (error, _error);
+          else
+            g_error_free (_error);
+
+          result = FALSE;
+        }
+    }
+
+  evd_websocket_protocol_frame_unref (frame);
+
+  return result;
+}
+
 static void
 evd_websocket_server_peer_closed (EvdTransport *transport,
                                   EvdPeer      *peer,
@@ -577,3 +675,211 @@ evd_websocket_server_get_validate_peer_arguments (EvdWebsocketServer  *self,
   if (request != NULL)
     *request = self->priv->peer_arg_request;
 }
+
+/**
+ * evd_websocket_server_set_max_message_size:
+ * @max_message_size: maximum size in bytes of a received message
+ *
+ * Connections whose peer sends a larger message, counting all its
+ * fragments, are closed. Applies to connections accepted from then on.
+ **/
+void
+evd_websocket_server_set_max_message_size (EvdWebsocketServer *self,
+                                           gsize               max_message_size)
+{
+  g_return_if_fail (EVD_IS_WEBSOCKET_SERVER (self));
+
+  self->priv->max_message_size = max_message_size;
+}
+
+gsize
+evd_websocket_server_get_max_message_size (EvdWebsocketServer *self)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_SERVER (self), 0);
+
+  return self->priv->max_message_size;
+}
+
+/**
+ * evd_websocket_server_set_streaming:
+ *
+ * When enabled, received messages are not buffered whole. Instead, the
+ * transport's #EvdTransport::receive signal is emitted for every slice of
+ * payload as it arrives, and evd_websocket_server_is_last_slice() tells
+ * whether the slice ends its message. Applies to connections accepted from
+ * then on.
+ **/
+void
+evd_websocket_server_set_streaming (EvdWebsocketServer *self,
+                                    gboolean            streaming)
+{
+  g_return_if_fail (EVD_IS_WEBSOCKET_SERVER (self));
+
+  self->priv->streaming = streaming;
+}
+
+gboolean
+evd_websocket_server_get_streaming (EvdWebsocketServer *self)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_SERVER (self), FALSE);
+
+  return self->priv->streaming;
+}
+
+/**
+ * evd_websocket_server_is_last_slice:
+ *
+ * To be called from a #EvdTransport::receive signal handler.
+ *
+ * Returns: %FALSE if more slices of the message being received are to
+ * come, %TRUE otherwise. Always %TRUE when streaming is disabled.
+ **/
+gboolean
+evd_websocket_server_is_last_slice (EvdWebsocketServer *self,
+                                    EvdPeer            *peer)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_SERVER (self), TRUE);
+  g_return_val_if_fail (EVD_IS_PEER (peer), TRUE);
+
+  return g_object_get_data (G_OBJECT (peer), MORE_SLICES_KEY) == NULL;
+}
+
+/**
+ * evd_websocket_server_set_deflate:
+ * @enabled: whether to negotiate permessage-deflate compression
+ * @max_window_bits: base-2 logarithm of the compression window, 9 to 15
+ * @no_context_takeover: whether to compress each message independently
+ *
+ * Configures RFC 7692 permessage-deflate compression for connections
+ * established from then on. A smaller window and no context takeover save
+ * memory and CPU at the expense of the compression ratio. The client
+ * can restrict them further during negotiation. Disabled by default.
+ **/
+void
+evd_websocket_server_set_deflate (EvdWebsocketServer *self,
+                                  gboolean            enabled,
+                                  guint8              max_window_bits,
+                                  gboolean            no_context_takeover)
+{
+  g_return_if_fail (EVD_IS_WEBSOCKET_SERVER (self));
+  g_return_if_fail (max_window_bits >= 9 && max_window_bits <= 15);
+
+  self->priv->deflate_enabled = enabled;
+  self->priv->deflate.max_window_bits = max_window_bits;
+  self->priv->deflate.no_context_takeover = no_context_takeover;
+}
+
+/**
+ * evd_websocket_server_get_deflate:
+ * @max_window_bits: (out) (allow-none):
+ * @no_context_takeover: (out) (allow-none):
+ *
+ * Returns: %TRUE if permessage-deflate compression is enabled
+ **/
+gboolean
+evd_websocket_server_get_deflate (EvdWebsocketServer *self,
+                                  guint8             *max_window_bits,
+                                  gboolean           *no_context_takeover)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_SERVER (self), FALSE);
+
+  if (max_window_bits != NULL)
+    *max_window_bits = self->priv->deflate.max_window_bits;
+  if (no_context_takeover != NULL)
+    *no_context_takeover = self->priv->deflate.no_context_takeover;
+
+  return self->priv->deflate_enabled;
+}
+
+/**
+ * evd_websocket_server_set_coalescing:
+ * @coalesce: whether to coalesce outbound frames
+ * @max_latency: maximum time in milliseconds a message can be held back
+ *
+ * When enabled, messages sent to a peer within the same main loop
+ * iteration, or within @max_latency milliseconds if it is not 0, are
+ * written to its connection together. Fanning out many small messages
+ * then takes far fewer writes. Applies to connections accepted from then
+ * on.
+ **/
+void
+evd_websocket_server_set_coalescing (EvdWebsocketServer *self,
+                                     gboolean            coalesce,
+                                     guint               max_latency)
+{
+  g_return_if_fail (EVD_IS_WEBSOCKET_SERVER (self));
+
+  self->priv->coalesce = coalesce;
+  self->priv->coalesce_max_latency = max_latency;
+}
+
+/**
+ * evd_websocket_server_get_coalescing:
+ * @max_latency: (out) (allow-none):
+ *
+ * Returns: %TRUE if outbound frames are coalesced
+ **/
+gboolean
+evd_websocket_server_get_coalescing (EvdWebsocketServer *self,
+                                     guint              *max_latency)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_SERVER (self), FALSE);
+
+  if (max_latency != NULL)
+    *max_latency = self->priv->coalesce_max_latency;
+
+  return self->priv->coalesce;
+}
+
+/**
+ * evd_websocket_server_broadcast:
+ * @peers: (element-type Evd.Peer):
+ * @buffer: (array length=size) (element-type guint8):
+ *
+ * Sends the same binary message to all @peers. The message is framed
+ * only once and the resulting bytes are written as they are to every
+ * connection, except those that need a compression context of their own.
+ * Peers that are not currently connected get it in their backlog, like
+ * with evd_transport_send().
+ *
+ * Returns: %TRUE if the message was sent or queued for every peer,
+ * %FALSE otherwise, in which case @error holds the first error
+ **/
+gboolean
+evd_websocket_server_broadcast (EvdWebsocketServer  *self,
+                                GList               *peers,
+                                const gchar         *buffer,
+                                gsize                size,
+                                GError             **error)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_SERVER (self), FALSE);
+  g_return_val_if_fail (buffer != NULL || size == 0, FALSE);
+
+  return broadcast (self, peers, buffer, size, EVD_MESSAGE_TYPE_BINARY, error);
+}
+
+/**
+ * evd_websocket_server_broadcast_text:
+ * @peers: (element-type Evd.Peer):
+ *
+ * Text version of evd_websocket_server_broadcast().
+ *
+ * Returns: %TRUE if the message was sent or queued for every peer,
+ * %FALSE otherwise
+ **/
+gboolean
+evd_websocket_server_broadcast_text (EvdWebsocketServer  *self,
+                                     GList               *peers,
+                                     const gchar         *text,
+                                     GError             **error)
+{
+  g_return_val_if_fail (EVD_IS_WEBSOCKET_SERVER (self), FALSE);
+  g_return_val_if_fail (text != NULL, FALSE);
+
+  return broadcast (self,
+                    peers,
+                    text,
+                    strlen (text),
+                    EVD_MESSAGE_TYPE_TEXT,
+                    error);
+}
@@ -76,11 +76,46 @@ void                    evd_websocket_server_set_standalone              (EvdWeb
                                                                           gboolean            standalone);
 gboolean                evd_websocket_server_get_standalone              (EvdWebsocketServer *self);
 
+void                    evd_websocket_server_set_deflate                 (EvdWebsocketServer *self,
+                                                                          gboolean            enabled,
+                                                                          guint8              max_window_bits,
+                                                                          gboolean            no_context_takeover);
+gboolean                evd_websocket_server_get_deflate                 (EvdWebsocketServer *self,
+                                                                          guint8             *max_window_bits,
+                                                                          gboolean           *no_context_takeover);
+
 void                    evd_websocket_server_get_validate_peer_arguments (EvdWebsocketServer  *self,
                                                                           EvdPeer             *peer,
                                                                           EvdHttpConnection  **conn,
                                                                           EvdHttpRequest     **request);
 
+void                    evd_websocket_server_set_max_message_size        (EvdWebsocketServer *self,
+                                                                          gsize               max_message_size);
+gsize                   evd_websocket_server_get_max_message_size        (EvdWebsocketServer *self);
+
+void                    evd_websocket_server_set_streaming               (EvdWebsocketServer *self,
+                                                                          gboolean            streaming);
+gboolean                evd_websocket_server_get_streaming               (EvdWebsocketServer *self);
+
+gboolean                evd_websocket_server_is_last_slice               (EvdWebsocketServer *self,
+                                                                          EvdPeer            *peer);
+
+void                    evd_websocket_server_set_coalescing              (EvdWebsocketServer *self,
+                                                                          gboolean            coalesce,
+                                                                          guint               max_latency);
+gboolean                evd_websocket_server_get_coalescing              (EvdWebsocketServer *self,
+                                                                          guint              *max_latency);
+
+gboolean                evd_websocket_server_broadcast                   (EvdWebsocketServer  *self,
+                                                                          GList               *peers,
+                                                                          const gchar         *buffer,
+                                                                          gsize                size,
+                                                                          GError             **error);
+gboolean                evd_websocket_server_broadcast_text              (EvdWebsocketServer  *self,
+                                                                          GList               *peers,
+                                                                          const gchar         *text,
+                                                                          GError             **error);
+
 G_END_DECLS
 
 #endif /* __EVD_WEBSOCKET_SERVER_H__ */
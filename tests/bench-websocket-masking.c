@@ -0,0 +1,139 @@
+/*
+ * bench-websocket-masking.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+/*
+ * Microbenchmark for websocket payload (un)masking. For a range of typical
+ * frame sizes, masks a buffer repeatedly with the byte-by-byte loop and with
+ * evd_websocket_protocol_apply_masking(), checks that both agree, and prints
+ * the throughput of each in MB/sec.
+ *
+ *   bench-websocket-masking --seconds=1
+ */
+
+#include <string.h>
+#include <evd.h>
+
+#include "evd-websocket-protocol.h"
+
+static gint seconds = 1;
+
+static GOptionEntry entries[] =
+{
+  { "seconds", 'd', 0, G_OPTION_ARG_INT, &seconds, "Duration of each run", "S" },
+  { NULL }
+};
+
+static const gsize frame_sizes[] = { 16, 125, 1024, 4096, 65536, 1048576 };
+
+typedef void (* MaskingFunc) (gchar        *data,
+                              gsize         data_len,
+                              const guint8  masking_key[4]);
+
+static void
+apply_masking_bytewise (gchar        *data,
+                        gsize         data_len,
+                        const guint8  masking_key[4])
+{
+  gsize i;
+
+  for (i = 0; i < data_len; i++)
+    data[i] = data[i] ^ masking_key[i % 4];
+}
+
+static gdouble
+run (MaskingFunc   func,
+     gchar        *data,
+     gsize         data_len,
+     const guint8  masking_key[4])
+{
+  GTimer *timer;
+  guint64 bytes = 0;
+  gdouble elapsed;
+  gint i;
+
+  timer = g_timer_new ();
+
+  do
+    {
+      /* check the timer only every few rounds, it is not free */
+      for (i = 0; i < 64; i++)
+        func (data, data_len, masking_key);
+      bytes += data_len * 64;
+
+      elapsed = g_timer_elapsed (timer, NULL);
+    }
+  while (elapsed < seconds);
+
+  g_timer_destroy (timer);
+
+  return bytes / elapsed / (1024 * 1024);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+  GOptionContext *opt_context;
+  GError *error = NULL;
+  guint8 masking_key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  gchar *data;
+  gchar *expected;
+  gsize max_size;
+  gsize i;
+
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  opt_context = g_option_context_new ("- websocket masking benchmark");
+  g_option_context_add_main_entries (opt_context, entries, NULL);
+  if (! g_option_context_parse (opt_context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (opt_context);
+
+  max_size = frame_sizes[G_N_ELEMENTS (frame_sizes) - 1];
+
+  /* one byte more, so runs over an unaligned payload are also checked */
+  data = g_malloc (max_size + 1);
+  expected = g_malloc (max_size + 1);
+  for (i = 0; i < max_size + 1; i++)
+    data[i] = g_random_int_range (0, 256);
+
+  for (i = 0; i < G_N_ELEMENTS (frame_sizes); i++)
+    {
+      gsize size = frame_sizes[i];
+      gdouble bytewise;
+      gdouble evd;
+
+      memcpy (expected, data + 1, size);
+      apply_masking_bytewise (expected, size, masking_key);
+      evd_websocket_protocol_apply_masking (data + 1, size, masking_key);
+      if (memcmp (expected, data + 1, size) != 0)
+        g_error ("Masking mismatch for a %" G_GSIZE_FORMAT " bytes payload",
+                 size);
+
+      bytewise = run (apply_masking_bytewise, data, size, masking_key);
+      evd = run (evd_websocket_protocol_apply_masking, data, size, masking_key);
+
+      g_print ("%8" G_GSIZE_FORMAT " bytes: bytewise %8.0f MB/sec, evd %8.0f MB/sec (x%.1f)\n",
+               size,
+               bytewise,
+               evd,
+               evd / bytewise);
+    }
+
+  g_free (expected);
+  g_free (data);
+
+  return 0;
+}
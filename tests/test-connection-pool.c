@@ -0,0 +1,496 @@
+/*
+ * test-connection-pool.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <evd.h>
+
+typedef struct _Fixture Fixture;
+
+struct _Fixture
+{
+  GMainLoop *main_loop;
+
+  EvdSocket *listener;
+  gchar *addr;
+  EvdConnectionPool *pool;
+
+  GPtrArray *server_conns;
+  GPtrArray *client_conns;
+  guint requested;
+
+  guint health_changes;
+
+  gboolean (* condition) (Fixture *f);
+  guint expected_idle;
+};
+
+static void
+listener_on_new_connection (EvdSocket     *listener,
+                            EvdConnection *conn,
+                            gpointer       user_data)
+{
+  Fixture *f = user_data;
+
+  /* keep the server side open, otherwise pooled connections close */
+  g_ptr_array_add (f->server_conns, g_object_ref (conn));
+}
+
+static void
+fixture_setup (Fixture *f, gconstpointer test_data)
+{
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+
+  f->listener = evd_socket_new ();
+  f->addr = g_strdup_printf ("127.0.0.1:%d", g_random_int_range (1025, 65535));
+  f->pool = NULL;
+
+  f->server_conns = g_ptr_array_new_with_free_func (g_object_unref);
+  f->client_conns = g_ptr_array_new_with_free_func (g_object_unref);
+  f->requested = 0;
+
+  f->health_changes = 0;
+
+  g_signal_connect (f->listener,
+                    "new-connection",
+                    G_CALLBACK (listener_on_new_connection),
+                    f);
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer test_data)
+{
+  if (f->pool != NULL)
+    g_object_unref (f->pool);
+
+  g_ptr_array_unref (f->client_conns);
+  g_ptr_array_unref (f->server_conns);
+
+  g_object_unref (f->listener);
+  g_free (f->addr);
+
+  g_main_loop_unref (f->main_loop);
+}
+
+static gboolean
+quit (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return FALSE;
+}
+
+static gboolean
+poll_condition (gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  if (! f->condition (f))
+    return TRUE;
+
+  g_main_loop_quit (f->main_loop);
+
+  return FALSE;
+}
+
+static void
+run_until (Fixture *f, gboolean (* condition) (Fixture *f))
+{
+  if (condition (f))
+    return;
+
+  f->condition = condition;
+  evd_timeout_add (NULL, 10, G_PRIORITY_DEFAULT, poll_condition, f);
+
+  g_main_loop_run (f->main_loop);
+}
+
+static gboolean
+pool_is_quiet (Fixture *f)
+{
+  EvdConnectionPoolStats stats;
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+
+  return stats.connecting == 0 && stats.waiting_requests == 0;
+}
+
+static gboolean
+pool_is_settled (Fixture *f)
+{
+  EvdConnectionPoolStats stats;
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+
+  return pool_is_quiet (f) && stats.idle_conns == f->expected_idle;
+}
+
+static gboolean
+requests_are_served (Fixture *f)
+{
+  return f->client_conns->len == f->requested;
+}
+
+static void
+listener_on_listen (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_socket_listen_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static void
+start_listening (Fixture *f)
+{
+  evd_socket_listen (f->listener, f->addr, NULL, listener_on_listen, f);
+  g_main_loop_run (f->main_loop);
+}
+
+static void
+pool_on_get_connection (GObject      *obj,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  Fixture *f = user_data;
+  EvdConnection *conn;
+  GError *error = NULL;
+
+  conn = evd_connection_pool_get_connection_finish (EVD_CONNECTION_POOL (obj),
+                                                    res,
+                                                    &error);
+  g_assert_no_error (error);
+  g_assert (EVD_IS_CONNECTION (conn));
+
+  g_ptr_array_add (f->client_conns, conn);
+}
+
+static void
+request_connections (Fixture *f, guint count)
+{
+  guint i;
+
+  for (i = 0; i < count; i++)
+    {
+      f->requested++;
+      evd_connection_pool_get_connection (f->pool,
+                                          NULL,
+                                          pool_on_get_connection,
+                                          f);
+    }
+}
+
+static guint
+recycle_connections (Fixture *f)
+{
+  guint recycled = 0;
+  guint i;
+
+  for (i = 0; i < f->client_conns->len; i++)
+    {
+      EvdConnection *conn = g_ptr_array_index (f->client_conns, i);
+
+      if (evd_connection_pool_recycle (f->pool, conn))
+        recycled++;
+      else
+        g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
+    }
+
+  g_ptr_array_set_size (f->client_conns, 0);
+  f->requested = 0;
+
+  return recycled;
+}
+
+/* sizing */
+
+static void
+test_min_conns (Fixture *f, gconstpointer test_data)
+{
+  EvdConnectionPoolStats stats;
+
+  start_listening (f);
+
+  f->pool = g_object_new (EVD_TYPE_CONNECTION_POOL,
+                          "address", f->addr,
+                          "min-conns", 3,
+                          "max-conns", 5,
+                          NULL);
+
+  /* connections are opened up-front, without any request */
+  f->expected_idle = 3;
+  run_until (f, pool_is_settled);
+
+  /* and not more than that */
+  evd_timeout_add (NULL, 100, G_PRIORITY_DEFAULT, quit, f->main_loop);
+  g_main_loop_run (f->main_loop);
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+  g_assert_cmpuint (stats.idle_conns, ==, 3);
+  g_assert_cmpuint (stats.target_conns, ==, 3);
+  g_assert_cmpuint (f->server_conns->len, ==, 3);
+}
+
+static void
+test_max_conns (Fixture *f, gconstpointer test_data)
+{
+  EvdConnectionPoolStats stats;
+  EvdConnectionPoolStats prev_stats;
+
+  start_listening (f);
+
+  f->pool = g_object_new (EVD_TYPE_CONNECTION_POOL,
+                          "address", f->addr,
+                          "min-conns", 1,
+                          "max-conns", 2,
+                          NULL);
+
+  /* a burst opens connections in parallel, but no more than max-conns */
+  request_connections (f, 4);
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+  g_assert_cmpuint (stats.connecting, ==, 2);
+  g_assert_cmpuint (stats.waiting_requests, ==, 4);
+  g_assert_cmpuint (stats.misses, ==, 4);
+
+  run_until (f, requests_are_served);
+
+  /* the pool never keeps more than max-conns */
+  g_assert_cmpuint (recycle_connections (f), <=, 2);
+
+  f->expected_idle = 2;
+  run_until (f, pool_is_settled);
+
+  /* requests served right away pull the average wait down */
+  evd_connection_pool_get_stats (f->pool, &prev_stats);
+  g_assert_cmpfloat (prev_stats.avg_wait, >, 0.0);
+
+  request_connections (f, 1);
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+  g_assert_cmpuint (stats.hits, ==, prev_stats.hits + 1);
+  g_assert_cmpfloat (stats.avg_wait, <, prev_stats.avg_wait);
+
+  run_until (f, requests_are_served);
+}
+
+static void
+test_idle_reaper (Fixture *f, gconstpointer test_data)
+{
+  EvdConnectionPoolStats stats;
+
+  start_listening (f);
+
+  f->pool = g_object_new (EVD_TYPE_CONNECTION_POOL,
+                          "address", f->addr,
+                          "min-conns", 1,
+                          "max-conns", 4,
+                          NULL);
+
+  f->expected_idle = 1;
+  run_until (f, pool_is_settled);
+
+  request_connections (f, 3);
+  run_until (f, requests_are_served);
+
+  /* return them all, so that the pool holds surplus connections */
+  g_assert_cmpuint (recycle_connections (f), >, 0);
+  run_until (f, pool_is_quiet);
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+  g_assert_cmpuint (stats.idle_conns, >, 1);
+
+  /* idle connections are closed down to min-conns */
+  evd_connection_pool_set_idle_timeout (f->pool, 50);
+
+  f->expected_idle = 1;
+  run_until (f, pool_is_settled);
+
+  evd_timeout_add (NULL, 200, G_PRIORITY_DEFAULT, quit, f->main_loop);
+  g_main_loop_run (f->main_loop);
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+  g_assert_cmpuint (stats.idle_conns, ==, 1);
+  g_assert_cmpuint (stats.target_conns, ==, 1);
+}
+
+/* ejection */
+
+static void
+eject_listener_on_listen (GObject      *obj,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  GError *error = NULL;
+
+  g_assert (evd_socket_listen_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+}
+
+static void
+eject_pool_on_healthy (GObject    *obj,
+                       GParamSpec *pspec,
+                       gpointer    user_data)
+{
+  Fixture *f = user_data;
+
+  f->health_changes++;
+
+  if (f->health_changes == 1)
+    {
+      /* nothing listens yet, so the first connection failed */
+      g_assert (! evd_connection_pool_is_healthy (f->pool));
+
+      /* the back-off timer brings it back once the target is up */
+      evd_socket_listen (f->listener,
+                         f->addr,
+                         NULL,
+                         eject_listener_on_listen,
+                         f);
+    }
+  else
+    {
+      g_assert (evd_connection_pool_is_healthy (f->pool));
+
+      g_main_loop_quit (f->main_loop);
+    }
+}
+
+static void
+test_eject (Fixture *f, gconstpointer test_data)
+{
+  f->pool = g_object_new (EVD_TYPE_CONNECTION_POOL,
+                          "address", f->addr,
+                          "max-failures", 1,
+                          NULL);
+  g_signal_connect (f->pool,
+                    "notify::healthy",
+                    G_CALLBACK (eject_pool_on_healthy),
+                    f);
+
+  g_main_loop_run (f->main_loop);
+
+  g_assert_cmpuint (f->health_changes, ==, 2);
+}
+
+static void
+count_health_changes (GObject    *obj,
+                      GParamSpec *pspec,
+                      gpointer    user_data)
+{
+  Fixture *f = user_data;
+
+  f->health_changes++;
+}
+
+static void
+test_no_eject_by_default (Fixture *f, gconstpointer test_data)
+{
+  guint max_failures;
+
+  f->pool = evd_connection_pool_new (f->addr, EVD_TYPE_CONNECTION);
+  g_signal_connect (f->pool,
+                    "notify::healthy",
+                    G_CALLBACK (count_health_changes),
+                    f);
+
+  g_object_get (f->pool, "max-failures", &max_failures, NULL);
+  g_assert_cmpuint (max_failures, ==, 0);
+
+  /* connections keep failing, but the target stays in rotation */
+  evd_timeout_add (NULL, 200, G_PRIORITY_DEFAULT, quit, f->main_loop);
+  g_main_loop_run (f->main_loop);
+
+  g_assert (evd_connection_pool_is_healthy (f->pool));
+  g_assert_cmpuint (f->health_changes, ==, 0);
+}
+
+static void
+test_connect_timeout (Fixture *f, gconstpointer test_data)
+{
+  EvdConnectionPoolStats stats;
+  guint timeout;
+
+  start_listening (f);
+
+  f->pool = evd_connection_pool_new (f->addr, EVD_TYPE_CONNECTION);
+
+  g_object_get (f->pool, "connect-timeout", &timeout, NULL);
+  g_assert_cmpuint (timeout, ==, 10000);
+
+  g_object_set (f->pool,
+                "connect-timeout", 100,
+                "min-conns", 3,
+                NULL);
+
+  f->expected_idle = 3;
+  run_until (f, pool_is_settled);
+
+  /* the timeouts of connections that made it don't close them later */
+  evd_timeout_add (NULL, 300, G_PRIORITY_DEFAULT, quit, f->main_loop);
+  g_main_loop_run (f->main_loop);
+
+  evd_connection_pool_get_stats (f->pool, &stats);
+  g_assert_cmpuint (stats.idle_conns, ==, 3);
+  g_assert (evd_connection_pool_is_healthy (f->pool));
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/evd/connection-pool/min-conns",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_min_conns,
+              fixture_teardown);
+  g_test_add ("/evd/connection-pool/max-conns",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_max_conns,
+              fixture_teardown);
+  g_test_add ("/evd/connection-pool/idle-reaper",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_idle_reaper,
+              fixture_teardown);
+  g_test_add ("/evd/connection-pool/eject",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_eject,
+              fixture_teardown);
+  g_test_add ("/evd/connection-pool/connect-timeout",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_connect_timeout,
+              fixture_teardown);
+  g_test_add ("/evd/connection-pool/no-eject-by-default",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_no_eject_by_default,
+              fixture_teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,437 @@
+/*
+ * test-connection.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <evd.h>
+
+#define CHUNK_SIZE 4096
+
+typedef enum
+{
+  TEST_WRITEV,
+  TEST_SENDFILE,
+  TEST_SPLICE_FROM
+} TestType;
+
+typedef struct
+{
+  const gchar *test_path;
+  TestType type;
+  gboolean tls;
+} TestCase;
+
+typedef struct
+{
+  const TestCase *test_case;
+
+  GMainLoop *main_loop;
+
+  EvdSocket *listener;
+  EvdSocket *socket;
+  EvdTlsCredentials *credentials;
+
+  EvdConnection *server_conn;
+  EvdConnection *client_conn;
+  guint tls_handshakes;
+
+  GString *expected;
+  GString *received;
+  gchar buf[CHUNK_SIZE];
+
+  gchar *addr;
+} Fixture;
+
+static const TestCase test_cases[] =
+{
+  { "/evd/connection/writev",      TEST_WRITEV,      FALSE },
+  { "/evd/connection/writev/tls",  TEST_WRITEV,      TRUE  },
+  { "/evd/connection/sendfile",    TEST_SENDFILE,    FALSE },
+  { "/evd/connection/splice-from", TEST_SPLICE_FROM, FALSE }
+};
+
+static void
+fixture_setup (Fixture *f, gconstpointer test_data)
+{
+  f->test_case = test_data;
+
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+
+  f->listener = evd_socket_new ();
+  f->socket = evd_socket_new ();
+  f->credentials = evd_tls_credentials_new ();
+
+  f->server_conn = NULL;
+  f->client_conn = NULL;
+  f->tls_handshakes = 0;
+
+  f->expected = g_string_new ("");
+  f->received = g_string_new ("");
+
+  f->addr = g_strdup_printf ("127.0.0.1:%d", g_random_int_range (1025, 65535));
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer test_data)
+{
+  if (f->server_conn != NULL)
+    g_object_unref (f->server_conn);
+  if (f->client_conn != NULL)
+    g_object_unref (f->client_conn);
+
+  g_object_unref (f->credentials);
+  g_object_unref (f->socket);
+  g_object_unref (f->listener);
+
+  g_string_free (f->expected, TRUE);
+  g_string_free (f->received, TRUE);
+
+  g_free (f->addr);
+
+  g_main_loop_unref (f->main_loop);
+}
+
+static void
+fill_random (gchar *buf, gsize size)
+{
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = g_random_int_range (0, 256);
+}
+
+static void
+client_on_read (GObject      *obj,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, >, 0);
+
+  g_string_append_len (f->received, f->buf, size);
+  g_assert_cmpuint (f->received->len, <=, f->expected->len);
+
+  if (f->received->len < f->expected->len)
+    {
+      g_input_stream_read_async (G_INPUT_STREAM (obj),
+                                 f->buf,
+                                 CHUNK_SIZE,
+                                 G_PRIORITY_DEFAULT,
+                                 NULL,
+                                 client_on_read,
+                                 f);
+      return;
+    }
+
+  g_assert (memcmp (f->received->str, f->expected->str, f->expected->len) == 0);
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static void
+test_writev (Fixture *f)
+{
+  GOutputVector vectors[3];
+  gchar *data[3];
+  gsize sizes[3] = { 16, CHUNK_SIZE, 100 };
+  GError *error = NULL;
+  gssize size;
+  gint i;
+
+  for (i = 0; i < 3; i++)
+    {
+      data[i] = g_malloc (sizes[i]);
+      fill_random (data[i], sizes[i]);
+      g_string_append_len (f->expected, data[i], sizes[i]);
+
+      vectors[i].buffer = data[i];
+      vectors[i].size = sizes[i];
+    }
+
+  /* all vectors must go through, also when the base stream is not
+     vectored (TLS) */
+  size = evd_connection_writev (f->server_conn, vectors, 3, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, f->expected->len);
+
+  for (i = 0; i < 3; i++)
+    g_free (data[i]);
+}
+
+static void
+test_sendfile (Fixture *f)
+{
+  gchar *filename;
+  gchar data[CHUNK_SIZE];
+  GError *error = NULL;
+  goffset offset;
+  gssize size;
+  gint fd;
+
+  fill_random (data, CHUNK_SIZE);
+  g_string_append_len (f->expected, data + CHUNK_SIZE / 2, CHUNK_SIZE / 2);
+  g_string_append_len (f->expected, data, CHUNK_SIZE / 2);
+
+  fd = g_file_open_tmp ("test-connection-XXXXXX", &filename, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (write (fd, data, CHUNK_SIZE), ==, CHUNK_SIZE);
+
+  /* send the second half of the file, then the first one */
+  offset = CHUNK_SIZE / 2;
+  size = evd_connection_sendfile (f->server_conn,
+                                  fd,
+                                  &offset,
+                                  CHUNK_SIZE / 2,
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, CHUNK_SIZE / 2);
+  g_assert_cmpint (offset, ==, CHUNK_SIZE);
+
+  offset = 0;
+  size = evd_connection_sendfile (f->server_conn,
+                                  fd,
+                                  &offset,
+                                  CHUNK_SIZE / 2,
+                                  &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, CHUNK_SIZE / 2);
+  g_assert_cmpint (offset, ==, CHUNK_SIZE / 2);
+
+  close (fd);
+  g_unlink (filename);
+  g_free (filename);
+}
+
+static void
+test_splice_from (Fixture *f)
+{
+  gchar data[CHUNK_SIZE];
+  GError *error = NULL;
+  gssize size;
+  gint pipe_fds[2];
+
+  fill_random (data, CHUNK_SIZE);
+  g_string_append_len (f->expected, data, CHUNK_SIZE);
+
+  g_assert_cmpint (pipe (pipe_fds), ==, 0);
+  g_assert_cmpint (write (pipe_fds[1], data, CHUNK_SIZE), ==, CHUNK_SIZE);
+
+  size = evd_connection_splice_from (f->server_conn,
+                                     pipe_fds[0],
+                                     CHUNK_SIZE,
+                                     &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, CHUNK_SIZE);
+
+  close (pipe_fds[0]);
+  close (pipe_fds[1]);
+}
+
+static void
+run_test (Fixture *f)
+{
+  GInputStream *input_stream;
+
+  input_stream = g_io_stream_get_input_stream (G_IO_STREAM (f->client_conn));
+  g_input_stream_read_async (input_stream,
+                             f->buf,
+                             CHUNK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             client_on_read,
+                             f);
+
+  switch (f->test_case->type)
+    {
+    case TEST_WRITEV:
+      test_writev (f);
+      break;
+
+    case TEST_SENDFILE:
+      test_sendfile (f);
+      break;
+
+    case TEST_SPLICE_FROM:
+      test_splice_from (f);
+      break;
+    }
+}
+
+static void
+connection_on_starttls (GObject      *obj,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_connection_starttls_finish (EVD_CONNECTION (obj),
+                                            res,
+                                            &error));
+  g_assert_no_error (error);
+  g_assert (evd_connection_get_tls_active (EVD_CONNECTION (obj)));
+
+  f->tls_handshakes++;
+  if (f->tls_handshakes == 2)
+    run_test (f);
+}
+
+static void
+on_connected (Fixture *f)
+{
+  EvdTlsSession *session;
+
+  if (f->server_conn == NULL || f->client_conn == NULL)
+    return;
+
+  if (! f->test_case->tls)
+    {
+      run_test (f);
+      return;
+    }
+
+  session = evd_connection_get_tls_session (f->server_conn);
+  evd_tls_session_set_credentials (session, f->credentials);
+
+  evd_connection_starttls (f->server_conn,
+                           EVD_TLS_MODE_SERVER,
+                           NULL,
+                           connection_on_starttls,
+                           f);
+  evd_connection_starttls (f->client_conn,
+                           EVD_TLS_MODE_CLIENT,
+                           NULL,
+                           connection_on_starttls,
+                           f);
+}
+
+static void
+listener_on_new_connection (EvdSocket     *listener,
+                            EvdConnection *conn,
+                            gpointer       user_data)
+{
+  Fixture *f = user_data;
+
+  g_assert (f->server_conn == NULL);
+  f->server_conn = g_object_ref (conn);
+
+  on_connected (f);
+}
+
+static void
+socket_on_connect (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  f->client_conn = EVD_CONNECTION (evd_socket_connect_finish (EVD_SOCKET (obj),
+                                                              res,
+                                                              &error));
+  g_assert_no_error (error);
+  g_assert (EVD_IS_CONNECTION (f->client_conn));
+
+  on_connected (f);
+}
+
+static void
+listener_on_listen (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_socket_listen_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  evd_socket_connect_to (f->socket, f->addr, NULL, socket_on_connect, f);
+}
+
+static void
+start_listening (Fixture *f)
+{
+  g_signal_connect (f->listener,
+                    "new-connection",
+                    G_CALLBACK (listener_on_new_connection),
+                    f);
+
+  evd_socket_listen (f->listener, f->addr, NULL, listener_on_listen, f);
+}
+
+static void
+credentials_on_cert_loaded (GObject      *obj,
+                            GAsyncResult *res,
+                            gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_tls_credentials_add_certificate_from_file_finish (
+                                                   EVD_TLS_CREDENTIALS (obj),
+                                                   res,
+                                                   &error));
+  g_assert_no_error (error);
+
+  start_listening (f);
+}
+
+static void
+test_func (Fixture *f, gconstpointer test_data)
+{
+  if (f->test_case->tls)
+    evd_tls_credentials_add_certificate_from_file (f->credentials,
+                                         TESTS_DIR "certs/x509-server.pem",
+                                         TESTS_DIR "certs/x509-server-key.pem",
+                                         NULL,
+                                         credentials_on_cert_loaded,
+                                         f);
+  else
+    start_listening (f);
+
+  g_main_loop_run (f->main_loop);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+  gint i;
+  gint result;
+
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  evd_tls_init (NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (test_cases); i++)
+    g_test_add (test_cases[i].test_path,
+                Fixture,
+                &test_cases[i],
+                fixture_setup,
+                test_func,
+                fixture_teardown);
+
+  result = g_test_run ();
+
+  evd_tls_deinit ();
+
+  return result;
+}
@@ -0,0 +1,521 @@
+/*
+ * test-poll.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <unistd.h>
+#include <evd.h>
+
+#include "evd-poll.h"
+
+#define MAX_ITEMS 64
+
+typedef struct _Fixture Fixture;
+
+typedef struct
+{
+  Fixture *f;
+  gint fds[2];
+  EvdPollSession *session;
+  GMainContext *context;
+  guint priority;
+  volatile gint calls;
+} Item;
+
+struct _Fixture
+{
+  GMainLoop *main_loop;
+  EvdPoll *poll;
+
+  Item items[MAX_ITEMS];
+  guint n_items;
+
+  volatile gint callbacks;
+  volatile gint expected_callbacks;
+  volatile gint freed;
+
+  volatile gint drained;
+  volatile gint blocked;
+
+  gboolean check_priority;
+  gint last_priority;
+};
+
+static void
+fixture_setup (Fixture *f, gconstpointer test_data)
+{
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+  f->poll = NULL;
+
+  f->n_items = 0;
+
+  f->callbacks = 0;
+  f->expected_callbacks = 0;
+  f->freed = 0;
+
+  f->drained = FALSE;
+  f->blocked = FALSE;
+
+  f->check_priority = FALSE;
+  f->last_priority = G_MININT;
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer test_data)
+{
+  guint i;
+
+  if (f->poll != NULL)
+    g_object_unref (f->poll);
+
+  for (i = 0; i < f->n_items; i++)
+    {
+      close (f->items[i].fds[0]);
+      close (f->items[i].fds[1]);
+    }
+
+  g_main_loop_unref (f->main_loop);
+}
+
+static gboolean
+quit (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return FALSE;
+}
+
+static Item *
+new_item (Fixture *f)
+{
+  Item *item;
+
+  g_assert_cmpuint (f->n_items, <, MAX_ITEMS);
+
+  item = &f->items[f->n_items];
+  f->n_items++;
+
+  item->f = f;
+  g_assert_cmpint (pipe (item->fds), ==, 0);
+  item->session = NULL;
+  item->context = NULL;
+  item->calls = 0;
+
+  return item;
+}
+
+static void
+item_free (gpointer user_data)
+{
+  Item *item = user_data;
+
+  g_atomic_int_inc (&item->f->freed);
+}
+
+static GIOCondition
+item_on_condition (EvdPoll      *poll,
+                   GIOCondition  condition,
+                   gpointer      user_data)
+{
+  Item *item = user_data;
+  Fixture *f = item->f;
+  GMainContext *context;
+  gchar buf[16];
+
+  g_assert (condition & G_IO_IN);
+
+  /* callbacks run in the context the session was meant for */
+  context = g_main_context_get_thread_default ();
+  if (context == NULL)
+    context = g_main_context_default ();
+  g_assert (context == item->context);
+
+  g_assert_cmpint (read (item->fds[0], buf, sizeof (buf)), >, 0);
+
+  /* higher priorities (lower values) first */
+  if (f->check_priority)
+    {
+      g_assert_cmpint ((gint) item->priority, >=, f->last_priority);
+      f->last_priority = (gint) item->priority;
+    }
+
+  g_atomic_int_inc (&item->calls);
+
+  /* quitting twice from two threads is harmless */
+  g_atomic_int_inc (&f->callbacks);
+  if (g_atomic_int_get (&f->callbacks) ==
+      g_atomic_int_get (&f->expected_callbacks))
+    {
+      g_main_loop_quit (f->main_loop);
+    }
+
+  return condition;
+}
+
+static void
+item_write (Item *item)
+{
+  g_assert_cmpint (write (item->fds[1], "x", 1), ==, 1);
+}
+
+static void
+item_add (Fixture  *f,
+          Item     *item,
+          gint      thread_index,
+          gboolean  in_thread,
+          guint     priority)
+{
+  GError *error = NULL;
+
+  item->priority = priority;
+
+  if (in_thread)
+    {
+      item->context = evd_poll_get_thread_context (f->poll, thread_index);
+      item->session = evd_poll_add_in_thread (f->poll,
+                                              thread_index,
+                                              item->fds[0],
+                                              G_IO_IN,
+                                              priority,
+                                              item_on_condition,
+                                              item,
+                                              item_free,
+                                              &error);
+    }
+  else
+    {
+      item->context = g_main_context_default ();
+
+      if (thread_index >= 0)
+        item->session = evd_poll_add_to_thread (f->poll,
+                                                thread_index,
+                                                item->fds[0],
+                                                G_IO_IN,
+                                                priority,
+                                                item_on_condition,
+                                                item,
+                                                item_free,
+                                                &error);
+      else
+        item->session = evd_poll_add (f->poll,
+                                      item->fds[0],
+                                      G_IO_IN,
+                                      priority,
+                                      item_on_condition,
+                                      item,
+                                      item_free,
+                                      &error);
+    }
+
+  g_assert_no_error (error);
+  g_assert (item->session != NULL);
+}
+
+static void
+run (Fixture *f, guint expected_callbacks)
+{
+  guint src_id;
+
+  g_atomic_int_set (&f->expected_callbacks, expected_callbacks);
+
+  if (g_atomic_int_get (&f->callbacks) < (gint) expected_callbacks)
+    {
+      src_id = evd_timeout_add (NULL, 5000, G_PRIORITY_DEFAULT, quit, f->main_loop);
+      g_main_loop_run (f->main_loop);
+      g_source_remove (src_id);
+    }
+
+  g_assert_cmpint (g_atomic_int_get (&f->callbacks), ==, expected_callbacks);
+}
+
+static gboolean
+mark_drained (gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  g_atomic_int_set (&f->drained, TRUE);
+
+  return FALSE;
+}
+
+/* Waits until the poll thread has gone through every ready event. The
+   epoll source has a higher priority than the marker, so the marker is
+   only dispatched once the epoll set is empty */
+static void
+wait_drained (Fixture *f, guint thread_index)
+{
+  g_atomic_int_set (&f->drained, FALSE);
+
+  evd_timeout_add (evd_poll_get_thread_context (f->poll, thread_index),
+                   0,
+                   G_PRIORITY_LOW,
+                   mark_drained,
+                   f);
+
+  while (! g_atomic_int_get (&f->drained))
+    g_usleep (1000);
+}
+
+static gboolean
+block_thread (gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  g_atomic_int_set (&f->blocked, TRUE);
+  while (g_atomic_int_get (&f->blocked))
+    g_usleep (1000);
+
+  return FALSE;
+}
+
+/* Keeps the poll thread busy, so that fds made ready in the meantime are
+   all found by the waits that follow */
+static void
+block (Fixture *f, guint thread_index)
+{
+  evd_timeout_add (evd_poll_get_thread_context (f->poll, thread_index),
+                   0,
+                   G_PRIORITY_DEFAULT,
+                   block_thread,
+                   f);
+
+  while (! g_atomic_int_get (&f->blocked))
+    g_usleep (1000);
+}
+
+static void
+unblock (Fixture *f)
+{
+  g_atomic_int_set (&f->blocked, FALSE);
+}
+
+static void
+del_items (Fixture *f)
+{
+  GError *error = NULL;
+  guint i;
+
+  for (i = 0; i < f->n_items; i++)
+    {
+      g_assert (evd_poll_del (f->poll, f->items[i].session, &error));
+      g_assert_no_error (error);
+    }
+}
+
+/* threads */
+
+static void
+test_threads (Fixture *f, gconstpointer test_data)
+{
+  Item *items[6];
+  guint i;
+
+  f->poll = evd_poll_new_with_threads (3);
+  g_object_set (f->poll, "least-loaded", TRUE, NULL);
+
+  g_assert_cmpuint (evd_poll_get_n_threads (f->poll), ==, 3);
+  for (i = 0; i < 3; i++)
+    {
+      g_assert (evd_poll_get_thread_context (f->poll, i) != NULL);
+      g_assert (evd_poll_get_thread_context (f->poll, i) !=
+                g_main_context_default ());
+      g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, i), ==, 0);
+    }
+  g_assert (evd_poll_get_thread_context (f->poll, 0) !=
+            evd_poll_get_thread_context (f->poll, 1));
+
+  for (i = 0; i < 6; i++)
+    items[i] = new_item (f);
+
+  /* requested thread */
+  item_add (f, items[0], 0, FALSE, G_PRIORITY_DEFAULT);
+  item_add (f, items[1], 3, FALSE, G_PRIORITY_DEFAULT); /* wraps around to 0 */
+  g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, 0), ==, 2);
+
+  /* least loaded, the lowest index on a tie */
+  item_add (f, items[2], -1, FALSE, G_PRIORITY_DEFAULT);
+  g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, 1), ==, 1);
+  item_add (f, items[3], -1, FALSE, G_PRIORITY_DEFAULT);
+  g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, 2), ==, 1);
+  item_add (f, items[4], -1, FALSE, G_PRIORITY_DEFAULT);
+  g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, 1), ==, 2);
+
+  /* dispatched by the poll thread itself */
+  item_add (f, items[5], 2, TRUE, G_PRIORITY_DEFAULT);
+
+  g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, 0), ==, 2);
+  g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, 1), ==, 2);
+  g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, 2), ==, 2);
+
+  for (i = 0; i < 6; i++)
+    item_write (items[i]);
+
+  run (f, 6);
+
+  for (i = 0; i < 6; i++)
+    g_assert_cmpint (g_atomic_int_get (&items[i]->calls), ==, 1);
+
+  /* deleting releases the sessions from the poll threads, and stopping
+     releases whatever they did not get to yet */
+  del_items (f);
+  for (i = 0; i < 3; i++)
+    g_assert_cmpuint (evd_poll_get_thread_n_sessions (f->poll, i), ==, 0);
+
+  g_object_unref (f->poll);
+  f->poll = NULL;
+
+  g_assert_cmpint (g_atomic_int_get (&f->freed), ==, 6);
+}
+
+/* batch delivery */
+
+static void
+test_batch_delivery (Fixture *f, gconstpointer test_data)
+{
+  const guint priorities[] = { G_PRIORITY_DEFAULT_IDLE,
+                               G_PRIORITY_DEFAULT,
+                               G_PRIORITY_HIGH_IDLE };
+  Item *items[30];
+  guint i;
+
+  /* every wait retrieves only a few of the ready fds */
+  f->poll = g_object_new (EVD_TYPE_POLL,
+                          "batch-delivery", TRUE,
+                          "batch-size", 4,
+                          "max-batch-size", 4,
+                          NULL);
+
+  for (i = 0; i < 30; i++)
+    {
+      items[i] = new_item (f);
+      item_add (f, items[i], -1, FALSE, priorities[i % 3]);
+    }
+
+  for (i = 0; i < 30; i++)
+    item_write (items[i]);
+
+  /* queued over several waits before the main context gets to run */
+  wait_drained (f, 0);
+
+  f->check_priority = TRUE;
+  run (f, 30);
+
+  /* nothing is delivered twice */
+  evd_timeout_add (NULL, 50, G_PRIORITY_DEFAULT, quit, f->main_loop);
+  g_main_loop_run (f->main_loop);
+
+  g_assert_cmpint (g_atomic_int_get (&f->callbacks), ==, 30);
+  for (i = 0; i < 30; i++)
+    g_assert_cmpint (g_atomic_int_get (&items[i]->calls), ==, 1);
+
+  del_items (f);
+
+  g_object_unref (f->poll);
+  f->poll = NULL;
+
+  g_assert_cmpint (g_atomic_int_get (&f->freed), ==, 30);
+}
+
+/* batch size */
+
+static void
+write_all_blocked (Fixture *f, Item **items, guint n_items)
+{
+  guint i;
+
+  block (f, 0);
+
+  for (i = 0; i < n_items; i++)
+    item_write (items[i]);
+
+  unblock (f);
+  wait_drained (f, 0);
+}
+
+static void
+test_batch_size (Fixture *f, gconstpointer test_data)
+{
+  Item *items[20];
+  gint batch_size;
+  guint i;
+
+  f->poll = g_object_new (EVD_TYPE_POLL,
+                          "batch-size", 2,
+                          "max-batch-size", 8,
+                          NULL);
+
+  for (i = 0; i < 20; i++)
+    {
+      items[i] = new_item (f);
+      item_add (f, items[i], -1, FALSE, G_PRIORITY_DEFAULT);
+    }
+
+  g_assert_cmpfloat (evd_poll_get_batch_fill_ratio (f->poll), ==, 0.0);
+
+  /* 20 ready fds take waits of 2, 4, 8 and 8, the last one returning 6.
+     Without growth the ratio would be 1.0, and growing past the limit
+     (2, 4, 8, 16) would give 20/30 */
+  write_all_blocked (f, items, 20);
+  g_assert_cmpfloat (ABS (evd_poll_get_batch_fill_ratio (f->poll) - 20.0 / 22.0),
+                     <,
+                     1e-9);
+
+  run (f, 20);
+
+  /* a new size is picked up by the next wait and grows from there: waits
+     of 5, 8 and 8, the last one returning 7 */
+  g_object_set (f->poll, "batch-size", 5, NULL);
+  g_object_get (f->poll, "batch-size", &batch_size, NULL);
+  g_assert_cmpint (batch_size, ==, 5);
+
+  write_all_blocked (f, items, 20);
+  g_assert_cmpfloat (ABS (evd_poll_get_batch_fill_ratio (f->poll) - 40.0 / 43.0),
+                     <,
+                     1e-9);
+
+  run (f, 40);
+
+  del_items (f);
+
+  g_object_unref (f->poll);
+  f->poll = NULL;
+
+  g_assert_cmpint (g_atomic_int_get (&f->freed), ==, 20);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/evd/poll/threads",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_threads,
+              fixture_teardown);
+  g_test_add ("/evd/poll/batch-delivery",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_batch_delivery,
+              fixture_teardown);
+  g_test_add ("/evd/poll/batch-size",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_batch_size,
+              fixture_teardown);
+
+  return g_test_run ();
+}
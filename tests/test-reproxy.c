@@ -0,0 +1,826 @@
+/*
+ * test-reproxy.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <string.h>
+#include <evd.h>
+
+#define BLOCK_SIZE 4096
+#define DATA_SIZE  (256 * 1024)
+
+typedef struct
+{
+  GMainLoop *main_loop;
+
+  EvdReproxy *reproxy;
+  gchar *addr;
+
+  EvdSocket *backend;
+  gchar *backend_addr;
+  EvdConnection *backend_conn;
+  gchar backend_buf[BLOCK_SIZE];
+
+  EvdSocket *socket;
+  EvdConnection *conn;
+  gchar buf[BLOCK_SIZE];
+
+  GString *sent;
+  GString *received;
+} Fixture;
+
+static void
+fixture_setup (Fixture *f, gconstpointer test_data)
+{
+  gint port;
+
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+
+  port = g_random_int_range (1025, 65534);
+  f->addr = g_strdup_printf ("127.0.0.1:%d", port);
+  f->backend_addr = g_strdup_printf ("127.0.0.1:%d", port + 1);
+
+  f->reproxy = evd_reproxy_new ();
+  f->backend = evd_socket_new ();
+  f->socket = evd_socket_new ();
+
+  f->backend_conn = NULL;
+  f->conn = NULL;
+
+  f->sent = g_string_new ("");
+  f->received = g_string_new ("");
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer test_data)
+{
+  if (f->conn != NULL)
+    g_object_unref (f->conn);
+  if (f->backend_conn != NULL)
+    g_object_unref (f->backend_conn);
+
+  g_object_unref (f->socket);
+  g_object_unref (f->backend);
+  g_object_unref (f->reproxy);
+
+  g_free (f->addr);
+  g_free (f->backend_addr);
+
+  g_string_free (f->sent, TRUE);
+  g_string_free (f->received, TRUE);
+
+  g_main_loop_unref (f->main_loop);
+}
+
+/* the backend echoes back everything it receives */
+
+static void
+backend_conn_on_read (GObject      *obj,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  GOutputStream *output_stream;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  if (size <= 0)
+    {
+      g_clear_error (&error);
+      return;
+    }
+
+  output_stream = g_io_stream_get_output_stream (G_IO_STREAM (f->backend_conn));
+  g_assert_cmpint (g_output_stream_write (output_stream,
+                                          f->backend_buf,
+                                          size,
+                                          NULL,
+                                          &error), ==, size);
+  g_assert_no_error (error);
+
+  g_input_stream_read_async (G_INPUT_STREAM (obj),
+                             f->backend_buf,
+                             BLOCK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             backend_conn_on_read,
+                             f);
+}
+
+static void
+backend_on_new_connection (EvdSocket     *socket,
+                           EvdConnection *conn,
+                           gpointer       user_data)
+{
+  Fixture *f = user_data;
+
+  g_assert (f->backend_conn == NULL);
+  f->backend_conn = g_object_ref (conn);
+
+  g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (conn)),
+                             f->backend_buf,
+                             BLOCK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             backend_conn_on_read,
+                             f);
+}
+
+/* client */
+
+static void
+conn_on_read (GObject      *obj,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, >, 0);
+
+  g_string_append_len (f->received, f->buf, size);
+  g_assert_cmpuint (f->received->len, <=, DATA_SIZE);
+
+  if (f->received->len < DATA_SIZE)
+    {
+      g_input_stream_read_async (G_INPUT_STREAM (obj),
+                                 f->buf,
+                                 BLOCK_SIZE,
+                                 G_PRIORITY_DEFAULT,
+                                 NULL,
+                                 conn_on_read,
+                                 f);
+      return;
+    }
+
+  g_assert (memcmp (f->received->str, f->sent->str, DATA_SIZE) == 0);
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static void
+socket_on_connect (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  GOutputStream *output_stream;
+  gint i;
+
+  f->conn = EVD_CONNECTION (evd_socket_connect_finish (EVD_SOCKET (obj),
+                                                       res,
+                                                       &error));
+  g_assert_no_error (error);
+
+  for (i = 0; i < DATA_SIZE; i++)
+    g_string_append_c (f->sent, g_random_int_range (0, 256));
+
+  /* the connection buffers whatever the socket doesn't take */
+  output_stream = g_io_stream_get_output_stream (G_IO_STREAM (f->conn));
+  g_assert_cmpint (g_output_stream_write (output_stream,
+                                          f->sent->str,
+                                          DATA_SIZE,
+                                          NULL,
+                                          &error), ==, DATA_SIZE);
+  g_assert_no_error (error);
+
+  g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (f->conn)),
+                             f->buf,
+                             BLOCK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             conn_on_read,
+                             f);
+}
+
+static void
+reproxy_on_listen (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_service_listen_finish (EVD_SERVICE (obj), res, &error));
+  g_assert_no_error (error);
+
+  evd_socket_connect_to (f->socket, f->addr, NULL, socket_on_connect, f);
+}
+
+static void
+backend_on_listen (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_socket_listen_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  evd_reproxy_add_backend (f->reproxy, f->backend_addr);
+
+  evd_service_listen (EVD_SERVICE (f->reproxy),
+                      f->addr,
+                      NULL,
+                      reproxy_on_listen,
+                      f);
+}
+
+static void
+test_splice (Fixture *f, gconstpointer test_data)
+{
+  /* plaintext bridges move data through a pipe with splice(), in both
+     directions */
+  g_signal_connect (f->backend,
+                    "new-connection",
+                    G_CALLBACK (backend_on_new_connection),
+                    f);
+  evd_socket_listen (f->backend, f->backend_addr, NULL, backend_on_listen, f);
+
+  g_main_loop_run (f->main_loop);
+}
+
+/* balancing */
+
+#define MAX_BACKENDS 3
+#define MAX_CLIENTS  8
+
+typedef struct _BalanceFixture BalanceFixture;
+
+typedef struct
+{
+  BalanceFixture *f;
+  EvdSocket *listener;
+  gchar *addr;
+  EvdConnectionPool *pool;
+
+  /* milliseconds to wait before responding, or -1 for never */
+  gint delay;
+} Backend;
+
+struct _BalanceFixture
+{
+  GMainLoop *main_loop;
+
+  EvdReproxy *reproxy;
+  gchar *addr;
+  gint port;
+
+  Backend backends[MAX_BACKENDS];
+  guint n_backends;
+  gchar scratch[BLOCK_SIZE];
+
+  EvdSocket *sockets[MAX_CLIENTS];
+  EvdConnection *clients[MAX_CLIENTS];
+  gint picks[MAX_CLIENTS];
+  guint n_clients;
+  guint64 total_bridges[MAX_BACKENDS];
+  gchar buf[1];
+
+  /* backend to wait for until it has no active bridges, or -1 for all */
+  gint wait_backend;
+
+  guint step;
+};
+
+static void balance_next_step (BalanceFixture *f);
+
+static void
+balance_fixture_setup (BalanceFixture *f, gconstpointer test_data)
+{
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+
+  f->port = g_random_int_range (1025, 65535 - MAX_BACKENDS);
+  f->addr = g_strdup_printf ("127.0.0.1:%d", f->port);
+
+  f->reproxy = evd_reproxy_new ();
+  evd_reproxy_set_balance (f->reproxy,
+                           (EvdReproxyBalance) GPOINTER_TO_INT (test_data));
+
+  f->n_backends = 0;
+  f->n_clients = 0;
+  f->wait_backend = -1;
+  f->step = 0;
+}
+
+static void
+balance_fixture_teardown (BalanceFixture *f, gconstpointer test_data)
+{
+  guint i;
+
+  for (i = 0; i < f->n_clients; i++)
+    {
+      if (f->clients[i] != NULL)
+        g_object_unref (f->clients[i]);
+      g_object_unref (f->sockets[i]);
+    }
+
+  g_object_unref (f->reproxy);
+
+  for (i = 0; i < f->n_backends; i++)
+    {
+      g_object_unref (f->backends[i].listener);
+      g_free (f->backends[i].addr);
+    }
+
+  g_free (f->addr);
+
+  g_main_loop_unref (f->main_loop);
+}
+
+static gboolean
+backend_respond (gpointer user_data)
+{
+  EvdConnection *conn = EVD_CONNECTION (user_data);
+
+  if (! g_io_stream_is_closed (G_IO_STREAM (conn)))
+    g_output_stream_write (g_io_stream_get_output_stream (G_IO_STREAM (conn)),
+                           "x",
+                           1,
+                           NULL,
+                           NULL);
+  g_object_unref (conn);
+
+  return FALSE;
+}
+
+static void
+balance_backend_conn_on_read (GObject      *obj,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+  Backend *backend = user_data;
+  EvdConnection *conn;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, NULL);
+  if (size <= 0)
+    return;
+
+  conn = g_object_get_data (obj, "conn");
+
+  if (backend->delay == 0)
+    backend_respond (g_object_ref (conn));
+  else if (backend->delay > 0)
+    evd_timeout_add (NULL,
+                     backend->delay,
+                     G_PRIORITY_DEFAULT,
+                     backend_respond,
+                     g_object_ref (conn));
+
+  g_input_stream_read_async (G_INPUT_STREAM (obj),
+                             backend->f->scratch,
+                             BLOCK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             balance_backend_conn_on_read,
+                             backend);
+}
+
+static void
+balance_backend_on_new_connection (EvdSocket     *listener,
+                                   EvdConnection *conn,
+                                   gpointer       user_data)
+{
+  Backend *backend = user_data;
+  GInputStream *stream;
+
+  stream = g_io_stream_get_input_stream (G_IO_STREAM (conn));
+  g_object_set_data (G_OBJECT (stream), "conn", conn);
+
+  g_input_stream_read_async (stream,
+                             backend->f->scratch,
+                             BLOCK_SIZE,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             balance_backend_conn_on_read,
+                             backend);
+}
+
+static void
+balance_reproxy_on_listen (GObject      *obj,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+  BalanceFixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_service_listen_finish (EVD_SERVICE (obj), res, &error));
+  g_assert_no_error (error);
+
+  balance_next_step (f);
+}
+
+static void
+balance_backend_on_listen (GObject      *obj,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+  Backend *backend = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_socket_listen_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  backend->pool = evd_reproxy_add_backend (backend->f->reproxy, backend->addr);
+
+  if (backend == &backend->f->backends[0])
+    evd_service_listen (EVD_SERVICE (backend->f->reproxy),
+                        backend->f->addr,
+                        NULL,
+                        balance_reproxy_on_listen,
+                        backend->f);
+  else
+    balance_next_step (backend->f);
+}
+
+static void
+balance_add_backend (BalanceFixture *f, gint delay)
+{
+  Backend *backend;
+
+  g_assert_cmpuint (f->n_backends, <, MAX_BACKENDS);
+
+  backend = &f->backends[f->n_backends];
+  f->n_backends++;
+
+  backend->f = f;
+  backend->delay = delay;
+  backend->addr = g_strdup_printf ("127.0.0.1:%d", f->port + f->n_backends);
+  backend->listener = evd_socket_new ();
+
+  g_signal_connect (backend->listener,
+                    "new-connection",
+                    G_CALLBACK (balance_backend_on_new_connection),
+                    backend);
+  evd_socket_listen (backend->listener,
+                     backend->addr,
+                     NULL,
+                     balance_backend_on_listen,
+                     backend);
+}
+
+static void
+balance_client_on_read (GObject      *obj,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  BalanceFixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert_cmpint (g_input_stream_read_finish (G_INPUT_STREAM (obj),
+                                               res,
+                                               &error), ==, 1);
+  g_assert_no_error (error);
+
+  balance_next_step (f);
+}
+
+static gboolean
+balance_client_find_pick (gpointer user_data)
+{
+  BalanceFixture *f = user_data;
+  guint client = f->n_clients - 1;
+  guint i;
+
+  /* the backend whose bridge count went up got the client */
+  for (i = 0; i < f->n_backends; i++)
+    {
+      guint64 total;
+
+      evd_reproxy_get_backend_stats (f->reproxy,
+                                     f->backends[i].pool,
+                                     NULL,
+                                     &total,
+                                     NULL);
+      if (total > f->total_bridges[i])
+        {
+          f->total_bridges[i] = total;
+          f->picks[client] = i;
+          break;
+        }
+    }
+
+  if (i == f->n_backends)
+    return TRUE;
+
+  /* wait for the response, so the latency sample is taken */
+  if (f->backends[i].delay >= 0)
+    g_input_stream_read_async (
+                 g_io_stream_get_input_stream (G_IO_STREAM (f->clients[client])),
+                 f->buf,
+                 1,
+                 G_PRIORITY_DEFAULT,
+                 NULL,
+                 balance_client_on_read,
+                 f);
+  else
+    balance_next_step (f);
+
+  return FALSE;
+}
+
+static void
+balance_client_on_connect (GObject      *obj,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+  BalanceFixture *f = user_data;
+  guint client = f->n_clients - 1;
+  GError *error = NULL;
+
+  f->clients[client] =
+    EVD_CONNECTION (evd_socket_connect_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  g_output_stream_write (
+                 g_io_stream_get_output_stream (G_IO_STREAM (f->clients[client])),
+                 "x",
+                 1,
+                 NULL,
+                 &error);
+  g_assert_no_error (error);
+
+  evd_timeout_add (NULL, 10, G_PRIORITY_DEFAULT, balance_client_find_pick, f);
+}
+
+/* opens a client connection, then continues with the next step once it is
+   known which backend got it */
+static void
+balance_request (BalanceFixture *f)
+{
+  guint client;
+
+  g_assert_cmpuint (f->n_clients, <, MAX_CLIENTS);
+
+  client = f->n_clients;
+  f->n_clients++;
+
+  f->picks[client] = -1;
+  f->sockets[client] = evd_socket_new ();
+  evd_socket_connect_to (f->sockets[client],
+                         f->addr,
+                         NULL,
+                         balance_client_on_connect,
+                         f);
+}
+
+static gboolean
+balance_wait_idle (gpointer user_data)
+{
+  BalanceFixture *f = user_data;
+  guint i;
+
+  for (i = 0; i < f->n_backends; i++)
+    {
+      guint active;
+
+      if (f->wait_backend >= 0 && (guint) f->wait_backend != i)
+        continue;
+
+      evd_reproxy_get_backend_stats (f->reproxy,
+                                     f->backends[i].pool,
+                                     &active,
+                                     NULL,
+                                     NULL);
+      if (active > 0)
+        return TRUE;
+    }
+
+  balance_next_step (f);
+
+  return FALSE;
+}
+
+/* closes all client connections, then continues with the next step once
+   the backends have no active bridges */
+static void
+balance_close_all (BalanceFixture *f)
+{
+  guint i;
+
+  for (i = 0; i < f->n_clients; i++)
+    if (! g_io_stream_is_closed (G_IO_STREAM (f->clients[i])))
+      g_io_stream_close (G_IO_STREAM (f->clients[i]), NULL, NULL);
+
+  f->wait_backend = -1;
+  evd_timeout_add (NULL, 10, G_PRIORITY_DEFAULT, balance_wait_idle, f);
+}
+
+static gboolean
+balance_step_round_robin (BalanceFixture *f)
+{
+  guint i;
+  guint count[2] = { 0, 0 };
+
+  switch (f->step)
+    {
+    case 0:
+      balance_add_backend (f, 0);
+      return TRUE;
+
+    case 1:
+      balance_add_backend (f, 0);
+      return TRUE;
+
+    case 2:
+    case 4:
+    case 6:
+    case 8:
+      balance_request (f);
+      return TRUE;
+
+    case 3:
+    case 5:
+    case 7:
+    case 9:
+      balance_close_all (f);
+      return TRUE;
+    }
+
+  /* backends take turns */
+  for (i = 0; i < f->n_clients; i++)
+    count[f->picks[i]]++;
+  g_assert_cmpuint (count[0], ==, 2);
+  g_assert_cmpuint (count[1], ==, 2);
+
+  return FALSE;
+}
+
+static gboolean
+balance_step_least_connections (BalanceFixture *f)
+{
+  switch (f->step)
+    {
+    case 0:
+    case 1:
+      balance_add_backend (f, 0);
+      return TRUE;
+
+    case 2:
+    case 3:
+      balance_request (f);
+      return TRUE;
+
+    case 4:
+      /* each backend got one of the two connections held open */
+      g_assert_cmpint (f->picks[0], !=, f->picks[1]);
+
+      /* drop the second one, its backend is now the least loaded */
+      g_io_stream_close (G_IO_STREAM (f->clients[1]), NULL, NULL);
+      f->wait_backend = f->picks[1];
+      evd_timeout_add (NULL, 10, G_PRIORITY_DEFAULT, balance_wait_idle, f);
+      return TRUE;
+
+    case 5:
+      balance_request (f);
+      return TRUE;
+    }
+
+  g_assert_cmpint (f->picks[2], ==, f->picks[1]);
+
+  return FALSE;
+}
+
+static gboolean
+balance_step_least_latency (BalanceFixture *f)
+{
+  guint i;
+
+  switch (f->step)
+    {
+    case 0:
+      balance_add_backend (f, 100);
+      return TRUE;
+
+    case 1:
+      balance_add_backend (f, 0);
+      return TRUE;
+
+    /* each backend gets a first request to take a latency sample */
+    case 2:
+    case 4:
+    case 6:
+    case 8:
+    case 10:
+      balance_request (f);
+      return TRUE;
+
+    case 3:
+    case 5:
+    case 7:
+    case 9:
+    case 11:
+      balance_close_all (f);
+      return TRUE;
+
+    case 12:
+      g_assert_cmpint (f->picks[0], !=, f->picks[1]);
+
+      /* then the fast one gets everything */
+      for (i = 2; i < f->n_clients; i++)
+        g_assert_cmpint (f->picks[i], ==, 1);
+
+      /* a new backend that never responds */
+      balance_add_backend (f, -1);
+      return TRUE;
+
+    case 13:
+    case 14:
+    case 15:
+      balance_request (f);
+      return TRUE;
+    }
+
+  /* the new backend gets one connection to take a sample, but it doesn't
+     win every pick while that sample is missing */
+  g_assert_cmpint (f->picks[5], ==, 2);
+  g_assert_cmpint (f->picks[6], ==, 1);
+  g_assert_cmpint (f->picks[7], ==, 1);
+
+  return FALSE;
+}
+
+static void
+balance_next_step (BalanceFixture *f)
+{
+  gboolean more;
+
+  switch (evd_reproxy_get_balance (f->reproxy))
+    {
+    case EVD_REPROXY_BALANCE_ROUND_ROBIN:
+      more = balance_step_round_robin (f);
+      break;
+
+    case EVD_REPROXY_BALANCE_LEAST_CONNECTIONS:
+      more = balance_step_least_connections (f);
+      break;
+
+    default:
+      more = balance_step_least_latency (f);
+      break;
+    }
+
+  f->step++;
+
+  if (! more)
+    g_main_loop_quit (f->main_loop);
+}
+
+static void
+test_balance (BalanceFixture *f, gconstpointer test_data)
+{
+  balance_next_step (f);
+
+  g_main_loop_run (f->main_loop);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/evd/reproxy/splice",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_splice,
+              fixture_teardown);
+
+  g_test_add ("/evd/reproxy/balance/round-robin",
+              BalanceFixture,
+              GINT_TO_POINTER (EVD_REPROXY_BALANCE_ROUND_ROBIN),
+              balance_fixture_setup,
+              test_balance,
+              balance_fixture_teardown);
+  g_test_add ("/evd/reproxy/balance/least-connections",
+              BalanceFixture,
+              GINT_TO_POINTER (EVD_REPROXY_BALANCE_LEAST_CONNECTIONS),
+              balance_fixture_setup,
+              test_balance,
+              balance_fixture_teardown);
+  g_test_add ("/evd/reproxy/balance/least-latency",
+              BalanceFixture,
+              GINT_TO_POINTER (EVD_REPROXY_BALANCE_LEAST_LATENCY),
+              balance_fixture_setup,
+              test_balance,
+              balance_fixture_teardown);
+
+  return g_test_run ();
+}
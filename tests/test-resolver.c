@@ -30,6 +30,7 @@ typedef struct
 {
   GMainLoop   *main_loop;
   EvdResolver *resolver;
+  gint         pending;
 } Fixture;
 
 static void
@@ -274,37 +275,108 @@ resolve_good_localhost (Fixture       *f,
 
 /* cancel */
 
-/*
 static void
 resolve_cancel_on_resolve (GObject      *obj,
                            GAsyncResult *res,
                            gpointer      user_data)
 {
-  EvdResolver *resolver;
   Fixture *f = (Fixture *) user_data;
   GError *error = NULL;
   GList *addresses;
 
   g_assert (EVD_IS_RESOLVER (obj));
-  resolver = EVD_RESOLVER (obj);
-  g_assert (resolver == f->resolver);
 
-  addresses = evd_resolver_resolve_finish (resolver, res, &error);
+  addresses = evd_resolver_resolve_finish (EVD_RESOLVER (obj), res, &error);
 
   g_assert (addresses == NULL);
   g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
 
   g_error_free (error);
 
-  g_main_loop_quit (f->main_loop);
+  f->pending--;
+  if (f->pending == 0)
+    g_main_loop_quit (f->main_loop);
 }
-*/
+
+static void cache_on_resolve (GObject      *obj,
+                              GAsyncResult *res,
+                              gpointer      user_data);
 
 static void
 resolve_cancel (Fixture       *f,
                 gconstpointer  test_data)
 {
-  /* @TODO: completes this test once EvdResolver supports cancelling */
+  EvdResolver *resolver;
+  GCancellable *cancellable;
+  guint64 coalesced;
+
+  /* a resolver of its own, so that nothing is cached yet */
+  resolver = evd_resolver_new ();
+
+  /* a cancelled request fails, the one sharing its lookup doesn't */
+  f->pending = 2;
+  cancellable = g_cancellable_new ();
+  evd_resolver_resolve (resolver,
+                        RESOLVE_CANCEL,
+                        cancellable,
+                        resolve_cancel_on_resolve,
+                        f);
+  evd_resolver_resolve (resolver,
+                        RESOLVE_CANCEL,
+                        NULL,
+                        cache_on_resolve,
+                        f);
+  g_cancellable_cancel (cancellable);
+  g_object_unref (cancellable);
+
+  g_main_loop_run (f->main_loop);
+
+  evd_resolver_get_cache_stats (resolver, NULL, NULL, &coalesced);
+  g_assert_cmpuint (coalesced, ==, 1);
+
+  /* cancelling the only request cancels the lookup, and a new request
+     is not served from it */
+  evd_resolver_flush_cache (resolver);
+
+  f->pending = 1;
+  cancellable = g_cancellable_new ();
+  evd_resolver_resolve (resolver,
+                        RESOLVE_CANCEL,
+                        cancellable,
+                        resolve_cancel_on_resolve,
+                        f);
+  g_cancellable_cancel (cancellable);
+  g_object_unref (cancellable);
+
+  g_main_loop_run (f->main_loop);
+
+  f->pending = 1;
+  evd_resolver_resolve (resolver,
+                        RESOLVE_CANCEL,
+                        NULL,
+                        cache_on_resolve,
+                        f);
+  g_main_loop_run (f->main_loop);
+
+  evd_resolver_get_cache_stats (resolver, NULL, NULL, &coalesced);
+  g_assert_cmpuint (coalesced, ==, 1);
+
+  /* already cancelled requests don't wait for the lookup either */
+  evd_resolver_flush_cache (resolver);
+
+  f->pending = 1;
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+  evd_resolver_resolve (resolver,
+                        RESOLVE_CANCEL,
+                        cancellable,
+                        resolve_cancel_on_resolve,
+                        f);
+  g_object_unref (cancellable);
+
+  g_main_loop_run (f->main_loop);
+
+  g_object_unref (resolver);
 }
 
 /* error */
@@ -354,6 +426,91 @@ resolve_error (Fixture       *f,
   g_main_loop_run (f->main_loop);
 }
 
+/* cache */
+
+static void
+cache_on_resolve (GObject      *obj,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  Fixture *f = (Fixture *) user_data;
+  GError *error = NULL;
+  GList *addresses;
+
+  g_assert (EVD_IS_RESOLVER (obj));
+
+  addresses = evd_resolver_resolve_finish (EVD_RESOLVER (obj), res, &error);
+  g_assert (addresses != NULL);
+  g_assert_no_error (error);
+
+  evd_resolver_free_addresses (addresses);
+
+  f->pending--;
+  if (f->pending == 0)
+    g_main_loop_quit (f->main_loop);
+}
+
+static void
+cache (Fixture       *f,
+       gconstpointer  test_data)
+{
+  EvdResolver *resolver;
+  guint64 hits;
+  guint64 misses;
+  guint64 coalesced;
+
+  resolver = evd_resolver_new ();
+
+  /* concurrent identical requests share a single lookup */
+  f->pending = 2;
+  evd_resolver_resolve (resolver,
+                        RESOLVE_GOOD_LOCALHOST,
+                        NULL,
+                        cache_on_resolve,
+                        f);
+  evd_resolver_resolve (resolver,
+                        RESOLVE_GOOD_LOCALHOST,
+                        NULL,
+                        cache_on_resolve,
+                        f);
+  g_main_loop_run (f->main_loop);
+
+  evd_resolver_get_cache_stats (resolver, &hits, &misses, &coalesced);
+  g_assert_cmpuint (hits, ==, 0);
+  g_assert_cmpuint (misses, ==, 2);
+  g_assert_cmpuint (coalesced, ==, 1);
+
+  /* then it is answered from the cache */
+  f->pending = 1;
+  evd_resolver_resolve (resolver,
+                        RESOLVE_GOOD_LOCALHOST,
+                        NULL,
+                        cache_on_resolve,
+                        f);
+  g_main_loop_run (f->main_loop);
+
+  evd_resolver_get_cache_stats (resolver, &hits, &misses, NULL);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 2);
+
+  /* until the cache is flushed */
+  evd_resolver_flush_cache (resolver);
+
+  f->pending = 1;
+  evd_resolver_resolve (resolver,
+                        RESOLVE_GOOD_LOCALHOST,
+                        NULL,
+                        cache_on_resolve,
+                        f);
+  g_main_loop_run (f->main_loop);
+
+  evd_resolver_get_cache_stats (resolver, &hits, &misses, NULL);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 3);
+
+  g_object_unref (resolver);
+}
+
 gint
 main (gint argc, gchar **argv)
 {
@@ -400,6 +557,13 @@ main (gint argc, gchar **argv)
               resolve_good_localhost,
               fixture_teardown);
 
+  g_test_add ("/evd/resolver/cache",
+              Fixture,
+              NULL,
+              fixture_setup,
+              cache,
+              fixture_teardown);
+
   g_test_add ("/evd/resolver/cancel",
               Fixture,
               NULL,
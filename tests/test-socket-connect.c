@@ -0,0 +1,278 @@
+/*
+ * test-socket-connect.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <evd.h>
+
+/* long enough that a test only passes if failed attempts move on to the
+   next address right away, instead of waiting for the delay */
+#define LONG_ATTEMPT_DELAY 10000 /* milliseconds */
+
+typedef struct
+{
+  GMainLoop *main_loop;
+
+  EvdSocket *listener;
+  EvdSocket *socket;
+
+  gchar *listen_addr;
+  gchar *connect_addr;
+
+  guint server_conns;
+  guint callbacks;
+  gint64 started;
+} Fixture;
+
+static void
+fixture_setup (Fixture *f, gconstpointer test_data)
+{
+  gint port;
+
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+
+  f->listener = evd_socket_new ();
+  f->socket = evd_socket_new ();
+
+  /* 'localhost' usually resolves to both ::1 and 127.0.0.1, only one of
+     which is listened on */
+  port = g_random_int_range (1025, 65535);
+  f->listen_addr = g_strdup_printf ("127.0.0.1:%d", port);
+  f->connect_addr = g_strdup_printf ("localhost:%d", port);
+
+  f->server_conns = 0;
+  f->callbacks = 0;
+  f->started = 0;
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer test_data)
+{
+  g_object_unref (f->socket);
+  g_object_unref (f->listener);
+
+  g_free (f->listen_addr);
+  g_free (f->connect_addr);
+
+  g_main_loop_unref (f->main_loop);
+}
+
+static void
+listener_on_new_connection (EvdSocket     *listener,
+                            EvdConnection *conn,
+                            gpointer       user_data)
+{
+  Fixture *f = user_data;
+
+  /* connections are always delivered in the context listened from */
+  g_assert (g_main_context_is_owner (g_main_context_default ()));
+
+  f->server_conns++;
+}
+
+static void
+listener_on_listen (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_socket_listen_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static void
+start_listening (Fixture *f)
+{
+  g_signal_connect (f->listener,
+                    "new-connection",
+                    G_CALLBACK (listener_on_new_connection),
+                    f);
+
+  evd_socket_listen (f->listener, f->listen_addr, NULL, listener_on_listen, f);
+  g_main_loop_run (f->main_loop);
+}
+
+static void
+start_connecting (Fixture             *f,
+                  GAsyncReadyCallback  callback)
+{
+  g_object_set (f->socket,
+                "connect-attempt-delay", LONG_ATTEMPT_DELAY,
+                NULL);
+
+  f->started = g_get_monotonic_time ();
+  evd_socket_connect_to (f->socket, f->connect_addr, NULL, callback, f);
+  g_main_loop_run (f->main_loop);
+}
+
+static gboolean
+server_has_connection (gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  if (f->server_conns == 0)
+    return TRUE;
+
+  g_main_loop_quit (f->main_loop);
+
+  return FALSE;
+}
+
+/* connect */
+
+static void
+connect_on_connect (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GIOStream *conn;
+  GError *error = NULL;
+  gboolean keepalive;
+
+  f->callbacks++;
+
+  conn = evd_socket_connect_finish (EVD_SOCKET (obj), res, &error);
+  g_assert_no_error (error);
+  g_assert (EVD_IS_CONNECTION (conn));
+
+  /* the address not listened on failed and was skipped right away */
+  g_assert_cmpint (g_get_monotonic_time () - f->started,
+                   <,
+                   (gint64) LONG_ATTEMPT_DELAY * 1000 / 2);
+
+  g_object_get (evd_socket_get_socket (f->socket),
+                "keepalive", &keepalive,
+                NULL);
+  g_assert (keepalive);
+
+  g_object_unref (conn);
+
+  evd_timeout_add (NULL, 10, G_PRIORITY_DEFAULT, server_has_connection, f);
+}
+
+static void
+test_connect (Fixture *f, gconstpointer test_data)
+{
+  guint delay;
+
+  g_object_get (f->socket, "connect-attempt-delay", &delay, NULL);
+  g_assert_cmpuint (delay, ==, 250);
+
+  start_listening (f);
+  start_connecting (f, connect_on_connect);
+
+  g_assert_cmpuint (f->callbacks, ==, 1);
+  g_assert_cmpuint (f->server_conns, ==, 1);
+}
+
+/* accept in poll thread */
+
+static void
+test_accept_in_poll_thread (Fixture *f, gconstpointer test_data)
+{
+  g_object_set (f->listener,
+                "poll-thread", 1,
+                "accept-in-poll-thread", TRUE,
+                NULL);
+
+  start_listening (f);
+  start_connecting (f, connect_on_connect);
+
+  g_assert_cmpuint (f->callbacks, ==, 1);
+  g_assert_cmpuint (f->server_conns, ==, 1);
+
+  /* the poll thread lets go of the listening socket */
+  g_assert (evd_socket_close (f->listener, NULL));
+  g_assert_cmpuint (evd_socket_get_status (f->listener),
+                    ==,
+                    EVD_SOCKET_STATE_CLOSED);
+}
+
+/* refused */
+
+static gboolean
+quit (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return FALSE;
+}
+
+static void
+refused_on_connect (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GIOStream *conn;
+  GError *error = NULL;
+
+  f->callbacks++;
+
+  conn = evd_socket_connect_finish (EVD_SOCKET (obj), res, &error);
+  g_assert (conn == NULL);
+  g_assert (error != NULL);
+  g_error_free (error);
+
+  /* every address was tried without waiting for the delay */
+  g_assert_cmpint (g_get_monotonic_time () - f->started,
+                   <,
+                   (gint64) LONG_ATTEMPT_DELAY * 1000 / 2);
+
+  /* give a stray attempt or timer the chance to report again */
+  evd_timeout_add (NULL, 100, G_PRIORITY_DEFAULT, quit, f->main_loop);
+}
+
+static void
+test_refused (Fixture *f, gconstpointer test_data)
+{
+  /* nothing listens */
+  start_connecting (f, refused_on_connect);
+
+  g_assert_cmpuint (f->callbacks, ==, 1);
+  g_assert_cmpuint (evd_socket_get_status (f->socket),
+                    ==,
+                    EVD_SOCKET_STATE_CLOSED);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/evd/socket/connect/race",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_connect,
+              fixture_teardown);
+  g_test_add ("/evd/socket/connect/accept-in-poll-thread",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_accept_in_poll_thread,
+              fixture_teardown);
+  g_test_add ("/evd/socket/connect/race/refused",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_refused,
+              fixture_teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,685 @@
+/*
+ * test-tls-session.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <string.h>
+#include <evd.h>
+
+#define TLS12_PRIORITY "NORMAL:-VERS-TLS-ALL:+VERS-TLS1.2"
+
+#define WRITE_SIZE (512 * 1024)
+
+typedef enum
+{
+  TEST_RESUMPTION,
+  TEST_OFFLOAD,
+  TEST_WRITE
+} TestType;
+
+typedef struct
+{
+  const gchar *test_path;
+  TestType type;
+
+  /* server side resumption */
+  gboolean session_tickets;
+  guint session_cache_size;
+
+  const gchar *priority;
+
+  /* server side handshake */
+  gboolean offload;
+  gboolean cert_cb;
+} TestCase;
+
+typedef struct
+{
+  const TestCase *test_case;
+
+  GMainLoop *main_loop;
+
+  EvdSocket *listener;
+  EvdSocket *socket;
+  EvdTlsCredentials *credentials;
+
+  EvdConnection *server_conn;
+  EvdConnection *client_conn;
+  guint tls_handshakes;
+
+  guint round;
+  gchar *resumption_data;
+  gsize resumption_data_size;
+
+  EvdTlsCertificate *cert;
+  guint cert_cb_calls;
+  GThread *cert_cb_thread;
+
+  gchar buf[16];
+
+  gchar *payload;
+  gsize sent;
+  GString *received;
+  gchar read_buf[4096];
+
+  gchar *addr;
+} Fixture;
+
+static const TestCase test_cases[] =
+{
+  {
+    "/evd/tls-session/resumption/ticket",
+    TEST_RESUMPTION,
+    TRUE, 0, NULL,
+    FALSE, FALSE
+  },
+  {
+    "/evd/tls-session/resumption/session-id",
+    TEST_RESUMPTION,
+    FALSE, 16, TLS12_PRIORITY,
+    FALSE, FALSE
+  },
+  {
+    "/evd/tls-session/offload-handshake",
+    TEST_OFFLOAD,
+    TRUE, 0, NULL,
+    TRUE, FALSE
+  },
+  {
+    "/evd/tls-session/offload-handshake/cert-callback",
+    TEST_OFFLOAD,
+    TRUE, 0, NULL,
+    TRUE, TRUE
+  },
+  {
+    "/evd/tls-session/write/large",
+    TEST_WRITE,
+    TRUE, 0, NULL,
+    FALSE, FALSE
+  }
+};
+
+static void
+fixture_setup (Fixture *f, gconstpointer test_data)
+{
+  f->test_case = test_data;
+
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+
+  f->listener = evd_socket_new ();
+  f->socket = NULL;
+
+  f->credentials = evd_tls_credentials_new ();
+  g_object_set (f->credentials,
+                "session-tickets", f->test_case->session_tickets,
+                "session-cache-size", f->test_case->session_cache_size,
+                NULL);
+
+  f->server_conn = NULL;
+  f->client_conn = NULL;
+  f->tls_handshakes = 0;
+
+  f->round = 0;
+  f->resumption_data = NULL;
+  f->resumption_data_size = 0;
+
+  f->cert = NULL;
+  f->cert_cb_calls = 0;
+  f->cert_cb_thread = NULL;
+
+  f->payload = NULL;
+  f->sent = 0;
+  f->received = g_string_new ("");
+
+  f->addr = g_strdup_printf ("127.0.0.1:%d", g_random_int_range (1025, 65535));
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer test_data)
+{
+  if (f->server_conn != NULL)
+    g_object_unref (f->server_conn);
+  if (f->client_conn != NULL)
+    g_object_unref (f->client_conn);
+
+  if (f->socket != NULL)
+    g_object_unref (f->socket);
+
+  g_object_unref (f->credentials);
+  g_object_unref (f->listener);
+
+  if (f->cert != NULL)
+    g_object_unref (f->cert);
+
+  g_free (f->resumption_data);
+  g_free (f->payload);
+  g_string_free (f->received, TRUE);
+  g_free (f->addr);
+
+  g_main_loop_unref (f->main_loop);
+}
+
+static void connect_client (Fixture *f);
+
+/* resumption */
+
+static void
+resumption_client_on_read (GObject      *obj,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+  Fixture *f = user_data;
+  EvdTlsSession *session;
+  GError *error = NULL;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, 1);
+
+  /* by now a ticket, if any, has arrived too */
+  session = evd_connection_get_tls_session (f->client_conn);
+  f->resumption_data =
+    evd_tls_session_get_resumption_data (session,
+                                         &f->resumption_data_size,
+                                         &error);
+  g_assert_no_error (error);
+  g_assert (f->resumption_data != NULL);
+  g_assert_cmpuint (f->resumption_data_size, >, 0);
+
+  g_io_stream_close (G_IO_STREAM (f->client_conn), NULL, NULL);
+  g_io_stream_close (G_IO_STREAM (f->server_conn), NULL, NULL);
+
+  g_object_unref (f->client_conn);
+  f->client_conn = NULL;
+  g_object_unref (f->server_conn);
+  f->server_conn = NULL;
+
+  /* reconnect, resuming the session */
+  connect_client (f);
+}
+
+static void
+test_resumption (Fixture *f)
+{
+  GOutputStream *output_stream;
+  GInputStream *input_stream;
+  GError *error = NULL;
+
+  if (f->round == 1)
+    {
+      g_assert (! evd_tls_session_is_resumed (
+                              evd_connection_get_tls_session (f->server_conn)));
+
+      output_stream =
+        g_io_stream_get_output_stream (G_IO_STREAM (f->server_conn));
+      g_assert_cmpint (g_output_stream_write (output_stream, "x", 1, NULL, &error),
+                       ==,
+                       1);
+      g_assert_no_error (error);
+
+      input_stream =
+        g_io_stream_get_input_stream (G_IO_STREAM (f->client_conn));
+      g_input_stream_read_async (input_stream,
+                                 f->buf,
+                                 sizeof (f->buf),
+                                 G_PRIORITY_DEFAULT,
+                                 NULL,
+                                 resumption_client_on_read,
+                                 f);
+    }
+  else
+    {
+      g_assert (evd_tls_session_is_resumed (
+                              evd_connection_get_tls_session (f->client_conn)));
+      g_assert (evd_tls_session_is_resumed (
+                              evd_connection_get_tls_session (f->server_conn)));
+
+      g_main_loop_quit (f->main_loop);
+    }
+}
+
+/* offloaded handshake */
+
+static gboolean
+offload_cert_cb (EvdTlsCredentials *credentials,
+                 EvdTlsSession     *session,
+                 GList             *ca_rdns,
+                 GList             *algorithms,
+                 gpointer           user_data)
+{
+  Fixture *f = user_data;
+  EvdTlsPrivkey *privkey;
+  gchar *data;
+  gsize size;
+  GError *error = NULL;
+
+  f->cert_cb_calls++;
+  f->cert_cb_thread = g_thread_self ();
+
+  if (f->cert == NULL)
+    {
+      g_assert (g_file_get_contents (TESTS_DIR "certs/x509-server.pem",
+                                     &data,
+                                     &size,
+                                     &error));
+      g_assert_no_error (error);
+
+      f->cert = evd_tls_certificate_new ();
+      g_assert (evd_tls_certificate_import (f->cert, data, size, &error));
+      g_assert_no_error (error);
+      g_free (data);
+    }
+
+  /* the native key is taken over by the credentials */
+  g_assert (g_file_get_contents (TESTS_DIR "certs/x509-server-key.pem",
+                                 &data,
+                                 &size,
+                                 &error));
+  g_assert_no_error (error);
+
+  privkey = evd_tls_privkey_new ();
+  g_assert (evd_tls_privkey_import (privkey, data, size, &error));
+  g_assert_no_error (error);
+  g_free (data);
+
+  g_assert (evd_tls_credentials_add_certificate (credentials,
+                                                 f->cert,
+                                                 privkey,
+                                                 &error));
+  g_assert_no_error (error);
+  g_object_unref (privkey);
+
+  return TRUE;
+}
+
+static void
+offload_client_on_read (GObject      *obj,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, 1);
+  g_assert_cmpint (f->buf[0], ==, 'x');
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static void
+test_offload (Fixture *f)
+{
+  GOutputStream *output_stream;
+  GInputStream *input_stream;
+  GError *error = NULL;
+
+  /* a certificate callback must never run in a worker thread */
+  if (f->test_case->cert_cb)
+    {
+      g_assert_cmpuint (f->cert_cb_calls, ==, 1);
+      g_assert (f->cert_cb_thread == g_thread_self ());
+    }
+
+  output_stream = g_io_stream_get_output_stream (G_IO_STREAM (f->server_conn));
+  g_assert_cmpint (g_output_stream_write (output_stream, "x", 1, NULL, &error),
+                   ==,
+                   1);
+  g_assert_no_error (error);
+
+  input_stream = g_io_stream_get_input_stream (G_IO_STREAM (f->client_conn));
+  g_input_stream_read_async (input_stream,
+                             f->buf,
+                             sizeof (f->buf),
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             offload_client_on_read,
+                             f);
+}
+
+static void
+test_service_offload_property (void)
+{
+  EvdService *service;
+  gboolean offload;
+
+  service = evd_service_new ();
+
+  g_object_get (service, "tls-offload-handshake", &offload, NULL);
+  g_assert (! offload);
+
+  g_object_set (service, "tls-offload-handshake", TRUE, NULL);
+  g_assert (evd_service_get_tls_offload_handshake (service));
+
+  g_object_get (service, "tls-offload-handshake", &offload, NULL);
+  g_assert (offload);
+
+  g_object_unref (service);
+}
+
+/* corked write */
+
+static void
+write_payload (Fixture *f)
+{
+  GOutputStream *output_stream;
+  GError *error = NULL;
+  gssize size;
+
+  output_stream = g_io_stream_get_output_stream (G_IO_STREAM (f->server_conn));
+
+  /* only the part the stream didn't take is written again */
+  while (f->sent < WRITE_SIZE)
+    {
+      size = g_output_stream_write (output_stream,
+                                    f->payload + f->sent,
+                                    WRITE_SIZE - f->sent,
+                                    NULL,
+                                    &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (size, >=, 0);
+
+      if (size == 0)
+        break;
+
+      f->sent += size;
+    }
+}
+
+static void
+write_server_on_write (EvdConnection *conn, gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  write_payload (f);
+}
+
+static void
+write_client_on_read (GObject      *obj,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, >, 0);
+
+  g_string_append_len (f->received, f->read_buf, size);
+  g_assert_cmpuint (f->received->len, <=, WRITE_SIZE);
+
+  if (f->received->len == WRITE_SIZE)
+    {
+      /* nothing lost, duplicated or reordered */
+      g_assert_cmpuint (f->sent, ==, WRITE_SIZE);
+      g_assert (memcmp (f->received->str, f->payload, WRITE_SIZE) == 0);
+
+      g_main_loop_quit (f->main_loop);
+      return;
+    }
+
+  g_input_stream_read_async (G_INPUT_STREAM (obj),
+                             f->read_buf,
+                             sizeof (f->read_buf),
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             write_client_on_read,
+                             f);
+}
+
+static void
+test_write (Fixture *f)
+{
+  GInputStream *input_stream;
+  gsize i;
+
+  f->payload = g_malloc (WRITE_SIZE);
+  for (i = 0; i < WRITE_SIZE; i++)
+    f->payload[i] = (gchar) (i % 251);
+
+  g_signal_connect (f->server_conn,
+                    "write",
+                    G_CALLBACK (write_server_on_write),
+                    f);
+  write_payload (f);
+
+  input_stream = g_io_stream_get_input_stream (G_IO_STREAM (f->client_conn));
+  g_input_stream_read_async (input_stream,
+                             f->read_buf,
+                             sizeof (f->read_buf),
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             write_client_on_read,
+                             f);
+}
+
+/* common */
+
+static void
+run_test (Fixture *f)
+{
+  switch (f->test_case->type)
+    {
+    case TEST_RESUMPTION:
+      test_resumption (f);
+      break;
+
+    case TEST_OFFLOAD:
+      test_offload (f);
+      break;
+
+    case TEST_WRITE:
+      test_write (f);
+      break;
+    }
+}
+
+static void
+connection_on_starttls (GObject      *obj,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_connection_starttls_finish (EVD_CONNECTION (obj),
+                                            res,
+                                            &error));
+  g_assert_no_error (error);
+  g_assert (evd_connection_get_tls_active (EVD_CONNECTION (obj)));
+
+  f->tls_handshakes++;
+  if (f->tls_handshakes == 2)
+    run_test (f);
+}
+
+static void
+on_connected (Fixture *f)
+{
+  EvdTlsSession *session;
+  GError *error = NULL;
+
+  if (f->server_conn == NULL || f->client_conn == NULL)
+    return;
+
+  f->round++;
+  f->tls_handshakes = 0;
+
+  session = evd_connection_get_tls_session (f->server_conn);
+  evd_tls_session_set_credentials (session, f->credentials);
+  evd_tls_session_set_offload_handshake (session, f->test_case->offload);
+  if (f->test_case->priority != NULL)
+    g_object_set (session, "priority", f->test_case->priority, NULL);
+
+  session = evd_connection_get_tls_session (f->client_conn);
+  if (f->test_case->priority != NULL)
+    g_object_set (session, "priority", f->test_case->priority, NULL);
+  if (f->resumption_data != NULL)
+    {
+      evd_tls_session_set_resumption_data (session,
+                                           f->resumption_data,
+                                           f->resumption_data_size,
+                                           &error);
+      g_assert_no_error (error);
+    }
+
+  evd_connection_starttls (f->server_conn,
+                           EVD_TLS_MODE_SERVER,
+                           NULL,
+                           connection_on_starttls,
+                           f);
+  evd_connection_starttls (f->client_conn,
+                           EVD_TLS_MODE_CLIENT,
+                           NULL,
+                           connection_on_starttls,
+                           f);
+}
+
+static void
+listener_on_new_connection (EvdSocket     *listener,
+                            EvdConnection *conn,
+                            gpointer       user_data)
+{
+  Fixture *f = user_data;
+
+  g_assert (f->server_conn == NULL);
+  f->server_conn = g_object_ref (conn);
+
+  on_connected (f);
+}
+
+static void
+socket_on_connect (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  f->client_conn = EVD_CONNECTION (evd_socket_connect_finish (EVD_SOCKET (obj),
+                                                              res,
+                                                              &error));
+  g_assert_no_error (error);
+  g_assert (EVD_IS_CONNECTION (f->client_conn));
+
+  on_connected (f);
+}
+
+static void
+connect_client (Fixture *f)
+{
+  if (f->socket != NULL)
+    g_object_unref (f->socket);
+
+  f->socket = evd_socket_new ();
+  evd_socket_connect_to (f->socket, f->addr, NULL, socket_on_connect, f);
+}
+
+static void
+listener_on_listen (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_socket_listen_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  connect_client (f);
+}
+
+static void
+start_listening (Fixture *f)
+{
+  g_signal_connect (f->listener,
+                    "new-connection",
+                    G_CALLBACK (listener_on_new_connection),
+                    f);
+
+  evd_socket_listen (f->listener, f->addr, NULL, listener_on_listen, f);
+}
+
+static void
+credentials_on_cert_loaded (GObject      *obj,
+                            GAsyncResult *res,
+                            gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_tls_credentials_add_certificate_from_file_finish (
+                                                   EVD_TLS_CREDENTIALS (obj),
+                                                   res,
+                                                   &error));
+  g_assert_no_error (error);
+
+  start_listening (f);
+}
+
+static void
+test_func (Fixture *f, gconstpointer test_data)
+{
+  if (f->test_case->cert_cb)
+    {
+      evd_tls_credentials_set_cert_callback (f->credentials,
+                                             offload_cert_cb,
+                                             f,
+                                             NULL);
+      start_listening (f);
+    }
+  else
+    {
+      evd_tls_credentials_add_certificate_from_file (f->credentials,
+                                         TESTS_DIR "certs/x509-server.pem",
+                                         TESTS_DIR "certs/x509-server-key.pem",
+                                         NULL,
+                                         credentials_on_cert_loaded,
+                                         f);
+    }
+
+  g_main_loop_run (f->main_loop);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+  gint i;
+  gint result;
+
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  evd_tls_init (NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (test_cases); i++)
+    g_test_add (test_cases[i].test_path,
+                Fixture,
+                &test_cases[i],
+                fixture_setup,
+                test_func,
+                fixture_teardown);
+
+  g_test_add_func ("/evd/tls-session/offload-handshake/service-property",
+                   test_service_offload_property);
+
+  result = g_test_run ();
+
+  evd_tls_deinit ();
+
+  return result;
+}
@@ -0,0 +1,505 @@
+/*
+ * test-web-dir.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include <glib/gstdio.h>
+#include <evd.h>
+
+#define FILENAME "file.txt"
+
+typedef struct _Fixture Fixture;
+
+typedef void (* TestFunc) (Fixture *f);
+
+typedef struct
+{
+  const gchar *test_path;
+  TestFunc func;
+} TestCase;
+
+struct _Fixture
+{
+  const TestCase *test_case;
+
+  GMainLoop *main_loop;
+
+  EvdWebDir *web_dir;
+  gchar *root;
+  gchar *addr;
+
+  EvdSocket *socket;
+  EvdConnection *conn;
+  gchar *request;
+  gchar buf[1024];
+  GString *data;
+
+  guint status;
+  SoupMessageHeaders *headers;
+  GString *body;
+  TestFunc on_response;
+
+  gchar *etag;
+};
+
+static void
+fixture_setup (Fixture *f, gconstpointer test_data)
+{
+  GError *error = NULL;
+
+  f->test_case = test_data;
+
+  f->main_loop = g_main_loop_new (NULL, FALSE);
+
+  f->root = g_dir_make_tmp ("test-web-dir-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  f->web_dir = evd_web_dir_new ();
+  evd_web_dir_set_root (f->web_dir, f->root);
+
+  f->addr = g_strdup_printf ("127.0.0.1:%d", g_random_int_range (1025, 65535));
+
+  f->socket = NULL;
+  f->conn = NULL;
+  f->request = NULL;
+  f->data = g_string_new ("");
+
+  f->headers = NULL;
+  f->body = g_string_new ("");
+
+  f->etag = NULL;
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer test_data)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (f->root, 0, NULL);
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *filename;
+
+      filename = g_build_filename (f->root, name, NULL);
+      g_unlink (filename);
+      g_free (filename);
+    }
+  g_dir_close (dir);
+  g_rmdir (f->root);
+  g_free (f->root);
+
+  g_object_unref (f->web_dir);
+  g_free (f->addr);
+
+  if (f->conn != NULL)
+    g_object_unref (f->conn);
+  if (f->socket != NULL)
+    g_object_unref (f->socket);
+  g_free (f->request);
+  g_string_free (f->data, TRUE);
+
+  if (f->headers != NULL)
+    soup_message_headers_free (f->headers);
+  g_string_free (f->body, TRUE);
+
+  g_free (f->etag);
+
+  g_main_loop_unref (f->main_loop);
+}
+
+static void
+write_file (Fixture     *f,
+            const gchar *name,
+            const gchar *content,
+            gsize        size,
+            glong        mtime_usec)
+{
+  gchar *filename;
+  struct timeval times[2];
+  GError *error = NULL;
+
+  filename = g_build_filename (f->root, name, NULL);
+
+  g_file_set_contents (filename, content, size, &error);
+  g_assert_no_error (error);
+
+  /* modification times of a test run fall within the same second, so only
+     the microseconds tell them apart */
+  times[0].tv_sec = times[1].tv_sec = 1000000000;
+  times[0].tv_usec = times[1].tv_usec = mtime_usec;
+  g_assert_cmpint (utimes (filename, times), ==, 0);
+
+  g_free (filename);
+}
+
+static gboolean
+parse_response (Fixture *f)
+{
+  const gchar *end;
+  gsize headers_len;
+  goffset content_len;
+
+  end = strstr (f->data->str, "\r\n\r\n");
+  if (end == NULL)
+    return FALSE;
+
+  headers_len = end - f->data->str + 4;
+
+  if (f->headers != NULL)
+    soup_message_headers_free (f->headers);
+  f->headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+
+  g_assert (soup_headers_parse_response (f->data->str,
+                                         headers_len,
+                                         f->headers,
+                                         NULL,
+                                         &f->status,
+                                         NULL));
+
+  content_len = soup_message_headers_get_content_length (f->headers);
+  if (f->data->len - headers_len < content_len)
+    return FALSE;
+
+  g_string_assign (f->body, f->data->str + headers_len);
+
+  return TRUE;
+}
+
+static void
+connection_on_read (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, >, 0);
+
+  g_string_append_len (f->data, f->buf, size);
+
+  if (! parse_response (f))
+    {
+      g_input_stream_read_async (G_INPUT_STREAM (obj),
+                                 f->buf,
+                                 sizeof (f->buf),
+                                 G_PRIORITY_DEFAULT,
+                                 NULL,
+                                 connection_on_read,
+                                 f);
+      return;
+    }
+
+  g_io_stream_close (G_IO_STREAM (f->conn), NULL, NULL);
+
+  f->on_response (f);
+}
+
+static void
+socket_on_connect (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  GOutputStream *output_stream;
+  GInputStream *input_stream;
+
+  f->conn = EVD_CONNECTION (evd_socket_connect_finish (EVD_SOCKET (obj),
+                                                       res,
+                                                       &error));
+  g_assert_no_error (error);
+
+  output_stream = g_io_stream_get_output_stream (G_IO_STREAM (f->conn));
+  g_output_stream_write (output_stream,
+                         f->request,
+                         strlen (f->request),
+                         NULL,
+                         &error);
+  g_assert_no_error (error);
+
+  input_stream = g_io_stream_get_input_stream (G_IO_STREAM (f->conn));
+  g_input_stream_read_async (input_stream,
+                             f->buf,
+                             sizeof (f->buf),
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             connection_on_read,
+                             f);
+}
+
+static void
+http_get (Fixture     *f,
+          const gchar *path,
+          const gchar *extra_headers,
+          TestFunc     on_response)
+{
+  if (f->conn != NULL)
+    g_object_unref (f->conn);
+  f->conn = NULL;
+  if (f->socket != NULL)
+    g_object_unref (f->socket);
+  f->socket = evd_socket_new ();
+
+  g_free (f->request);
+  f->request = g_strdup_printf ("GET %s HTTP/1.1\r\n"
+                                "Host: localhost\r\n"
+                                "Connection: close\r\n"
+                                "%s"
+                                "\r\n",
+                                path,
+                                extra_headers != NULL ? extra_headers : "");
+
+  g_string_truncate (f->data, 0);
+  f->status = 0;
+  f->on_response = on_response;
+
+  evd_socket_connect_to (f->socket, f->addr, NULL, socket_on_connect, f);
+}
+
+static void
+assert_response (Fixture     *f,
+                 guint        status,
+                 const gchar *body)
+{
+  g_assert_cmpuint (f->status, ==, status);
+  g_assert_cmpstr (f->body->str, ==, body);
+}
+
+/* cache */
+
+static void
+cache_on_revalidated (Fixture *f)
+{
+  /* the revalidation interval went by, so the change on disk is seen */
+  assert_response (f, SOUP_STATUS_OK, "bbbb");
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static gboolean
+cache_on_timeout (gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  http_get (f, "/" FILENAME, NULL, cache_on_revalidated);
+
+  return FALSE;
+}
+
+static void
+cache_on_cached (Fixture *f)
+{
+  /* served from memory, without looking at the file */
+  assert_response (f, SOUP_STATUS_OK, "aaaa");
+
+  evd_timeout_add (NULL, 1100, G_PRIORITY_DEFAULT, cache_on_timeout, f);
+}
+
+static void
+cache_on_loaded (Fixture *f)
+{
+  assert_response (f, SOUP_STATUS_OK, "aaaa");
+
+  /* same size and same modification time in seconds */
+  write_file (f, FILENAME, "bbbb", 4, 200000);
+
+  http_get (f, "/" FILENAME, NULL, cache_on_cached);
+}
+
+static void
+test_cache (Fixture *f)
+{
+  g_object_set (f->web_dir, "cache-size", 1024 * 1024, NULL);
+
+  write_file (f, FILENAME, "aaaa", 4, 100000);
+
+  http_get (f, "/" FILENAME, NULL, cache_on_loaded);
+}
+
+/* ETag and If-None-Match */
+
+static void
+etag_on_mismatch (Fixture *f)
+{
+  assert_response (f, SOUP_STATUS_OK, "hello");
+  g_assert_cmpstr (soup_message_headers_get_one (f->headers, "ETag"),
+                   ==,
+                   f->etag);
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static void
+etag_on_match (Fixture *f)
+{
+  assert_response (f, SOUP_STATUS_NOT_MODIFIED, "");
+
+  http_get (f,
+            "/" FILENAME,
+            "If-None-Match: \"foo\", \"bar\"\r\n",
+            etag_on_mismatch);
+}
+
+static void
+etag_on_first (Fixture *f)
+{
+  gchar *header;
+
+  assert_response (f, SOUP_STATUS_OK, "hello");
+
+  f->etag = g_strdup (soup_message_headers_get_one (f->headers, "ETag"));
+  g_assert (f->etag != NULL);
+  g_assert (f->etag[0] == '"');
+
+  header = g_strdup_printf ("If-None-Match: \"foo\", %s\r\n", f->etag);
+  http_get (f, "/" FILENAME, header, etag_on_match);
+  g_free (header);
+}
+
+static void
+test_etag (Fixture *f)
+{
+  g_object_set (f->web_dir, "cache-size", 1024 * 1024, NULL);
+
+  write_file (f, FILENAME, "hello", 5, 0);
+
+  http_get (f, "/" FILENAME, NULL, etag_on_first);
+}
+
+/* Accept-Encoding and pre-compressed siblings */
+
+#define GZ_CONTENT "not really gzip"
+
+static void
+gzip_on_disabled (Fixture *f)
+{
+  /* gzip-static is off by default */
+  assert_response (f, SOUP_STATUS_OK, "plain");
+  g_assert (soup_message_headers_get_one (f->headers,
+                                          "Content-Encoding") == NULL);
+
+  g_main_loop_quit (f->main_loop);
+}
+
+static void
+gzip_on_refused (Fixture *f)
+{
+  assert_response (f, SOUP_STATUS_OK, "plain");
+  g_assert (soup_message_headers_get_one (f->headers,
+                                          "Content-Encoding") == NULL);
+
+  g_object_set (f->web_dir, "gzip-static", FALSE, NULL);
+  http_get (f, "/" FILENAME, "Accept-Encoding: gzip\r\n", gzip_on_disabled);
+}
+
+static void
+gzip_on_not_accepted (Fixture *f)
+{
+  assert_response (f, SOUP_STATUS_OK, "plain");
+  g_assert (soup_message_headers_get_one (f->headers,
+                                          "Content-Encoding") == NULL);
+  g_assert_cmpstr (soup_message_headers_get_one (f->headers, "Vary"),
+                   ==,
+                   "Accept-Encoding");
+
+  http_get (f,
+            "/" FILENAME,
+            "Accept-Encoding: gzip;q=0, identity\r\n",
+            gzip_on_refused);
+}
+
+static void
+gzip_on_accepted (Fixture *f)
+{
+  assert_response (f, SOUP_STATUS_OK, GZ_CONTENT);
+  g_assert_cmpstr (soup_message_headers_get_one (f->headers,
+                                                 "Content-Encoding"),
+                   ==,
+                   "gzip");
+  g_assert_cmpstr (soup_message_headers_get_one (f->headers, "Vary"),
+                   ==,
+                   "Accept-Encoding");
+
+  http_get (f, "/" FILENAME, NULL, gzip_on_not_accepted);
+}
+
+static void
+test_gzip_static (Fixture *f)
+{
+  g_object_set (f->web_dir, "gzip-static", TRUE, NULL);
+
+  write_file (f, FILENAME, "plain", 5, 0);
+  write_file (f, FILENAME ".gz", GZ_CONTENT, strlen (GZ_CONTENT), 0);
+
+  http_get (f,
+            "/" FILENAME,
+            "Accept-Encoding: deflate, gzip\r\n",
+            gzip_on_accepted);
+}
+
+static const TestCase test_cases[] =
+{
+  { "/evd/web-dir/cache",       test_cache       },
+  { "/evd/web-dir/etag",        test_etag        },
+  { "/evd/web-dir/gzip-static", test_gzip_static }
+};
+
+static void
+web_dir_on_listen (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  g_assert (evd_service_listen_finish (EVD_SERVICE (obj), res, &error));
+  g_assert_no_error (error);
+
+  f->test_case->func (f);
+}
+
+static void
+test_func (Fixture *f, gconstpointer test_data)
+{
+  evd_service_listen (EVD_SERVICE (f->web_dir),
+                      f->addr,
+                      NULL,
+                      web_dir_on_listen,
+                      f);
+
+  g_main_loop_run (f->main_loop);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+  gint i;
+
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (test_cases); i++)
+    g_test_add (test_cases[i].test_path,
+                Fixture,
+                &test_cases[i],
+                fixture_setup,
+                test_func,
+                fixture_teardown);
+
+  return g_test_run ();
+}
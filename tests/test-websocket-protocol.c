@@ -0,0 +1,100 @@
+/*
+ * test-websocket-protocol.c
+ *
+ * EventDance, Peer-to-peer IPC library <http://eventdance.org>
+ *
+ * Copyright (C) 2009-2015, Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ */
+
+#include <string.h>
+#include <evd.h>
+
+#include "evd-websocket-protocol.h"
+
+/* covers the scalar path, one and several vector blocks, and every tail
+   length after them */
+#define MAX_LENGTH 70
+
+/* covers every misalignment against the widest vector */
+#define MAX_OFFSET 32
+
+/* guard bytes on both sides, to catch writes outside the payload */
+#define GUARD 8
+
+#define GUARD_BYTE 0xA5
+
+static void
+mask_bytewise (gchar *data, gsize data_len, const guint8 masking_key[4])
+{
+  gsize i;
+
+  for (i = 0; i < data_len; i++)
+    data[i] ^= masking_key[i % 4];
+}
+
+static void
+test_masking (void)
+{
+  static const guint8 key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  gchar buf[GUARD + MAX_OFFSET + MAX_LENGTH + GUARD];
+  gchar expected[sizeof (buf)];
+  guint phase;
+  gsize len;
+  gsize offset;
+  gsize i;
+
+  /* every rotation of the key, so that each key byte lands on each
+     position of a vector lane */
+  for (phase = 0; phase < 4; phase++)
+    {
+      guint8 masking_key[4];
+
+      for (i = 0; i < 4; i++)
+        masking_key[i] = key[(i + phase) % 4];
+
+      for (offset = 0; offset < MAX_OFFSET; offset++)
+        for (len = 0; len <= MAX_LENGTH; len++)
+          {
+            gchar *data = buf + GUARD + offset;
+
+            memset (buf, GUARD_BYTE, sizeof (buf));
+            for (i = 0; i < len; i++)
+              data[i] = (gchar) (i * 7 + phase);
+
+            memcpy (expected, buf, sizeof (buf));
+            mask_bytewise (expected + GUARD + offset, len, masking_key);
+
+            evd_websocket_protocol_apply_masking (data, len, masking_key);
+
+            if (memcmp (buf, expected, sizeof (buf)) != 0)
+              {
+                g_test_message ("phase %u, offset %" G_GSIZE_FORMAT
+                                ", length %" G_GSIZE_FORMAT,
+                                phase, offset, len);
+                g_assert_not_reached ();
+              }
+
+            /* masking twice restores the payload */
+            evd_websocket_protocol_apply_masking (data, len, masking_key);
+            for (i = 0; i < len; i++)
+              g_assert_cmpint (data[i], ==, (gchar) (i * 7 + phase));
+          }
+    }
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+#ifndef GLIB_VERSION_2_36
+  g_type_init ();
+#endif
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/evd/websocket/protocol/masking", test_masking);
+
+  return g_test_run ();
+}
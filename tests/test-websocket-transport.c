@@ -9,10 +9,34 @@
  *   Eduardo Lima Mitev <elima@igalia.com>
  */
 
+#include <string.h>
 #include <evd.h>
 
 #define LISTEN_ADDR "0.0.0.0:%d"
 #define WS_ADDR     "ws://127.0.0.1:%d/"
+#define RAW_ADDR    "127.0.0.1:%d"
+
+#define RAW_HANDSHAKE "GET / HTTP/1.1\r\n" \
+  "Host: 127.0.0.1\r\n" \
+  "Upgrade: websocket\r\n" \
+  "Connection: Upgrade\r\n" \
+  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+  "Sec-WebSocket-Version: 13\r\n" \
+  "\r\n"
+
+#define OPCODE_CONTINUATION 0x00
+#define OPCODE_TEXT_FRAME   0x01
+#define OPCODE_PING         0x09
+
+#define COALESCE_MESSAGES   32
+
+#define BROADCAST_PEERS     4
+#define BROADCAST_COMPRESSED "Hello everyone! Hello everyone! Hello everyone! " \
+  "Hello everyone! Hello everyone! Hello everyone!"
+#define BROADCAST_SHORT      "Bye!"
+#define COALESCE_LARGE_SIZE (70 * 1024) /* over the size written right away */
+
+#define PARTIAL_FIRST_MESSAGES 3 /* whole frames in the first write */
 
 typedef struct
 {
@@ -20,6 +44,7 @@ typedef struct
   gchar *msg;
   gssize msg_len;
   EvdMessageType msg_type;
+  gboolean deflate;
 } TestCase;
 
 typedef struct
@@ -32,6 +57,26 @@ typedef struct
   gboolean client_new_peer;
 
   guint listen_port;
+
+  /* hand-written frames sent over a plain connection */
+  EvdSocket *raw_socket;
+  EvdConnection *raw_conn;
+  GString *raw_frames;
+  GString *raw_input;
+  gchar raw_buf[1024];
+  gboolean raw_upgraded;
+  gsize raw_written;
+  GArray *raw_pauses; /* offsets in 'raw_frames' where writing pauses */
+
+  GString *received;
+  guint slices;
+  guint last_slices;
+
+  GPtrArray *expected;
+  guint messages;
+
+  GPtrArray *clients;
+  GList *server_peers;
 } Fixture;
 
 static const TestCase test_cases[] =
@@ -40,14 +85,35 @@ static const TestCase test_cases[] =
       "/text-message",
       "Hello World!",
       -1,
-      EVD_MESSAGE_TYPE_TEXT
+      EVD_MESSAGE_TYPE_TEXT,
+      FALSE
     },
 
     {
       "/binary-message",
       "Hello\0World!\0",
       13,
-      EVD_MESSAGE_TYPE_BINARY
+      EVD_MESSAGE_TYPE_BINARY,
+      FALSE
+    },
+
+    /* long enough to be sent compressed both ways */
+    {
+      "/text-message/deflate",
+      "Hello World! Hello World! Hello World! Hello World! Hello World! "
+      "Hello World! Hello World! Hello World! Hello World! Hello World!",
+      -1,
+      EVD_MESSAGE_TYPE_TEXT,
+      TRUE
+    },
+
+    {
+      "/binary-message/deflate",
+      "Hello\0World!\0Hello\0World!\0Hello\0World!\0Hello\0World!\0"
+      "Hello\0World!\0Hello\0World!\0Hello\0World!\0Hello\0World!\0",
+      104,
+      EVD_MESSAGE_TYPE_BINARY,
+      TRUE
     }
   };
 
@@ -63,6 +129,24 @@ fixture_setup (Fixture       *f,
   f->client_new_peer = FALSE;
 
   f->listen_port = g_random_int_range (1025, 65535);
+
+  f->raw_socket = NULL;
+  f->raw_conn = NULL;
+  f->raw_frames = g_string_new ("");
+  f->raw_input = g_string_new ("");
+  f->raw_upgraded = FALSE;
+  f->raw_written = 0;
+  f->raw_pauses = g_array_new (FALSE, FALSE, sizeof (gsize));
+
+  f->received = g_string_new ("");
+  f->slices = 0;
+  f->last_slices = 0;
+
+  f->expected = g_ptr_array_new_with_free_func (g_free);
+  f->messages = 0;
+
+  f->clients = g_ptr_array_new_with_free_func (g_object_unref);
+  f->server_peers = NULL;
 }
 
 static void
@@ -72,6 +156,19 @@ fixture_teardown (Fixture       *f,
   g_object_unref (f->ws_client);
   g_object_unref (f->ws_server);
 
+  if (f->raw_conn != NULL)
+    g_object_unref (f->raw_conn);
+  if (f->raw_socket != NULL)
+    g_object_unref (f->raw_socket);
+  g_string_free (f->raw_frames, TRUE);
+  g_string_free (f->raw_input, TRUE);
+  g_array_unref (f->raw_pauses);
+  g_string_free (f->received, TRUE);
+  g_ptr_array_unref (f->expected);
+
+  g_ptr_array_unref (f->clients);
+  g_list_free (f->server_peers);
+
   g_main_loop_unref (f->main_loop);
 }
 
@@ -281,6 +378,12 @@ test_func (Fixture       *f,
 
   evd_websocket_server_set_standalone (f->ws_server, TRUE);
 
+  if (f->test_case->deflate)
+    {
+      evd_websocket_server_set_deflate (f->ws_server, TRUE, 15, FALSE);
+      evd_websocket_client_set_deflate (f->ws_client, TRUE, 15, FALSE);
+    }
+
   /* open server transport */
   addr = g_strdup_printf (LISTEN_ADDR, f->listen_port);
 
@@ -294,6 +397,593 @@ test_func (Fixture       *f,
   g_main_loop_run (f->main_loop);
 }
 
+/* hand-written frames */
+
+static void
+raw_append_frame (Fixture     *f,
+                  gboolean     fin,
+                  guint8       opcode,
+                  const gchar *payload)
+{
+  gsize len;
+
+  len = strlen (payload);
+  g_assert_cmpuint (len, <, 126);
+
+  g_string_append_c (f->raw_frames, (fin ? 0x80 : 0x00) | opcode);
+
+  /* client frames are masked, a zero key leaves the payload as is */
+  g_string_append_c (f->raw_frames, 0x80 | (guint8) len);
+  g_string_append_len (f->raw_frames, "\0\0\0\0", 4);
+
+  g_string_append_len (f->raw_frames, payload, len);
+}
+
+/* writes the frames up to the next pause, or all that is left */
+static void
+raw_write_next (Fixture *f)
+{
+  GOutputStream *output_stream;
+  GError *error = NULL;
+  gsize until;
+
+  if (f->raw_pauses->len > 0)
+    {
+      until = g_array_index (f->raw_pauses, gsize, 0);
+      g_array_remove_index (f->raw_pauses, 0);
+    }
+  else
+    {
+      until = f->raw_frames->len;
+    }
+
+  g_assert_cmpuint (until, >, f->raw_written);
+
+  output_stream = g_io_stream_get_output_stream (G_IO_STREAM (f->raw_conn));
+  g_assert_cmpint (g_output_stream_write (output_stream,
+                                          f->raw_frames->str + f->raw_written,
+                                          until - f->raw_written,
+                                          NULL,
+                                          &error),
+                   ==,
+                   until - f->raw_written);
+  g_assert_no_error (error);
+
+  f->raw_written = until;
+}
+
+static void
+raw_on_read (GObject      *obj,
+             GAsyncResult *res,
+             gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gssize size;
+
+  size = g_input_stream_read_finish (G_INPUT_STREAM (obj), res, &error);
+  if (size <= 0)
+    {
+      /* the server closed the connection */
+      g_clear_error (&error);
+      g_main_loop_quit (f->main_loop);
+      return;
+    }
+
+  if (! f->raw_upgraded)
+    {
+      g_string_append_len (f->raw_input, f->raw_buf, size);
+
+      if (strstr (f->raw_input->str, "\r\n\r\n") != NULL)
+        {
+          g_assert (g_str_has_prefix (f->raw_input->str,
+                                      "HTTP/1.1 101"));
+          f->raw_upgraded = TRUE;
+
+          raw_write_next (f);
+        }
+    }
+
+  g_input_stream_read_async (G_INPUT_STREAM (obj),
+                             f->raw_buf,
+                             sizeof (f->raw_buf),
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             raw_on_read,
+                             f);
+}
+
+static void
+raw_on_connect (GObject      *obj,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GOutputStream *output_stream;
+  GInputStream *input_stream;
+  GError *error = NULL;
+
+  f->raw_conn =
+    EVD_CONNECTION (evd_socket_connect_finish (EVD_SOCKET (obj), res, &error));
+  g_assert_no_error (error);
+
+  output_stream = g_io_stream_get_output_stream (G_IO_STREAM (f->raw_conn));
+  g_assert_cmpint (g_output_stream_write (output_stream,
+                                          RAW_HANDSHAKE,
+                                          strlen (RAW_HANDSHAKE),
+                                          NULL,
+                                          &error),
+                   ==,
+                   strlen (RAW_HANDSHAKE));
+  g_assert_no_error (error);
+
+  input_stream = g_io_stream_get_input_stream (G_IO_STREAM (f->raw_conn));
+  g_input_stream_read_async (input_stream,
+                             f->raw_buf,
+                             sizeof (f->raw_buf),
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             raw_on_read,
+                             f);
+}
+
+static void
+raw_on_server_open (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gchar *addr;
+
+  g_assert (evd_transport_open_finish (EVD_TRANSPORT (obj), res, &error));
+  g_assert_no_error (error);
+
+  addr = g_strdup_printf (RAW_ADDR, f->listen_port);
+
+  f->raw_socket = evd_socket_new ();
+  evd_socket_connect_to (f->raw_socket, addr, NULL, raw_on_connect, f);
+
+  g_free (addr);
+}
+
+static void
+raw_run (Fixture *f)
+{
+  gchar *addr;
+
+  evd_websocket_server_set_standalone (f->ws_server, TRUE);
+
+  addr = g_strdup_printf (LISTEN_ADDR, f->listen_port);
+  evd_transport_open (EVD_TRANSPORT (f->ws_server),
+                      addr,
+                      NULL,
+                      raw_on_server_open,
+                      f);
+  g_free (addr);
+
+  g_main_loop_run (f->main_loop);
+}
+
+static void
+raw_on_receive (EvdTransport *transport,
+                EvdPeer      *peer,
+                gpointer      user_data)
+{
+  Fixture *f = user_data;
+  const gchar *msg;
+  gsize msg_len;
+
+  msg = evd_transport_receive (transport, peer, &msg_len);
+  g_string_append_len (f->received, msg, msg_len);
+
+  f->slices++;
+  if (evd_websocket_server_is_last_slice (EVD_WEBSOCKET_SERVER (transport),
+                                          peer))
+    {
+      f->last_slices++;
+
+      g_main_loop_quit (f->main_loop);
+    }
+}
+
+static void
+test_reassembly (Fixture       *f,
+                 gconstpointer  data)
+{
+  g_signal_connect (f->ws_server,
+                    "receive",
+                    G_CALLBACK (raw_on_receive),
+                    f);
+
+  /* a control frame may come in between fragments */
+  raw_append_frame (f, FALSE, OPCODE_TEXT_FRAME, "Hello ");
+  raw_append_frame (f, TRUE, OPCODE_PING, "ping");
+  raw_append_frame (f, FALSE, OPCODE_CONTINUATION, "fragmented ");
+  raw_append_frame (f, TRUE, OPCODE_CONTINUATION, "World!");
+
+  raw_run (f);
+
+  /* delivered once, whole */
+  g_assert_cmpuint (f->slices, ==, 1);
+  g_assert_cmpuint (f->last_slices, ==, 1);
+  g_assert_cmpstr (f->received->str, ==, "Hello fragmented World!");
+}
+
+static void
+test_max_message_size (Fixture       *f,
+                       gconstpointer  data)
+{
+  evd_websocket_server_set_max_message_size (f->ws_server, 16);
+  g_assert_cmpuint (evd_websocket_server_get_max_message_size (f->ws_server),
+                    ==,
+                    16);
+
+  g_signal_connect (f->ws_server,
+                    "receive",
+                    G_CALLBACK (raw_on_receive),
+                    f);
+
+  /* each fragment fits, the message doesn't */
+  raw_append_frame (f, FALSE, OPCODE_TEXT_FRAME, "0123456789");
+  raw_append_frame (f, TRUE, OPCODE_CONTINUATION, "0123456789");
+
+  /* quits when the server closes the connection */
+  raw_run (f);
+
+  g_assert (f->raw_upgraded);
+  g_assert_cmpuint (f->slices, ==, 0);
+}
+
+static void
+test_streaming (Fixture       *f,
+                gconstpointer  data)
+{
+  evd_websocket_server_set_streaming (f->ws_server, TRUE);
+  g_assert (evd_websocket_server_get_streaming (f->ws_server));
+
+  g_signal_connect (f->ws_server,
+                    "receive",
+                    G_CALLBACK (raw_on_receive),
+                    f);
+
+  raw_append_frame (f, FALSE, OPCODE_TEXT_FRAME, "Hello ");
+  raw_append_frame (f, FALSE, OPCODE_CONTINUATION, "streamed ");
+  raw_append_frame (f, TRUE, OPCODE_CONTINUATION, "World!");
+
+  raw_run (f);
+
+  /* handed over as it arrives, only the last slice ends the message */
+  g_assert_cmpuint (f->slices, >=, 3);
+  g_assert_cmpuint (f->last_slices, ==, 1);
+  g_assert_cmpstr (f->received->str, ==, "Hello streamed World!");
+}
+
+/* partial frames */
+
+static void
+partial_on_receive (EvdTransport *transport,
+                    EvdPeer      *peer,
+                    gpointer      user_data)
+{
+  Fixture *f = user_data;
+  const gchar *expected;
+  const gchar *msg;
+  gsize msg_len;
+
+  g_assert_cmpuint (f->messages, <, f->expected->len);
+
+  msg = evd_transport_receive (transport, peer, &msg_len);
+  expected = g_ptr_array_index (f->expected, f->messages);
+  g_assert_cmpuint (msg_len, ==, strlen (expected));
+  g_assert (memcmp (msg, expected, msg_len) == 0);
+
+  f->messages++;
+
+  if (f->messages == f->expected->len)
+    g_main_loop_quit (f->main_loop);
+  else if (f->messages >= PARTIAL_FIRST_MESSAGES)
+    {
+      /* everything written so far has been parsed, only now the rest of
+         the pending frame is sent, see test_partial_frames() */
+      raw_write_next (f);
+    }
+}
+
+static void
+test_partial_frames (Fixture       *f,
+                     gconstpointer  data)
+{
+  static const gchar *messages[] =
+    {
+      "first", "second", "third",
+      "a fourth message, split across two writes",
+      "fifth"
+    };
+  gsize frame_start;
+  gsize pause;
+  guint i;
+
+  g_signal_connect (f->ws_server,
+                    "receive",
+                    G_CALLBACK (partial_on_receive),
+                    f);
+
+  for (i = 0; i < G_N_ELEMENTS (messages); i++)
+    {
+      g_ptr_array_add (f->expected, g_strdup (messages[i]));
+
+      frame_start = f->raw_frames->len;
+      raw_append_frame (f, TRUE, OPCODE_TEXT_FRAME, messages[i]);
+
+      /* the first write carries three whole frames plus the header and
+         part of the payload of the fourth. The second one ends right
+         after the first header byte of the last frame */
+      if (i == PARTIAL_FIRST_MESSAGES)
+        {
+          pause = frame_start + 6 + 10;
+          g_array_append_val (f->raw_pauses, pause);
+        }
+      else if (i == PARTIAL_FIRST_MESSAGES + 1)
+        {
+          pause = frame_start + 1;
+          g_array_append_val (f->raw_pauses, pause);
+        }
+    }
+
+  raw_run (f);
+
+  g_assert_cmpuint (f->raw_written, ==, f->raw_frames->len);
+  g_assert_cmpuint (f->messages, ==, G_N_ELEMENTS (messages));
+}
+
+/* coalescing */
+
+static void
+coalesce_on_new_peer (EvdTransport *transport,
+                      EvdPeer      *peer,
+                      gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  guint i;
+
+  if (! EVD_IS_WEBSOCKET_SERVER (transport))
+    return;
+
+  /* a burst of messages of different sizes, all sent within the same
+     main loop iteration */
+  for (i = 0; i < f->expected->len; i++)
+    {
+      g_assert (evd_transport_send_text (transport,
+                                         peer,
+                                         g_ptr_array_index (f->expected, i),
+                                         &error));
+      g_assert_no_error (error);
+    }
+}
+
+static void
+coalesce_on_receive (EvdTransport *transport,
+                     EvdPeer      *peer,
+                     gpointer      user_data)
+{
+  Fixture *f = user_data;
+  const gchar *msg;
+
+  g_assert (EVD_IS_WEBSOCKET_CLIENT (transport));
+
+  /* one message per message sent, in the same order */
+  g_assert_cmpuint (f->messages, <, f->expected->len);
+
+  msg = evd_transport_receive_text (transport, peer);
+  g_assert_cmpstr (msg, ==, g_ptr_array_index (f->expected, f->messages));
+
+  f->messages++;
+
+  /* the last one arrives without anything else being sent after it */
+  if (f->messages == f->expected->len)
+    g_main_loop_quit (f->main_loop);
+}
+
+static gboolean
+coalesce_timeout (gpointer user_data)
+{
+  g_assert_not_reached ();
+
+  return FALSE;
+}
+
+static void
+test_coalescing (Fixture       *f,
+                 gconstpointer  data)
+{
+  guint max_latency = GPOINTER_TO_UINT (data);
+  guint latency;
+  gchar *addr;
+  guint src_id;
+  guint i;
+
+  for (i = 0; i < COALESCE_MESSAGES; i++)
+    {
+      gchar *msg;
+
+      if (i == COALESCE_MESSAGES / 2)
+        {
+          msg = g_malloc (COALESCE_LARGE_SIZE + 1);
+          memset (msg, 'x', COALESCE_LARGE_SIZE);
+          msg[COALESCE_LARGE_SIZE] = '\0';
+        }
+      else
+        {
+          msg = g_strdup_printf ("message %u%*s", i, i, "");
+        }
+
+      g_ptr_array_add (f->expected, msg);
+    }
+
+  evd_websocket_server_set_standalone (f->ws_server, TRUE);
+  evd_websocket_server_set_coalescing (f->ws_server, TRUE, max_latency);
+  g_assert (evd_websocket_server_get_coalescing (f->ws_server, &latency));
+  g_assert_cmpuint (latency, ==, max_latency);
+
+  g_signal_connect (f->ws_server,
+                    "new-peer",
+                    G_CALLBACK (coalesce_on_new_peer),
+                    f);
+  g_signal_connect (f->ws_client,
+                    "receive",
+                    G_CALLBACK (coalesce_on_receive),
+                    f);
+
+  addr = g_strdup_printf (LISTEN_ADDR, f->listen_port);
+  evd_transport_open (EVD_TRANSPORT (f->ws_server),
+                      addr,
+                      NULL,
+                      on_server_open,
+                      f);
+  g_free (addr);
+
+  src_id = evd_timeout_add (NULL, 5000, G_PRIORITY_DEFAULT, coalesce_timeout, f);
+
+  g_main_loop_run (f->main_loop);
+
+  g_source_remove (src_id);
+
+  g_assert_cmpuint (f->messages, ==, COALESCE_MESSAGES);
+}
+
+/* broadcast */
+
+static void
+broadcast_on_server_new_peer (EvdTransport *transport,
+                              EvdPeer      *peer,
+                              gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+
+  f->server_peers = g_list_append (f->server_peers, peer);
+  if (g_list_length (f->server_peers) < BROADCAST_PEERS)
+    return;
+
+  /* the compressed form is built once and reused for the second peer
+     with the same window, the others get the uncompressed one */
+  g_assert (evd_websocket_server_broadcast_text (f->ws_server,
+                                                 f->server_peers,
+                                                 BROADCAST_COMPRESSED,
+                                                 &error));
+  g_assert_no_error (error);
+
+  g_assert (evd_websocket_server_broadcast_text (f->ws_server,
+                                                 f->server_peers,
+                                                 BROADCAST_SHORT,
+                                                 &error));
+  g_assert_no_error (error);
+}
+
+static void
+broadcast_on_client_receive (EvdTransport *transport,
+                             EvdPeer      *peer,
+                             gpointer      user_data)
+{
+  Fixture *f = user_data;
+  guint received;
+  const gchar *msg;
+
+  received = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (transport),
+                                                  "received"));
+
+  msg = evd_transport_receive_text (transport, peer);
+  if (received == 0)
+    g_assert_cmpstr (msg, ==, BROADCAST_COMPRESSED);
+  else
+    g_assert_cmpstr (msg, ==, BROADCAST_SHORT);
+
+  received++;
+  g_assert_cmpuint (received, <=, 2);
+  g_object_set_data (G_OBJECT (transport),
+                     "received",
+                     GUINT_TO_POINTER (received));
+
+  f->messages++;
+  if (f->messages == BROADCAST_PEERS * 2)
+    g_main_loop_quit (f->main_loop);
+}
+
+static void
+broadcast_on_server_open (GObject      *obj,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  Fixture *f = user_data;
+  GError *error = NULL;
+  gchar *addr;
+  guint i;
+
+  g_assert (evd_transport_open_finish (EVD_TRANSPORT (obj), res, &error));
+  g_assert_no_error (error);
+
+  addr = g_strdup_printf (WS_ADDR, f->listen_port);
+
+  for (i = 0; i < f->clients->len; i++)
+    evd_transport_open (EVD_TRANSPORT (g_ptr_array_index (f->clients, i)),
+                        addr,
+                        NULL,
+                        on_client_open,
+                        f);
+
+  g_free (addr);
+}
+
+static void
+test_broadcast (Fixture       *f,
+                gconstpointer  data)
+{
+  gchar *addr;
+  guint i;
+
+  evd_websocket_server_set_standalone (f->ws_server, TRUE);
+
+  /* no context takeover on the server side, otherwise every deflate
+     connection compresses on its own */
+  evd_websocket_server_set_deflate (f->ws_server, TRUE, 15, TRUE);
+
+  g_signal_connect (f->ws_server,
+                    "new-peer",
+                    G_CALLBACK (broadcast_on_server_new_peer),
+                    f);
+
+  /* two peers without compression and two with, sharing the window */
+  for (i = 0; i < BROADCAST_PEERS; i++)
+    {
+      EvdWebsocketClient *client;
+
+      client = evd_websocket_client_new ();
+      if (i % 2 == 1)
+        evd_websocket_client_set_deflate (client, TRUE, 15, FALSE);
+
+      g_signal_connect (client,
+                        "receive",
+                        G_CALLBACK (broadcast_on_client_receive),
+                        f);
+
+      g_ptr_array_add (f->clients, client);
+    }
+
+  addr = g_strdup_printf (LISTEN_ADDR, f->listen_port);
+  evd_transport_open (EVD_TRANSPORT (f->ws_server),
+                      addr,
+                      NULL,
+                      broadcast_on_server_open,
+                      f);
+  g_free (addr);
+
+  g_main_loop_run (f->main_loop);
+
+  g_assert_cmpuint (f->messages, ==, BROADCAST_PEERS * 2);
+}
+
 gint
 main (gint argc, gchar *argv[])
 {
@@ -327,6 +1017,49 @@ main (gint argc, gchar *argv[])
       g_free (test_name);
     }
 
+  g_test_add ("/evd/websocket/transport/reassembly",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_reassembly,
+              fixture_teardown);
+  g_test_add ("/evd/websocket/transport/max-message-size",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_max_message_size,
+              fixture_teardown);
+  g_test_add ("/evd/websocket/transport/streaming",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_streaming,
+              fixture_teardown);
+  g_test_add ("/evd/websocket/transport/partial-frames",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_partial_frames,
+              fixture_teardown);
+  g_test_add ("/evd/websocket/transport/coalescing",
+              Fixture,
+              GUINT_TO_POINTER (0),
+              fixture_setup,
+              test_coalescing,
+              fixture_teardown);
+  g_test_add ("/evd/websocket/transport/coalescing/max-latency",
+              Fixture,
+              GUINT_TO_POINTER (20),
+              fixture_setup,
+              test_coalescing,
+              fixture_teardown);
+  g_test_add ("/evd/websocket/transport/broadcast",
+              Fixture,
+              NULL,
+              fixture_setup,
+              test_broadcast,
+              fixture_teardown);
+
   exit_code = g_test_run ();
 
   evd_tls_deinit ();